@@ -55,16 +55,28 @@ struct msi_ec_fan_mode_conf {
 	struct msi_ec_mode modes[5]; // fixed size for easier hard coding
 };
 
-struct msi_ec_cpu_conf {
-	int rt_temp_address;
-	int rt_fan_speed_address; // realtime % RPM
+enum msi_ec_sensor_kind {
+	MSI_EC_SENSOR_TEMP, // °C
+	MSI_EC_SENSOR_FAN,  // realtime % RPM
+	MSI_EC_SENSOR_RPM,
+	MSI_EC_SENSOR_TACH, // RPM = scale / raw, the period of a fan turn
+	MSI_EC_SENSOR_KIND_COUNT
 };
 
-struct msi_ec_gpu_conf {
-	int rt_temp_address;
-	int rt_fan_speed_address; // realtime % RPM
+#define MSI_EC_TACH_SCALE 478000 // of the tachometer register pairs
+
+#define MSI_EC_SENSOR_LABEL_LENGTH 12
+#define MSI_EC_SENSOR_NULL { "" }
+struct msi_ec_sensor {
+	char label[MSI_EC_SENSOR_LABEL_LENGTH]; // "cpu", "gpu", "vrm", ...
+	enum msi_ec_sensor_kind kind;
+	int address;
+	int width; // bytes, big-endian, 0 means 1
+	int scale; // units per raw step, 0 means 1 (MSI_EC_TACH_SCALE for tachs)
 };
 
+#define MSI_EC_SENSORS_MAX 12
+
 struct msi_ec_led_conf {
 	int micmute_led_address;
 	int mute_led_address;
@@ -84,6 +96,8 @@ struct msi_ec_kbd_bl_conf {
 
 struct msi_ec_conf {
 	const char **allowed_fw;
+	const char *name; // of a built-in configuration, "G1_0"
+	int generation;   // of the EC interface, 0 if unknown
 
 	int charge_control_address;
 	struct msi_ec_webcam_conf         webcam;
@@ -92,8 +106,7 @@ struct msi_ec_conf {
 	struct msi_ec_shift_mode_conf     shift_mode;
 	struct msi_ec_super_battery_conf  super_battery;
 	struct msi_ec_fan_mode_conf       fan_mode;
-	struct msi_ec_cpu_conf            cpu;
-	struct msi_ec_gpu_conf            gpu;
+	struct msi_ec_sensor              sensors[MSI_EC_SENSORS_MAX]; // fixed size for easier hard coding
 	struct msi_ec_led_conf            leds;
 	struct msi_ec_kbd_bl_conf         kbd_bl;
 };
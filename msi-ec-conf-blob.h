@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * msi-ec-conf-blob.h - Binary configuration blobs for the MSI EC driver.
+ *
+ * A blob holds configurations with the same fields as struct msi_ec_conf,
+ * loaded at runtime through request_firmware(). It is shared by the driver
+ * and tools/msi-ec-conf.c, so it only uses the UAPI types.
+ *
+ * Layout, all little-endian:
+ *
+ *   struct msi_ec_conf_blob_header
+ *   count times:
+ *     struct msi_ec_conf_blob_entry
+ *     fw_count times char[MSI_EC_FW_VERSION_LENGTH], not NUL-terminated
+ *     sensor_count times struct msi_ec_conf_blob_sensor (version 2)
+ *
+ * crc32 is the standard CRC-32 (as computed by zlib) of everything after
+ * the header. Addresses are MSI_EC_CONF_BLOB_UNSUPP if not supported.
+ *
+ * The cpu_ and gpu_ addresses of an entry become the "cpu" and "gpu"
+ * sensors, the sensor records are appended to them. Version 1 blobs have
+ * no sensor records and sensor_count (then reserved) is 0.
+ */
+
+#ifndef __MSI_EC_CONF_BLOB__
+#define __MSI_EC_CONF_BLOB__
+
+#include <linux/types.h>
+
+#define MSI_EC_CONF_BLOB_MAGIC "MSIECCF"
+#define MSI_EC_CONF_BLOB_VERSION 2
+#define MSI_EC_CONF_BLOB_UNSUPP 0xff01
+
+// mode names are stored as ids, 0 ends the list
+enum msi_ec_conf_blob_mode_id {
+	MSI_EC_CONF_BLOB_MODE_NONE,
+	MSI_EC_CONF_BLOB_SM_ECO,
+	MSI_EC_CONF_BLOB_SM_COMFORT,
+	MSI_EC_CONF_BLOB_SM_SPORT,
+	MSI_EC_CONF_BLOB_SM_TURBO,
+	MSI_EC_CONF_BLOB_FM_AUTO,
+	MSI_EC_CONF_BLOB_FM_SILENT,
+	MSI_EC_CONF_BLOB_FM_BASIC,
+	MSI_EC_CONF_BLOB_FM_ADVANCED,
+	MSI_EC_CONF_BLOB_MODE_COUNT
+};
+
+#define MSI_EC_CONF_BLOB_MODES 4 // msi_ec_conf mode lists end with a NULL entry
+
+struct msi_ec_conf_blob_header {
+	char magic[8];
+	__le16 version;
+	__le16 count; // configurations
+	__le32 crc32;
+} __attribute__((__packed__));
+
+struct msi_ec_conf_blob_mode {
+	__u8 id;
+	__u8 value;
+} __attribute__((__packed__));
+
+enum msi_ec_conf_blob_sensor_kind {
+	MSI_EC_CONF_BLOB_SENSOR_TEMP,
+	MSI_EC_CONF_BLOB_SENSOR_FAN,
+	MSI_EC_CONF_BLOB_SENSOR_RPM,
+	MSI_EC_CONF_BLOB_SENSOR_TACH, // RPM = scale / raw
+	MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT
+};
+
+#define MSI_EC_CONF_BLOB_SENSOR_LABEL_LENGTH 12 // NUL-terminated
+#define MSI_EC_CONF_BLOB_SENSOR_WIDTH_MAX 4
+
+struct msi_ec_conf_blob_sensor {
+	char label[MSI_EC_CONF_BLOB_SENSOR_LABEL_LENGTH];
+	__u8 kind;
+	__u8 width; // bytes, big-endian, 0 means 1
+	__le16 address;
+	__le32 scale; // 0 means 1, or 478000 for tachometers
+} __attribute__((__packed__));
+
+struct msi_ec_conf_blob_entry {
+	__u8 fw_count;
+	__u8 sensor_count;
+
+	__le16 charge_control_address;
+
+	__le16 webcam_address;
+	__le16 webcam_block_address;
+	__u8 webcam_bit;
+
+	__u8 fn_win_swap_bit;
+	__le16 fn_win_swap_address;
+	__u8 fn_win_swap_invert;
+
+	__u8 cooler_boost_bit;
+	__le16 cooler_boost_address;
+
+	__le16 shift_mode_address;
+	struct msi_ec_conf_blob_mode shift_modes[MSI_EC_CONF_BLOB_MODES];
+
+	__le16 super_battery_address;
+	__u8 super_battery_mask;
+	__u8 reserved2;
+
+	__le16 fan_mode_address;
+	struct msi_ec_conf_blob_mode fan_modes[MSI_EC_CONF_BLOB_MODES];
+
+	__le16 cpu_rt_temp_address;
+	__le16 cpu_rt_fan_speed_address;
+	__le16 gpu_rt_temp_address;
+	__le16 gpu_rt_fan_speed_address;
+
+	__le16 micmute_led_address;
+	__le16 mute_led_address;
+	__u8 leds_bit;
+
+	__u8 kbd_bl_max_mode;
+	__le16 kbd_bl_mode_address;
+	__u8 kbd_bl_modes[2];
+	__le16 kbd_bl_state_address;
+	__u8 kbd_bl_state_base_value;
+	__u8 kbd_bl_max_state;
+} __attribute__((__packed__));
+
+#endif // __MSI_EC_CONF_BLOB__
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * msi-ec-state.h - Binary state snapshots of the MSI EC driver.
+ *
+ * A read of /dev/msi-ec-state at offset 0 takes a snapshot of the EC and
+ * returns a struct msi_ec_state with the values of the state attribute.
+ * Reads at later offsets continue from the snapshot of the same open file.
+ * It is shared by the driver and userspace, so it only uses the
+ * UAPI types. All fields are little-endian.
+ *
+ * values[] holds the fields set in supported, in the units of the matching
+ * attribute: 1 for on or left and 0 for off or right, the mode ids of
+ * msi-ec-conf-blob.h for shift_mode and fan_mode (MSI_EC_CONF_BLOB_MODE_NONE
+ * if the mode is unknown), and signed integers for the sensors.
+ */
+
+#ifndef __MSI_EC_STATE__
+#define __MSI_EC_STATE__
+
+#include <linux/types.h>
+
+#define MSI_EC_STATE_VERSION 1
+#define MSI_EC_STATE_FW_VERSION_LENGTH 12
+
+enum msi_ec_state_field {
+	MSI_EC_STATE_WEBCAM,
+	MSI_EC_STATE_WEBCAM_BLOCK,
+	MSI_EC_STATE_FN_KEY,
+	MSI_EC_STATE_WIN_KEY,
+	MSI_EC_STATE_COOLER_BOOST,
+	MSI_EC_STATE_SHIFT_MODE,
+	MSI_EC_STATE_SUPER_BATTERY,
+	MSI_EC_STATE_FAN_MODE,
+	MSI_EC_STATE_CPU_REALTIME_TEMPERATURE,
+	MSI_EC_STATE_CPU_REALTIME_FAN_SPEED,
+	MSI_EC_STATE_GPU_REALTIME_TEMPERATURE,
+	MSI_EC_STATE_GPU_REALTIME_FAN_SPEED,
+	MSI_EC_STATE_FIELD_COUNT
+};
+
+struct msi_ec_state {
+	__le16 version;
+	__le16 size;      // of the struct, later versions only append fields
+	__le32 supported; // 1 << field for every field of values[]
+	__le64 time_ns;   // CLOCK_MONOTONIC time of the snapshot
+	__le64 fw_build_time; // seconds since the epoch, 0 if unknown
+	char fw_version[MSI_EC_STATE_FW_VERSION_LENGTH]; // not NUL-terminated
+	__le32 values[MSI_EC_STATE_FIELD_COUNT];
+} __attribute__((__packed__));
+
+#endif // __MSI_EC_STATE__
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * msi-ec-trace.h - Tracepoints for the MSI Embedded Controller driver.
+ *
+ * Every EC transaction issued by the driver and every sysfs show/store call
+ * is traced. EC transaction events record the attribute whose show/store
+ * call issued them, "-" for the others. Driver mutexes report
+ * contended acquisitions and the hold time of every release.
+ *
+ *   perf trace -e 'msi_ec:*'
+ *   trace-cmd record -e msi_ec
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM msi_ec
+
+#if !defined(_MSI_EC_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MSI_EC_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+#ifndef msi_ec_assign_str
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0))
+#define msi_ec_assign_str(dst, src) __assign_str(dst)
+#else
+#define msi_ec_assign_str(dst, src) __assign_str(dst, src)
+#endif
+#endif
+
+DECLARE_EVENT_CLASS(msi_ec_transaction,
+
+	TP_PROTO(u8 addr, u8 value, int result, u64 latency_ns,
+		 const char *attr),
+
+	TP_ARGS(addr, value, result, latency_ns, attr),
+
+	TP_STRUCT__entry(
+		__field(u8, addr)
+		__field(u8, value)
+		__field(int, result)
+		__field(u64, latency_ns)
+		__string(attr, attr ? attr : "-")
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->value = value;
+		__entry->result = result;
+		__entry->latency_ns = latency_ns;
+		msi_ec_assign_str(attr, attr ? attr : "-");
+	),
+
+	TP_printk("addr=0x%02x value=0x%02x result=%d latency_ns=%llu attr=%s",
+		  __entry->addr, __entry->value, __entry->result,
+		  __entry->latency_ns, __get_str(attr))
+);
+
+DEFINE_EVENT(msi_ec_transaction, msi_ec_read,
+	TP_PROTO(u8 addr, u8 value, int result, u64 latency_ns,
+		 const char *attr),
+	TP_ARGS(addr, value, result, latency_ns, attr)
+);
+
+DEFINE_EVENT(msi_ec_transaction, msi_ec_write,
+	TP_PROTO(u8 addr, u8 value, int result, u64 latency_ns,
+		 const char *attr),
+	TP_ARGS(addr, value, result, latency_ns, attr)
+);
+
+DECLARE_EVENT_CLASS(msi_ec_attr_enter,
+
+	TP_PROTO(const char *path),
+
+	TP_ARGS(path),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+	),
+
+	TP_fast_assign(
+		msi_ec_assign_str(path, path);
+	),
+
+	TP_printk("attr=%s", __get_str(path))
+);
+
+DEFINE_EVENT(msi_ec_attr_enter, msi_ec_attr_show_enter,
+	TP_PROTO(const char *path),
+	TP_ARGS(path)
+);
+
+DEFINE_EVENT(msi_ec_attr_enter, msi_ec_attr_store_enter,
+	TP_PROTO(const char *path),
+	TP_ARGS(path)
+);
+
+DECLARE_EVENT_CLASS(msi_ec_attr_exit,
+
+	TP_PROTO(const char *path, ssize_t result, u64 latency_ns,
+		 unsigned int ec_reads, unsigned int ec_writes),
+
+	TP_ARGS(path, result, latency_ns, ec_reads, ec_writes),
+
+	TP_STRUCT__entry(
+		__string(path, path)
+		__field(ssize_t, result)
+		__field(u64, latency_ns)
+		__field(unsigned int, ec_reads)
+		__field(unsigned int, ec_writes)
+	),
+
+	TP_fast_assign(
+		msi_ec_assign_str(path, path);
+		__entry->result = result;
+		__entry->latency_ns = latency_ns;
+		__entry->ec_reads = ec_reads;
+		__entry->ec_writes = ec_writes;
+	),
+
+	TP_printk("attr=%s result=%zd latency_ns=%llu ec_reads=%u ec_writes=%u",
+		  __get_str(path), __entry->result, __entry->latency_ns,
+		  __entry->ec_reads, __entry->ec_writes)
+);
+
+DEFINE_EVENT(msi_ec_attr_exit, msi_ec_attr_show,
+	TP_PROTO(const char *path, ssize_t result, u64 latency_ns,
+		 unsigned int ec_reads, unsigned int ec_writes),
+	TP_ARGS(path, result, latency_ns, ec_reads, ec_writes)
+);
+
+DEFINE_EVENT(msi_ec_attr_exit, msi_ec_attr_store,
+	TP_PROTO(const char *path, ssize_t result, u64 latency_ns,
+		 unsigned int ec_reads, unsigned int ec_writes),
+	TP_ARGS(path, result, latency_ns, ec_reads, ec_writes)
+);
+
+TRACE_EVENT(msi_ec_lock_contended,
+
+	TP_PROTO(const char *name, u64 wait_ns, int waiters),
+
+	TP_ARGS(name, wait_ns, waiters),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(u64, wait_ns)
+		__field(int, waiters)
+	),
+
+	TP_fast_assign(
+		msi_ec_assign_str(name, name);
+		__entry->wait_ns = wait_ns;
+		__entry->waiters = waiters;
+	),
+
+	TP_printk("lock=%s wait_ns=%llu waiters_ahead=%d",
+		  __get_str(name), __entry->wait_ns, __entry->waiters)
+);
+
+TRACE_EVENT(msi_ec_lock_released,
+
+	TP_PROTO(const char *name, u64 hold_ns, int waiters),
+
+	TP_ARGS(name, hold_ns, waiters),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(u64, hold_ns)
+		__field(int, waiters)
+	),
+
+	TP_fast_assign(
+		msi_ec_assign_str(name, name);
+		__entry->hold_ns = hold_ns;
+		__entry->waiters = waiters;
+	),
+
+	TP_printk("lock=%s hold_ns=%llu waiters=%d",
+		  __get_str(name), __entry->hold_ns, __entry->waiters)
+);
+
+#endif // _MSI_EC_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE msi-ec-trace
+
+#include <trace/define_trace.h>
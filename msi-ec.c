@@ -16,33 +16,131 @@
  * This driver also registers available led class devices for
  * mute, micmute and keyboard_backlight leds
  *
- * This driver might not work on other laptops produced by MSI. Also, and until
- * future enhancements, no DMI data are used to identify your compatibility
- *
+ * This driver might not work on other laptops produced by MSI. The
+ * configuration is chosen by the EC firmware version. By default a release
+ * missing from the configurations takes the one of the nearest known release
+ * of the same model, and the DMI board name is only used with conf_match=dmi
+ * or probe (see Configuration matching).
  */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include "ec_memory_configuration.h"
+#include "msi-ec-conf-blob.h"
+#include "msi-ec-state.h"
 
 #include <acpi/battery.h>
 #include <linux/acpi.h>
+#include <linux/bitmap.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/crc32.h>
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/dmi.h>
+#include <linux/firmware.h>
+#include <linux/hwmon.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/perf_event.h>
 #include <linux/platform_device.h>
+#include <linux/pm.h>
+#include <linux/pm_qos.h>
+#include <linux/power_supply.h>
 #include <linux/proc_fs.h>
+#include <linux/sched.h>
 #include <linux/seq_file.h>
+#include <linux/sizes.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/srcu.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/rtc.h>
 #include <linux/string_choices.h>
 
-static DEFINE_MUTEX(ec_set_by_mask_mutex);
-static DEFINE_MUTEX(ec_unset_by_mask_mutex);
-static DEFINE_MUTEX(ec_set_bit_mutex);
+#define CREATE_TRACE_POINTS
+#include "msi-ec-trace.h"
+
+/*
+ * Driver mutexes record how long they are waited for and held, exported in
+ * debugfs and through the msi_ec_lock_* tracepoints to spot lock convoys.
+ * The statistics are updated and reset with the mutex held.
+ */
+struct msi_ec_lock {
+	struct mutex mutex;
+	const char *name;
+	atomic_t waiters;
+	u64 acquired_at;
+	u64 acquisitions;
+	u64 contentions;
+	u64 wait_ns;
+	u64 wait_max_ns;
+	u64 hold_ns;
+	u64 hold_max_ns;
+};
+
+#define DEFINE_MSI_EC_LOCK(_name)					\
+static struct msi_ec_lock _name = {					\
+	.mutex = __MUTEX_INITIALIZER(_name.mutex),			\
+	.name = #_name,							\
+	.waiters = ATOMIC_INIT(0),					\
+}
+
+// for the locks of the driver instances
+static void msi_ec_lock_init(struct msi_ec_lock *lock, const char *name)
+{
+	memset(lock, 0, sizeof(*lock));
+	mutex_init(&lock->mutex);
+	lock->name = name;
+}
+
+static void msi_ec_lock(struct msi_ec_lock *lock)
+{
+	u64 start, wait_ns;
+	int waiters;
+
+	if (mutex_trylock(&lock->mutex)) {
+		lock->acquired_at = ktime_get_ns();
+		lock->acquisitions++;
+		return;
+	}
+
+	// tasks already waiting ahead of this one
+	waiters = atomic_inc_return(&lock->waiters) - 1;
+	start = ktime_get_ns();
+	mutex_lock(&lock->mutex);
+	lock->acquired_at = ktime_get_ns();
+	atomic_dec(&lock->waiters);
+
+	wait_ns = lock->acquired_at - start;
+	lock->acquisitions++;
+	lock->contentions++;
+	lock->wait_ns += wait_ns;
+	lock->wait_max_ns = max(lock->wait_max_ns, wait_ns);
+
+	trace_msi_ec_lock_contended(lock->name, wait_ns, waiters);
+}
+
+static void msi_ec_unlock(struct msi_ec_lock *lock)
+{
+	u64 hold_ns = ktime_get_ns() - lock->acquired_at;
+
+	lock->hold_ns += hold_ns;
+	lock->hold_max_ns = max(lock->hold_max_ns, hold_ns);
+	mutex_unlock(&lock->mutex);
+
+	trace_msi_ec_lock_released(lock->name, hold_ns,
+				   atomic_read(&lock->waiters));
+}
 
 #define SM_ECO_NAME		"eco"
 #define SM_COMFORT_NAME		"comfort"
@@ -67,6 +165,8 @@ static const char *ALLOWED_FW_G1_0[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_0 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_0, // legacy fw_0
+	.name = "G1_0",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -105,13 +205,12 @@ static struct msi_ec_conf CONF_G1_0 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -153,6 +252,8 @@ static const char *ALLOWED_FW_G1_1[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_1 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_1, // legacy fw_1
+	.name = "G1_1",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -190,13 +291,12 @@ static struct msi_ec_conf CONF_G1_1 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -224,6 +324,8 @@ static const char *ALLOWED_FW_G1_2[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_2 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_2, // legacy fw_5
+	.name = "G1_2",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -261,13 +363,12 @@ static struct msi_ec_conf CONF_G1_2 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -309,6 +410,8 @@ static const char *ALLOWED_FW_G1_3[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_3 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_3, // legacy fw_6
+	.name = "G1_3",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -347,13 +450,12 @@ static struct msi_ec_conf CONF_G1_3 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -380,6 +482,8 @@ static const char *ALLOWED_FW_G1_4[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_4 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_4, // legacy fw_7
+	.name = "G1_4",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -418,13 +522,12 @@ static struct msi_ec_conf CONF_G1_4 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -455,6 +558,8 @@ static const char *ALLOWED_FW_G1_5[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_5 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_5, // legacy fw_9
+	.name = "G1_5",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -492,13 +597,10 @@ static struct msi_ec_conf CONF_G1_5 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = MSI_EC_ADDR_UNSUPP,
-		.rt_fan_speed_address = MSI_EC_ADDR_UNSUPP,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -533,6 +635,8 @@ static const char *ALLOWED_FW_G1_6[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_6 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_6, // legacy fw_16
+	.name = "G1_6",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -570,13 +674,10 @@ static struct msi_ec_conf CONF_G1_6 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = MSI_EC_ADDR_UNSUPP,
-		.rt_fan_speed_address = MSI_EC_ADDR_UNSUPP,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -614,6 +715,8 @@ static const char *ALLOWED_FW_G1_7[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_7 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_7, // legacy fw_21, fw_46 (G1_10)
+	.name = "G1_7",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -653,13 +756,12 @@ static struct msi_ec_conf CONF_G1_7 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -685,6 +787,8 @@ static const char *ALLOWED_FW_G1_8[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_8 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_8, // legacy fw_23
+	.name = "G1_8",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -721,13 +825,12 @@ static struct msi_ec_conf CONF_G1_8 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -758,6 +861,8 @@ static const char *ALLOWED_FW_G1_9[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_9 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_9, // legacy fw_31, fw_55 (G1_12)
+	.name = "G1_9",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -795,13 +900,12 @@ static struct msi_ec_conf CONF_G1_9 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -827,6 +931,8 @@ static const char *ALLOWED_FW_G1_10[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_10 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_10, // new
+	.name = "G1_10",
+	.generation = 1,
 	.charge_control_address = MSI_EC_ADDR_UNSUPP, // unsupported
 	.webcam = {
 		.address       = 0x2e,
@@ -863,13 +969,12 @@ static struct msi_ec_conf CONF_G1_10 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -901,6 +1006,8 @@ static const char *ALLOWED_FW_G1_11[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_11 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_11, // legacy fw_51
+	.name = "G1_11",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -938,13 +1045,12 @@ static struct msi_ec_conf CONF_G1_11 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -970,6 +1076,8 @@ static const char *ALLOWED_FW_G1_13[] __initconst = {
 
 static struct msi_ec_conf CONF_G1_13 __initdata = {
 	.allowed_fw = ALLOWED_FW_G1_13, // legacy fw_58
+	.name = "G1_13",
+	.generation = 1,
 	.charge_control_address = 0xef,
 	.webcam = {
 		.address       = 0x2e,
@@ -1007,13 +1115,12 @@ static struct msi_ec_conf CONF_G1_13 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -1056,6 +1163,8 @@ static const char *ALLOWED_FW_G2_0[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_0 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_0, // legacy fw_2, fw_53 (G2_19), 159K - Center S app
+	.name = "G2_0",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = { // 159K, 15H5 have no webcam control
 		.address       = 0x2e,
@@ -1093,13 +1202,10 @@ static struct msi_ec_conf CONF_G2_0 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = MSI_EC_ADDR_UNSUPP,
-		.rt_fan_speed_address = MSI_EC_ADDR_UNSUPP,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -1180,6 +1286,8 @@ static const char *ALLOWED_FW_G2_1[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_1 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_1, // legacy fw_3, fw_10 (G2_4), fw_11 (G2_5), fw_14 (G2_7), fw_17 (G2_8), fw_32 (G2_12), fw_34 (G2_14)
+	.name = "G2_1",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1217,13 +1325,12 @@ static struct msi_ec_conf CONF_G2_1 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -1272,6 +1379,8 @@ static const char *ALLOWED_FW_G2_2[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_2 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_2, // legacy fw_4, fw_47 (G2_18)
+	.name = "G2_2",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1309,13 +1418,12 @@ static struct msi_ec_conf CONF_G2_2 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -1371,6 +1479,8 @@ static const char *ALLOWED_FW_G2_3[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_3 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_3, // legacy fw_8, fw_25, fw_42 (G2_17)
+	.name = "G2_3",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {          // Has no hardware webcam control: 13P5
 		.address       = 0x2e,
@@ -1408,13 +1518,10 @@ static struct msi_ec_conf CONF_G2_3 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = MSI_EC_ADDR_UNSUPP,
-		.rt_fan_speed_address = MSI_EC_ADDR_UNSUPP,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c, // not present on `14F1`
@@ -1441,6 +1548,8 @@ static const char *ALLOWED_FW_G2_4[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_4 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_4, // new
+	.name = "G2_4",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1478,13 +1587,12 @@ static struct msi_ec_conf CONF_G2_4 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -1517,6 +1625,8 @@ static const char *ALLOWED_FW_G2_5[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_5 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_5, // new
+	.name = "G2_5",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1554,13 +1664,12 @@ static struct msi_ec_conf CONF_G2_5 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -1601,6 +1710,8 @@ static const char *ALLOWED_FW_G2_6[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_6 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_6, // legacy fw_12
+	.name = "G2_6",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1638,13 +1749,12 @@ static struct msi_ec_conf CONF_G2_6 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -1760,6 +1870,8 @@ static const char *ALLOWED_FW_G2_10[] __initconst = {
 
 static struct msi_ec_conf CONF_G2_10 __initdata = {
 	.allowed_fw = ALLOWED_FW_G2_10, // legacy fw_27, fw_28 (G2_11), fw_33 (G2_13) fw_35 (G2_15), fw_37 (G2_16), fw_56 (G2_20), fw_59 (G2_21)
+	.name = "G2_10",
+	.generation = 2,
 	.charge_control_address = 0xd7,
 	.webcam = {
 		.address       = 0x2e,
@@ -1797,13 +1909,12 @@ static struct msi_ec_conf CONF_G2_10 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
-	.cpu = {
-		.rt_temp_address      = 0x68,
-		.rt_fan_speed_address = 0x71,
-	},
-	.gpu = {
-		.rt_temp_address      = 0x80,
-		.rt_fan_speed_address = 0x89,
+	.sensors = {
+		{ "cpu", MSI_EC_SENSOR_TEMP, 0x68 },
+		{ "cpu", MSI_EC_SENSOR_FAN,  0x71 },
+		{ "gpu", MSI_EC_SENSOR_TEMP, 0x80 },
+		{ "gpu", MSI_EC_SENSOR_FAN,  0x89 },
+		MSI_EC_SENSOR_NULL
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -1850,1257 +1961,7828 @@ static struct msi_ec_conf *CONFIGURATIONS[] __initdata = {
 	NULL
 };
 
-static bool conf_loaded = false;
-static struct msi_ec_conf conf; // current configuration
+// ============================================================ //
+// Driver instances
+// ============================================================ //
 
-static bool charge_control_supported = false;
+/*
+ * The state of one EC, the driver data of its platform device. The main
+ * instance is the EC of the laptop, accessed through the selected backend,
+ * and carries the system-wide features: the battery hook, the PM QoS hold,
+ * the fan lease, the power profiles, the predictive cooler boost, the perf
+ * PMU, traces and configuration switching. The instances created with the
+ * emulated_fw parameter are emulated ECs with the attributes and LEDs of
+ * their own configuration, so that several configurations can be exercised
+ * side by side on one kernel.
+ */
+struct msi_ec_backend;
 
-static char *firmware = NULL;
-module_param(firmware, charp, 0);
-MODULE_PARM_DESC(firmware, "Load a configuration for a specified firmware version");
+struct msi_ec_hwmon;
 
-static bool debug = false;
-module_param(debug, bool, 0);
-MODULE_PARM_DESC(debug, "Load the driver in the debug mode, exporting the debug attributes");
+// the firmware version, date and time, see Firmware identity
+struct msi_ec_identity {
+	bool valid;
+	char version[MSI_EC_FW_VERSION_LENGTH + 1];
+	int build_result; // -ENODATA if the date or time does not parse
+	struct rtc_time build;
+};
 
-// ============================================================ //
-// Helper functions
-// ============================================================ //
+struct msi_ec_device {
+	const char *name; // of the platform device
+	struct platform_device *pdev;
+	const struct msi_ec_backend *backend;
+	u8 image[256]; // memory of the emulated backends
+
+	struct msi_ec_conf __rcu *conf;
+	const char *conf_source; // where the current configuration is from
+	char fw_version[MSI_EC_FW_VERSION_LENGTH + 1];
+
+	// how the configuration was matched at load, see Configuration matching
+	const char *match_path;
+	int match_confidence;
+	char match_fw[MSI_EC_FW_VERSION_LENGTH + 1];
+
+	struct msi_ec_lock identity_mutex;
+	struct msi_ec_identity identity;
+
+	bool charge_control_supported;
+	u8 ec_get_addr; // debug/ec_get. MAY BE UNSAFE!!!
+
+	// serializes the calls and the state of the in-memory backends
+	struct msi_ec_lock backend_mutex;
+	struct msi_ec_lock ec_set_by_mask_mutex;
+	struct msi_ec_lock ec_unset_by_mask_mutex;
+	struct msi_ec_lock ec_set_bit_mutex;
+
+	struct led_classdev micmute_led;
+	struct led_classdev mute_led;
+	struct led_classdev kbd_led;
+	unsigned int leds_registered; // BIT(enum msi_ec_led) of each one
+	struct msi_ec_hwmon *hwmon;
+
+	struct work_struct bringup_work;
+	bool bringup_done;
+	struct dentry *debugfs; // emulated instances only
+};
 
-static int ec_read_seq(u8 addr, u8 *buf, u8 len)
-{
-	int result;
-	for (u8 i = 0; i < len; i++) {
-		result = ec_read(addr + i, buf + i);
-		if (result < 0)
-			return result;
-	}
-	return 0;
-}
+static struct msi_ec_device msi_ec_main = {
+	.name = MSI_EC_DRIVER_NAME,
+};
 
-static int ec_set_by_mask(u8 addr, u8 mask)
-{
-	int result;
-	u8 stored;
+enum msi_ec_led {
+	MSI_EC_LED_MICMUTE,
+	MSI_EC_LED_MUTE,
+	MSI_EC_LED_KBD,
+};
 
-	mutex_lock(&ec_set_by_mask_mutex);
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		goto unlock;
+#define MSI_EC_MAX_EMULATED 8
 
-	stored |= mask;
-	result = ec_write(addr, stored);
+// the instances of the emulated_fw parameter, msi-ec.0 and onwards
+static struct msi_ec_device *msi_ec_emulated[MSI_EC_MAX_EMULATED];
 
-unlock:
-	mutex_unlock(&ec_set_by_mask_mutex);
-	return result;
+static bool msi_ec_is_main(const struct msi_ec_device *ec)
+{
+	return ec == &msi_ec_main;
 }
 
-static int ec_unset_by_mask(u8 addr, u8 mask)
-{
-	int result;
-	u8 stored;
+/*
+ * The configuration of an instance, NULL until one is loaded. It is
+ * published with RCU so that it can be switched at runtime (see
+ * Configuration switching). The readers access the EC and sleep, so they are
+ * SRCU readers: every entry point (attribute, LED, work item, perf callback)
+ * holds conf_srcu, and every function fetches the configuration once with
+ * msi_ec_conf().
+ */
+DEFINE_STATIC_SRCU(conf_srcu);
+static DEFINE_MUTEX(conf_switch_mutex); // serializes the updaters
 
-	mutex_lock(&ec_unset_by_mask_mutex);
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		goto unlock;
+static const struct msi_ec_conf *msi_ec_conf(struct msi_ec_device *ec)
+{
+	return srcu_dereference_check(ec->conf, &conf_srcu,
+				      lockdep_is_held(&conf_switch_mutex));
+}
 
-	stored &= ~mask;
-	result = ec_write(addr, stored);
+// for the entry points of the readers
+static const struct msi_ec_conf *conf_read_lock(struct msi_ec_device *ec,
+						int *idx)
+{
+	*idx = srcu_read_lock(&conf_srcu);
+	return msi_ec_conf(ec);
+}
 
-unlock:
-	mutex_unlock(&ec_unset_by_mask_mutex);
-	return result;
+static void conf_read_unlock(int idx)
+{
+	srcu_read_unlock(&conf_srcu, idx);
 }
 
-static int ec_check_by_mask(u8 addr, u8 mask, bool *output)
+// publishes the first configuration, must be called before the probe
+static int __init conf_install(struct msi_ec_device *ec,
+			       const struct msi_ec_conf *src,
+			       const char *source)
 {
-	int result;
-	u8 stored;
+	struct msi_ec_conf *c = kmemdup(src, sizeof(*c), GFP_KERNEL);
 
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		return result;
+	if (!c)
+		return -ENOMEM;
 
-	*output = ((stored & mask) == mask);
+	c->allowed_fw = NULL; // __initconst
+	rcu_assign_pointer(ec->conf, c);
+	ec->conf_source = source;
 
 	return 0;
 }
 
-static int ec_set_bit(u8 addr, u8 bit, bool value)
+static void conf_free(struct msi_ec_device *ec)
 {
-	int result;
-	u8 stored;
+	kfree(rcu_dereference_protected(ec->conf, true));
+	RCU_INIT_POINTER(ec->conf, NULL);
+}
 
-	mutex_lock(&ec_set_bit_mutex);
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		goto unlock;
+#define msi_ec_for_each_sensor(_sensor, _conf)				\
+	for (_sensor = (_conf)->sensors;				\
+	     _sensor < (_conf)->sensors + MSI_EC_SENSORS_MAX &&		\
+	     _sensor->label[0];						\
+	     _sensor++)
 
-	if (value)
-		stored |= BIT(bit);
-	else
-		stored &= ~BIT(bit);
+static const struct msi_ec_sensor *
+msi_ec_sensor_find(const struct msi_ec_conf *conf, const char *label,
+		   enum msi_ec_sensor_kind kind)
+{
+	const struct msi_ec_sensor *sensor;
 
-	result = ec_write(addr, stored);
+	msi_ec_for_each_sensor(sensor, conf)
+		if (sensor->kind == kind && !strcmp(sensor->label, label))
+			return sensor;
 
-unlock:
-	mutex_unlock(&ec_set_bit_mutex);
-	return result;
+	return NULL;
 }
 
-static int ec_check_bit(u8 addr, u8 bit, bool *output)
+static int msi_ec_sensor_address(const struct msi_ec_conf *conf,
+				 const char *label,
+				 enum msi_ec_sensor_kind kind)
 {
-	int result;
-	u8 stored;
-
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		return result;
+	const struct msi_ec_sensor *sensor;
 
-	*output = stored & BIT(bit);
+	sensor = msi_ec_sensor_find(conf, label, kind);
+	return sensor ? sensor->address : MSI_EC_ADDR_UNSUPP;
+}
 
-	return 0;
+static int msi_ec_sensor_width(const struct msi_ec_sensor *sensor)
+{
+	return sensor->width ? sensor->width : 1;
 }
 
-static int ec_get_firmware_version(u8 buf[MSI_EC_FW_VERSION_LENGTH + 1])
+// decodes a sensor from the EC memory at its address, in units of its kind
+static long msi_ec_sensor_value(const struct msi_ec_sensor *sensor,
+				const u8 *data)
 {
-	int result;
+	long raw = 0;
 
-	memset(buf, 0, MSI_EC_FW_VERSION_LENGTH + 1);
-	result = ec_read_seq(MSI_EC_FW_VERSION_ADDRESS, buf,
-			     MSI_EC_FW_VERSION_LENGTH);
-	if (result < 0)
-		return result;
+	for (int i = 0; i < msi_ec_sensor_width(sensor); i++)
+		raw = raw << 8 | data[i];
 
-	return MSI_EC_FW_VERSION_LENGTH + 1;
-}
+	// a stopped fan has no period
+	if (sensor->kind == MSI_EC_SENSOR_TACH)
+		return raw ? (sensor->scale ? sensor->scale :
+					      MSI_EC_TACH_SCALE) / raw : 0;
 
-static inline const char *str_left_right(bool v)
-{
-	return v ? "left" : "right";
+	return raw * (sensor->scale ? sensor->scale : 1);
 }
 
-static int direction_is_left(const char *s, bool *res)
-{
-	if (!s)
-		return -EINVAL;
+static char *firmware = NULL;
+module_param(firmware, charp, 0);
+MODULE_PARM_DESC(firmware, "Load a configuration for a specified firmware version");
 
-	switch (s[0]) {
-	case 'l':
-	case 'L':
-		*res = true;
-		return 0;
-	case 'r':
-	case 'R':
-		*res = false;
-		return 0;
-	default:
-		break;
-	}
+static char *emulated_fw[MSI_EC_MAX_EMULATED];
+static unsigned int emulated_fw_count;
+module_param_array(emulated_fw, charp, &emulated_fw_count, 0);
+MODULE_PARM_DESC(emulated_fw, "Firmware versions of additional emulated ECs, comma-separated, each with its own platform device msi-ec.N");
 
-	return -EINVAL;
-}
+static bool debug = false;
+module_param(debug, bool, 0);
+MODULE_PARM_DESC(debug, "Load the driver in the debug mode, exporting the debug attributes");
+
+static char *ec_backend_name = "acpi";
+module_param_named(ec_backend, ec_backend_name, charp, 0);
+MODULE_PARM_DESC(ec_backend, "EC backend: acpi - the ACPI EC (default), emulated - an in-memory EC image for testing, replay - the emulated EC driven by a recorded trace, thermal - the emulated EC with a thermal model of the sensors");
+
+static bool ec_trace = false;
+module_param(ec_trace, bool, 0);
+MODULE_PARM_DESC(ec_trace, "Record the EC transactions from the module load");
+
+static unsigned int ec_trace_records = 65536;
+module_param(ec_trace_records, uint, 0);
+MODULE_PARM_DESC(ec_trace_records, "Capacity of the EC transaction trace buffers, in records (default: 65536)");
+
+static bool ec_replay_latency = false;
+module_param(ec_replay_latency, bool, 0);
+MODULE_PARM_DESC(ec_replay_latency, "Make replayed EC transactions take as long as the recorded ones");
 
 // ============================================================ //
-// Sysfs power_supply subsystem
+// EC backends
 // ============================================================ //
 
-static int get_end_threshold(u8 *out)
-{
-	u8 rdata;
-	int result;
+/*
+ * All EC transactions of an instance go to its backend. Besides the ACPI EC,
+ * an emulated EC allows exercising any configuration without the matching
+ * laptop. The ACPI EC serializes its transactions itself; the calls of the
+ * in-memory backends are serialized by the backend_mutex of the instance.
+ * The replay and thermal backends keep their state globally and are only
+ * available to the main instance.
+ */
+struct msi_ec_backend {
+	const char *name;
+	bool serialized; // by backend_mutex
+	int (*init)(struct msi_ec_device *ec);
+	int (*read)(struct msi_ec_device *ec, u8 addr, u8 *value);
+	int (*write)(struct msi_ec_device *ec, u8 addr, u8 value);
+};
 
-	result = ec_read(conf.charge_control_address, &rdata);
-	if (result < 0)
-		return result;
+static int acpi_ec_backend_read(struct msi_ec_device *ec, u8 addr, u8 *value)
+{
+	return ec_read(addr, value);
+}
 
-	rdata &= ~BIT(7); // last 7 bits contain the threshold
+static int acpi_ec_backend_write(struct msi_ec_device *ec, u8 addr, u8 value)
+{
+	return ec_write(addr, value);
+}
 
-	// the thresholds are unknown
-	if (rdata == 0)
-		return -ENODATA;
+static const struct msi_ec_backend acpi_ec_backend = {
+	.name = "acpi",
+	.read = acpi_ec_backend_read,
+	.write = acpi_ec_backend_write,
+};
 
-	if (rdata < 10 || rdata > 100)
-		return -EINVAL;
+/*
+ * The emulated EC is a plain memory image. It starts zeroed, except for the
+ * firmware version of the instance (the firmware or emulated_fw parameter),
+ * and can be inspected and seeded through the ec_image debugfs file.
+ */
+static int emulated_ec_init(struct msi_ec_device *ec)
+{
+	memcpy(ec->image + MSI_EC_FW_VERSION_ADDRESS, ec->fw_version,
+	       strnlen(ec->fw_version, MSI_EC_FW_VERSION_LENGTH));
 
-	*out = rdata;
 	return 0;
 }
 
-static int set_end_threshold(u8 value)
+static int emulated_ec_read(struct msi_ec_device *ec, u8 addr, u8 *value)
 {
-	if (value < 10 || value > 100)
-		return -EINVAL;
-
-	return ec_write(conf.charge_control_address, value | BIT(7));
+	*value = ec->image[addr];
+	return 0;
 }
 
-static ssize_t
-charge_control_start_threshold_show(struct device *device,
-				    struct device_attribute *attr, char *buf)
+static int emulated_ec_write(struct msi_ec_device *ec, u8 addr, u8 value)
 {
-	int result;
-	u8 threshold;
+	ec->image[addr] = value;
+	return 0;
+}
 
-	result = get_end_threshold(&threshold);
+static const struct msi_ec_backend emulated_ec_backend = {
+	.name = "emulated",
+	.serialized = true,
+	.init = emulated_ec_init,
+	.read = emulated_ec_read,
+	.write = emulated_ec_write,
+};
 
-	if (result == -ENODATA)
-		return sysfs_emit(buf, "0\n");
-	else if (result < 0)
-		return result;
+/*
+ * EC transaction traces. While recording, every EC transaction of the
+ * driver, with any backend, is appended to a buffer of ec_trace_records
+ * records; once it is full, further transactions are only counted. The
+ * trace is read in the binary format below from debugfs.
+ *
+ * The replay backend is the emulated EC driven by such a trace: every
+ * transaction advances the trace by one record, and the value of a recorded
+ * read is stored into the image before it is served, so the EC changes as
+ * the firmware changed it on the recorded machine. Recorded writes are not
+ * applied, the driver's own writes are. A recorded error is returned if the
+ * transaction matches the failed one. The replay is deterministic as long as
+ * the driver issues the recorded transactions; those that do not match
+ * their record are counted as diverged.
+ *
+ * A trace is replayed on a loaded driver, so it starts after a marker record
+ * that is written once the driver was loaded, or when a recording is
+ * started on a loaded driver. The transactions of the load before it are
+ * skipped. Background EC users (cooler_boost_auto, the hwmon sample cache,
+ * the mode arbiter delays and owner hold, and the perf PMU) depend on time
+ * and are disabled during a replay.
+ */
+#define MSI_EC_TRACE_MAGIC "MSIECTR"
+#define MSI_EC_TRACE_VERSION 2
+
+#define MSI_EC_TRACE_WRITE BIT(0)
+#define MSI_EC_TRACE_ERROR BIT(1)
+#define MSI_EC_TRACE_MARKER BIT(2) // no transaction, the replay starts after it
+
+struct msi_ec_trace_header {
+	char magic[8];
+	__le32 version;
+	__le32 count; // records following the header
+	__le32 dropped; // transactions not recorded, the buffer was full
+	__le32 reserved;
+} __packed;
+
+struct msi_ec_trace_record {
+	__le64 time_ns; // since the recording started
+	__le32 latency_ns;
+	u8 addr;
+	u8 value;
+	u8 flags;
+	u8 reserved;
+} __packed;
+
+struct msi_ec_trace {
+	struct msi_ec_trace_record *records;
+	unsigned int count;
+	unsigned int dropped; // recording: not recorded, replay: diverged
+	unsigned int position; // replay only
+	u64 start_ns; // recording only
+};
 
-	return sysfs_emit(buf, "%u\n", threshold - 10);
-}
+// of the main instance
+DEFINE_MSI_EC_LOCK(ec_trace_mutex); // protects the recording
+static struct msi_ec_trace ec_trace_rec;
+static bool ec_trace_recording;
+static struct msi_ec_trace ec_trace_replay; // protected by backend_mutex
 
-static ssize_t
-charge_control_start_threshold_store(struct device *dev,
-				     struct device_attribute *attr,
-				     const char *buf, size_t count)
+// must be called with ec_trace_mutex held
+static int ec_trace_start(void)
 {
-	int result;
-	u8 threshold;
-
-	result = kstrtou8(buf, 10, &threshold);
-	if (result < 0)
-		return result;
+	if (!ec_trace_rec.records) {
+		ec_trace_rec.records = vmalloc(array_size(
+			ec_trace_records, sizeof(*ec_trace_rec.records)));
+		if (!ec_trace_rec.records)
+			return -ENOMEM;
+	}
 
-	result = set_end_threshold(threshold + 10);
-	if (result < 0)
-		return result;
+	ec_trace_rec.count = 0;
+	ec_trace_rec.dropped = 0;
+	ec_trace_rec.start_ns = ktime_get_ns();
+	WRITE_ONCE(ec_trace_recording, true);
 
-	return count;
+	return 0;
 }
 
-static ssize_t charge_control_end_threshold_show(struct device *device,
-						 struct device_attribute *attr,
-						 char *buf)
+// must be called with ec_trace_mutex held
+static struct msi_ec_trace_record *ec_trace_append(u64 start_ns)
 {
-	int result;
-	u8 threshold;
+	struct msi_ec_trace_record *r;
 
-	result = get_end_threshold(&threshold);
+	if (ec_trace_rec.count == ec_trace_records) {
+		ec_trace_rec.dropped++;
+		return NULL;
+	}
 
-	if (result == -ENODATA)
-		return sysfs_emit(buf, "0\n");
-	else if (result < 0)
-		return result;
+	r = &ec_trace_rec.records[ec_trace_rec.count++];
+	memset(r, 0, sizeof(*r));
+	r->time_ns = cpu_to_le64(start_ns - ec_trace_rec.start_ns);
 
-	return sysfs_emit(buf, "%u\n", threshold);
+	return r;
 }
 
-static ssize_t charge_control_end_threshold_store(struct device *dev,
-						  struct device_attribute *attr,
-						  const char *buf, size_t count)
+// called by the EC access wrappers, only locks while recording
+static void ec_trace_record(struct msi_ec_device *ec, u8 addr, u8 value,
+			    bool write, int result, u64 start_ns,
+			    u64 latency_ns)
 {
-	int result;
-	u8 threshold;
+	struct msi_ec_trace_record *r;
+
+	if (!READ_ONCE(ec_trace_recording) || !msi_ec_is_main(ec))
+		return;
+
+	msi_ec_lock(&ec_trace_mutex);
+	r = ec_trace_recording ? ec_trace_append(start_ns) : NULL;
+	if (r) {
+		r->latency_ns = cpu_to_le32(min_t(u64, latency_ns, U32_MAX));
+		r->addr = addr;
+		r->value = value;
+		r->flags = (write ? MSI_EC_TRACE_WRITE : 0) |
+			   (result < 0 ? MSI_EC_TRACE_ERROR : 0);
+	}
+	msi_ec_unlock(&ec_trace_mutex);
+}
 
-	result = kstrtou8(buf, 10, &threshold);
-	if (result < 0)
-		return result;
+// must be called with ec_trace_mutex held
+static void ec_trace_mark(void)
+{
+	struct msi_ec_trace_record *r;
 
-	result = set_end_threshold(threshold);
-	if (result < 0)
-		return result;
+	if (!ec_trace_recording)
+		return;
 
-	return count;
+	r = ec_trace_append(ktime_get_ns());
+	if (r)
+		r->flags = MSI_EC_TRACE_MARKER;
 }
 
-static DEVICE_ATTR_RW(charge_control_start_threshold);
-static DEVICE_ATTR_RW(charge_control_end_threshold);
+static void ec_trace_free(void)
+{
+	ec_trace_recording = false;
+	vfree(ec_trace_rec.records);
+	ec_trace_rec.records = NULL;
+	vfree(ec_trace_replay.records);
+	ec_trace_replay.records = NULL;
+}
 
-static struct attribute *msi_battery_attrs[] = {
-	&dev_attr_charge_control_start_threshold.attr,
-	&dev_attr_charge_control_end_threshold.attr,
-	NULL
-};
+// returns the error of the transaction if it failed when recorded
+static int replay_ec_advance(struct msi_ec_device *ec, u8 addr, bool write)
+{
+	const struct msi_ec_trace_record *r;
+	bool matches;
 
-ATTRIBUTE_GROUPS(msi_battery);
+	// markers of a recording restarted during the replay
+	while (ec_trace_replay.position < ec_trace_replay.count &&
+	       (ec_trace_replay.records[ec_trace_replay.position].flags &
+		MSI_EC_TRACE_MARKER))
+		ec_trace_replay.position++;
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0))
-static int msi_battery_add(struct power_supply *battery,
-			   struct acpi_battery_hook *hook)
-#else
-static int msi_battery_add(struct power_supply *battery)
-#endif
-{
-	return device_add_groups(&battery->dev, msi_battery_groups);
-}
+	if (ec_trace_replay.position == ec_trace_replay.count)
+		return 0;
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0))
-static int msi_battery_remove(struct power_supply *battery,
-			      struct acpi_battery_hook *hook)
-#else
-static int msi_battery_remove(struct power_supply *battery)
-#endif
-{
-	device_remove_groups(&battery->dev, msi_battery_groups);
-	return 0;
-}
+	r = &ec_trace_replay.records[ec_trace_replay.position++];
+	matches = r->addr == addr && !(r->flags & MSI_EC_TRACE_WRITE) == !write;
+	if (!matches)
+		ec_trace_replay.dropped++;
 
-static struct acpi_battery_hook battery_hook = {
-	.add_battery = msi_battery_add,
-	.remove_battery = msi_battery_remove,
-	.name = MSI_EC_DRIVER_NAME,
-};
+	if (ec_replay_latency)
+		fsleep(DIV_ROUND_UP(le32_to_cpu(r->latency_ns), 1000));
 
-// ============================================================ //
-// Sysfs platform device attributes (root)
-// ============================================================ //
+	if (r->flags & MSI_EC_TRACE_ERROR)
+		return matches ? -EIO : 0;
+
+	if (!(r->flags & MSI_EC_TRACE_WRITE))
+		ec->image[r->addr] = r->value;
+
+	return 0;
+}
 
-static ssize_t webcam_common_show(u8 address, char *buf, bool inverted)
+static int replay_ec_read(struct msi_ec_device *ec, u8 addr, u8 *value)
 {
-	int result;
-	bool value;
+	int result = replay_ec_advance(ec, addr, false);
 
-	result = ec_check_bit(address, conf.webcam.bit, &value);
 	if (result < 0)
 		return result;
 
-	return sysfs_emit(buf, "%s\n", str_on_off(value ^ inverted));
+	return emulated_ec_read(ec, addr, value);
 }
 
-static ssize_t webcam_common_store(u8 address,
-				   const char *buf,
-				   size_t count,
-				   bool inverted)
+static int replay_ec_write(struct msi_ec_device *ec, u8 addr, u8 value)
 {
-	int result;
-	bool value;
-
-	result = kstrtobool(buf, &value);
-	if (result)
-		return result;
+	int result = replay_ec_advance(ec, addr, true);
 
-	result = ec_set_bit(address, conf.webcam.bit, value ^ inverted);
 	if (result < 0)
 		return result;
 
-	return count;
+	return emulated_ec_write(ec, addr, value);
 }
 
-static ssize_t webcam_show(struct device *device,
-			   struct device_attribute *attr,
-			   char *buf)
-{
-	return webcam_common_show(conf.webcam.address, buf, false);
-}
+static const struct msi_ec_backend replay_ec_backend = {
+	.name = "replay",
+	.serialized = true,
+	.init = emulated_ec_init,
+	.read = replay_ec_read,
+	.write = replay_ec_write,
+};
 
-static ssize_t webcam_store(struct device *dev,
-			    struct device_attribute *attr,
-			    const char *buf, size_t count)
+// the background EC users are disabled during a replay
+static bool msi_ec_replaying(const struct msi_ec_device *ec)
 {
-	return webcam_common_store(conf.webcam.address, buf, count, false);
+	return ec->backend == &replay_ec_backend;
 }
 
-static ssize_t webcam_block_show(struct device *device,
-				 struct device_attribute *attr,
-				 char *buf)
-{
-	return webcam_common_show(conf.webcam.block_address, buf, true);
-}
+/*
+ * The thermal backend is the emulated EC with a thermal model behind the
+ * realtime sensors of the loaded configuration, so that fan and mode
+ * policies can be tested in a closed loop. Before every transaction the
+ * model is advanced to the current time and the sensor registers are
+ * updated; mode registers written by the driver take effect from then on.
+ *
+ * Each temperature follows a first-order response towards
+ *
+ *   ambient + SIM_MAX_RISE * power / (1 + 1.5 * fan)
+ *
+ * with time constant tau, where power is the heat load scaled by the shift
+ * mode and fan the fan speed, itself following a first-order response with
+ * time constant fan_tau towards the target of the fan mode (or 100% with
+ * cooler boost). Values are fixed-point: m°C, milli-% and ns.
+ *
+ * The model clock follows the real time, or with step_us set, advances by
+ * step_us on every transaction so that runs are reproducible.
+ */
+#define SIM_MAX_RISE 70000 // m°C above ambient at full power without fan
+#define SIM_MAX_RPM 5600 // of the fans at 100 %
+#define SIM_MAX_STEP_NS (100 * NSEC_PER_MSEC)
+
+struct sim_ec_params {
+	u32 ambient; // °C
+	u32 cpu_load; // %
+	u32 gpu_load; // %
+	u32 tau_ms;
+	u32 fan_tau_ms;
+	u32 step_us;
+};
 
-static ssize_t webcam_block_store(struct device *dev,
-				  struct device_attribute *attr,
-				  const char *buf, size_t count)
-{
-	return webcam_common_store(conf.webcam.block_address, buf, count, true);
-}
+struct sim_ec_state {
+	u64 clock_ns; // model time
+	u64 updated_ns; // real time of the last update
+	s32 cpu_temp;
+	s32 cpu_fan;
+	s32 gpu_temp;
+	s32 gpu_fan;
+};
 
-static ssize_t fn_key_show(struct device *device, struct device_attribute *attr,
-			   char *buf)
+// the parameters are set through debugfs, the state is protected by the
+// backend_mutex of the main instance
+static struct sim_ec_params sim_params = {
+	.ambient = 25,
+	.cpu_load = 50,
+	.gpu_load = 0,
+	.tau_ms = 20000,
+	.fan_tau_ms = 3000,
+	.step_us = 0,
+};
+
+static struct sim_ec_state sim_state;
+
+static const char *sim_ec_mode(struct msi_ec_device *ec,
+			       const struct msi_ec_mode *modes, int address)
 {
-	int result;
-	bool value;
+	if (address == MSI_EC_ADDR_UNSUPP)
+		return NULL;
 
-	result = ec_check_bit(conf.fn_win_swap.address, conf.fn_win_swap.bit, &value);
-	if (result < 0)
-		return result;
+	for (int i = 0; modes[i].name; i++)
+		if (modes[i].value == ec->image[address])
+			return modes[i].name;
 
-	value ^= conf.fn_win_swap.invert; // invert the direction for some laptops
-	value = !value; // fn key position is the opposite of win key
+	return NULL;
+}
 
-	return sysfs_emit(buf, "%s\n", str_left_right(value));
+// heat load scaling of the current shift mode, in %
+static s32 sim_ec_shift_factor(struct msi_ec_device *ec,
+			       const struct msi_ec_conf *conf)
+{
+	const char *mode = sim_ec_mode(ec, conf->shift_mode.modes,
+				       conf->shift_mode.address);
+
+	if (!mode)
+		return 100;
+	if (!strcmp(mode, SM_ECO_NAME))
+		return 60;
+	if (!strcmp(mode, SM_COMFORT_NAME))
+		return 80;
+	if (!strcmp(mode, SM_TURBO_NAME))
+		return 115;
+
+	return 100;
 }
 
-static ssize_t fn_key_store(struct device *dev, struct device_attribute *attr,
-			    const char *buf, size_t count)
+static s32 sim_ec_fan_target(struct msi_ec_device *ec,
+			     const struct msi_ec_conf *conf, s32 temp)
 {
-	int result;
-	bool value;
+	const char *mode;
+	s32 target;
 
-	result = direction_is_left(buf, &value);
-	if (result < 0)
-		return result;
+	if (conf->cooler_boost.address != MSI_EC_ADDR_UNSUPP &&
+	    ec->image[conf->cooler_boost.address] & BIT(conf->cooler_boost.bit))
+		return 100000;
 
-	value ^= conf.fn_win_swap.invert; // invert the direction for some laptops
-	value = !value; // fn key position is the opposite of win key
+	// from 0% at 45°C to 100% at 95°C
+	target = clamp((temp - 45000) * 2, 0, 100000);
 
-	result = ec_set_bit(conf.fn_win_swap.address, conf.fn_win_swap.bit, value);
+	mode = sim_ec_mode(ec, conf->fan_mode.modes, conf->fan_mode.address);
+	if (mode && !strcmp(mode, FM_SILENT_NAME))
+		target = min(target / 2, 50000);
 
-	if (result < 0)
-		return result;
+	return target;
+}
 
-	return count;
+// implicit Euler step of a first-order response, stable for any dt
+static s32 sim_ec_approach(s32 value, s32 target, u64 dt_ns, u32 tau_ms)
+{
+	u64 tau_ns = (u64)max(tau_ms, 1u) * NSEC_PER_MSEC;
+
+	return value + div64_s64((s64)(target - value) * dt_ns, tau_ns + dt_ns);
 }
 
-static ssize_t win_key_show(struct device *device,
-			    struct device_attribute *attr, char *buf)
+static void sim_ec_step(struct msi_ec_device *ec,
+			const struct msi_ec_conf *conf, s32 *temp, s32 *fan,
+			u32 load, s32 shift, u64 dt_ns)
 {
-	int result;
-	bool value;
+	s64 power = (s64)min(load, 100u) * shift; // 10000 is 100%
+	s32 ambient = sim_params.ambient * 1000;
+	s32 target;
+
+	target = ambient + div64_s64(SIM_MAX_RISE * power / 100 * 100000,
+				     100 * (100000 + (s64)*fan * 3 / 2));
+	*temp = sim_ec_approach(*temp, target, dt_ns, sim_params.tau_ms);
+	*fan = sim_ec_approach(*fan, sim_ec_fan_target(ec, conf, *temp), dt_ns,
+			       sim_params.fan_tau_ms);
+}
 
-	result = ec_check_bit(conf.fn_win_swap.address, conf.fn_win_swap.bit, &value);
-	if (result < 0)
-		return result;
+static void sim_ec_set_sensor(struct msi_ec_device *ec, int address, s32 value)
+{
+	if (address != MSI_EC_ADDR_UNSUPP)
+		ec->image[address] = clamp(DIV_ROUND_CLOSEST(value, 1000),
+					   0, 255);
+}
 
-	value ^= conf.fn_win_swap.invert; // invert the direction for some laptops
+// tachometers count the period of a fan turn
+static void sim_ec_set_tach(struct msi_ec_device *ec,
+			    const struct msi_ec_sensor *sensor, s32 fan)
+{
+	int scale = sensor->scale ? sensor->scale : MSI_EC_TACH_SCALE;
+	int rpm = DIV_ROUND_CLOSEST(fan, 1000) * SIM_MAX_RPM / 100;
+	u32 raw = rpm > 0 ? scale / rpm : 0;
 
-	return sysfs_emit(buf, "%s\n", str_left_right(value));
+	for (int i = msi_ec_sensor_width(sensor) - 1; i >= 0; i--) {
+		ec->image[sensor->address + i] = raw;
+		raw >>= 8;
+	}
 }
 
-static ssize_t win_key_store(struct device *dev, struct device_attribute *attr,
-			     const char *buf, size_t count)
+static void sim_ec_update(struct msi_ec_device *ec)
 {
-	int result;
-	bool value;
+	const struct msi_ec_sensor *sensor;
+	const struct msi_ec_conf *conf;
+	u64 now = ktime_get_ns();
+	u64 dt_ns;
+	s32 shift;
+	int idx;
+
+	if (sim_params.step_us)
+		dt_ns = (u64)sim_params.step_us * NSEC_PER_USEC;
+	else
+		dt_ns = now - sim_state.updated_ns;
 
-	result = direction_is_left(buf, &value);
-	if (result < 0)
-		return result;
+	sim_state.updated_ns = now;
+	sim_state.clock_ns += dt_ns;
 
-	value ^= conf.fn_win_swap.invert; // invert the direction for some laptops
+	// the sensors are only known once the configuration is loaded
+	idx = srcu_read_lock(&conf_srcu);
+	conf = msi_ec_conf(ec);
+	if (!conf)
+		goto unlock;
 
-	result = ec_set_bit(conf.fn_win_swap.address, conf.fn_win_swap.bit, value);
+	// after 10 time constants the state has settled anyway
+	dt_ns = min_t(u64, dt_ns,
+		      10ull * max(sim_params.tau_ms, sim_params.fan_tau_ms) *
+			      NSEC_PER_MSEC);
 
-	if (result < 0)
-		return result;
+	shift = sim_ec_shift_factor(ec, conf);
+	while (dt_ns) {
+		u64 step = min_t(u64, dt_ns, SIM_MAX_STEP_NS);
 
-	return count;
+		sim_ec_step(ec, conf, &sim_state.cpu_temp, &sim_state.cpu_fan,
+			    sim_params.cpu_load, shift, step);
+		sim_ec_step(ec, conf, &sim_state.gpu_temp, &sim_state.gpu_fan,
+			    sim_params.gpu_load, 100, step);
+		dt_ns -= step;
+	}
+
+	sim_ec_set_sensor(ec, msi_ec_sensor_address(conf, "cpu",
+						    MSI_EC_SENSOR_TEMP),
+			  sim_state.cpu_temp);
+	sim_ec_set_sensor(ec, msi_ec_sensor_address(conf, "cpu",
+						    MSI_EC_SENSOR_FAN),
+			  sim_state.cpu_fan);
+	sim_ec_set_sensor(ec, msi_ec_sensor_address(conf, "gpu",
+						    MSI_EC_SENSOR_TEMP),
+			  sim_state.gpu_temp);
+	sim_ec_set_sensor(ec, msi_ec_sensor_address(conf, "gpu",
+						    MSI_EC_SENSOR_FAN),
+			  sim_state.gpu_fan);
+
+	sensor = msi_ec_sensor_find(conf, "cpu", MSI_EC_SENSOR_TACH);
+	if (sensor)
+		sim_ec_set_tach(ec, sensor, sim_state.cpu_fan);
+
+	sensor = msi_ec_sensor_find(conf, "gpu", MSI_EC_SENSOR_TACH);
+	if (sensor)
+		sim_ec_set_tach(ec, sensor, sim_state.gpu_fan);
+
+unlock:
+	srcu_read_unlock(&conf_srcu, idx);
 }
 
-static ssize_t cooler_boost_show(struct device *device,
-				 struct device_attribute *attr, char *buf)
+static int sim_ec_init(struct msi_ec_device *ec)
 {
-	int result;
-	bool value;
-
-	result = ec_check_bit(conf.cooler_boost.address, conf.cooler_boost.bit, &value);
-	if (result < 0)
-		return result;
+	sim_state.updated_ns = ktime_get_ns();
+	sim_state.cpu_temp = sim_params.ambient * 1000;
+	sim_state.gpu_temp = sim_params.ambient * 1000;
 
-	return sysfs_emit(buf, "%s\n", str_on_off(value));
+	return emulated_ec_init(ec);
 }
 
-static ssize_t cooler_boost_store(struct device *dev,
-				  struct device_attribute *attr,
-				  const char *buf, size_t count)
+static int sim_ec_read(struct msi_ec_device *ec, u8 addr, u8 *value)
 {
-	int result;
-	bool value;
+	sim_ec_update(ec);
+	return emulated_ec_read(ec, addr, value);
+}
 
-	result = kstrtobool(buf, &value);
-	if (result)
-		return result;
+static int sim_ec_write(struct msi_ec_device *ec, u8 addr, u8 value)
+{
+	sim_ec_update(ec);
+	return emulated_ec_write(ec, addr, value);
+}
 
-	result = ec_set_bit(conf.cooler_boost.address, conf.cooler_boost.bit, value);
-	if (result < 0)
-		return result;
+static const struct msi_ec_backend sim_ec_backend = {
+	.name = "thermal",
+	.serialized = true,
+	.init = sim_ec_init,
+	.read = sim_ec_read,
+	.write = sim_ec_write,
+};
 
-	return count;
-}
+static const struct msi_ec_backend *ec_backends[] = {
+	&acpi_ec_backend,
+	&emulated_ec_backend,
+	&replay_ec_backend,
+	&sim_ec_backend,
+	NULL
+};
 
-static ssize_t available_shift_modes_show(struct device *device,
-					  struct device_attribute *attr,
-					  char *buf)
+// must be called before the first EC access of the main instance
+static int __init ec_backend_select(struct msi_ec_device *ec)
 {
-	int result = 0;
-	int count = 0;
+	for (int i = 0; ec_backends[i]; i++) {
+		if (strcmp(ec_backends[i]->name, ec_backend_name))
+			continue;
 
-	for (int i = 0; conf.shift_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+		ec->backend = ec_backends[i];
+		if (ec->backend != &acpi_ec_backend)
+			pr_info("using the %s EC backend\n", ec->backend->name);
 
-		result = sysfs_emit_at(buf, count, "%s\n", conf.shift_mode.modes[i].name);
-		if (result < 0)
-			return result;
-		count += result;
+		return ec->backend->init ? ec->backend->init(ec) : 0;
 	}
 
-	return count;
+	pr_err("Unknown EC backend: %s\n", ec_backend_name);
+	return -EINVAL;
 }
 
-static ssize_t shift_mode_show(struct device *device,
-			       struct device_attribute *attr,
-			       char *buf)
+// ============================================================ //
+// Helper functions
+// ============================================================ //
+
+/*
+ * EC access statistics, exported through debugfs. The counters are per-CPU
+ * so that accounting never contends between concurrent EC users; readers
+ * sum them over all CPUs. Latencies are kept in log2 buckets of ns: bucket
+ * i counts accesses that took [2^i, 2^(i+1)) ns, the last one is open.
+ */
+#define MSI_EC_LATENCY_BUCKETS 32
+
+struct msi_ec_access_stats {
+	u64 reads[256];
+	u64 writes[256];
+	u64 read_errors[256];
+	u64 write_errors[256];
+	u64 read_latency[MSI_EC_LATENCY_BUCKETS];
+	u64 write_latency[MSI_EC_LATENCY_BUCKETS];
+};
+
+static struct msi_ec_access_stats __percpu *ec_access_stats;
+
+static unsigned int latency_bucket(u64 latency_ns)
 {
-	u8 rdata;
-	int result;
+	if (!latency_ns)
+		return 0;
 
-	result = ec_read(conf.shift_mode.address, &rdata);
-	if (result < 0)
-		return result;
+	return min_t(unsigned int, ilog2(latency_ns),
+		     MSI_EC_LATENCY_BUCKETS - 1);
+}
 
-	if (rdata == 0x80)
-		return sysfs_emit(buf, "%s\n", "unspecified");
+static void ec_access_account(u8 addr, bool write, int result, u64 latency_ns)
+{
+	unsigned int bucket = latency_bucket(latency_ns);
 
-	for (int i = 0; conf.shift_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+	if (!ec_access_stats)
+		return;
 
-		if (rdata == conf.shift_mode.modes[i].value) {
-			return sysfs_emit(buf, "%s\n", conf.shift_mode.modes[i].name);
-		}
+	if (write) {
+		this_cpu_inc(ec_access_stats->writes[addr]);
+		this_cpu_inc(ec_access_stats->write_latency[bucket]);
+		if (result < 0)
+			this_cpu_inc(ec_access_stats->write_errors[addr]);
+	} else {
+		this_cpu_inc(ec_access_stats->reads[addr]);
+		this_cpu_inc(ec_access_stats->read_latency[bucket]);
+		if (result < 0)
+			this_cpu_inc(ec_access_stats->read_errors[addr]);
 	}
-
-	return sysfs_emit(buf, "%s (%i)\n", "unknown", rdata);
 }
 
-static ssize_t shift_mode_store(struct device *dev,
-				struct device_attribute *attr, const char *buf,
-				size_t count)
+/*
+ * EC transactions issued by an operation, e.g. a show/store call, are
+ * counted while it is running. A running operation owns a slot, found by
+ * the EC accesses through current: the slots are only written when an
+ * operation begins or ends, so counting takes no lock and the counts are
+ * exact even if several operations run concurrently. The operations of more
+ * than MSI_EC_OP_SLOTS tasks at once are not counted.
+ */
+struct msi_ec_op {
+	const char *attr; // path of the attribute, for the EC tracepoints
+	int slot; // -1 if the operation is not counted
+	unsigned int ec_reads;
+	unsigned int ec_writes;
+};
+
+#define MSI_EC_OP_SLOTS 16
+
+struct msi_ec_op_slot {
+	struct task_struct *task;
+	struct msi_ec_op *op; // only used by task
+} ____cacheline_aligned_in_smp;
+
+static struct msi_ec_op_slot ec_op_slots[MSI_EC_OP_SLOTS];
+
+static void ec_op_begin(struct msi_ec_op *op, const char *attr)
 {
-	int result;
+	op->attr = attr;
+	op->slot = -1;
+	op->ec_reads = 0;
+	op->ec_writes = 0;
 
-	for (int i = 0; conf.shift_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+	for (int i = 0; i < MSI_EC_OP_SLOTS; i++) {
+		struct msi_ec_op_slot *slot = &ec_op_slots[i];
 
-		if (sysfs_streq(conf.shift_mode.modes[i].name, buf)) {
-			result = ec_write(conf.shift_mode.address,
-					  conf.shift_mode.modes[i].value);
-			if (result < 0)
-				return result;
+		if (READ_ONCE(slot->task) ||
+		    cmpxchg(&slot->task, NULL, current))
+			continue;
 
-			return count;
-		}
+		slot->op = op;
+		op->slot = i;
+		break;
 	}
-
-	return -EINVAL;
 }
 
-static ssize_t super_battery_show(struct device *device,
-				  struct device_attribute *attr, char *buf)
+static void ec_op_end(struct msi_ec_op *op)
 {
-	int result;
-	bool enabled;
-
-	result = ec_check_by_mask(conf.super_battery.address,
-				  conf.super_battery.mask,
-				  &enabled);
-	if (result < 0)
-		return result;
+	if (op->slot < 0)
+		return;
 
-	return sysfs_emit(buf, "%s\n", str_on_off(enabled));
+	ec_op_slots[op->slot].op = NULL;
+	smp_store_release(&ec_op_slots[op->slot].task, NULL);
 }
 
-static ssize_t super_battery_store(struct device *dev,
-				   struct device_attribute *attr,
-				   const char *buf, size_t count)
+// the operation of the current task, NULL if none is counted
+static struct msi_ec_op *ec_op_current(void)
 {
-	int result;
-	bool value;
+	for (int i = 0; i < MSI_EC_OP_SLOTS; i++)
+		if (READ_ONCE(ec_op_slots[i].task) == current)
+			return ec_op_slots[i].op;
 
-	result = kstrtobool(buf, &value);
-	if (result)
-		return result;
+	return NULL;
+}
 
-	if (value)
-		result = ec_set_by_mask(conf.super_battery.address,
-					conf.super_battery.mask);
+static void ec_op_account(struct msi_ec_op *op, bool write)
+{
+	if (!op)
+		return;
+
+	if (write)
+		op->ec_writes++;
 	else
-		result = ec_unset_by_mask(conf.super_battery.address,
-					  conf.super_battery.mask);
+		op->ec_reads++;
+}
 
-	if (result < 0)
-		return result;
+static void msi_ec_backend_lock(struct msi_ec_device *ec)
+{
+	if (ec->backend->serialized)
+		msi_ec_lock(&ec->backend_mutex);
+}
 
-	return count;
+static void msi_ec_backend_unlock(struct msi_ec_device *ec)
+{
+	if (ec->backend->serialized)
+		msi_ec_unlock(&ec->backend_mutex);
 }
 
-static ssize_t available_fan_modes_show(struct device *device,
-					struct device_attribute *attr,
-					char *buf)
+// All EC accesses go through these wrappers to be traceable and accounted
+static noinline int msi_ec_read(struct msi_ec_device *ec, u8 addr, u8 *value)
 {
-	int result = 0;
-	int count = 0;
+	struct msi_ec_op *op;
+	u64 start, latency_ns;
+	int result;
 
-	for (int i = 0; conf.fan_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+	msi_ec_backend_lock(ec);
+	start = ktime_get_ns();
+	result = ec->backend->read(ec, addr, value);
+	latency_ns = ktime_get_ns() - start;
+	ec_trace_record(ec, addr, result < 0 ? 0 : *value, false, result, start,
+			latency_ns);
+	msi_ec_backend_unlock(ec);
 
-		result = sysfs_emit_at(buf, count, "%s\n", conf.fan_mode.modes[i].name);
-		if (result < 0)
-			return result;
-		count += result;
-	}
+	op = ec_op_current();
+	ec_access_account(addr, false, result, latency_ns);
+	ec_op_account(op, false);
+	trace_msi_ec_read(addr, result < 0 ? 0 : *value, result, latency_ns,
+			  op ? op->attr : NULL);
 
-	return count;
+	return result;
 }
 
-static ssize_t fan_mode_show(struct device *device,
-			     struct device_attribute *attr, char *buf)
+static noinline int msi_ec_write(struct msi_ec_device *ec, u8 addr, u8 value)
 {
-	u8 rdata;
+	struct msi_ec_op *op;
+	u64 start, latency_ns;
 	int result;
 
-	result = ec_read(conf.fan_mode.address, &rdata);
-	if (result < 0)
-		return result;
-
-	for (int i = 0; conf.fan_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+	msi_ec_backend_lock(ec);
+	start = ktime_get_ns();
+	result = ec->backend->write(ec, addr, value);
+	latency_ns = ktime_get_ns() - start;
+	ec_trace_record(ec, addr, value, true, result, start, latency_ns);
+	msi_ec_backend_unlock(ec);
 
-		if (rdata == conf.fan_mode.modes[i].value) {
-			return sysfs_emit(buf, "%s\n", conf.fan_mode.modes[i].name);
-		}
-	}
+	op = ec_op_current();
+	ec_access_account(addr, true, result, latency_ns);
+	ec_op_account(op, true);
+	trace_msi_ec_write(addr, value, result, latency_ns,
+			   op ? op->attr : NULL);
 
-	return sysfs_emit(buf, "%s (%i)\n", "unknown", rdata);
+	return result;
 }
 
-static ssize_t fan_mode_store(struct device *dev, struct device_attribute *attr,
-			      const char *buf, size_t count)
-{
-	int result;
+// per-CPU call counters of an attribute, allocated by msi_ec_stats_init()
+struct msi_ec_attr_stats {
+	u64 shows;
+	u64 stores;
+	u64 show_ns;
+	u64 store_ns;
+	u64 show_ec_reads;
+	u64 show_ec_writes;
+	u64 store_ec_reads;
+	u64 store_ec_writes;
+};
 
-	for (int i = 0; conf.fan_mode.modes[i].name; i++) {
-		// NULL entries have NULL name
+/*
+ * Platform and battery attributes are wrapped to trace and account every
+ * show/store call. path is the attribute path relative to the device
+ * directory.
+ */
+struct msi_ec_attribute {
+	struct device_attribute dev_attr;
+	const char *path;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr,
+			char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t count);
+	struct msi_ec_attr_stats __percpu *stats;
+};
 
-		if (sysfs_streq(conf.fan_mode.modes[i].name, buf)) {
-			result = ec_write(conf.fan_mode.address,
-					  conf.fan_mode.modes[i].value);
-			if (result < 0)
-				return result;
+#define to_msi_ec_attr(_attr) \
+	container_of(_attr, struct msi_ec_attribute, dev_attr)
 
-			return count;
-		}
+static ssize_t msi_ec_attr_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct msi_ec_attribute *ma = to_msi_ec_attr(attr);
+	u64 start = ktime_get_ns();
+	struct msi_ec_op op;
+	u64 latency_ns;
+	ssize_t result;
+	int idx;
+
+	if (!ma->show)
+		return -EIO;
+
+	trace_msi_ec_attr_show_enter(ma->path);
+	ec_op_begin(&op, ma->path);
+	idx = srcu_read_lock(&conf_srcu);
+	result = ma->show(dev, attr, buf);
+	srcu_read_unlock(&conf_srcu, idx);
+	ec_op_end(&op);
+	latency_ns = ktime_get_ns() - start;
+	trace_msi_ec_attr_show(ma->path, result, latency_ns, op.ec_reads,
+			       op.ec_writes);
+
+	if (ma->stats) {
+		this_cpu_inc(ma->stats->shows);
+		this_cpu_add(ma->stats->show_ns, latency_ns);
+		this_cpu_add(ma->stats->show_ec_reads, op.ec_reads);
+		this_cpu_add(ma->stats->show_ec_writes, op.ec_writes);
 	}
 
-	return -EINVAL;
+	return result;
 }
 
-static ssize_t fw_version_show(struct device *device,
-			       struct device_attribute *attr, char *buf)
+static ssize_t msi_ec_attr_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
 {
-	u8 rdata[MSI_EC_FW_VERSION_LENGTH + 1];
-	int result;
-
-	result = ec_get_firmware_version(rdata);
-	if (result < 0)
-		return result;
+	struct msi_ec_attribute *ma = to_msi_ec_attr(attr);
+	u64 start = ktime_get_ns();
+	struct msi_ec_op op;
+	u64 latency_ns;
+	ssize_t result;
+	int idx;
+
+	if (!ma->store)
+		return -EIO;
+
+	trace_msi_ec_attr_store_enter(ma->path);
+	ec_op_begin(&op, ma->path);
+	idx = srcu_read_lock(&conf_srcu);
+	result = ma->store(dev, attr, buf, count);
+	srcu_read_unlock(&conf_srcu, idx);
+	ec_op_end(&op);
+	latency_ns = ktime_get_ns() - start;
+	trace_msi_ec_attr_store(ma->path, result, latency_ns, op.ec_reads,
+			        op.ec_writes);
+
+	if (ma->stats) {
+		this_cpu_inc(ma->stats->stores);
+		this_cpu_add(ma->stats->store_ns, latency_ns);
+		this_cpu_add(ma->stats->store_ec_reads, op.ec_reads);
+		this_cpu_add(ma->stats->store_ec_writes, op.ec_writes);
+	}
 
-	return sysfs_emit(buf, "%s\n", rdata);
+	return result;
 }
 
-static ssize_t fw_release_date_show(struct device *device,
-				    struct device_attribute *attr, char *buf)
-{
-	u8 rdate[MSI_EC_FW_DATE_LENGTH + 1];
-	u8 rtime[MSI_EC_FW_TIME_LENGTH + 1];
-	int result;
-	struct rtc_time time;
-
-	memset(rdate, 0, sizeof(rdate));
-	result = ec_read_seq(MSI_EC_FW_DATE_ADDRESS, rdate,
-			     MSI_EC_FW_DATE_LENGTH);
-	if (result < 0)
-		return result;
+#define __MSI_EC_ATTR_INIT(_path, _name, _mode, _show, _store)		\
+{									\
+	.dev_attr = __ATTR(_name, _mode, msi_ec_attr_show,		\
+			   msi_ec_attr_store),				\
+	.path = _path,							\
+	.show = _show,							\
+	.store = _store,						\
+}
 
-	result = sscanf(rdate, "%02d%02d%04d", &time.tm_mon, &time.tm_mday, &time.tm_year);
-	if (result != 3)
-		return -ENODATA;
+#define MSI_EC_ATTR_RW(_name)						\
+static struct msi_ec_attribute dev_attr_##_name =			\
+	__MSI_EC_ATTR_INIT(#_name, _name, 0644,				\
+			   _name##_show, _name##_store)
 
-	/* the number of months since January and number of years since 1900 */
-	time.tm_mon -= 1;
-	time.tm_year -= 1900;
+#define MSI_EC_ATTR_RO(_name)						\
+static struct msi_ec_attribute dev_attr_##_name =			\
+	__MSI_EC_ATTR_INIT(#_name, _name, 0444, _name##_show, NULL)
 
-	memset(rtime, 0, sizeof(rtime));
-	result = ec_read_seq(MSI_EC_FW_TIME_ADDRESS, rtime,
-			     MSI_EC_FW_TIME_LENGTH);
-	if (result < 0)
-		return result;
+#define MSI_EC_ATTR_WO(_name)						\
+static struct msi_ec_attribute dev_attr_##_name =			\
+	__MSI_EC_ATTR_INIT(#_name, _name, 0200, NULL, _name##_store)
 
-	result = sscanf(rtime, "%02d:%02d:%02d", &time.tm_hour, &time.tm_min, &time.tm_sec);
-	if (result != 3)
-		return -ENODATA;
+// an attribute of a named group, _var is prefixed with the group name
+#define MSI_EC_GROUP_ATTR(_var, _group, _name, _mode, _show, _store)	\
+static struct msi_ec_attribute dev_attr_##_var =			\
+	__MSI_EC_ATTR_INIT(_group "/" #_name, _name, _mode, _show, _store)
 
-	return sysfs_emit(buf, "%ptR\n", &time);
-}
-
-static DEVICE_ATTR_RW(webcam);
-static DEVICE_ATTR_RW(webcam_block);
-static DEVICE_ATTR_RW(fn_key);
-static DEVICE_ATTR_RW(win_key);
-static DEVICE_ATTR_RW(cooler_boost);
-static DEVICE_ATTR_RO(available_shift_modes);
-static DEVICE_ATTR_RW(shift_mode);
-static DEVICE_ATTR_RW(super_battery);
-static DEVICE_ATTR_RO(available_fan_modes);
-static DEVICE_ATTR_RW(fan_mode);
-static DEVICE_ATTR_RO(fw_version);
-static DEVICE_ATTR_RO(fw_release_date);
-
-static struct attribute *msi_root_attrs[] = {
-	&dev_attr_webcam.attr,
-	&dev_attr_webcam_block.attr,
-	&dev_attr_fn_key.attr,
-	&dev_attr_win_key.attr,
-	&dev_attr_cooler_boost.attr,
-	&dev_attr_available_shift_modes.attr,
-	&dev_attr_shift_mode.attr,
-	&dev_attr_super_battery.attr,
-	&dev_attr_available_fan_modes.attr,
-	&dev_attr_fan_mode.attr,
-	&dev_attr_fw_version.attr,
-	&dev_attr_fw_release_date.attr,
-	NULL
-};
+static int ec_read_seq(struct msi_ec_device *ec, u8 addr, u8 *buf, u8 len)
+{
+	int result;
+	for (u8 i = 0; i < len; i++) {
+		result = msi_ec_read(ec, addr + i, buf + i);
+		if (result < 0)
+			return result;
+	}
+	return 0;
+}
 
-// ============================================================ //
-// Sysfs platform device attributes (cpu)
-// ============================================================ //
+#define MSI_EC_SENSOR_RETRIES 3
 
-static ssize_t cpu_realtime_temperature_show(struct device *device,
-					     struct device_attribute *attr,
-					     char *buf)
+/*
+ * The EC may update a multi-byte sensor between the reads of its bytes, so
+ * data is only consistent if a second read of all the bytes returns the
+ * same. Otherwise the sensor is read again, a few times at most, and a
+ * sensor that never settles is an error.
+ */
+static int ec_sensor_settle(struct msi_ec_device *ec,
+			    const struct msi_ec_sensor *sensor, u8 *data)
 {
-	u8 rdata;
+	u8 again[MSI_EC_CONF_BLOB_SENSOR_WIDTH_MAX];
+	int width = msi_ec_sensor_width(sensor);
 	int result;
 
-	result = ec_read(conf.cpu.rt_temp_address, &rdata);
-	if (result < 0)
-		return result;
+	if (width == 1)
+		return 0;
+
+	for (int i = 0; i < MSI_EC_SENSOR_RETRIES; i++) {
+		result = ec_read_seq(ec, sensor->address, again, width);
+		if (result < 0)
+			return result;
+
+		if (!memcmp(again, data, width))
+			return 0;
+
+		memcpy(data, again, width);
+	}
 
-	return sysfs_emit(buf, "%i\n", rdata);
+	return -EAGAIN;
 }
 
-static ssize_t cpu_realtime_fan_speed_show(struct device *device,
-					   struct device_attribute *attr,
-					   char *buf)
+static int ec_set_by_mask(struct msi_ec_device *ec, u8 addr, u8 mask)
 {
-	u8 rdata;
 	int result;
+	u8 stored;
 
-	result = ec_read(conf.cpu.rt_fan_speed_address, &rdata);
+	msi_ec_lock(&ec->ec_set_by_mask_mutex);
+	result = msi_ec_read(ec, addr, &stored);
 	if (result < 0)
-		return result;
+		goto unlock;
+
+	stored |= mask;
+	result = msi_ec_write(ec, addr, stored);
 
-	return sysfs_emit(buf, "%i\n", rdata);
+unlock:
+	msi_ec_unlock(&ec->ec_set_by_mask_mutex);
+	return result;
 }
 
-static struct device_attribute dev_attr_cpu_realtime_temperature = {
-	.attr = {
-		.name = "realtime_temperature",
-		.mode = 0444,
-	},
-	.show = cpu_realtime_temperature_show,
-};
+static int ec_unset_by_mask(struct msi_ec_device *ec, u8 addr, u8 mask)
+{
+	int result;
+	u8 stored;
 
-static struct device_attribute dev_attr_cpu_realtime_fan_speed = {
-	.attr = {
-		.name = "realtime_fan_speed",
-		.mode = 0444,
-	},
-	.show = cpu_realtime_fan_speed_show,
-};
+	msi_ec_lock(&ec->ec_unset_by_mask_mutex);
+	result = msi_ec_read(ec, addr, &stored);
+	if (result < 0)
+		goto unlock;
 
-static struct attribute *msi_cpu_attrs[] = {
-	&dev_attr_cpu_realtime_temperature.attr,
-	&dev_attr_cpu_realtime_fan_speed.attr,
-	NULL
-};
+	stored &= ~mask;
+	result = msi_ec_write(ec, addr, stored);
 
-// ============================================================ //
-// Sysfs platform device attributes (gpu)
-// ============================================================ //
+unlock:
+	msi_ec_unlock(&ec->ec_unset_by_mask_mutex);
+	return result;
+}
 
-static ssize_t gpu_realtime_temperature_show(struct device *device,
-					     struct device_attribute *attr,
-					     char *buf)
+static int ec_check_by_mask(struct msi_ec_device *ec, u8 addr, u8 mask, bool *output)
 {
-	u8 rdata;
 	int result;
+	u8 stored;
 
-	result = ec_read(conf.gpu.rt_temp_address, &rdata);
+	result = msi_ec_read(ec, addr, &stored);
 	if (result < 0)
 		return result;
 
-	return sysfs_emit(buf, "%i\n", rdata);
+	*output = ((stored & mask) == mask);
+
+	return 0;
 }
 
-static ssize_t gpu_realtime_fan_speed_show(struct device *device,
-					   struct device_attribute *attr,
-					   char *buf)
+static int ec_set_bit(struct msi_ec_device *ec, u8 addr, u8 bit, bool value)
+{
+	int result;
+	u8 stored;
+
+	msi_ec_lock(&ec->ec_set_bit_mutex);
+	result = msi_ec_read(ec, addr, &stored);
+	if (result < 0)
+		goto unlock;
+
+	if (value)
+		stored |= BIT(bit);
+	else
+		stored &= ~BIT(bit);
+
+	result = msi_ec_write(ec, addr, stored);
+
+unlock:
+	msi_ec_unlock(&ec->ec_set_bit_mutex);
+	return result;
+}
+
+static int ec_check_bit(struct msi_ec_device *ec, u8 addr, u8 bit, bool *output)
 {
-	u8 rdata;
 	int result;
+	u8 stored;
 
-	result = ec_read(conf.gpu.rt_fan_speed_address, &rdata);
+	result = msi_ec_read(ec, addr, &stored);
 	if (result < 0)
 		return result;
 
-	return sysfs_emit(buf, "%i\n", rdata);
+	*output = stored & BIT(bit);
+
+	return 0;
 }
 
-static struct device_attribute dev_attr_gpu_realtime_temperature = {
-	.attr = {
-		.name = "realtime_temperature",
-		.mode = 0444,
-	},
-	.show = gpu_realtime_temperature_show,
+struct msi_ec_batch_op {
+	u8 addr;
+	u8 mask;
+	u8 value;
 };
 
-static struct device_attribute dev_attr_gpu_realtime_fan_speed = {
-	.attr = {
-		.name = "realtime_fan_speed",
-		.mode = 0444,
-	},
-	.show = gpu_realtime_fan_speed_show,
-};
+// Adds an EC byte update to a batch. Only the bits set in mask are changed.
+static int ec_batch_add(struct msi_ec_batch_op *ops, int n, u8 addr,
+			u8 mask, u8 value)
+{
+	for (int i = 0; i < n; i++) {
+		if (ops[i].addr == addr) {
+			ops[i].mask |= mask;
+			ops[i].value = (ops[i].value & ~mask) | (value & mask);
+			return n;
+		}
+	}
 
-static struct attribute *msi_gpu_attrs[] = {
-	&dev_attr_gpu_realtime_temperature.attr,
-	&dev_attr_gpu_realtime_fan_speed.attr,
-	NULL
-};
+	ops[n].addr = addr;
+	ops[n].mask = mask;
+	ops[n].value = value & mask;
 
-// ============================================================ //
-// Sysfs platform device attributes (debug)
-// ============================================================ //
+	return n + 1;
+}
 
-// Prints an EC memory dump in form of a table
-static ssize_t ec_dump_show(struct device *device,
-			    struct device_attribute *attr,
-			    char *buf)
+/*
+ * Applies a set of updates merged by address, reading each partially
+ * modified byte once and skipping the writes that would not change anything.
+ * The bytes may be updated by the read-modify-write helpers above at the same
+ * time, so the batch holds all of their locks.
+ */
+static int ec_write_batch(struct msi_ec_device *ec,
+			  const struct msi_ec_batch_op *ops, int n)
 {
-	int count = 0;
-	char ascii_row[16]; // not null-terminated
-
-	// print header
-	count += sysfs_emit(
-		buf,
-		"|      | _0 _1 _2 _3 _4 _5 _6 _7 _8 _9 _a _b _c _d _e _f\n"
-		"|------+------------------------------------------------\n");
+	int result = 0;
 
-	// print dump
-	for (u8 i = 0x0; i <= 0xf; i++) {
-		u8 addr_base = i * 16;
+	msi_ec_lock(&ec->ec_set_by_mask_mutex);
+	msi_ec_lock(&ec->ec_unset_by_mask_mutex);
+	msi_ec_lock(&ec->ec_set_bit_mutex);
+	for (int i = 0; i < n; i++) {
+		u8 stored = 0;
+		u8 wdata;
 
-		count += sysfs_emit_at(buf, count, "| %#x_ |", i);
-		for (u8 j = 0x0; j <= 0xf; j++) {
-			u8 rdata;
-			int result = ec_read(addr_base + j, &rdata);
+		if (ops[i].mask != 0xff) {
+			result = msi_ec_read(ec, ops[i].addr, &stored);
 			if (result < 0)
-				return result;
-
-			count += sysfs_emit_at(buf, count, " %02x", rdata);
-			ascii_row[j] = isascii(rdata) && isgraph(rdata) ? rdata : '.';
+				break;
 		}
 
-		count += sysfs_emit_at(buf, count, "  |%.16s|\n", ascii_row);
+		wdata = (stored & ~ops[i].mask) | ops[i].value;
+		if (ops[i].mask != 0xff && wdata == stored)
+			continue;
+
+		result = msi_ec_write(ec, ops[i].addr, wdata);
+		if (result < 0)
+			break;
 	}
+	msi_ec_unlock(&ec->ec_set_bit_mutex);
+	msi_ec_unlock(&ec->ec_unset_by_mask_mutex);
+	msi_ec_unlock(&ec->ec_set_by_mask_mutex);
 
-	return count;
+	return result;
 }
 
-// stores a value in the specified EC memory address. Format: "xx=xx", xx - hex u8
-static ssize_t ec_set_store(struct device *dev, struct device_attribute *attr,
-			    const char *buf, size_t count)
+static int ec_get_firmware_version(struct msi_ec_device *ec,
+				   u8 buf[MSI_EC_FW_VERSION_LENGTH + 1])
 {
-	if (count > 6) // "xx=xx\n" - 6 chars
-		return -EINVAL;
-
 	int result;
 
-	char addr_s[3], val_s[3];
-	result = sscanf(buf, "%2s=%2s", addr_s, val_s);
-	if (result != 2)
-		return -EINVAL;
-
-	u8 addr, val;
-
-	// convert addr
-	result = kstrtou8(addr_s, 16, &addr);
-	if (result < 0)
-		return result;
-
-	// convert val
-	result = kstrtou8(val_s, 16, &val);
-	if (result < 0)
-		return result;
-
-	// write val to EC[addr]
-	result = ec_write(addr, val);
+	memset(buf, 0, MSI_EC_FW_VERSION_LENGTH + 1);
+	result = ec_read_seq(ec, MSI_EC_FW_VERSION_ADDRESS, buf,
+			     MSI_EC_FW_VERSION_LENGTH);
 	if (result < 0)
 		return result;
 
-	return count;
+	return MSI_EC_FW_VERSION_LENGTH + 1;
 }
 
-// ec_get. stores the specified EC memory address. MAY BE UNSAFE!!!
-static u8 ec_get_addr;
+static inline const char *str_left_right(bool v)
+{
+	return v ? "left" : "right";
+}
 
-// ec_get. reads and stores the specified EC memory address. Format: "xx", xx - hex u8
-static ssize_t ec_get_store(struct device *dev, struct device_attribute *attr,
-			    const char *buf, size_t count)
+static int direction_is_left(const char *s, bool *res)
 {
-	if (count > 3) // "xx\n" - 3 chars
+	if (!s)
 		return -EINVAL;
 
-	int result;
-	char addr_s[3];
+	switch (s[0]) {
+	case 'l':
+	case 'L':
+		*res = true;
+		return 0;
+	case 'r':
+	case 'R':
+		*res = false;
+		return 0;
+	default:
+		break;
+	}
 
-	result = sscanf(buf, "%2s", addr_s);
-	if (result != 1)
-		return -EINVAL;
+	return -EINVAL;
+}
 
-	// convert addr
-	result = kstrtou8(addr_s, 16, &ec_get_addr);
-	if (result < 0)
-		return result;
+// ============================================================ //
+// Firmware identity
+// ============================================================ //
 
-	return count;
-};
+/*
+ * The firmware version, date and time do not change while the EC runs, so
+ * they are read once at probe and served from memory. The region is read
+ * until two reads in a row agree, so that it cannot be torn by an update
+ * between the byte reads. It is read again after a resume, after a write to
+ * the emulated EC image or when "refresh" is written to identity.
+ */
 
-// ec_get. prints value of previously stored EC memory address
-static ssize_t ec_get_show(struct device *device,
-			   struct device_attribute *attr,
-			   char *buf)
+#define MSI_EC_IDENTITY_ADDRESS MSI_EC_FW_VERSION_ADDRESS
+#define MSI_EC_IDENTITY_LENGTH \
+	(MSI_EC_FW_TIME_ADDRESS + MSI_EC_FW_TIME_LENGTH - \
+	 MSI_EC_IDENTITY_ADDRESS)
+#define MSI_EC_IDENTITY_RETRIES 3
+
+static void identity_parse(struct msi_ec_identity *id, const u8 *data)
 {
-	u8 rdata;
+	char date[MSI_EC_FW_DATE_LENGTH + 1] = { 0 };
+	char time[MSI_EC_FW_TIME_LENGTH + 1] = { 0 };
+	struct rtc_time *build = &id->build;
+
+	memcpy(id->version, data, MSI_EC_FW_VERSION_LENGTH);
+	id->version[MSI_EC_FW_VERSION_LENGTH] = '\0';
+	memcpy(date, data + MSI_EC_FW_DATE_ADDRESS - MSI_EC_IDENTITY_ADDRESS,
+	       MSI_EC_FW_DATE_LENGTH);
+	memcpy(time, data + MSI_EC_FW_TIME_ADDRESS - MSI_EC_IDENTITY_ADDRESS,
+	       MSI_EC_FW_TIME_LENGTH);
+
+	memset(build, 0, sizeof(*build));
+	id->build_result = -ENODATA;
+
+	if (sscanf(date, "%02d%02d%04d", &build->tm_mon, &build->tm_mday,
+		   &build->tm_year) != 3 ||
+	    sscanf(time, "%02d:%02d:%02d", &build->tm_hour, &build->tm_min,
+		   &build->tm_sec) != 3)
+		return;
+
+	/* the number of months since January and number of years since 1900 */
+	build->tm_mon -= 1;
+	build->tm_year -= 1900;
+	id->build_result = 0;
+}
+
+// must be called with identity_mutex held
+static int identity_read(struct msi_ec_device *ec)
+{
+	u8 data[2][MSI_EC_IDENTITY_LENGTH];
 	int result;
 
-	result = ec_read(ec_get_addr, &rdata);
+	result = ec_read_seq(ec, MSI_EC_IDENTITY_ADDRESS, data[0],
+			     MSI_EC_IDENTITY_LENGTH);
 	if (result < 0)
 		return result;
 
-	//	return sysfs_emit(buf, "%02x=%02x\n", ec_get_addr, rdata);
-	return sysfs_emit(buf, "%02x\n", rdata);
-};
+	for (int i = 0; i < MSI_EC_IDENTITY_RETRIES; i++) {
+		u8 *prev = data[i % 2], *cur = data[(i + 1) % 2];
 
-static DEVICE_ATTR_RO(ec_dump);
-static DEVICE_ATTR_WO(ec_set);
-static DEVICE_ATTR_RW(ec_get);
+		result = ec_read_seq(ec, MSI_EC_IDENTITY_ADDRESS, cur,
+				     MSI_EC_IDENTITY_LENGTH);
+		if (result < 0)
+			return result;
 
-static struct attribute *msi_debug_attrs[] = {
-	&dev_attr_fw_version.attr,
-	&dev_attr_ec_dump.attr,
-	&dev_attr_ec_set.attr,
-	&dev_attr_ec_get.attr,
-	NULL
-};
+		if (!memcmp(prev, cur, MSI_EC_IDENTITY_LENGTH)) {
+			identity_parse(&ec->identity, cur);
+			ec->identity.valid = true;
+			return 0;
+		}
+	}
+
+	return -EIO;
+}
+
+// copies the identity to id, reading it first if needed
+static int identity_get(struct msi_ec_device *ec, struct msi_ec_identity *id)
+{
+	int result = 0;
+
+	msi_ec_lock(&ec->identity_mutex);
+	if (!ec->identity.valid)
+		result = identity_read(ec);
+	if (!result)
+		*id = ec->identity;
+	msi_ec_unlock(&ec->identity_mutex);
+
+	return result;
+}
+
+static int identity_refresh(struct msi_ec_device *ec)
+{
+	int result;
+
+	msi_ec_lock(&ec->identity_mutex);
+	ec->identity.valid = false;
+	result = identity_read(ec);
+	msi_ec_unlock(&ec->identity_mutex);
+
+	return result;
+}
+
+// the next access reads the identity again
+static void identity_invalidate(struct msi_ec_device *ec)
+{
+	msi_ec_lock(&ec->identity_mutex);
+	ec->identity.valid = false;
+	msi_ec_unlock(&ec->identity_mutex);
+}
 
 // ============================================================ //
-// Sysfs leds subsystem
+// Sysfs power_supply subsystem
 // ============================================================ //
 
-static int micmute_led_sysfs_set(struct led_classdev *led_cdev,
-				 enum led_brightness brightness)
+// the battery hook is only registered by the main instance
+
+static int get_end_threshold(u8 *out)
 {
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	u8 rdata;
 	int result;
 
-	result = ec_set_bit(conf.leds.micmute_led_address, conf.leds.bit, brightness);
-
+	result = msi_ec_read(ec, conf->charge_control_address, &rdata);
 	if (result < 0)
 		return result;
 
+	rdata &= ~BIT(7); // last 7 bits contain the threshold
+
+	// the thresholds are unknown
+	if (rdata == 0)
+		return -ENODATA;
+
+	if (rdata < 10 || rdata > 100)
+		return -EINVAL;
+
+	*out = rdata;
 	return 0;
 }
 
-static int mute_led_sysfs_set(struct led_classdev *led_cdev,
-			      enum led_brightness brightness)
+static int set_end_threshold(u8 value)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+
+	if (value < 10 || value > 100)
+		return -EINVAL;
+
+	return msi_ec_write(ec, conf->charge_control_address, value | BIT(7));
+}
+
+static ssize_t
+charge_control_start_threshold_show(struct device *device,
+				    struct device_attribute *attr, char *buf)
+{
+	int result;
+	u8 threshold;
+
+	result = get_end_threshold(&threshold);
+
+	if (result == -ENODATA)
+		return sysfs_emit(buf, "0\n");
+	else if (result < 0)
+		return result;
+
+	return sysfs_emit(buf, "%u\n", threshold - 10);
+}
+
+static ssize_t
+charge_control_start_threshold_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int result;
+	u8 threshold;
+
+	result = kstrtou8(buf, 10, &threshold);
+	if (result < 0)
+		return result;
+
+	result = set_end_threshold(threshold + 10);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static ssize_t charge_control_end_threshold_show(struct device *device,
+						 struct device_attribute *attr,
+						 char *buf)
+{
+	int result;
+	u8 threshold;
+
+	result = get_end_threshold(&threshold);
+
+	if (result == -ENODATA)
+		return sysfs_emit(buf, "0\n");
+	else if (result < 0)
+		return result;
+
+	return sysfs_emit(buf, "%u\n", threshold);
+}
+
+static ssize_t charge_control_end_threshold_store(struct device *dev,
+						  struct device_attribute *attr,
+						  const char *buf, size_t count)
+{
+	int result;
+	u8 threshold;
+
+	result = kstrtou8(buf, 10, &threshold);
+	if (result < 0)
+		return result;
+
+	result = set_end_threshold(threshold);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+MSI_EC_ATTR_RW(charge_control_start_threshold);
+MSI_EC_ATTR_RW(charge_control_end_threshold);
+
+static struct attribute *msi_battery_attrs[] = {
+	&dev_attr_charge_control_start_threshold.dev_attr.attr,
+	&dev_attr_charge_control_end_threshold.dev_attr.attr,
+	NULL
+};
+
+ATTRIBUTE_GROUPS(msi_battery);
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0))
+static int msi_battery_add(struct power_supply *battery,
+			   struct acpi_battery_hook *hook)
+#else
+static int msi_battery_add(struct power_supply *battery)
+#endif
+{
+	return device_add_groups(&battery->dev, msi_battery_groups);
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0))
+static int msi_battery_remove(struct power_supply *battery,
+			      struct acpi_battery_hook *hook)
+#else
+static int msi_battery_remove(struct power_supply *battery)
+#endif
+{
+	device_remove_groups(&battery->dev, msi_battery_groups);
+	return 0;
+}
+
+static struct acpi_battery_hook battery_hook = {
+	.add_battery = msi_battery_add,
+	.remove_battery = msi_battery_remove,
+	.name = MSI_EC_DRIVER_NAME,
+};
+
+// ============================================================ //
+// PM QoS performance hold
+// ============================================================ //
+
+/*
+ * While any online CPU carries a resume latency constraint below the
+ * configured bound, shift_mode is held at the highest performance mode
+ * available. Mode writes made during the hold are remembered and applied once
+ * the last constraint goes away.
+ *
+ * The constraints are followed per CPU across hotplug, including the ones set
+ * before the driver was loaded. The global CPU latency QoS request
+ * (/dev/cpu_dma_latency) is not followed: it has no notifier and its value is
+ * not exported to modules.
+ */
+
+static unsigned int qos_latency_bound_us = 0; // 0 - the hold is disabled
+module_param(qos_latency_bound_us, uint, 0);
+MODULE_PARM_DESC(qos_latency_bound_us, "Hold the highest shift mode while a CPU resume latency constraint is below this bound (us), 0 - disabled");
+
+static bool qos_block_super_battery = false;
+module_param(qos_block_super_battery, bool, 0);
+MODULE_PARM_DESC(qos_block_super_battery, "Keep super battery disabled during a PM QoS performance hold");
+
+DEFINE_MSI_EC_LOCK(qos_hold_mutex);
+static bool qos_hold_active = false;
+static u8 qos_saved_shift_mode;
+static bool qos_saved_super_battery;
+static unsigned long qos_holds;
+static unsigned long qos_releases;
+
+struct msi_ec_qos_nb {
+	struct notifier_block nb;
+	struct device *cpu_dev;
+	unsigned int latency; // current resume latency target of the cpu
+};
+
+static struct msi_ec_qos_nb *qos_nbs; // one per possible cpu
+static enum cpuhp_state qos_cpuhp_state = CPUHP_INVALID;
+
+static void qos_hold_work_fn(struct work_struct *work);
+static DECLARE_WORK(qos_hold_work, qos_hold_work_fn);
+
+// the performance order of the known shift modes, highest first
+static const char *const qos_shift_mode_order[] = {
+	SM_TURBO_NAME,
+	SM_SPORT_NAME,
+	SM_COMFORT_NAME,
+	SM_ECO_NAME,
+	NULL
+};
+
+static int qos_highest_shift_mode(struct msi_ec_device *ec, u8 *value)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+
+	for (int i = 0; qos_shift_mode_order[i]; i++) {
+		for (int j = 0; conf->shift_mode.modes[j].name; j++) {
+			// NULL entries have NULL name
+
+			if (!strcmp(conf->shift_mode.modes[j].name,
+				    qos_shift_mode_order[i])) {
+				*value = conf->shift_mode.modes[j].value;
+				return 0;
+			}
+		}
+	}
+
+	return -ENODEV;
+}
+
+static bool qos_super_battery_blocked(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+
+	return qos_block_super_battery &&
+	       conf->super_battery.address != MSI_EC_ADDR_UNSUPP;
+}
+
+// must be called with qos_hold_mutex held
+static int qos_hold_engage(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+	u8 highest;
+
+	result = qos_highest_shift_mode(ec, &highest);
+	if (result < 0)
+		return result;
+
+	result = msi_ec_read(ec, conf->shift_mode.address,
+			     &qos_saved_shift_mode);
+	if (result < 0)
+		return result;
+
+	if (qos_super_battery_blocked(ec)) {
+		result = ec_check_by_mask(ec, conf->super_battery.address,
+					  conf->super_battery.mask,
+					  &qos_saved_super_battery);
+		if (result < 0)
+			return result;
+
+		if (qos_saved_super_battery) {
+			result = ec_unset_by_mask(ec, conf->super_battery.address,
+						  conf->super_battery.mask);
+			if (result < 0)
+				return result;
+		}
+	}
+
+	result = msi_ec_write(ec, conf->shift_mode.address, highest);
+	if (result < 0) {
+		// the hold is not active, so nothing else would turn it on
+		if (qos_super_battery_blocked(ec) && qos_saved_super_battery)
+			ec_set_by_mask(ec, conf->super_battery.address,
+				       conf->super_battery.mask);
+		return result;
+	}
+
+	qos_hold_active = true;
+	qos_holds++;
+
+	return 0;
+}
+
+// must be called with qos_hold_mutex held
+static int qos_hold_release(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+
+	result = msi_ec_write(ec, conf->shift_mode.address,
+			      qos_saved_shift_mode);
+	if (result < 0)
+		return result;
+
+	if (qos_super_battery_blocked(ec) && qos_saved_super_battery) {
+		result = ec_set_by_mask(ec, conf->super_battery.address,
+					conf->super_battery.mask);
+		if (result < 0)
+			return result;
+	}
+
+	qos_hold_active = false;
+	qos_releases++;
+
+	return 0;
+}
+
+static bool qos_constraint_active(void)
+{
+	unsigned int cpu;
+
+	if (!qos_latency_bound_us || !qos_nbs)
+		return false;
+
+	for_each_possible_cpu(cpu) {
+		if (READ_ONCE(qos_nbs[cpu].cpu_dev) &&
+		    READ_ONCE(qos_nbs[cpu].latency) < qos_latency_bound_us)
+			return true;
+	}
+
+	return false;
+}
+
+static void qos_hold_work_fn(struct work_struct *work)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	int result = 0;
+	bool active = qos_constraint_active();
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&qos_hold_mutex);
+	if (active && !qos_hold_active)
+		result = qos_hold_engage(ec);
+	else if (!active && qos_hold_active)
+		result = qos_hold_release(ec);
+	msi_ec_unlock(&qos_hold_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+
+	if (result < 0)
+		pr_err("Failed to update the PM QoS performance hold: %d\n",
+		       result);
+}
+
+static int qos_latency_notify(struct notifier_block *nb,
+			      unsigned long value, void *data)
+{
+	struct msi_ec_qos_nb *qnb = container_of(nb, struct msi_ec_qos_nb, nb);
+
+	WRITE_ONCE(qnb->latency, value);
+	schedule_work(&qos_hold_work);
+
+	return NOTIFY_OK;
+}
+
+/*
+ * Called by shift_mode_write(). During a hold the requested mode becomes the
+ * mode to return to, instead of being written to the EC.
+ */
+static int qos_hold_write_shift_mode(struct msi_ec_device *ec, u8 value)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result = 0;
+
+	msi_ec_lock(&qos_hold_mutex);
+	if (msi_ec_is_main(ec) && qos_hold_active)
+		qos_saved_shift_mode = value;
+	else
+		result = msi_ec_write(ec, conf->shift_mode.address, value);
+	msi_ec_unlock(&qos_hold_mutex);
+
+	return result;
+}
+
+/*
+ * Called by the mode arbiter before it compares a write with the EC value.
+ * Returns true if the write was consumed by an active hold on the main
+ * instance and became the mode to return to.
+ */
+static bool qos_hold_capture_shift_mode(struct msi_ec_device *ec, u8 value)
+{
+	bool captured = false;
+
+	if (!msi_ec_is_main(ec))
+		return false;
+
+	msi_ec_lock(&qos_hold_mutex);
+	if (qos_hold_active) {
+		qos_saved_shift_mode = value;
+		captured = true;
+	}
+	msi_ec_unlock(&qos_hold_mutex);
+
+	return captured;
+}
+
+/*
+ * Called by super_battery_write(). Returns true if the write was consumed by
+ * an active hold that blocks super_battery, which is only held on the main
+ * instance.
+ */
+static bool qos_hold_capture_super_battery(struct msi_ec_device *ec,
+					   bool value)
+{
+	bool captured = false;
+
+	if (!msi_ec_is_main(ec))
+		return false;
+
+	msi_ec_lock(&qos_hold_mutex);
+	if (qos_hold_active && qos_super_battery_blocked(ec)) {
+		qos_saved_super_battery = value;
+		captured = true;
+	}
+	msi_ec_unlock(&qos_hold_mutex);
+
+	return captured;
+}
+
+static int qos_cpu_online(unsigned int cpu)
+{
+	struct msi_ec_qos_nb *qnb = &qos_nbs[cpu];
+	struct device *cpu_dev = get_cpu_device(cpu);
+	int result;
+
+	if (!cpu_dev)
+		return 0;
+
+	qnb->nb.notifier_call = qos_latency_notify;
+	result = dev_pm_qos_add_notifier(cpu_dev, &qnb->nb,
+					 DEV_PM_QOS_RESUME_LATENCY);
+	if (result < 0)
+		return result;
+
+	// constraints added before the notifier
+	WRITE_ONCE(qnb->latency,
+		   dev_pm_qos_read_value(cpu_dev, DEV_PM_QOS_RESUME_LATENCY));
+	WRITE_ONCE(qnb->cpu_dev, cpu_dev);
+	schedule_work(&qos_hold_work);
+
+	return 0;
+}
+
+static int qos_cpu_offline(unsigned int cpu)
+{
+	struct msi_ec_qos_nb *qnb = &qos_nbs[cpu];
+
+	if (!qnb->cpu_dev)
+		return 0;
+
+	dev_pm_qos_remove_notifier(qnb->cpu_dev, &qnb->nb,
+				   DEV_PM_QOS_RESUME_LATENCY);
+	WRITE_ONCE(qnb->cpu_dev, NULL);
+	schedule_work(&qos_hold_work);
+
+	return 0;
+}
+
+static void qos_hold_unregister(void)
+{
+	if (!qos_nbs)
+		return;
+
+	// runs qos_cpu_offline() on every online cpu
+	cpuhp_remove_state(qos_cpuhp_state);
+	qos_cpuhp_state = CPUHP_INVALID;
+
+	cancel_work_sync(&qos_hold_work);
+
+	msi_ec_lock(&qos_hold_mutex);
+	if (qos_hold_active)
+		qos_hold_release(&msi_ec_main);
+	msi_ec_unlock(&qos_hold_mutex);
+
+	kfree(qos_nbs);
+	qos_nbs = NULL;
+}
+
+static int qos_hold_register(void)
+{
+	int result;
+
+	qos_nbs = kcalloc(nr_cpu_ids, sizeof(*qos_nbs), GFP_KERNEL);
+	if (!qos_nbs)
+		return -ENOMEM;
+
+	// runs qos_cpu_online() on every online cpu
+	result = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "platform/msi-ec:qos",
+				   qos_cpu_online, qos_cpu_offline);
+	if (result < 0) {
+		kfree(qos_nbs);
+		qos_nbs = NULL;
+		return result;
+	}
+
+	qos_cpuhp_state = result;
+
+	return 0;
+}
+
+static ssize_t pm_qos_latency_bound_us_show(struct device *device,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	return sysfs_emit(buf, "%u\n", qos_latency_bound_us);
+}
+
+static ssize_t pm_qos_latency_bound_us_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	int result;
+	unsigned int value;
+
+	result = kstrtouint(buf, 10, &value);
+	if (result < 0)
+		return result;
+
+	WRITE_ONCE(qos_latency_bound_us, value);
+	schedule_work(&qos_hold_work);
+
+	return count;
+}
+
+static ssize_t pm_qos_block_super_battery_show(struct device *device,
+					       struct device_attribute *attr,
+					       char *buf)
+{
+	return sysfs_emit(buf, "%s\n", str_on_off(qos_block_super_battery));
+}
+
+static ssize_t pm_qos_block_super_battery_store(struct device *dev,
+						struct device_attribute *attr,
+						const char *buf, size_t count)
+{
+	int result;
+	bool value;
+
+	result = kstrtobool(buf, &value);
+	if (result)
+		return result;
+
+	// the setting is only applied on the next hold
+	msi_ec_lock(&qos_hold_mutex);
+	if (qos_hold_active)
+		result = -EBUSY;
+	else
+		qos_block_super_battery = value;
+	msi_ec_unlock(&qos_hold_mutex);
+
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static ssize_t pm_qos_active_show(struct device *device,
+				  struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%s\n", str_on_off(READ_ONCE(qos_hold_active)));
+}
+
+static ssize_t pm_qos_holds_show(struct device *device,
+				 struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(qos_holds));
+}
+
+static ssize_t pm_qos_releases_show(struct device *device,
+				    struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(qos_releases));
+}
+
+MSI_EC_GROUP_ATTR(pm_qos_latency_bound_us, "pm_qos", latency_bound_us, 0644,
+		  pm_qos_latency_bound_us_show, pm_qos_latency_bound_us_store);
+
+MSI_EC_GROUP_ATTR(pm_qos_block_super_battery, "pm_qos", block_super_battery, 0644,
+		  pm_qos_block_super_battery_show, pm_qos_block_super_battery_store);
+
+MSI_EC_GROUP_ATTR(pm_qos_active, "pm_qos", active, 0444,
+		  pm_qos_active_show, NULL);
+
+MSI_EC_GROUP_ATTR(pm_qos_holds, "pm_qos", holds, 0444,
+		  pm_qos_holds_show, NULL);
+
+MSI_EC_GROUP_ATTR(pm_qos_releases, "pm_qos", releases, 0444,
+		  pm_qos_releases_show, NULL);
+
+static struct attribute *msi_pm_qos_attrs[] = {
+	&dev_attr_pm_qos_latency_bound_us.dev_attr.attr,
+	&dev_attr_pm_qos_block_super_battery.dev_attr.attr,
+	&dev_attr_pm_qos_active.dev_attr.attr,
+	&dev_attr_pm_qos_holds.dev_attr.attr,
+	&dev_attr_pm_qos_releases.dev_attr.attr,
+	NULL
+};
+
+// ============================================================ //
+// Fan control lease
+// ============================================================ //
+
+/*
+ * A process takes the lease by opening /dev/msi-ec-fan and keeps it by
+ * writing to the handle at least every timeout_ms. While the lease is held
+ * only the owner can change fan_mode and cooler_boost. When the heartbeat
+ * stops or the handle is closed, the fan mode is returned to auto and
+ * cooler boost to its state at the time the lease was taken. The lease
+ * belongs to the handle: once it expired, the handle can no longer renew it
+ * and another one can take a new lease.
+ */
+
+static unsigned int fan_lease_timeout_ms = 5000;
+
+DEFINE_MSI_EC_LOCK(fan_lease_mutex);
+static struct file *fan_lease_file; // handle holding the lease, if any
+static pid_t fan_lease_owner;       // tgid of the lease owner, 0 - no lease
+static unsigned long fan_lease_expires; // jiffies
+static u8 fan_lease_saved_fan_mode;
+static bool fan_lease_saved_cooler_boost;
+static unsigned long fan_lease_expirations;
+
+static void fan_lease_expire_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(fan_lease_expire_work, fan_lease_expire_fn);
+
+static bool fan_lease_registered = false;
+
+// must be called with fan_lease_mutex held
+static bool fan_lease_denied(pid_t tgid)
+{
+	return fan_lease_owner && fan_lease_owner != tgid;
+}
+
+// must be called with fan_lease_mutex held
+static int fan_lease_restore(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	struct msi_ec_batch_op ops[2];
+	u8 fan_mode = fan_lease_saved_fan_mode;
+	int n = 0;
+
+	// prefer the firmware controlled mode over the one we found
+	for (int i = 0; conf->fan_mode.modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		if (!strcmp(conf->fan_mode.modes[i].name, FM_AUTO_NAME)) {
+			fan_mode = conf->fan_mode.modes[i].value;
+			break;
+		}
+	}
+
+	n = ec_batch_add(ops, n, conf->fan_mode.address, 0xff, fan_mode);
+	if (conf->cooler_boost.address != MSI_EC_ADDR_UNSUPP)
+		n = ec_batch_add(ops, n, conf->cooler_boost.address,
+				 BIT(conf->cooler_boost.bit),
+				 fan_lease_saved_cooler_boost ?
+				 BIT(conf->cooler_boost.bit) : 0);
+
+	fan_lease_file = NULL;
+	fan_lease_owner = 0;
+
+	return ec_write_batch(ec, ops, n);
+}
+
+static void fan_lease_expire_fn(struct work_struct *work)
+{
+	int result;
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&fan_lease_mutex);
+	// released, or renewed while the work was waiting for the lock
+	if (!fan_lease_file || time_before(jiffies, fan_lease_expires))
+		goto unlock;
+
+	// the handle stays open, but further heartbeats are refused
+	result = fan_lease_restore(&msi_ec_main);
+	if (result < 0)
+		pr_err("Failed to restore the fan state: %d\n", result);
+
+	fan_lease_expirations++;
+	pr_warn("Fan control lease expired, restored the firmware fan mode\n");
+
+unlock:
+	msi_ec_unlock(&fan_lease_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+}
+
+static int fan_lease_open(struct inode *inode, struct file *file)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf;
+	int result;
+	int idx;
+
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EINVAL;
+
+	conf = conf_read_lock(ec, &idx);
+	msi_ec_lock(&fan_lease_mutex);
+	if (fan_lease_file) {
+		result = -EBUSY;
+		goto unlock;
+	}
+
+	result = msi_ec_read(ec, conf->fan_mode.address,
+			     &fan_lease_saved_fan_mode);
+	if (result < 0)
+		goto unlock;
+
+	fan_lease_saved_cooler_boost = false;
+	if (conf->cooler_boost.address != MSI_EC_ADDR_UNSUPP) {
+		result = ec_check_bit(ec, conf->cooler_boost.address,
+				      conf->cooler_boost.bit,
+				      &fan_lease_saved_cooler_boost);
+		if (result < 0)
+			goto unlock;
+	}
+
+	fan_lease_file = file;
+	fan_lease_owner = task_tgid_nr(current);
+	fan_lease_expires = jiffies + msecs_to_jiffies(fan_lease_timeout_ms);
+	mod_delayed_work(system_wq, &fan_lease_expire_work,
+			 msecs_to_jiffies(fan_lease_timeout_ms));
+
+unlock:
+	msi_ec_unlock(&fan_lease_mutex);
+	conf_read_unlock(idx);
+	return result;
+}
+
+// any write renews the lease
+static ssize_t fan_lease_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	ssize_t result = count;
+
+	msi_ec_lock(&fan_lease_mutex);
+	if (fan_lease_file != file) {
+		result = -ETIMEDOUT;
+	} else {
+		fan_lease_expires = jiffies +
+				    msecs_to_jiffies(fan_lease_timeout_ms);
+		mod_delayed_work(system_wq, &fan_lease_expire_work,
+				 msecs_to_jiffies(fan_lease_timeout_ms));
+	}
+	msi_ec_unlock(&fan_lease_mutex);
+
+	return result;
+}
+
+static int fan_lease_release(struct inode *inode, struct file *file)
+{
+	int result;
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&fan_lease_mutex);
+	// an expired handle leaves the lease of another one alone
+	if (fan_lease_file == file) {
+		cancel_delayed_work(&fan_lease_expire_work);
+		result = fan_lease_restore(&msi_ec_main);
+		if (result < 0)
+			pr_err("Failed to restore the fan state: %d\n", result);
+	}
+	msi_ec_unlock(&fan_lease_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+
+	return 0;
+}
+
+static const struct file_operations fan_lease_fops = {
+	.owner = THIS_MODULE,
+	.open = fan_lease_open,
+	.write = fan_lease_write,
+	.release = fan_lease_release,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice fan_lease_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "msi-ec-fan",
+	.fops = &fan_lease_fops,
+};
+
+static int fan_lease_register(void)
+{
+	int result;
+
+	result = misc_register(&fan_lease_miscdev);
+	if (result < 0)
+		return result;
+
+	fan_lease_registered = true;
+
+	return 0;
+}
+
+static void fan_lease_unregister(void)
+{
+	if (!fan_lease_registered)
+		return;
+
+	misc_deregister(&fan_lease_miscdev);
+	cancel_delayed_work_sync(&fan_lease_expire_work);
+	fan_lease_registered = false;
+}
+
+static ssize_t fan_lease_timeout_ms_show(struct device *device,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(fan_lease_timeout_ms));
+}
+
+static ssize_t fan_lease_timeout_ms_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	int result;
+	unsigned int value;
+
+	result = kstrtouint(buf, 10, &value);
+	if (result < 0)
+		return result;
+
+	if (value == 0)
+		return -EINVAL;
+
+	// applied on the next heartbeat
+	WRITE_ONCE(fan_lease_timeout_ms, value);
+
+	return count;
+}
+
+static ssize_t fan_lease_owner_show(struct device *device,
+				    struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%d\n", READ_ONCE(fan_lease_owner));
+}
+
+static ssize_t fan_lease_expirations_show(struct device *device,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(fan_lease_expirations));
+}
+
+MSI_EC_GROUP_ATTR(fan_lease_timeout_ms, "fan_lease", timeout_ms, 0644,
+		  fan_lease_timeout_ms_show, fan_lease_timeout_ms_store);
+
+MSI_EC_GROUP_ATTR(fan_lease_owner, "fan_lease", owner, 0444,
+		  fan_lease_owner_show, NULL);
+
+MSI_EC_GROUP_ATTR(fan_lease_expirations, "fan_lease", expirations, 0444,
+		  fan_lease_expirations_show, NULL);
+
+static struct attribute *msi_fan_lease_attrs[] = {
+	&dev_attr_fan_lease_timeout_ms.dev_attr.attr,
+	&dev_attr_fan_lease_owner.dev_attr.attr,
+	&dev_attr_fan_lease_expirations.dev_attr.attr,
+	NULL
+};
+
+/*
+ * Called for fan_mode and cooler_boost writes. While the lease is held only
+ * its owner can change the fan settings of the main instance.
+ */
+static int fan_lease_write_fan_mode(struct msi_ec_device *ec, u8 value,
+				    pid_t writer)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+
+	msi_ec_lock(&fan_lease_mutex);
+	if (msi_ec_is_main(ec) && fan_lease_denied(writer))
+		result = -EBUSY;
+	else
+		result = msi_ec_write(ec, conf->fan_mode.address, value);
+	msi_ec_unlock(&fan_lease_mutex);
+
+	return result;
+}
+
+static int fan_lease_set_cooler_boost(struct msi_ec_device *ec, bool value)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+
+	msi_ec_lock(&fan_lease_mutex);
+	if (msi_ec_is_main(ec) && fan_lease_denied(task_tgid_nr(current)))
+		result = -EBUSY;
+	else
+		result = ec_set_bit(ec, conf->cooler_boost.address,
+				    conf->cooler_boost.bit, value);
+	msi_ec_unlock(&fan_lease_mutex);
+
+	return result;
+}
+
+// ============================================================ //
+// Mode write arbitration
+// ============================================================ //
+
+/*
+ * shift_mode and fan_mode writes from userspace go through an arbiter that
+ * drops writes not changing the current value, delays writes arriving less
+ * than min_interval_ms after the previous EC write (only the last delayed
+ * value is applied), and lets the last writer own the register for
+ * owner_hold_ms. During that time, writers with a lower priority are refused.
+ * A writer becomes the owner once its write is applied or delayed. Delayed
+ * writes are fire-and-forget: the writer has already been told they
+ * succeeded, a later failure is only logged and counted.
+ */
+
+#define ARBITER_MAX_PRIORITIES 8
+
+struct msi_ec_writer_priority {
+	char comm[TASK_COMM_LEN];
+	int priority;
+};
+
+struct msi_ec_arbiter {
+	const char *name;
+	// the EC register behind the attribute
+	int (*address)(struct msi_ec_device *ec);
+	int (*apply)(struct msi_ec_device *ec, u8 value, pid_t writer);
+	// optional, takes writes that must not be compared with the EC value
+	bool (*capture)(struct msi_ec_device *ec, u8 value);
+
+	unsigned long last_write; // jiffies of the last EC write
+	pid_t owner;
+	char owner_comm[TASK_COMM_LEN];
+	int owner_priority;
+	unsigned long owned_until; // jiffies
+
+	bool pending;
+	u8 pending_value;
+	struct delayed_work pending_work;
+
+	unsigned long writes;
+	unsigned long applied;
+	unsigned long suppressed;
+	unsigned long deferred;
+	unsigned long overridden;
+	unsigned long rejected;
+	unsigned long failed; // delayed writes that could not be applied
+};
+
+DEFINE_MSI_EC_LOCK(arbiter_mutex);
+static unsigned int arbiter_min_interval_ms = 0;
+static unsigned int arbiter_owner_hold_ms = 0;
+static struct msi_ec_writer_priority arbiter_priorities[ARBITER_MAX_PRIORITIES];
+static int arbiter_priorities_count = 0;
+
+static int arbiter_apply_shift_mode(struct msi_ec_device *ec, u8 value,
+				    pid_t writer)
+{
+	return qos_hold_write_shift_mode(ec, value);
+}
+
+static int arbiter_apply_fan_mode(struct msi_ec_device *ec, u8 value,
+				  pid_t writer)
+{
+	return fan_lease_write_fan_mode(ec, value, writer);
+}
+
+static int arbiter_shift_mode_address(struct msi_ec_device *ec)
+{
+	return msi_ec_conf(ec)->shift_mode.address;
+}
+
+static int arbiter_fan_mode_address(struct msi_ec_device *ec)
+{
+	return msi_ec_conf(ec)->fan_mode.address;
+}
+
+static void arbiter_pending_work_fn(struct work_struct *work);
+
+static struct msi_ec_arbiter shift_mode_arbiter = {
+	.name = "shift_mode",
+	.address = arbiter_shift_mode_address,
+	.apply = arbiter_apply_shift_mode,
+	.capture = qos_hold_capture_shift_mode,
+	.pending_work = __DELAYED_WORK_INITIALIZER(shift_mode_arbiter.pending_work,
+						   arbiter_pending_work_fn, 0),
+};
+
+static struct msi_ec_arbiter fan_mode_arbiter = {
+	.name = "fan_mode",
+	.address = arbiter_fan_mode_address,
+	.apply = arbiter_apply_fan_mode,
+	.pending_work = __DELAYED_WORK_INITIALIZER(fan_mode_arbiter.pending_work,
+						   arbiter_pending_work_fn, 0),
+};
+
+static struct msi_ec_arbiter *const arbiters[] = {
+	&shift_mode_arbiter,
+	&fan_mode_arbiter,
+	NULL
+};
+
+// must be called with arbiter_mutex held
+static int arbiter_writer_priority(const char *comm)
+{
+	for (int i = 0; i < arbiter_priorities_count; i++) {
+		if (!strcmp(arbiter_priorities[i].comm, comm))
+			return arbiter_priorities[i].priority;
+	}
+
+	return 0;
+}
+
+static void arbiter_pending_work_fn(struct work_struct *work)
+{
+	struct msi_ec_arbiter *arb =
+		container_of(to_delayed_work(work), struct msi_ec_arbiter,
+			     pending_work);
+	struct msi_ec_device *ec = &msi_ec_main;
+	int result;
+	u8 stored;
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&arbiter_mutex);
+	if (!arb->pending)
+		goto unlock;
+
+	arb->pending = false;
+
+	if (arb->capture && arb->capture(ec, arb->pending_value)) {
+		arb->applied++;
+		goto unlock;
+	}
+
+	result = msi_ec_read(ec, arb->address(ec), &stored);
+	if (result < 0)
+		goto err;
+
+	if (stored == arb->pending_value) {
+		arb->suppressed++;
+		goto unlock;
+	}
+
+	result = arb->apply(ec, arb->pending_value, arb->owner);
+	if (result < 0)
+		goto err;
+
+	arb->last_write = jiffies;
+	arb->applied++;
+	goto unlock;
+
+err:
+	arb->failed++;
+	pr_err("Failed to apply a delayed %s write: %d\n", arb->name, result);
+unlock:
+	msi_ec_unlock(&arbiter_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+}
+
+// must be called with arbiter_mutex held
+static void arbiter_take_ownership(struct msi_ec_arbiter *arb, pid_t writer,
+				   int priority, bool override,
+				   unsigned long now)
+{
+	if (override)
+		arb->overridden++;
+
+	arb->owner = writer;
+	get_task_comm(arb->owner_comm, current);
+	arb->owner_priority = priority;
+	arb->owned_until = now + msecs_to_jiffies(arbiter_owner_hold_ms);
+}
+
+// passes a write of the current task through the arbiter
+static int arbiter_write(struct msi_ec_device *ec, struct msi_ec_arbiter *arb,
+			 u8 value)
+{
+	pid_t writer = task_tgid_nr(current);
+	unsigned long now = jiffies;
+	unsigned long next_write;
+	bool override = false;
+	bool replaying;
+	int priority;
+	int result = 0;
+	u8 stored;
+
+	// only the writes to the main instance are arbitrated
+	if (!msi_ec_is_main(ec))
+		return arb->apply(ec, value, writer);
+
+	msi_ec_lock(&arbiter_mutex);
+	arb->writes++;
+
+	// the timing of a replay differs from the recording
+	replaying = msi_ec_replaying(ec);
+
+	priority = arbiter_writer_priority(current->comm);
+	if (!replaying && arb->owner && arb->owner != writer &&
+	    time_before(now, arb->owned_until)) {
+		if (priority < arb->owner_priority) {
+			arb->rejected++;
+			result = -EBUSY;
+			goto unlock;
+		}
+
+		override = true;
+	}
+
+	// a newer write replaces the delayed one
+	if (arb->pending) {
+		arb->pending_value = value;
+		arb->deferred++;
+		arbiter_take_ownership(arb, writer, priority, override, now);
+		goto unlock;
+	}
+
+	// the EC value may not be the one the write is applied to
+	if (arb->capture && arb->capture(ec, value)) {
+		arb->deferred++;
+		arbiter_take_ownership(arb, writer, priority, override, now);
+		goto unlock;
+	}
+
+	result = msi_ec_read(ec, arb->address(ec), &stored);
+	if (result < 0)
+		goto unlock;
+
+	if (stored == value) {
+		arb->suppressed++;
+		goto unlock;
+	}
+
+	next_write = arb->last_write + msecs_to_jiffies(arbiter_min_interval_ms);
+	if (!replaying && arb->applied && time_before(now, next_write)) {
+		arb->pending = true;
+		arb->pending_value = value;
+		arb->deferred++;
+		arbiter_take_ownership(arb, writer, priority, override, now);
+		schedule_delayed_work(&arb->pending_work, next_write - now);
+		goto unlock;
+	}
+
+	result = arb->apply(ec, value, writer);
+	if (result < 0)
+		goto unlock;
+
+	arb->last_write = now;
+	arb->applied++;
+	arbiter_take_ownership(arb, writer, priority, override, now);
+
+unlock:
+	msi_ec_unlock(&arbiter_mutex);
+	return result;
+}
+
+// a delayed write is dropped, its value may not mean the same afterwards
+static void arbiter_stop(void)
+{
+	for (int i = 0; arbiters[i]; i++) {
+		cancel_delayed_work_sync(&arbiters[i]->pending_work);
+
+		msi_ec_lock(&arbiter_mutex);
+		arbiters[i]->pending = false;
+		msi_ec_unlock(&arbiter_mutex);
+	}
+}
+
+static ssize_t arbiter_min_interval_ms_show(struct device *device,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(arbiter_min_interval_ms));
+}
+
+static ssize_t arbiter_min_interval_ms_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	int result;
+	unsigned int value;
+
+	result = kstrtouint(buf, 10, &value);
+	if (result < 0)
+		return result;
+
+	WRITE_ONCE(arbiter_min_interval_ms, value);
+
+	return count;
+}
+
+static ssize_t arbiter_owner_hold_ms_show(struct device *device,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(arbiter_owner_hold_ms));
+}
+
+static ssize_t arbiter_owner_hold_ms_store(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	int result;
+	unsigned int value;
+
+	result = kstrtouint(buf, 10, &value);
+	if (result < 0)
+		return result;
+
+	WRITE_ONCE(arbiter_owner_hold_ms, value);
+
+	return count;
+}
+
+static ssize_t arbiter_priorities_show(struct device *device,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	int count = 0;
+
+	msi_ec_lock(&arbiter_mutex);
+	for (int i = 0; i < arbiter_priorities_count; i++)
+		count += sysfs_emit_at(buf, count, "%s=%d\n",
+				       arbiter_priorities[i].comm,
+				       arbiter_priorities[i].priority);
+	msi_ec_unlock(&arbiter_mutex);
+
+	return count;
+}
+
+// Format: "comm=priority" pairs separated by spaces, replaces the whole table
+static ssize_t arbiter_priorities_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct msi_ec_writer_priority table[ARBITER_MAX_PRIORITIES];
+	char *copy, *cur, *token;
+	int n = 0;
+	int result = 0;
+
+	copy = kstrndup(buf, count, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	cur = strim(copy);
+	while ((token = strsep(&cur, " \t\n")) != NULL) {
+		char *sep = strchr(token, '=');
+
+		if (!*token)
+			continue;
+
+		if (!sep || sep == token || sep - token >= TASK_COMM_LEN ||
+		    n == ARBITER_MAX_PRIORITIES) {
+			result = -EINVAL;
+			goto free;
+		}
+
+		*sep = '\0';
+		result = kstrtoint(sep + 1, 10, &table[n].priority);
+		if (result < 0)
+			goto free;
+
+		strscpy(table[n].comm, token, TASK_COMM_LEN);
+		n++;
+	}
+
+	msi_ec_lock(&arbiter_mutex);
+	memcpy(arbiter_priorities, table, n * sizeof(*table));
+	arbiter_priorities_count = n;
+	msi_ec_unlock(&arbiter_mutex);
+
+free:
+	kfree(copy);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static ssize_t arbiter_stats_show(struct device *device,
+				  struct device_attribute *attr, char *buf)
+{
+	int count;
+
+	count = sysfs_emit(buf, "%-10s %8s %8s %10s %8s %10s %8s %8s  %s\n",
+			   "register", "writes", "applied", "suppressed",
+			   "deferred", "overridden", "rejected", "failed",
+			   "owner");
+
+	msi_ec_lock(&arbiter_mutex);
+	for (int i = 0; arbiters[i]; i++) {
+		struct msi_ec_arbiter *arb = arbiters[i];
+
+		count += sysfs_emit_at(buf, count,
+				       "%-10s %8lu %8lu %10lu %8lu %10lu %8lu %8lu  ",
+				       arb->name, arb->writes, arb->applied,
+				       arb->suppressed, arb->deferred,
+				       arb->overridden, arb->rejected,
+				       arb->failed);
+
+		if (arb->owner)
+			count += sysfs_emit_at(buf, count, "%s[%d]\n",
+					       arb->owner_comm, arb->owner);
+		else
+			count += sysfs_emit_at(buf, count, "-\n");
+	}
+	msi_ec_unlock(&arbiter_mutex);
+
+	return count;
+}
+
+MSI_EC_GROUP_ATTR(arbiter_min_interval_ms, "mode_arbiter", min_interval_ms, 0644,
+		  arbiter_min_interval_ms_show, arbiter_min_interval_ms_store);
+
+MSI_EC_GROUP_ATTR(arbiter_owner_hold_ms, "mode_arbiter", owner_hold_ms, 0644,
+		  arbiter_owner_hold_ms_show, arbiter_owner_hold_ms_store);
+
+MSI_EC_GROUP_ATTR(arbiter_priorities, "mode_arbiter", priorities, 0644,
+		  arbiter_priorities_show, arbiter_priorities_store);
+
+MSI_EC_GROUP_ATTR(arbiter_stats, "mode_arbiter", stats, 0444,
+		  arbiter_stats_show, NULL);
+
+static struct attribute *msi_arbiter_attrs[] = {
+	&dev_attr_arbiter_min_interval_ms.dev_attr.attr,
+	&dev_attr_arbiter_owner_hold_ms.dev_attr.attr,
+	&dev_attr_arbiter_priorities.dev_attr.attr,
+	&dev_attr_arbiter_stats.dev_attr.attr,
+	NULL
+};
+
+// ============================================================ //
+// Power source profiles
+// ============================================================ //
+
+/*
+ * Each profile holds the settings to apply when the system switches to the
+ * corresponding power source. Negative values leave the setting unchanged.
+ */
+struct msi_ec_power_profile {
+	int shift_mode;    // index in conf->shift_mode.modes
+	int fan_mode;      // index in conf->fan_mode.modes
+	int super_battery; // 0 - off, 1 - on
+	int kbd_bl;        // keyboard backlight level
+};
+
+#define MSI_EC_PROFILE_UNCHANGED -1
+#define MSI_EC_PROFILE_INIT {			\
+	.shift_mode    = MSI_EC_PROFILE_UNCHANGED,	\
+	.fan_mode      = MSI_EC_PROFILE_UNCHANGED,	\
+	.super_battery = MSI_EC_PROFILE_UNCHANGED,	\
+	.kbd_bl        = MSI_EC_PROFILE_UNCHANGED,	\
+}
+
+static struct msi_ec_power_profile ac_profile = MSI_EC_PROFILE_INIT;
+static struct msi_ec_power_profile battery_profile = MSI_EC_PROFILE_INIT;
+
+DEFINE_MSI_EC_LOCK(power_profile_mutex);
+static int power_profile_source = -1; // 1 - AC, 0 - battery, -1 - unknown
+static unsigned long power_profile_switches;
+static bool power_profile_registered = false;
+
+static void power_profile_work_fn(struct work_struct *work);
+static DECLARE_WORK(power_profile_work, power_profile_work_fn);
+
+static int power_profile_apply(struct msi_ec_device *ec,
+			       const struct msi_ec_power_profile *profile)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	struct msi_ec_batch_op ops[4];
+	int result;
+	int n = 0;
+
+	// the PM QoS hold owns shift_mode and super_battery while it is active
+	msi_ec_lock(&qos_hold_mutex);
+
+	if (profile->shift_mode >= 0) {
+		u8 value = conf->shift_mode.modes[profile->shift_mode].value;
+
+		if (qos_hold_active)
+			qos_saved_shift_mode = value;
+		else
+			n = ec_batch_add(ops, n, conf->shift_mode.address,
+					 0xff, value);
+	}
+
+	// the fan settings belong to the lease owner, if there is one
+	msi_ec_lock(&fan_lease_mutex);
+	if (profile->fan_mode >= 0 && !fan_lease_owner)
+		n = ec_batch_add(ops, n, conf->fan_mode.address, 0xff,
+				 conf->fan_mode.modes[profile->fan_mode].value);
+
+	if (profile->super_battery >= 0) {
+		if (qos_hold_active && qos_super_battery_blocked(ec))
+			qos_saved_super_battery = profile->super_battery;
+		else
+			n = ec_batch_add(ops, n, conf->super_battery.address,
+					 conf->super_battery.mask,
+					 profile->super_battery ?
+					 conf->super_battery.mask : 0);
+	}
+
+	if (profile->kbd_bl >= 0)
+		n = ec_batch_add(ops, n, conf->kbd_bl.bl_state_address, 0xff,
+				 conf->kbd_bl.state_base_value | profile->kbd_bl);
+
+	result = ec_write_batch(ec, ops, n);
+
+	msi_ec_unlock(&fan_lease_mutex);
+	msi_ec_unlock(&qos_hold_mutex);
+
+	return result;
+}
+
+static void power_profile_work_fn(struct work_struct *work)
+{
+	int result;
+	int source = power_supply_is_system_supplied() > 0;
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&power_profile_mutex);
+	if (source == power_profile_source)
+		goto unlock;
+
+	// the first evaluation only records the current source
+	if (power_profile_source >= 0) {
+		result = power_profile_apply(&msi_ec_main,
+					     source ? &ac_profile :
+						      &battery_profile);
+		if (result < 0)
+			pr_err("Failed to apply the %s profile: %d\n",
+			       source ? "AC" : "battery", result);
+		power_profile_switches++;
+	}
+
+	power_profile_source = source;
+
+unlock:
+	msi_ec_unlock(&power_profile_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+}
+
+static int power_profile_notify(struct notifier_block *nb,
+				unsigned long event, void *data)
+{
+	struct power_supply *psy = data;
+
+	if (event != PSY_EVENT_PROP_CHANGED ||
+	    psy->desc->type != POWER_SUPPLY_TYPE_MAINS)
+		return NOTIFY_DONE;
+
+	queue_work(system_highpri_wq, &power_profile_work);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block power_profile_nb = {
+	.notifier_call = power_profile_notify,
+};
+
+static int power_profile_register(void)
+{
+	int result;
+
+	result = power_supply_reg_notifier(&power_profile_nb);
+	if (result < 0)
+		return result;
+
+	power_profile_registered = true;
+	queue_work(system_highpri_wq, &power_profile_work);
+
+	return 0;
+}
+
+static void power_profile_unregister(void)
+{
+	if (!power_profile_registered)
+		return;
+
+	power_supply_unreg_notifier(&power_profile_nb);
+	cancel_work_sync(&power_profile_work);
+	power_profile_registered = false;
+}
+
+// the mode indices are only valid for the configuration they were set with
+static void power_profile_reset_modes(void)
+{
+	msi_ec_lock(&power_profile_mutex);
+	ac_profile.shift_mode = MSI_EC_PROFILE_UNCHANGED;
+	ac_profile.fan_mode = MSI_EC_PROFILE_UNCHANGED;
+	battery_profile.shift_mode = MSI_EC_PROFILE_UNCHANGED;
+	battery_profile.fan_mode = MSI_EC_PROFILE_UNCHANGED;
+	msi_ec_unlock(&power_profile_mutex);
+}
+
+struct msi_ec_profile_attribute {
+	struct msi_ec_attribute attr;
+	struct msi_ec_power_profile *profile;
+};
+
+static struct msi_ec_power_profile *to_power_profile(struct device_attribute *attr)
+{
+	return container_of(to_msi_ec_attr(attr), struct msi_ec_profile_attribute,
+			    attr)->profile;
+}
+
+static ssize_t profile_mode_show(const struct msi_ec_mode *modes, int index,
+				 char *buf)
+{
+	if (index < 0)
+		return sysfs_emit(buf, "%s\n", "none");
+
+	return sysfs_emit(buf, "%s\n", modes[index].name);
+}
+
+static int profile_mode_parse(const struct msi_ec_mode *modes,
+			      const char *buf, int *index)
+{
+	if (sysfs_streq(buf, "none")) {
+		*index = MSI_EC_PROFILE_UNCHANGED;
+		return 0;
+	}
+
+	for (int i = 0; modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		if (sysfs_streq(modes[i].name, buf)) {
+			*index = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t profile_shift_mode_show(struct device *device,
+				       struct device_attribute *attr, char *buf)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(dev_get_drvdata(device));
+
+	return profile_mode_show(conf->shift_mode.modes,
+				 READ_ONCE(to_power_profile(attr)->shift_mode),
+				 buf);
+}
+
+static ssize_t profile_shift_mode_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(dev_get_drvdata(dev));
+	int result;
+	int index;
+
+	result = profile_mode_parse(conf->shift_mode.modes, buf, &index);
+	if (result < 0)
+		return result;
+
+	WRITE_ONCE(to_power_profile(attr)->shift_mode, index);
+
+	return count;
+}
+
+static ssize_t profile_fan_mode_show(struct device *device,
+				     struct device_attribute *attr, char *buf)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(dev_get_drvdata(device));
+
+	return profile_mode_show(conf->fan_mode.modes,
+				 READ_ONCE(to_power_profile(attr)->fan_mode),
+				 buf);
+}
+
+static ssize_t profile_fan_mode_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(dev_get_drvdata(dev));
+	int result;
+	int index;
+
+	result = profile_mode_parse(conf->fan_mode.modes, buf, &index);
+	if (result < 0)
+		return result;
+
+	WRITE_ONCE(to_power_profile(attr)->fan_mode, index);
+
+	return count;
+}
+
+static ssize_t profile_super_battery_show(struct device *device,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	int value = READ_ONCE(to_power_profile(attr)->super_battery);
+
+	if (value < 0)
+		return sysfs_emit(buf, "%s\n", "none");
+
+	return sysfs_emit(buf, "%s\n", str_on_off(value));
+}
+
+static ssize_t profile_super_battery_store(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	int result;
+	bool value;
+
+	if (sysfs_streq(buf, "none")) {
+		WRITE_ONCE(to_power_profile(attr)->super_battery,
+			   MSI_EC_PROFILE_UNCHANGED);
+		return count;
+	}
+
+	result = kstrtobool(buf, &value);
+	if (result)
+		return result;
+
+	WRITE_ONCE(to_power_profile(attr)->super_battery, value);
+
+	return count;
+}
+
+static ssize_t profile_kbd_backlight_show(struct device *device,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	int value = READ_ONCE(to_power_profile(attr)->kbd_bl);
+
+	if (value < 0)
+		return sysfs_emit(buf, "%s\n", "none");
+
+	return sysfs_emit(buf, "%i\n", value);
+}
+
+static ssize_t profile_kbd_backlight_store(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(dev_get_drvdata(dev));
+	int result;
+	u8 value;
+
+	if (sysfs_streq(buf, "none")) {
+		WRITE_ONCE(to_power_profile(attr)->kbd_bl,
+			   MSI_EC_PROFILE_UNCHANGED);
+		return count;
+	}
+
+	result = kstrtou8(buf, 10, &value);
+	if (result < 0)
+		return result;
+
+	if (value > conf->kbd_bl.max_state)
+		return -EINVAL;
+
+	WRITE_ONCE(to_power_profile(attr)->kbd_bl, value);
+
+	return count;
+}
+
+#define MSI_EC_PROFILE_ATTR(_profile, _name)				\
+static struct msi_ec_profile_attribute dev_attr_##_profile##_##_name = {	\
+	.attr = __MSI_EC_ATTR_INIT(#_profile "/" #_name, _name, 0644,	\
+				   profile_##_name##_show,		\
+				   profile_##_name##_store),		\
+	.profile = &_profile,						\
+}
+
+MSI_EC_PROFILE_ATTR(ac_profile, shift_mode);
+MSI_EC_PROFILE_ATTR(ac_profile, fan_mode);
+MSI_EC_PROFILE_ATTR(ac_profile, super_battery);
+MSI_EC_PROFILE_ATTR(ac_profile, kbd_backlight);
+
+MSI_EC_PROFILE_ATTR(battery_profile, shift_mode);
+MSI_EC_PROFILE_ATTR(battery_profile, fan_mode);
+MSI_EC_PROFILE_ATTR(battery_profile, super_battery);
+MSI_EC_PROFILE_ATTR(battery_profile, kbd_backlight);
+
+static struct attribute *msi_ac_profile_attrs[] = {
+	&dev_attr_ac_profile_shift_mode.attr.dev_attr.attr,
+	&dev_attr_ac_profile_fan_mode.attr.dev_attr.attr,
+	&dev_attr_ac_profile_super_battery.attr.dev_attr.attr,
+	&dev_attr_ac_profile_kbd_backlight.attr.dev_attr.attr,
+	NULL
+};
+
+static struct attribute *msi_battery_profile_attrs[] = {
+	&dev_attr_battery_profile_shift_mode.attr.dev_attr.attr,
+	&dev_attr_battery_profile_fan_mode.attr.dev_attr.attr,
+	&dev_attr_battery_profile_super_battery.attr.dev_attr.attr,
+	&dev_attr_battery_profile_kbd_backlight.attr.dev_attr.attr,
+	NULL
+};
+
+// ============================================================ //
+// Predictive cooler boost
+// ============================================================ //
+
+/*
+ * Samples the temperatures periodically and engages cooler boost when the
+ * current temperature trend is expected to cross the threshold within the
+ * prediction horizon. Every engagement is limited to max_on_ms and followed
+ * by a cooldown_ms period during which the boost is not engaged again.
+ */
+
+#define CB_AUTO_INTERVAL_MS	500
+#define CB_AUTO_HYSTERESIS	5 // celsius below the threshold to disengage
+
+DEFINE_MSI_EC_LOCK(cb_auto_mutex);
+static bool cb_auto_enabled = false;
+static unsigned int cb_auto_threshold = 85;   // celsius
+static unsigned int cb_auto_horizon_ms = 5000;
+static unsigned int cb_auto_max_on_ms = 30000;
+static unsigned int cb_auto_cooldown_ms = 30000;
+
+static bool cb_auto_engaged = false; // cooler boost was turned on by us
+static int cb_auto_prev_temp = -1;   // celsius, -1 - no previous sample
+static s64 cb_auto_slope;            // millicelsius per second, smoothed
+static s64 cb_auto_prev_ms;
+static s64 cb_auto_engaged_ms;
+static s64 cb_auto_cooldown_until_ms;
+
+static unsigned long cb_auto_engagements;
+static u64 cb_auto_on_ms;      // time spent engaged since enabled
+static u64 cb_auto_total_ms;   // time elapsed since enabled
+
+static void cb_auto_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cb_auto_work, cb_auto_work_fn);
+
+static const char *const cb_auto_sensors[] = { "cpu", "gpu" };
+
+// returns the hottest of the supported cpu and gpu sensors
+static int cb_auto_read_temp(struct msi_ec_device *ec, u8 *temp)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+	u8 rdata;
+
+	*temp = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(cb_auto_sensors); i++) {
+		int address = msi_ec_sensor_address(conf, cb_auto_sensors[i],
+						    MSI_EC_SENSOR_TEMP);
+
+		if (address == MSI_EC_ADDR_UNSUPP)
+			continue;
+
+		result = msi_ec_read(ec, address, &rdata);
+		if (result < 0)
+			return result;
+		*temp = max(*temp, rdata);
+	}
+
+	return 0;
+}
+
+// must be called with cb_auto_mutex held
+static int cb_auto_engage(struct msi_ec_device *ec, s64 now)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result = 0;
+	bool value;
+
+	msi_ec_lock(&fan_lease_mutex);
+	// the fans are controlled by the lease owner
+	if (fan_lease_owner)
+		goto unlock;
+
+	// the boost has been turned on by the user, leave it alone
+	result = ec_check_bit(ec, conf->cooler_boost.address,
+			      conf->cooler_boost.bit, &value);
+	if (result < 0 || value)
+		goto unlock;
+
+	result = ec_set_bit(ec, conf->cooler_boost.address,
+			    conf->cooler_boost.bit, true);
+	if (result < 0)
+		goto unlock;
+
+	cb_auto_engaged = true;
+	cb_auto_engaged_ms = now;
+	cb_auto_engagements++;
+
+unlock:
+	msi_ec_unlock(&fan_lease_mutex);
+	return result;
+}
+
+// must be called with cb_auto_mutex held
+static int cb_auto_disengage(struct msi_ec_device *ec, s64 now)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result = 0;
+
+	msi_ec_lock(&fan_lease_mutex);
+	/*
+	 * The lease was taken while the boost was ours, leave the fans to the
+	 * owner and turn the boost off when the lease ends.
+	 */
+	if (fan_lease_owner)
+		fan_lease_saved_cooler_boost = false;
+	else
+		result = ec_set_bit(ec, conf->cooler_boost.address,
+				    conf->cooler_boost.bit, false);
+	msi_ec_unlock(&fan_lease_mutex);
+	if (result < 0)
+		return result;
+
+	cb_auto_engaged = false;
+	cb_auto_cooldown_until_ms = now + cb_auto_cooldown_ms;
+
+	return 0;
+}
+
+static void cb_auto_work_fn(struct work_struct *work)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	s64 now = ktime_to_ms(ktime_get());
+	s64 predicted; // millicelsius
+	int result;
+	u8 temp;
+	int idx;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&cb_auto_mutex);
+	if (!cb_auto_enabled)
+		goto unlock;
+
+	result = cb_auto_read_temp(ec, &temp);
+	if (result < 0)
+		goto resched;
+
+	if (cb_auto_prev_temp >= 0 && now > cb_auto_prev_ms) {
+		s64 elapsed = now - cb_auto_prev_ms;
+		s64 slope = div64_s64((temp - cb_auto_prev_temp) * 1000 * 1000,
+				      elapsed);
+
+		// exponential moving average to ignore single-sample jitter
+		cb_auto_slope = (3 * cb_auto_slope + slope) / 4;
+
+		cb_auto_total_ms += elapsed;
+		if (cb_auto_engaged)
+			cb_auto_on_ms += elapsed;
+	}
+
+	cb_auto_prev_temp = temp;
+	cb_auto_prev_ms = now;
+
+	predicted = temp * 1000 +
+		    div_s64(cb_auto_slope * cb_auto_horizon_ms, 1000);
+
+	if (cb_auto_engaged) {
+		if (now - cb_auto_engaged_ms >= cb_auto_max_on_ms ||
+		    (temp + CB_AUTO_HYSTERESIS <= cb_auto_threshold &&
+		     predicted < cb_auto_threshold * 1000))
+			result = cb_auto_disengage(ec, now);
+	} else if (now >= cb_auto_cooldown_until_ms &&
+		   (temp >= cb_auto_threshold ||
+		    predicted >= cb_auto_threshold * 1000)) {
+		result = cb_auto_engage(ec, now);
+	}
+
+resched:
+	if (result < 0)
+		pr_err("Predictive cooler boost update failed: %d\n", result);
+
+	schedule_delayed_work(&cb_auto_work,
+			      msecs_to_jiffies(CB_AUTO_INTERVAL_MS));
+unlock:
+	msi_ec_unlock(&cb_auto_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+}
+
+// must be called with cb_auto_mutex held
+static int cb_auto_set_enabled(bool value)
+{
+	int result = 0;
+
+	if (value == cb_auto_enabled)
+		return 0;
+
+	// the sampling worker would not follow the replayed trace
+	if (value && msi_ec_replaying(&msi_ec_main))
+		return -EBUSY;
+
+	if (value) {
+		cb_auto_prev_temp = -1;
+		cb_auto_slope = 0;
+		cb_auto_cooldown_until_ms = 0;
+		cb_auto_on_ms = 0;
+		cb_auto_total_ms = 0;
+		schedule_delayed_work(&cb_auto_work, 0);
+	} else if (cb_auto_engaged) {
+		result = cb_auto_disengage(&msi_ec_main,
+					   ktime_to_ms(ktime_get()));
+	}
+
+	cb_auto_enabled = value;
+
+	return result;
+}
+
+static void cb_auto_stop(void)
+{
+	msi_ec_lock(&cb_auto_mutex);
+	cb_auto_set_enabled(false);
+	msi_ec_unlock(&cb_auto_mutex);
+
+	cancel_delayed_work_sync(&cb_auto_work);
+}
+
+static ssize_t cb_auto_enable_show(struct device *device,
+				   struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%s\n", str_on_off(READ_ONCE(cb_auto_enabled)));
+}
+
+static ssize_t cb_auto_enable_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int result;
+	bool value;
+
+	result = kstrtobool(buf, &value);
+	if (result)
+		return result;
+
+	msi_ec_lock(&cb_auto_mutex);
+	result = cb_auto_set_enabled(value);
+	msi_ec_unlock(&cb_auto_mutex);
+
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static ssize_t cb_auto_uint_show(unsigned int *value, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(*value));
+}
+
+static ssize_t cb_auto_uint_store(unsigned int *value, unsigned int max,
+				  const char *buf, size_t count)
+{
+	int result;
+	unsigned int data;
+
+	result = kstrtouint(buf, 10, &data);
+	if (result < 0)
+		return result;
+
+	if (data > max)
+		return -EINVAL;
+
+	msi_ec_lock(&cb_auto_mutex);
+	*value = data;
+	msi_ec_unlock(&cb_auto_mutex);
+
+	return count;
+}
+
+static ssize_t cb_auto_threshold_show(struct device *device,
+				      struct device_attribute *attr, char *buf)
+{
+	return cb_auto_uint_show(&cb_auto_threshold, buf);
+}
+
+static ssize_t cb_auto_threshold_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	return cb_auto_uint_store(&cb_auto_threshold, 150, buf, count);
+}
+
+static ssize_t cb_auto_horizon_ms_show(struct device *device,
+				       struct device_attribute *attr, char *buf)
+{
+	return cb_auto_uint_show(&cb_auto_horizon_ms, buf);
+}
+
+static ssize_t cb_auto_horizon_ms_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	return cb_auto_uint_store(&cb_auto_horizon_ms, 60000, buf, count);
+}
+
+static ssize_t cb_auto_max_on_ms_show(struct device *device,
+				      struct device_attribute *attr, char *buf)
+{
+	return cb_auto_uint_show(&cb_auto_max_on_ms, buf);
+}
+
+static ssize_t cb_auto_max_on_ms_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	return cb_auto_uint_store(&cb_auto_max_on_ms, U32_MAX, buf, count);
+}
+
+static ssize_t cb_auto_cooldown_ms_show(struct device *device,
+					struct device_attribute *attr,
+					char *buf)
+{
+	return cb_auto_uint_show(&cb_auto_cooldown_ms, buf);
+}
+
+static ssize_t cb_auto_cooldown_ms_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	return cb_auto_uint_store(&cb_auto_cooldown_ms, U32_MAX, buf, count);
+}
+
+static ssize_t cb_auto_engagements_show(struct device *device,
+					struct device_attribute *attr,
+					char *buf)
+{
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(cb_auto_engagements));
+}
+
+static ssize_t cb_auto_duty_cycle_show(struct device *device,
+				       struct device_attribute *attr, char *buf)
+{
+	u64 on_ms, total_ms;
+
+	msi_ec_lock(&cb_auto_mutex);
+	on_ms = cb_auto_on_ms;
+	total_ms = cb_auto_total_ms;
+	msi_ec_unlock(&cb_auto_mutex);
+
+	// percent of the time since enabling spent with the boost engaged
+	return sysfs_emit(buf, "%llu\n",
+			  total_ms ? div64_u64(on_ms * 100, total_ms) : 0);
+}
+
+MSI_EC_GROUP_ATTR(cb_auto_enable, "cooler_boost_auto", enable, 0644,
+		  cb_auto_enable_show, cb_auto_enable_store);
+MSI_EC_GROUP_ATTR(cb_auto_threshold, "cooler_boost_auto", threshold, 0644,
+		  cb_auto_threshold_show, cb_auto_threshold_store);
+MSI_EC_GROUP_ATTR(cb_auto_horizon_ms, "cooler_boost_auto", horizon_ms, 0644,
+		  cb_auto_horizon_ms_show, cb_auto_horizon_ms_store);
+MSI_EC_GROUP_ATTR(cb_auto_max_on_ms, "cooler_boost_auto", max_on_ms, 0644,
+		  cb_auto_max_on_ms_show, cb_auto_max_on_ms_store);
+MSI_EC_GROUP_ATTR(cb_auto_cooldown_ms, "cooler_boost_auto", cooldown_ms, 0644,
+		  cb_auto_cooldown_ms_show, cb_auto_cooldown_ms_store);
+MSI_EC_GROUP_ATTR(cb_auto_engagements, "cooler_boost_auto", engagements, 0444,
+		  cb_auto_engagements_show, NULL);
+MSI_EC_GROUP_ATTR(cb_auto_duty_cycle, "cooler_boost_auto", duty_cycle, 0444,
+		  cb_auto_duty_cycle_show, NULL);
+
+static struct attribute *msi_cb_auto_attrs[] = {
+	&dev_attr_cb_auto_enable.dev_attr.attr,
+	&dev_attr_cb_auto_threshold.dev_attr.attr,
+	&dev_attr_cb_auto_horizon_ms.dev_attr.attr,
+	&dev_attr_cb_auto_max_on_ms.dev_attr.attr,
+	&dev_attr_cb_auto_cooldown_ms.dev_attr.attr,
+	&dev_attr_cb_auto_engagements.dev_attr.attr,
+	&dev_attr_cb_auto_duty_cycle.dev_attr.attr,
+	NULL
+};
+
+// ============================================================ //
+// Sysfs platform device attributes (features)
+// ============================================================ //
+
+/*
+ * The root, cpu and gpu attributes are described by msi_ec_features[]: what
+ * kind of value they expose and which fields of struct msi_ec_conf hold its
+ * address, bit or mask and mode list. The attribute lists of the groups,
+ * their visibility and the read plans are generated from the table, and all
+ * of them share the show/store callbacks below.
+ */
+enum msi_ec_feature_kind {
+	MSI_EC_KIND_BIT,    // on/off or left/right of a bit
+	MSI_EC_KIND_MASK,   // on/off of all the bits of a mask
+	MSI_EC_KIND_ENUM,   // a mode of a mode list
+	MSI_EC_KIND_MODES,  // the names of a mode list
+	MSI_EC_KIND_SENSOR, // a sensor of the configuration
+	MSI_EC_KIND_CUSTOM, // formatted by its own show callback
+};
+
+enum msi_ec_feature_group {
+	MSI_EC_GROUP_ROOT,
+	MSI_EC_GROUP_CPU,
+	MSI_EC_GROUP_GPU,
+	MSI_EC_GROUP_COUNT
+};
+
+// an offset into struct msi_ec_conf, 0 (allowed_fw) means none
+#define MSI_EC_CONF(_field) offsetof(struct msi_ec_conf, _field)
+
+// written to the shift mode address until a mode is set
+#define MSI_EC_SHIFT_MODE_UNSPECIFIED 0x80
+
+struct msi_ec_feature {
+	struct msi_ec_attribute attr;
+	enum msi_ec_feature_group group;
+	enum msi_ec_feature_kind kind;
+
+	size_t address; // int
+	size_t bit;     // int, the mask for MSI_EC_KIND_MASK
+	size_t invert;  // bool, inverts the bit
+	size_t modes;   // struct msi_ec_mode[]
+
+	const char *sensor; // label
+	enum msi_ec_sensor_kind sensor_kind;
+
+	bool inverted;    // the value is the opposite of the bit
+	bool direction;   // left/right instead of on/off
+	bool unspecified; // see MSI_EC_SHIFT_MODE_UNSPECIFIED
+
+	// replaces the plain EC write of a store
+	int (*write)(struct msi_ec_device *ec, const struct msi_ec_conf *conf,
+		     u8 value);
+};
+
+#define to_msi_ec_feature(_attr) \
+	container_of(to_msi_ec_attr(_attr), struct msi_ec_feature, attr)
+
+static ssize_t msi_ec_feature_show(struct device *device,
+				   struct device_attribute *attr, char *buf);
+static ssize_t msi_ec_feature_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count);
+
+#define __MSI_EC_FEATURE(_group, _path, _name, _mode, _show, _store,	\
+			 _kind, ...)					\
+{									\
+	.attr = __MSI_EC_ATTR_INIT(_path, _name, _mode, _show, _store),	\
+	.group = _group,						\
+	.kind = _kind,							\
+	__VA_ARGS__							\
+}
+
+#define MSI_EC_FEATURE(_name, _mode, _kind, ...)			\
+	__MSI_EC_FEATURE(MSI_EC_GROUP_ROOT, #_name, _name, _mode,	\
+			 msi_ec_feature_show, msi_ec_feature_store, _kind,	\
+			 __VA_ARGS__)
+
+#define MSI_EC_CPU_FEATURE(_name, _mode, _kind, ...)			\
+	__MSI_EC_FEATURE(MSI_EC_GROUP_CPU, "cpu/" #_name, _name, _mode, \
+			 msi_ec_feature_show, msi_ec_feature_store, _kind,	\
+			 __VA_ARGS__)
+
+#define MSI_EC_GPU_FEATURE(_name, _mode, _kind, ...)			\
+	__MSI_EC_FEATURE(MSI_EC_GROUP_GPU, "gpu/" #_name, _name, _mode, \
+			 msi_ec_feature_show, msi_ec_feature_store, _kind,	\
+			 __VA_ARGS__)
+
+static inline int conf_int(const struct msi_ec_conf *conf, size_t offset)
+{
+	return *(const int *)((const char *)conf + offset);
+}
+
+// returns the address behind a feature, -1 if it has none
+static int msi_ec_feature_address(const struct msi_ec_feature *f,
+				  const struct msi_ec_conf *conf)
+{
+	if (f->kind == MSI_EC_KIND_SENSOR)
+		return msi_ec_sensor_address(conf, f->sensor, f->sensor_kind);
+
+	if (!f->address)
+		return -1;
+
+	return conf_int(conf, f->address);
+}
+
+// returns the number of EC bytes behind a feature
+static int msi_ec_feature_length(const struct msi_ec_feature *f,
+				 const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_sensor *sensor;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_MODES:
+	case MSI_EC_KIND_CUSTOM:
+		return 0;
+	case MSI_EC_KIND_SENSOR:
+		sensor = msi_ec_sensor_find(conf, f->sensor, f->sensor_kind);
+		return sensor ? msi_ec_sensor_width(sensor) : 0;
+	default:
+		return 1;
+	}
+}
+
+static const struct msi_ec_mode *
+msi_ec_feature_modes(const struct msi_ec_feature *f,
+		     const struct msi_ec_conf *conf)
+{
+	return (const struct msi_ec_mode *)((const char *)conf + f->modes);
+}
+
+// the displayed value of a bit, and the bit of a displayed value
+static bool msi_ec_feature_flip(const struct msi_ec_feature *f,
+				const struct msi_ec_conf *conf, bool value)
+{
+	value ^= f->inverted;
+	if (f->invert)
+		value ^= *(const bool *)((const char *)conf + f->invert);
+
+	return value;
+}
+
+/*
+ * Formats a feature at offset at of buf. data points to the EC memory at
+ * the address of the feature, read directly or through a read plan.
+ */
+static int msi_ec_feature_format(const struct msi_ec_feature *f,
+				 const struct msi_ec_conf *conf,
+				 const u8 *data, char *buf, int at)
+{
+	const struct msi_ec_sensor *sensor;
+	const struct msi_ec_mode *modes;
+	int count = 0;
+	int result;
+	bool value;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_BIT:
+		value = *data & BIT(conf_int(conf, f->bit));
+		value = msi_ec_feature_flip(f, conf, value);
+		return sysfs_emit_at(buf, at, "%s\n",
+				     f->direction ? str_left_right(value) :
+						    str_on_off(value));
+
+	case MSI_EC_KIND_MASK:
+		value = (*data & conf_int(conf, f->bit)) == conf_int(conf, f->bit);
+		return sysfs_emit_at(buf, at, "%s\n", str_on_off(value));
+
+	case MSI_EC_KIND_ENUM:
+		if (f->unspecified && *data == MSI_EC_SHIFT_MODE_UNSPECIFIED)
+			return sysfs_emit_at(buf, at, "%s\n", "unspecified");
+
+		modes = msi_ec_feature_modes(f, conf);
+		for (int i = 0; modes[i].name; i++) {
+			// NULL entries have NULL name
+
+			if (*data == modes[i].value)
+				return sysfs_emit_at(buf, at, "%s\n",
+						     modes[i].name);
+		}
+
+		return sysfs_emit_at(buf, at, "%s (%i)\n", "unknown", *data);
+
+	case MSI_EC_KIND_MODES:
+		modes = msi_ec_feature_modes(f, conf);
+		for (int i = 0; modes[i].name; i++) {
+			result = sysfs_emit_at(buf, at + count, "%s\n",
+					       modes[i].name);
+			if (result < 0)
+				return result;
+			count += result;
+		}
+
+		return count;
+
+	case MSI_EC_KIND_SENSOR:
+		sensor = msi_ec_sensor_find(conf, f->sensor, f->sensor_kind);
+		if (!sensor)
+			return -EIO;
+
+		return sysfs_emit_at(buf, at, "%li\n",
+				     msi_ec_sensor_value(sensor, data));
+
+	default:
+		return -EIO;
+	}
+}
+
+static ssize_t msi_ec_feature_show(struct device *device,
+				   struct device_attribute *attr, char *buf)
+{
+	const struct msi_ec_feature *f = to_msi_ec_feature(attr);
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	u8 data[MSI_EC_CONF_BLOB_SENSOR_WIDTH_MAX] = { 0 }; // the widest kind
+	const struct msi_ec_sensor *sensor;
+	int result;
+
+	// the mode lists are known without the EC
+	result = ec_read_seq(ec, msi_ec_feature_address(f, conf), data,
+			     msi_ec_feature_length(f, conf));
+	if (result < 0)
+		return result;
+
+	if (f->kind == MSI_EC_KIND_SENSOR) {
+		sensor = msi_ec_sensor_find(conf, f->sensor, f->sensor_kind);
+		result = sensor ? ec_sensor_settle(ec, sensor, data) : 0;
+		if (result < 0)
+			return result;
+	}
+
+	return msi_ec_feature_format(f, conf, data, buf, 0);
+}
+
+static ssize_t msi_ec_feature_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	const struct msi_ec_feature *f = to_msi_ec_feature(attr);
+	struct msi_ec_device *ec = dev_get_drvdata(dev);
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	const struct msi_ec_mode *modes;
+	int address = msi_ec_feature_address(f, conf);
+	int result;
+	bool value;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_BIT:
+		if (f->direction)
+			result = direction_is_left(buf, &value);
+		else
+			result = kstrtobool(buf, &value);
+		if (result)
+			return result;
+
+		value = msi_ec_feature_flip(f, conf, value);
+		if (f->write)
+			result = f->write(ec, conf, value);
+		else
+			result = ec_set_bit(ec, address, conf_int(conf, f->bit),
+					    value);
+		break;
+
+	case MSI_EC_KIND_MASK:
+		result = kstrtobool(buf, &value);
+		if (result)
+			return result;
+
+		if (f->write)
+			result = f->write(ec, conf, value);
+		else if (value)
+			result = ec_set_by_mask(ec, address,
+						conf_int(conf, f->bit));
+		else
+			result = ec_unset_by_mask(ec, address,
+						  conf_int(conf, f->bit));
+		break;
+
+	case MSI_EC_KIND_ENUM:
+		modes = msi_ec_feature_modes(f, conf);
+		result = -EINVAL;
+		for (int i = 0; modes[i].name; i++) {
+			// NULL entries have NULL name
+
+			if (!sysfs_streq(modes[i].name, buf))
+				continue;
+
+			if (f->write)
+				result = f->write(ec, conf, modes[i].value);
+			else
+				result = msi_ec_write(ec, address,
+						      modes[i].value);
+			break;
+		}
+		break;
+
+	default:
+		return -EIO;
+	}
+
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+// ============================================================ //
+// Sysfs platform device attributes (root, cpu, gpu)
+// ============================================================ //
+
+static int cooler_boost_write(struct msi_ec_device *ec,
+			      const struct msi_ec_conf *conf, u8 value)
+{
+	int result;
+
+	if (!msi_ec_is_main(ec))
+		return fan_lease_set_cooler_boost(ec, value);
+
+	// the boost now belongs to the user, cooler_boost_auto leaves it alone
+	msi_ec_lock(&cb_auto_mutex);
+	result = fan_lease_set_cooler_boost(ec, value);
+	if (result >= 0)
+		cb_auto_engaged = false;
+	msi_ec_unlock(&cb_auto_mutex);
+
+	return result;
+}
+
+static int shift_mode_write(struct msi_ec_device *ec,
+			    const struct msi_ec_conf *conf, u8 value)
+{
+	return arbiter_write(ec, &shift_mode_arbiter, value);
+}
+
+static int super_battery_write(struct msi_ec_device *ec,
+			       const struct msi_ec_conf *conf, u8 value)
+{
+	if (qos_hold_capture_super_battery(ec, value))
+		return 0;
+
+	if (value)
+		return ec_set_by_mask(ec, conf->super_battery.address,
+				      conf->super_battery.mask);
+
+	return ec_unset_by_mask(ec, conf->super_battery.address,
+				conf->super_battery.mask);
+}
+
+static int fan_mode_write(struct msi_ec_device *ec,
+			  const struct msi_ec_conf *conf, u8 value)
+{
+	return arbiter_write(ec, &fan_mode_arbiter, value);
+}
+
+static ssize_t fw_version_show(struct device *device,
+			       struct device_attribute *attr, char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	struct msi_ec_identity id;
+	int result;
+
+	result = identity_get(ec, &id);
+	if (result < 0)
+		return result;
+
+	return sysfs_emit(buf, "%s\n", id.version);
+}
+
+static ssize_t fw_release_date_show(struct device *device,
+				    struct device_attribute *attr, char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	struct msi_ec_identity id;
+	int result;
+
+	result = identity_get(ec, &id);
+	if (result < 0)
+		return result;
+
+	if (id.build_result < 0)
+		return id.build_result;
+
+	return sysfs_emit(buf, "%ptR\n", &id.build);
+}
+
+// the firmware identity and the configuration in use, "-" if unknown
+static ssize_t identity_show(struct device *device,
+			     struct device_attribute *attr, char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	struct msi_ec_identity id;
+	int count;
+	int result;
+
+	result = identity_get(ec, &id);
+	if (result < 0)
+		return result;
+
+	count = sysfs_emit(buf, "version=%s\n", id.version);
+	if (id.build_result < 0)
+		count += sysfs_emit_at(buf, count, "build=-\n");
+	else
+		count += sysfs_emit_at(buf, count, "build=%ptR\n", &id.build);
+
+	count += sysfs_emit_at(buf, count, "conf=%s\n",
+			       conf->name ? conf->name : "-");
+	if (conf->generation)
+		count += sysfs_emit_at(buf, count, "generation=%d\n",
+				       conf->generation);
+	else
+		count += sysfs_emit_at(buf, count, "generation=-\n");
+	count += sysfs_emit_at(buf, count, "source=%s\n", ec->conf_source);
+
+	return count;
+}
+
+// "refresh" reads the identity again
+static ssize_t identity_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(dev);
+	int result;
+
+	if (!sysfs_streq(buf, "refresh"))
+		return -EINVAL;
+
+	result = identity_refresh(ec);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+// see Aggregated state
+static ssize_t state_show(struct device *device,
+			  struct device_attribute *attr, char *buf);
+
+enum msi_ec_feature_id {
+	MSI_EC_WEBCAM,
+	MSI_EC_WEBCAM_BLOCK,
+	MSI_EC_FN_KEY,
+	MSI_EC_WIN_KEY,
+	MSI_EC_COOLER_BOOST,
+	MSI_EC_AVAILABLE_SHIFT_MODES,
+	MSI_EC_SHIFT_MODE,
+	MSI_EC_SUPER_BATTERY,
+	MSI_EC_AVAILABLE_FAN_MODES,
+	MSI_EC_FAN_MODE,
+	MSI_EC_FW_VERSION,
+	MSI_EC_FW_RELEASE_DATE,
+	MSI_EC_IDENTITY,
+	MSI_EC_STATE,
+	MSI_EC_CPU_REALTIME_TEMPERATURE,
+	MSI_EC_CPU_REALTIME_FAN_SPEED,
+	MSI_EC_GPU_REALTIME_TEMPERATURE,
+	MSI_EC_GPU_REALTIME_FAN_SPEED,
+	MSI_EC_FEATURE_COUNT
+};
+
+static struct msi_ec_feature msi_ec_features[MSI_EC_FEATURE_COUNT] = {
+	/* root group */
+	[MSI_EC_WEBCAM] = MSI_EC_FEATURE(webcam, 0644, MSI_EC_KIND_BIT,
+		.address = MSI_EC_CONF(webcam.address),
+		.bit = MSI_EC_CONF(webcam.bit)),
+	[MSI_EC_WEBCAM_BLOCK] = MSI_EC_FEATURE(webcam_block, 0644,
+					       MSI_EC_KIND_BIT,
+		.address = MSI_EC_CONF(webcam.block_address),
+		.bit = MSI_EC_CONF(webcam.bit),
+		.inverted = true),
+	// fn key position is the opposite of win key
+	[MSI_EC_FN_KEY] = MSI_EC_FEATURE(fn_key, 0644, MSI_EC_KIND_BIT,
+		.address = MSI_EC_CONF(fn_win_swap.address),
+		.bit = MSI_EC_CONF(fn_win_swap.bit),
+		.invert = MSI_EC_CONF(fn_win_swap.invert),
+		.inverted = true,
+		.direction = true),
+	[MSI_EC_WIN_KEY] = MSI_EC_FEATURE(win_key, 0644, MSI_EC_KIND_BIT,
+		.address = MSI_EC_CONF(fn_win_swap.address),
+		.bit = MSI_EC_CONF(fn_win_swap.bit),
+		.invert = MSI_EC_CONF(fn_win_swap.invert),
+		.direction = true),
+	[MSI_EC_COOLER_BOOST] = MSI_EC_FEATURE(cooler_boost, 0644,
+					       MSI_EC_KIND_BIT,
+		.address = MSI_EC_CONF(cooler_boost.address),
+		.bit = MSI_EC_CONF(cooler_boost.bit),
+		.write = cooler_boost_write),
+	[MSI_EC_AVAILABLE_SHIFT_MODES] = MSI_EC_FEATURE(available_shift_modes,
+							0444, MSI_EC_KIND_MODES,
+		.address = MSI_EC_CONF(shift_mode.address),
+		.modes = MSI_EC_CONF(shift_mode.modes)),
+	[MSI_EC_SHIFT_MODE] = MSI_EC_FEATURE(shift_mode, 0644, MSI_EC_KIND_ENUM,
+		.address = MSI_EC_CONF(shift_mode.address),
+		.modes = MSI_EC_CONF(shift_mode.modes),
+		.unspecified = true,
+		.write = shift_mode_write),
+	[MSI_EC_SUPER_BATTERY] = MSI_EC_FEATURE(super_battery, 0644,
+						MSI_EC_KIND_MASK,
+		.address = MSI_EC_CONF(super_battery.address),
+		.bit = MSI_EC_CONF(super_battery.mask),
+		.write = super_battery_write),
+	[MSI_EC_AVAILABLE_FAN_MODES] = MSI_EC_FEATURE(available_fan_modes,
+						      0444, MSI_EC_KIND_MODES,
+		.address = MSI_EC_CONF(fan_mode.address),
+		.modes = MSI_EC_CONF(fan_mode.modes)),
+	[MSI_EC_FAN_MODE] = MSI_EC_FEATURE(fan_mode, 0644, MSI_EC_KIND_ENUM,
+		.address = MSI_EC_CONF(fan_mode.address),
+		.modes = MSI_EC_CONF(fan_mode.modes),
+		.write = fan_mode_write),
+	[MSI_EC_FW_VERSION] = __MSI_EC_FEATURE(MSI_EC_GROUP_ROOT,
+		"fw_version", fw_version, 0444,
+		fw_version_show, NULL, MSI_EC_KIND_CUSTOM),
+	[MSI_EC_FW_RELEASE_DATE] = __MSI_EC_FEATURE(MSI_EC_GROUP_ROOT,
+		"fw_release_date", fw_release_date, 0444,
+		fw_release_date_show, NULL, MSI_EC_KIND_CUSTOM),
+	[MSI_EC_IDENTITY] = __MSI_EC_FEATURE(MSI_EC_GROUP_ROOT,
+		"identity", identity, 0644,
+		identity_show, identity_store, MSI_EC_KIND_CUSTOM),
+	[MSI_EC_STATE] = __MSI_EC_FEATURE(MSI_EC_GROUP_ROOT,
+		"state", state, 0444,
+		state_show, NULL, MSI_EC_KIND_CUSTOM),
+
+	/* cpu group */
+	[MSI_EC_CPU_REALTIME_TEMPERATURE] = MSI_EC_CPU_FEATURE(
+		realtime_temperature, 0444, MSI_EC_KIND_SENSOR,
+		.sensor = "cpu", .sensor_kind = MSI_EC_SENSOR_TEMP),
+	[MSI_EC_CPU_REALTIME_FAN_SPEED] = MSI_EC_CPU_FEATURE(
+		realtime_fan_speed, 0444, MSI_EC_KIND_SENSOR,
+		.sensor = "cpu", .sensor_kind = MSI_EC_SENSOR_FAN),
+
+	/* gpu group */
+	[MSI_EC_GPU_REALTIME_TEMPERATURE] = MSI_EC_GPU_FEATURE(
+		realtime_temperature, 0444, MSI_EC_KIND_SENSOR,
+		.sensor = "gpu", .sensor_kind = MSI_EC_SENSOR_TEMP),
+	[MSI_EC_GPU_REALTIME_FAN_SPEED] = MSI_EC_GPU_FEATURE(
+		realtime_fan_speed, 0444, MSI_EC_KIND_SENSOR,
+		.sensor = "gpu", .sensor_kind = MSI_EC_SENSOR_FAN),
+};
+
+// filled from msi_ec_features[] by msi_ec_features_init()
+static struct attribute *msi_ec_feature_attrs[MSI_EC_GROUP_COUNT]
+					     [MSI_EC_FEATURE_COUNT + 1];
+
+static void __init msi_ec_features_init(void)
+{
+	int count[MSI_EC_GROUP_COUNT] = { 0 };
+
+	for (int i = 0; i < MSI_EC_FEATURE_COUNT; i++) {
+		struct msi_ec_feature *f = &msi_ec_features[i];
+
+		msi_ec_feature_attrs[f->group][count[f->group]++] =
+			&f->attr.dev_attr.attr;
+	}
+}
+
+/*
+ * A read plan holds the EC addresses behind the features available with a
+ * configuration, so that a snapshot of all of them takes a single read per
+ * address, in ascending order.
+ */
+struct msi_ec_read_plan {
+	DECLARE_BITMAP(addrs, 256);
+};
+
+static void msi_ec_read_plan_add(struct msi_ec_read_plan *plan, int address,
+				 int length)
+{
+	for (int i = 0; i < length && address + i < 256; i++)
+		__set_bit(address + i, plan->addrs);
+}
+
+static void msi_ec_read_plan_init(struct msi_ec_read_plan *plan,
+				  const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_sensor *sensor;
+
+	bitmap_zero(plan->addrs, 256);
+
+	for (int i = 0; i < MSI_EC_FEATURE_COUNT; i++) {
+		const struct msi_ec_feature *f = &msi_ec_features[i];
+		int address = msi_ec_feature_address(f, conf);
+
+		if (address < 0 || address == MSI_EC_ADDR_UNSUPP)
+			continue;
+
+		msi_ec_read_plan_add(plan, address,
+				     msi_ec_feature_length(f, conf));
+	}
+
+	msi_ec_for_each_sensor(sensor, conf)
+		msi_ec_read_plan_add(plan, sensor->address,
+				     msi_ec_sensor_width(sensor));
+}
+
+// reads the addresses of a plan to their offsets in image
+static int ec_read_plan(struct msi_ec_device *ec,
+			const struct msi_ec_read_plan *plan, u8 image[256])
+{
+	unsigned int addr;
+	int result;
+
+	for_each_set_bit(addr, plan->addrs, 256) {
+		result = msi_ec_read(ec, addr, &image[addr]);
+		if (result < 0)
+			return result;
+	}
+
+	return 0;
+}
+
+// reads every feature and sensor of conf to their offsets in image
+static int ec_read_snapshot(struct msi_ec_device *ec,
+			    const struct msi_ec_conf *conf, u8 image[256])
+{
+	const struct msi_ec_sensor *sensor;
+	struct msi_ec_read_plan plan;
+	int result;
+
+	msi_ec_read_plan_init(&plan, conf);
+	result = ec_read_plan(ec, &plan, image);
+	if (result < 0)
+		return result;
+
+	msi_ec_for_each_sensor(sensor, conf) {
+		result = ec_sensor_settle(ec, sensor, image + sensor->address);
+		if (result < 0)
+			return result;
+	}
+
+	return 0;
+}
+
+// ============================================================ //
+// Sysfs platform device attributes (debug)
+// ============================================================ //
+
+// Prints an EC memory dump in form of a table
+static ssize_t ec_dump_show(struct device *device,
+			    struct device_attribute *attr,
+			    char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	int count = 0;
+	char ascii_row[16]; // not null-terminated
+
+	// print header
+	count += sysfs_emit(
+		buf,
+		"|      | _0 _1 _2 _3 _4 _5 _6 _7 _8 _9 _a _b _c _d _e _f\n"
+		"|------+------------------------------------------------\n");
+
+	// print dump
+	for (u8 i = 0x0; i <= 0xf; i++) {
+		u8 addr_base = i * 16;
+
+		count += sysfs_emit_at(buf, count, "| %#x_ |", i);
+		for (u8 j = 0x0; j <= 0xf; j++) {
+			u8 rdata;
+			int result = msi_ec_read(ec, addr_base + j, &rdata);
+			if (result < 0)
+				return result;
+
+			count += sysfs_emit_at(buf, count, " %02x", rdata);
+			ascii_row[j] = isascii(rdata) && isgraph(rdata) ? rdata : '.';
+		}
+
+		count += sysfs_emit_at(buf, count, "  |%.16s|\n", ascii_row);
+	}
+
+	return count;
+}
+
+// stores a value in the specified EC memory address. Format: "xx=xx", xx - hex u8
+static ssize_t ec_set_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(dev);
+
+	if (count > 6) // "xx=xx\n" - 6 chars
+		return -EINVAL;
+
+	int result;
+
+	char addr_s[3], val_s[3];
+	result = sscanf(buf, "%2s=%2s", addr_s, val_s);
+	if (result != 2)
+		return -EINVAL;
+
+	u8 addr, val;
+
+	// convert addr
+	result = kstrtou8(addr_s, 16, &addr);
+	if (result < 0)
+		return result;
+
+	// convert val
+	result = kstrtou8(val_s, 16, &val);
+	if (result < 0)
+		return result;
+
+	// write val to EC[addr]
+	result = msi_ec_write(ec, addr, val);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+// ec_get. reads and stores the specified EC memory address. Format: "xx", xx - hex u8
+static ssize_t ec_get_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(dev);
+
+	if (count > 3) // "xx\n" - 3 chars
+		return -EINVAL;
+
+	int result;
+	char addr_s[3];
+
+	result = sscanf(buf, "%2s", addr_s);
+	if (result != 1)
+		return -EINVAL;
+
+	// convert addr
+	result = kstrtou8(addr_s, 16, &ec->ec_get_addr);
+	if (result < 0)
+		return result;
+
+	return count;
+};
+
+// ec_get. prints value of previously stored EC memory address
+static ssize_t ec_get_show(struct device *device,
+			   struct device_attribute *attr,
+			   char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	u8 rdata;
+	int result;
+
+	result = msi_ec_read(ec, ec->ec_get_addr, &rdata);
+	if (result < 0)
+		return result;
+
+	//	return sysfs_emit(buf, "%02x=%02x\n", ec_get_addr, rdata);
+	return sysfs_emit(buf, "%02x\n", rdata);
+};
+
+MSI_EC_GROUP_ATTR(ec_dump, "debug", ec_dump, 0444, ec_dump_show, NULL);
+MSI_EC_GROUP_ATTR(ec_set, "debug", ec_set, 0200, NULL, ec_set_store);
+MSI_EC_GROUP_ATTR(ec_get, "debug", ec_get, 0644, ec_get_show, ec_get_store);
+
+static struct attribute *msi_debug_attrs[] = {
+	&msi_ec_features[MSI_EC_FW_VERSION].attr.dev_attr.attr,
+	&dev_attr_ec_dump.dev_attr.attr,
+	&dev_attr_ec_set.dev_attr.attr,
+	&dev_attr_ec_get.dev_attr.attr,
+	NULL
+};
+
+// ============================================================ //
+// Sysfs leds subsystem
+// ============================================================ //
+
+static int micmute_led_sysfs_set(struct led_classdev *led_cdev,
+				 enum led_brightness brightness)
+{
+	struct msi_ec_device *ec =
+		container_of(led_cdev, struct msi_ec_device, micmute_led);
+	const struct msi_ec_conf *conf;
+	int result;
+	int idx;
+
+	conf = conf_read_lock(ec, &idx);
+	result = ec_set_bit(ec, conf->leds.micmute_led_address, conf->leds.bit, brightness);
+	conf_read_unlock(idx);
+
+	if (result < 0)
+		return result;
+
+	return 0;
+}
+
+static int mute_led_sysfs_set(struct led_classdev *led_cdev,
+			      enum led_brightness brightness)
+{
+	struct msi_ec_device *ec =
+		container_of(led_cdev, struct msi_ec_device, mute_led);
+	const struct msi_ec_conf *conf;
+	int result;
+	int idx;
+
+	conf = conf_read_lock(ec, &idx);
+	result = ec_set_bit(ec, conf->leds.mute_led_address, conf->leds.bit, brightness);
+	conf_read_unlock(idx);
+
+	if (result < 0)
+		return result;
+
+	return 0;
+}
+
+static enum led_brightness kbd_bl_sysfs_get(struct led_classdev *led_cdev)
+{
+	struct msi_ec_device *ec =
+		container_of(led_cdev, struct msi_ec_device, kbd_led);
+	const struct msi_ec_conf *conf;
+	u8 rdata;
+	int result;
+	int idx;
+
+	conf = conf_read_lock(ec, &idx);
+	result = msi_ec_read(ec, conf->kbd_bl.bl_state_address, &rdata);
+	conf_read_unlock(idx);
+	if (result < 0)
+		return 0;
+	return rdata & MSI_EC_KBD_BL_STATE_MASK;
+}
+
+static int kbd_bl_sysfs_set(struct led_classdev *led_cdev,
+			    enum led_brightness brightness)
+{
+	struct msi_ec_device *ec =
+		container_of(led_cdev, struct msi_ec_device, kbd_led);
+	const struct msi_ec_conf *conf;
+	int result;
+	int idx;
+
+	// By default, on an unregister event,
+	// kernel triggers the setter with 0 brightness.
+	if (led_cdev->flags & LED_UNREGISTERING)
+		return 0;
+
+	u8 wdata;
+	if (brightness < 0 || brightness > 3)
+		return -1;
+	conf = conf_read_lock(ec, &idx);
+	wdata = conf->kbd_bl.state_base_value | brightness;
+	result = msi_ec_write(ec, conf->kbd_bl.bl_state_address, wdata);
+	conf_read_unlock(idx);
+	return result;
+}
+
+// templates of the LEDs of an instance
+static const struct led_classdev micmute_led_cdev = {
+	.name = "platform::micmute",
+	.max_brightness = 1,
+	.brightness_set_blocking = &micmute_led_sysfs_set,
+	.default_trigger = "audio-micmute",
+};
+
+static const struct led_classdev mute_led_cdev = {
+	.name = "platform::mute",
+	.max_brightness = 1,
+	.brightness_set_blocking = &mute_led_sysfs_set,
+	.default_trigger = "audio-mute",
+};
+
+static const struct led_classdev msiacpi_led_kbdlight = {
+	.name = "msiacpi::kbd_backlight",
+	.max_brightness = 3,
+	.flags = LED_BRIGHT_HW_CHANGED,
+	.brightness_set_blocking = &kbd_bl_sysfs_set,
+	.brightness_get = &kbd_bl_sysfs_get,
+};
+
+// ============================================================ //
+// Hwmon
+// ============================================================ //
+
+/*
+ * The sensors of the configuration are exposed as hwmon channels:
+ * temperatures as tempN_input, realtime fan speeds as read-only pwmN (their
+ * percentage scaled to 0-255) and tachometers as fanN_input, with their
+ * labels. The channels are generated at the bring-up, so that a
+ * configuration switch regenerates them. A read samples all the sensors in
+ * one sweep, which serves the other reads for MSI_EC_SENSOR_SAMPLE_MS, as
+ * monitoring tools read all the channels in a row.
+ */
+
+#define MSI_EC_SENSOR_SAMPLE_MS 100
+
+// the channel types, in the order they are listed
+static const enum hwmon_sensor_types msi_ec_hwmon_types[] = {
+	hwmon_temp,
+	hwmon_pwm,
+	hwmon_fan,
+};
+
+#define MSI_EC_HWMON_TYPES ARRAY_SIZE(msi_ec_hwmon_types)
+
+struct msi_ec_hwmon_kind {
+	enum hwmon_sensor_types type;
+	u32 config;
+};
+
+// indexed by enum msi_ec_sensor_kind
+static const struct msi_ec_hwmon_kind msi_ec_hwmon_kinds[] = {
+	[MSI_EC_SENSOR_TEMP] = { hwmon_temp, HWMON_T_INPUT | HWMON_T_LABEL },
+	[MSI_EC_SENSOR_FAN] = { hwmon_pwm, HWMON_PWM_INPUT },
+	[MSI_EC_SENSOR_RPM] = { hwmon_fan, HWMON_F_INPUT | HWMON_F_LABEL },
+	[MSI_EC_SENSOR_TACH] = { hwmon_fan, HWMON_F_INPUT | HWMON_F_LABEL },
+};
+
+struct msi_ec_hwmon_channels {
+	int count;
+	u8 sensor[MSI_EC_SENSORS_MAX]; // index in the sensor table
+	u32 config[MSI_EC_SENSORS_MAX + 1];
+	struct hwmon_channel_info info;
+};
+
+struct msi_ec_hwmon {
+	struct msi_ec_device *ec;
+	struct device *dev;
+
+	struct msi_ec_hwmon_channels channels[MSI_EC_HWMON_TYPES];
+	const struct hwmon_channel_info *info[MSI_EC_HWMON_TYPES + 1];
+	struct hwmon_chip_info chip;
+
+	struct msi_ec_lock sample_mutex; // protects the sample
+	struct msi_ec_read_plan plan;
+	bool sampled;
+	u64 sampled_ns;
+	u8 image[256];
+};
+
+static struct msi_ec_hwmon_channels *
+msi_ec_hwmon_channels(struct msi_ec_hwmon *hw, enum hwmon_sensor_types type)
+{
+	for (int i = 0; i < MSI_EC_HWMON_TYPES; i++)
+		if (msi_ec_hwmon_types[i] == type)
+			return &hw->channels[i];
+
+	return NULL;
+}
+
+// returns the sensor of a channel, NULL if there is none
+static const struct msi_ec_sensor *
+msi_ec_hwmon_sensor(struct msi_ec_hwmon *hw, const struct msi_ec_conf *conf,
+		    enum hwmon_sensor_types type, int channel)
+{
+	const struct msi_ec_hwmon_channels *ch = msi_ec_hwmon_channels(hw, type);
+
+	if (!ch || channel < 0 || channel >= ch->count)
+		return NULL;
+
+	return &conf->sensors[ch->sensor[channel]];
+}
+
+// one sweep over the sensors, the multi-byte ones are checked for tearing
+static int msi_ec_hwmon_sample(struct msi_ec_hwmon *hw,
+			       const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_sensor *sensor;
+	int result;
+
+	result = ec_read_plan(hw->ec, &hw->plan, hw->image);
+	if (result < 0)
+		return result;
+
+	msi_ec_for_each_sensor(sensor, conf) {
+		result = ec_sensor_settle(hw->ec, sensor,
+					  hw->image + sensor->address);
+		if (result < 0)
+			return result;
+	}
+
+	return 0;
+}
+
+static umode_t msi_ec_hwmon_is_visible(const void *drvdata,
+				       enum hwmon_sensor_types type, u32 attr,
+				       int channel)
+{
+	return 0444;
+}
+
+static int msi_ec_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+			     u32 attr, int channel, long *val)
+{
+	struct msi_ec_hwmon *hw = dev_get_drvdata(dev);
+	const struct msi_ec_sensor *sensor;
+	const struct msi_ec_conf *conf;
+	u64 now = ktime_get_ns();
+	int result = 0;
+	long value;
+	int idx;
+
+	conf = conf_read_lock(hw->ec, &idx);
+	sensor = msi_ec_hwmon_sensor(hw, conf, type, channel);
+	if (!sensor) {
+		result = -EOPNOTSUPP;
+		goto unlock;
+	}
+
+	msi_ec_lock(&hw->sample_mutex);
+	if (!hw->sampled || msi_ec_replaying(hw->ec) ||
+	    now - hw->sampled_ns >= MSI_EC_SENSOR_SAMPLE_MS * NSEC_PER_MSEC) {
+		result = msi_ec_hwmon_sample(hw, conf);
+		hw->sampled = result >= 0;
+		hw->sampled_ns = now;
+	}
+	value = msi_ec_sensor_value(sensor, hw->image + sensor->address);
+	msi_ec_unlock(&hw->sample_mutex);
+	if (result < 0)
+		goto unlock;
+
+	switch (sensor->kind) {
+	case MSI_EC_SENSOR_TEMP:
+		*val = value * 1000; // millidegrees
+		break;
+	case MSI_EC_SENSOR_FAN:
+		*val = clamp(value, 0L, 100L) * 255 / 100;
+		break;
+	default:
+		*val = value;
+		break;
+	}
+
+unlock:
+	conf_read_unlock(idx);
+	return result;
+}
+
+static int msi_ec_hwmon_read_string(struct device *dev,
+				    enum hwmon_sensor_types type, u32 attr,
+				    int channel, const char **str)
+{
+	struct msi_ec_hwmon *hw = dev_get_drvdata(dev);
+	const struct msi_ec_sensor *sensor;
+	const struct msi_ec_conf *conf;
+	int idx;
+
+	// the table outlives the channels, they are removed before a switch
+	conf = conf_read_lock(hw->ec, &idx);
+	sensor = msi_ec_hwmon_sensor(hw, conf, type, channel);
+	if (sensor)
+		*str = sensor->label;
+	conf_read_unlock(idx);
+
+	return sensor ? 0 : -EOPNOTSUPP;
+}
+
+static const struct hwmon_ops msi_ec_hwmon_ops = {
+	.is_visible = msi_ec_hwmon_is_visible,
+	.read = msi_ec_hwmon_read,
+	.read_string = msi_ec_hwmon_read_string,
+};
+
+static int msi_ec_hwmon_register(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	const struct msi_ec_sensor *sensor;
+	struct msi_ec_hwmon *hw;
+	int infos = 0;
+
+	hw = kzalloc(sizeof(*hw), GFP_KERNEL);
+	if (!hw)
+		return -ENOMEM;
+
+	hw->ec = ec;
+	msi_ec_lock_init(&hw->sample_mutex, "sample_mutex");
+	bitmap_zero(hw->plan.addrs, 256);
+
+	msi_ec_for_each_sensor(sensor, conf) {
+		struct msi_ec_hwmon_channels *ch = msi_ec_hwmon_channels(
+			hw, msi_ec_hwmon_kinds[sensor->kind].type);
+
+		ch->sensor[ch->count] = sensor - conf->sensors;
+		ch->config[ch->count++] = msi_ec_hwmon_kinds[sensor->kind].config;
+		msi_ec_read_plan_add(&hw->plan, sensor->address,
+				     msi_ec_sensor_width(sensor));
+	}
+
+	for (int i = 0; i < MSI_EC_HWMON_TYPES; i++) {
+		struct msi_ec_hwmon_channels *ch = &hw->channels[i];
+
+		if (!ch->count)
+			continue;
+
+		ch->info.type = msi_ec_hwmon_types[i];
+		ch->info.config = ch->config;
+		hw->info[infos++] = &ch->info;
+	}
+
+	// nothing to monitor
+	if (!infos) {
+		kfree(hw);
+		return 0;
+	}
+
+	hw->chip.ops = &msi_ec_hwmon_ops;
+	hw->chip.info = hw->info;
+
+	hw->dev = hwmon_device_register_with_info(&ec->pdev->dev, "msi_ec", hw,
+						  &hw->chip, NULL);
+	if (IS_ERR(hw->dev)) {
+		int result = PTR_ERR(hw->dev);
+
+		kfree(hw);
+		return result;
+	}
+
+	ec->hwmon = hw;
+	return 0;
+}
+
+static void msi_ec_hwmon_unregister(struct msi_ec_device *ec)
+{
+	if (!ec->hwmon)
+		return;
+
+	hwmon_device_unregister(ec->hwmon->dev);
+	kfree(ec->hwmon);
+	ec->hwmon = NULL;
+}
+
+// ============================================================ //
+// Sysfs platform driver
+// ============================================================ //
+
+// returns the address behind a root, cpu or gpu attribute, -1 if none
+static int msi_ec_attr_address(const struct msi_ec_conf *conf,
+			       struct attribute *attr)
+{
+	return msi_ec_feature_address(
+		to_msi_ec_feature(container_of(attr, struct device_attribute,
+					       attr)),
+		conf);
+}
+
+// returns the address behind a profile attribute, -1 if none
+static int msi_power_profile_attr_address(const struct msi_ec_conf *conf,
+					  struct attribute *attr)
+{
+	struct msi_ec_attribute *ma = to_msi_ec_attr(
+		container_of(attr, struct device_attribute, attr));
+
+	if (ma->show == profile_shift_mode_show)
+		return conf->shift_mode.address;
+
+	if (ma->show == profile_fan_mode_show)
+		return conf->fan_mode.address;
+
+	if (ma->show == profile_super_battery_show)
+		return conf->super_battery.address;
+
+	if (ma->show == profile_kbd_backlight_show)
+		return conf->kbd_bl.bl_state_address;
+
+	/* default */
+	return -1;
+}
+
+static bool msi_cb_auto_supported(const struct msi_ec_conf *conf)
+{
+	if (conf->cooler_boost.address == MSI_EC_ADDR_UNSUPP)
+		return false;
+
+	return msi_ec_sensor_find(conf, "cpu", MSI_EC_SENSOR_TEMP) ||
+	       msi_ec_sensor_find(conf, "gpu", MSI_EC_SENSOR_TEMP);
+}
+
+static bool msi_arbiter_supported(const struct msi_ec_conf *conf)
+{
+	return conf->shift_mode.address != MSI_EC_ADDR_UNSUPP ||
+	       conf->fan_mode.address != MSI_EC_ADDR_UNSUPP;
+}
+
+enum msi_ec_visibility {
+	VISIBLE_ATTR,    // msi_ec_attr_address()
+	VISIBLE_PROFILE, // msi_power_profile_attr_address()
+	VISIBLE_PM_QOS,
+	VISIBLE_CB_AUTO,
+	VISIBLE_FAN_LEASE,
+	VISIBLE_ARBITER,
+};
+
+/*
+ * The visibility of the attributes depends on the current configuration of
+ * the instance, it is evaluated again by conf_switch(). Nothing is visible
+ * without one, and the groups of the system-wide features are only visible
+ * on the main instance.
+ */
+static umode_t msi_ec_visibility(struct kobject *kobj, struct attribute *attr,
+				 enum msi_ec_visibility kind)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(kobj_to_dev(kobj));
+	const struct msi_ec_conf *conf;
+	int address = -1;
+	bool visible;
+	int idx;
+
+	if (kind != VISIBLE_ATTR && !msi_ec_is_main(ec))
+		return 0;
+
+	conf = conf_read_lock(ec, &idx);
+
+	if (!conf) {
+		visible = false;
+	} else {
+		switch (kind) {
+		case VISIBLE_ATTR:
+			address = msi_ec_attr_address(conf, attr);
+			break;
+		case VISIBLE_PROFILE:
+			address = msi_power_profile_attr_address(conf, attr);
+			break;
+		case VISIBLE_PM_QOS:
+			address = conf->shift_mode.address;
+			break;
+		case VISIBLE_CB_AUTO:
+			address = msi_cb_auto_supported(conf) ? -1 :
+								MSI_EC_ADDR_UNSUPP;
+			break;
+		case VISIBLE_FAN_LEASE:
+			address = conf->fan_mode.address;
+			break;
+		case VISIBLE_ARBITER:
+			address = msi_arbiter_supported(conf) ? -1 :
+								MSI_EC_ADDR_UNSUPP;
+			break;
+		}
+
+		visible = address != MSI_EC_ADDR_UNSUPP;
+	}
+
+	conf_read_unlock(idx);
+
+	return visible ? attr->mode : 0;
+}
+
+static umode_t msi_ec_is_visible(struct kobject *kobj,
+				 struct attribute *attr,
+				 int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_ATTR);
+}
+
+static umode_t msi_pm_qos_is_visible(struct kobject *kobj,
+				     struct attribute *attr,
+				     int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_PM_QOS);
+}
+
+static umode_t msi_power_profile_is_visible(struct kobject *kobj,
+					    struct attribute *attr,
+					    int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_PROFILE);
+}
+
+static umode_t msi_cb_auto_is_visible(struct kobject *kobj,
+				      struct attribute *attr,
+				      int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_CB_AUTO);
+}
+
+static umode_t msi_fan_lease_is_visible(struct kobject *kobj,
+					struct attribute *attr,
+					int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_FAN_LEASE);
+}
+
+static umode_t msi_arbiter_is_visible(struct kobject *kobj,
+				      struct attribute *attr,
+				      int idx)
+{
+	return msi_ec_visibility(kobj, attr, VISIBLE_ARBITER);
+}
+
+static struct attribute_group msi_root_group = {
+	.is_visible = msi_ec_is_visible,
+	.attrs = msi_ec_feature_attrs[MSI_EC_GROUP_ROOT],
+};
+
+static struct attribute_group msi_cpu_group = {
+	.name = "cpu",
+	.is_visible = msi_ec_is_visible,
+	.attrs = msi_ec_feature_attrs[MSI_EC_GROUP_CPU],
+};
+static struct attribute_group msi_gpu_group = {
+	.name = "gpu",
+	.is_visible = msi_ec_is_visible,
+	.attrs = msi_ec_feature_attrs[MSI_EC_GROUP_GPU],
+};
+
+static struct attribute_group msi_pm_qos_group = {
+	.name = "pm_qos",
+	.is_visible = msi_pm_qos_is_visible,
+	.attrs = msi_pm_qos_attrs,
+};
+
+static struct attribute_group msi_ac_profile_group = {
+	.name = "ac_profile",
+	.is_visible = msi_power_profile_is_visible,
+	.attrs = msi_ac_profile_attrs,
+};
+
+static struct attribute_group msi_battery_profile_group = {
+	.name = "battery_profile",
+	.is_visible = msi_power_profile_is_visible,
+	.attrs = msi_battery_profile_attrs,
+};
+
+static struct attribute_group msi_cb_auto_group = {
+	.name = "cooler_boost_auto",
+	.is_visible = msi_cb_auto_is_visible,
+	.attrs = msi_cb_auto_attrs,
+};
+
+static struct attribute_group msi_fan_lease_group = {
+	.name = "fan_lease",
+	.is_visible = msi_fan_lease_is_visible,
+	.attrs = msi_fan_lease_attrs,
+};
+
+static struct attribute_group msi_arbiter_group = {
+	.name = "mode_arbiter",
+	.is_visible = msi_arbiter_is_visible,
+	.attrs = msi_arbiter_attrs,
+};
+
+static const struct attribute_group msi_debug_group = {
+	.name = "debug",
+	.attrs = msi_debug_attrs,
+};
+
+/* the debug group is created separately if needed */
+static const struct attribute_group *msi_platform_groups[] = {
+	&msi_root_group,
+	&msi_cpu_group,
+	&msi_gpu_group,
+	&msi_pm_qos_group,
+	&msi_ac_profile_group,
+	&msi_battery_profile_group,
+	&msi_cb_auto_group,
+	&msi_fan_lease_group,
+	&msi_arbiter_group,
+	NULL
+};
+
+/*
+ * Init stage timings, exported through debugfs. Only the identification and
+ * the driver registration run in the module init; the probe runs
+ * asynchronously and the battery hook, LEDs and background features are
+ * brought up by a work item, so a slow EC does not hold up the boot.
+ */
+enum msi_ec_init_stage {
+	INIT_IDENTIFY,
+	INIT_REGISTER,
+	INIT_PROBE,
+	INIT_BATTERY,
+	INIT_LEDS,
+	INIT_HWMON,
+	INIT_PM_QOS,
+	INIT_FAN_LEASE,
+	INIT_STATE,
+	INIT_POWER_PROFILE,
+	INIT_PMU,
+	INIT_STAGES_COUNT
+};
+
+static const char *const init_stage_names[INIT_STAGES_COUNT] = {
+	[INIT_IDENTIFY] = "identify",
+	[INIT_REGISTER] = "register",
+	[INIT_PROBE] = "probe",
+	[INIT_BATTERY] = "battery",
+	[INIT_LEDS] = "leds",
+	[INIT_HWMON] = "hwmon",
+	[INIT_PM_QOS] = "pm_qos",
+	[INIT_FAN_LEASE] = "fan_lease",
+	[INIT_STATE] = "state",
+	[INIT_POWER_PROFILE] = "power_profile",
+	[INIT_PMU] = "pmu",
+};
+
+struct msi_ec_init_timing {
+	u64 start_ns; // since the module init started
+	u64 duration_ns;
+	bool done;
+};
+
+static struct msi_ec_init_timing init_timings[INIT_STAGES_COUNT];
+static u64 init_start_ns;
+
+static void init_stage_begin(enum msi_ec_init_stage stage)
+{
+	init_timings[stage].start_ns = ktime_get_ns() - init_start_ns;
+}
+
+static void init_stage_end(enum msi_ec_init_stage stage)
+{
+	struct msi_ec_init_timing *timing = &init_timings[stage];
+
+	timing->duration_ns = ktime_get_ns() - init_start_ns - timing->start_ns;
+	timing->done = true;
+}
+
+static int msi_platform_probe(struct platform_device *pdev)
+{
+	// the emulated instances are numbered, the main one is not
+	struct msi_ec_device *ec = pdev->id == PLATFORM_DEVID_NONE ?
+		&msi_ec_main : msi_ec_emulated[pdev->id];
+
+	int result;
+
+	platform_set_drvdata(pdev, ec);
+
+	// the init stages are those of the main instance
+	if (msi_ec_is_main(ec))
+		init_stage_begin(INIT_PROBE);
+
+	// otherwise it is read on the first access
+	result = identity_refresh(ec);
+	if (result < 0)
+		pr_warn("%s: failed to read the firmware identity: %d\n",
+			ec->name, result);
+
+	if (debug) {
+		result = sysfs_create_group(&pdev->dev.kobj, &msi_debug_group);
+		if (result < 0)
+			return result;
+	}
+
+	if (msi_ec_is_main(ec))
+		init_stage_end(INIT_PROBE);
+
+	return 0;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0))
+static void msi_platform_remove(struct platform_device *pdev)
+#else
+static int msi_platform_remove(struct platform_device *pdev)
+#endif
+{
+	if (debug)
+		sysfs_remove_group(&pdev->dev.kobj, &msi_debug_group);
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0))
+	return 0;
+#endif
+}
+
+// the firmware may have been updated while suspended
+static int __maybe_unused msi_platform_resume(struct device *dev)
+{
+	identity_invalidate(dev_get_drvdata(dev));
+	return 0;
+}
+
+static SIMPLE_DEV_PM_OPS(msi_platform_pm_ops, NULL, msi_platform_resume);
+
+static struct platform_driver msi_platform_driver = {
+	.driver = {
+		.name = MSI_EC_DRIVER_NAME,
+		.dev_groups = msi_platform_groups,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = &msi_platform_pm_ops,
+	},
+	.probe = msi_platform_probe,
+	.remove = msi_platform_remove,
+};
+
+// ============================================================ //
+// Debugfs statistics
+// ============================================================ //
+
+/*
+ * /sys/kernel/debug/msi-ec/
+ *   ec_access   per-address read/write and error counts
+ *   ec_latency  log2 latency histograms of EC reads and writes
+ *   attributes  per-attribute call counts, cumulative time and EC
+ *               transactions
+ *   locks       wait and hold times of the driver mutexes
+ *   reset       write anything to clear all of the above
+ *   ec_image    the memory image of the emulated EC backend, if selected
+ *   ec_trace    the recorded EC transaction trace, in binary form
+ *   ec_trace_enable
+ *               write 1 to start a new recording, 0 to stop it
+ *   ec_replay   write a trace to replay it with the replay backend, read
+ *               for the replay progress
+ *   thermal/    parameters and state of the thermal backend, if selected
+ *   init        start and duration of the init stages
+ */
+
+static struct dentry *msi_ec_debugfs;
+
+// the EC locks are those of the main instance
+// the locks of the instances are added by msi_ec_for_each_lock()
+static struct msi_ec_lock *const msi_ec_locks[] = {
+	&ec_trace_mutex,
+	&qos_hold_mutex,
+	&fan_lease_mutex,
+	&arbiter_mutex,
+	&power_profile_mutex,
+	&cb_auto_mutex,
+};
+
+static const struct attribute_group *msi_stats_debug_groups[] = {
+	&msi_debug_group,
+	NULL
+};
+
+// every wrapped attribute is reachable from one of these
+static const struct attribute_group *const *msi_stats_group_lists[] = {
+	msi_platform_groups,
+	msi_battery_groups,
+	msi_stats_debug_groups,
+};
+
+static void msi_ec_for_each_attr(void (*fn)(struct msi_ec_attribute *ma,
+					    void *data),
+				 void *data)
+{
+	const struct attribute_group *const *groups;
+	struct attribute **attrs;
+
+	for (int i = 0; i < ARRAY_SIZE(msi_stats_group_lists); i++)
+		for (groups = msi_stats_group_lists[i]; *groups; groups++)
+			for (attrs = (*groups)->attrs; *attrs; attrs++)
+				fn(to_msi_ec_attr(container_of(*attrs,
+						struct device_attribute, attr)),
+				   data);
+}
+
+static int ec_access_show(struct seq_file *m, void *v)
+{
+	seq_puts(m, "addr  reads        writes       read_errors  write_errors\n");
+
+	for (int addr = 0; addr < 256; addr++) {
+		u64 reads = 0, writes = 0, read_errors = 0, write_errors = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			struct msi_ec_access_stats *stats =
+				per_cpu_ptr(ec_access_stats, cpu);
+
+			reads += stats->reads[addr];
+			writes += stats->writes[addr];
+			read_errors += stats->read_errors[addr];
+			write_errors += stats->write_errors[addr];
+		}
+
+		if (!reads && !writes)
+			continue;
+
+		seq_printf(m, "0x%02x  %-12llu %-12llu %-12llu %llu\n", addr,
+			   reads, writes, read_errors, write_errors);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ec_access);
+
+static int ec_latency_show(struct seq_file *m, void *v)
+{
+	seq_puts(m, "min_ns        reads        writes\n");
+
+	for (int i = 0; i < MSI_EC_LATENCY_BUCKETS; i++) {
+		u64 reads = 0, writes = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			struct msi_ec_access_stats *stats =
+				per_cpu_ptr(ec_access_stats, cpu);
+
+			reads += stats->read_latency[i];
+			writes += stats->write_latency[i];
+		}
+
+		seq_printf(m, "%-13llu %-12llu %llu\n", i ? 1ULL << i : 0ULL,
+			   reads, writes);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ec_latency);
+
+static void attr_stats_show_one(struct msi_ec_attribute *ma, void *data)
+{
+	struct seq_file *m = data;
+	struct msi_ec_attr_stats sum = {};
+	int cpu;
+
+	if (!ma->stats)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct msi_ec_attr_stats *stats = per_cpu_ptr(ma->stats, cpu);
+
+		sum.shows += stats->shows;
+		sum.stores += stats->stores;
+		sum.show_ns += stats->show_ns;
+		sum.store_ns += stats->store_ns;
+		sum.show_ec_reads += stats->show_ec_reads;
+		sum.show_ec_writes += stats->show_ec_writes;
+		sum.store_ec_reads += stats->store_ec_reads;
+		sum.store_ec_writes += stats->store_ec_writes;
+	}
+
+	if (!sum.shows && !sum.stores)
+		return;
+
+	seq_printf(m, "%-40s %-10llu %-14llu %-10llu %-10llu %-10llu %-14llu %-10llu %llu\n",
+		   ma->path, sum.shows, sum.show_ns, sum.show_ec_reads,
+		   sum.show_ec_writes, sum.stores, sum.store_ns,
+		   sum.store_ec_reads, sum.store_ec_writes);
+}
+
+static int attributes_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%-40s %-10s %-14s %-10s %-10s %-10s %-14s %-10s %s\n",
+		   "attribute", "shows", "show_ns", "ec_reads", "ec_writes",
+		   "stores", "store_ns", "ec_reads", "ec_writes");
+	msi_ec_for_each_attr(attr_stats_show_one, m);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(attributes);
+
+static void msi_ec_instance_for_each_lock(struct msi_ec_device *ec,
+					  void (*fn)(struct msi_ec_lock *lock,
+						     const char *instance,
+						     void *data),
+					  void *data)
+{
+	fn(&ec->backend_mutex, ec->name, data);
+	fn(&ec->ec_set_by_mask_mutex, ec->name, data);
+	fn(&ec->ec_unset_by_mask_mutex, ec->name, data);
+	fn(&ec->ec_set_bit_mutex, ec->name, data);
+	fn(&ec->identity_mutex, ec->name, data);
+	if (ec->hwmon)
+		fn(&ec->hwmon->sample_mutex, ec->name, data);
+}
+
+/*
+ * Calls fn for the global locks, with a NULL instance, then for the locks of
+ * every instance. The instances and their hwmon devices are only added and
+ * removed with conf_switch_mutex held, which is held here.
+ */
+static void msi_ec_for_each_lock(void (*fn)(struct msi_ec_lock *lock,
+					    const char *instance, void *data),
+				 void *data)
+{
+	mutex_lock(&conf_switch_mutex);
+
+	for (int i = 0; i < ARRAY_SIZE(msi_ec_locks); i++)
+		fn(msi_ec_locks[i], NULL, data);
+
+	msi_ec_instance_for_each_lock(&msi_ec_main, fn, data);
+	for (int i = 0; i < MSI_EC_MAX_EMULATED; i++)
+		if (msi_ec_emulated[i])
+			msi_ec_instance_for_each_lock(msi_ec_emulated[i], fn,
+						      data);
+
+	mutex_unlock(&conf_switch_mutex);
+}
+
+static void lock_stats_show_one(struct msi_ec_lock *lock,
+				const char *instance, void *data)
+{
+	struct seq_file *m = data;
+	char name[48];
+
+	if (instance)
+		snprintf(name, sizeof(name), "%s/%s", instance, lock->name);
+	else
+		strscpy(name, lock->name, sizeof(name));
+
+	seq_printf(m, "%-32s %-12llu %-12llu %-14llu %-12llu %-14llu %llu\n",
+		   name, READ_ONCE(lock->acquisitions),
+		   READ_ONCE(lock->contentions), READ_ONCE(lock->wait_ns),
+		   READ_ONCE(lock->wait_max_ns), READ_ONCE(lock->hold_ns),
+		   READ_ONCE(lock->hold_max_ns));
+}
+
+static int locks_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%-32s %-12s %-12s %-14s %-12s %-14s %s\n", "lock",
+		   "acquisitions", "contentions", "wait_ns", "wait_max_ns",
+		   "hold_ns", "hold_max_ns");
+	msi_ec_for_each_lock(lock_stats_show_one, m);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(locks);
+
+static void attr_stats_reset_one(struct msi_ec_attribute *ma, void *data)
+{
+	int cpu;
+
+	if (!ma->stats)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ma->stats, cpu), 0,
+		       sizeof(struct msi_ec_attr_stats));
+}
+
+// the statistics are only updated with the mutex held, so they are reset too
+static void lock_stats_reset_one(struct msi_ec_lock *lock,
+				 const char *instance, void *data)
+{
+	mutex_lock(&lock->mutex);
+	lock->acquisitions = 0;
+	lock->contentions = 0;
+	lock->wait_ns = 0;
+	lock->wait_max_ns = 0;
+	lock->hold_ns = 0;
+	lock->hold_max_ns = 0;
+	mutex_unlock(&lock->mutex);
+}
+
+static ssize_t reset_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	// counters updated concurrently with the reset may survive it
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ec_access_stats, cpu), 0,
+		       sizeof(struct msi_ec_access_stats));
+
+	msi_ec_for_each_attr(attr_stats_reset_one, NULL);
+	msi_ec_for_each_lock(lock_stats_reset_one, NULL);
+
+	return count;
+}
+
+static const struct file_operations reset_fops = {
+	.owner = THIS_MODULE,
+	.write = reset_write,
+	.llseek = noop_llseek,
+};
+
+// the private data is the instance
+static ssize_t ec_image_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct msi_ec_device *ec = file->private_data;
+	ssize_t result;
+
+	msi_ec_lock(&ec->backend_mutex);
+	result = simple_read_from_buffer(buf, count, ppos, ec->image,
+					 sizeof(ec->image));
+	msi_ec_unlock(&ec->backend_mutex);
+
+	return result;
+}
+
+static ssize_t ec_image_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct msi_ec_device *ec = file->private_data;
+	ssize_t result;
+
+	msi_ec_lock(&ec->backend_mutex);
+	result = simple_write_to_buffer(ec->image, sizeof(ec->image), ppos,
+					buf, count);
+	msi_ec_unlock(&ec->backend_mutex);
+
+	// the image may hold another firmware
+	identity_invalidate(ec);
+
+	return result;
+}
+
+static const struct file_operations ec_image_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ec_image_read,
+	.write = ec_image_write,
+	.llseek = default_llseek,
+};
+
+// the trace is copied on open, so it is consistent however it is read
+struct ec_trace_snapshot {
+	size_t size;
+	u8 data[];
+};
+
+static int ec_trace_open(struct inode *inode, struct file *file)
+{
+	struct msi_ec_trace_header header = {
+		.magic = MSI_EC_TRACE_MAGIC,
+		.version = cpu_to_le32(MSI_EC_TRACE_VERSION),
+	};
+	struct ec_trace_snapshot *snapshot;
+	size_t records_size;
+
+	msi_ec_lock(&ec_trace_mutex);
+	records_size = array_size(ec_trace_rec.count,
+				  sizeof(*ec_trace_rec.records));
+	snapshot = vmalloc(struct_size(snapshot, data,
+				       sizeof(header) + records_size));
+	if (!snapshot) {
+		msi_ec_unlock(&ec_trace_mutex);
+		return -ENOMEM;
+	}
+
+	header.count = cpu_to_le32(ec_trace_rec.count);
+	header.dropped = cpu_to_le32(ec_trace_rec.dropped);
+	snapshot->size = sizeof(header) + records_size;
+	memcpy(snapshot->data, &header, sizeof(header));
+	if (records_size)
+		memcpy(snapshot->data + sizeof(header), ec_trace_rec.records,
+		       records_size);
+	msi_ec_unlock(&ec_trace_mutex);
+
+	file->private_data = snapshot;
+	return 0;
+}
+
+static ssize_t ec_trace_read(struct file *file, char __user *buf, size_t count,
+			     loff_t *ppos)
+{
+	struct ec_trace_snapshot *snapshot = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snapshot->data,
+				       snapshot->size);
+}
+
+static int ec_trace_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations ec_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = ec_trace_open,
+	.read = ec_trace_read,
+	.release = ec_trace_release,
+	.llseek = default_llseek,
+};
+
+static ssize_t ec_trace_enable_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	char status[2] = { '0', '\n' };
+
+	status[0] += READ_ONCE(ec_trace_recording);
+	return simple_read_from_buffer(buf, count, ppos, status,
+				       sizeof(status));
+}
+
+static ssize_t ec_trace_enable_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	bool enable;
+	int result;
+
+	result = kstrtobool_from_user(buf, count, &enable);
+	if (result < 0)
+		return result;
+
+	msi_ec_lock(&ec_trace_mutex);
+	if (enable) {
+		// the driver is loaded, a replay starts right away
+		result = ec_trace_start();
+		if (!result)
+			ec_trace_mark();
+	} else {
+		WRITE_ONCE(ec_trace_recording, false);
+	}
+	msi_ec_unlock(&ec_trace_mutex);
+
+	return result < 0 ? result : count;
+}
+
+static const struct file_operations ec_trace_enable_fops = {
+	.owner = THIS_MODULE,
+	.read = ec_trace_enable_read,
+	.write = ec_trace_enable_write,
+	.llseek = default_llseek,
+};
+
+/*
+ * A trace written to ec_replay is collected in a buffer of the largest
+ * accepted size and replaces the replayed trace when the file is closed.
+ * The header is checked as soon as it is complete.
+ */
+struct ec_replay_upload {
+	size_t size;
+	size_t written;
+	u8 data[];
+};
+
+static size_t ec_replay_trace_size(const struct msi_ec_trace_header *header)
+{
+	return sizeof(*header) + array_size(le32_to_cpu(header->count),
+					    sizeof(struct msi_ec_trace_record));
+}
+
+static int ec_replay_open(struct inode *inode, struct file *file)
+{
+	struct ec_replay_upload *upload;
+	size_t size;
+
+	if (!(file->f_mode & FMODE_WRITE))
+		return 0;
+
+	size = sizeof(struct msi_ec_trace_header) +
+	       array_size(ec_trace_records, sizeof(struct msi_ec_trace_record));
+	upload = vmalloc(struct_size(upload, data, size));
+	if (!upload)
+		return -ENOMEM;
+
+	upload->size = size;
+	upload->written = 0;
+	file->private_data = upload;
+
+	return 0;
+}
+
+static ssize_t ec_replay_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	char status[64];
+	int len;
+
+	msi_ec_lock(&msi_ec_main.backend_mutex);
+	len = scnprintf(status, sizeof(status), "%u/%u %u\n",
+			ec_trace_replay.position, ec_trace_replay.count,
+			ec_trace_replay.dropped);
+	msi_ec_unlock(&msi_ec_main.backend_mutex);
+
+	return simple_read_from_buffer(buf, count, ppos, status, len);
+}
+
+static ssize_t ec_replay_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct ec_replay_upload *upload = file->private_data;
+	const struct msi_ec_trace_header *header = (void *)upload->data;
+	ssize_t result;
+
+	if (*ppos + count > upload->size)
+		return -EFBIG;
+
+	result = simple_write_to_buffer(upload->data, upload->size, ppos, buf,
+					count);
+	if (result < 0)
+		return result;
+
+	upload->written = max_t(size_t, upload->written, *ppos);
+	if (upload->written < sizeof(*header))
+		return result;
+
+	if (memcmp(header->magic, MSI_EC_TRACE_MAGIC, sizeof(header->magic)) ||
+	    le32_to_cpu(header->version) != MSI_EC_TRACE_VERSION)
+		return -EINVAL;
+
+	if (ec_replay_trace_size(header) > upload->size)
+		return -EFBIG;
+
+	return result;
+}
+
+static int ec_replay_release(struct inode *inode, struct file *file)
+{
+	struct ec_replay_upload *upload = file->private_data;
+	const struct msi_ec_trace_header *header;
+	struct msi_ec_trace_record *records;
+	unsigned int count;
+	unsigned int start;
+
+	if (!upload)
+		return 0;
+
+	header = (void *)upload->data;
+
+	if (upload->written < sizeof(*header) ||
+	    upload->written != ec_replay_trace_size(header)) {
+		pr_warn("Incomplete EC trace ignored\n");
+		goto out;
+	}
+
+	count = le32_to_cpu(header->count);
+	records = vmalloc(array_size(count, sizeof(*records)));
+	if (!records)
+		goto out;
+
+	memcpy(records, upload->data + sizeof(*header),
+	       array_size(count, sizeof(*records)));
+
+	// the transactions of the load are skipped
+	for (start = 0; start < count; start++)
+		if (records[start].flags & MSI_EC_TRACE_MARKER)
+			break;
+
+	if (start == count) {
+		pr_warn("EC trace without a start marker ignored\n");
+		vfree(records);
+		goto out;
+	}
+
+	msi_ec_lock(&msi_ec_main.backend_mutex);
+	swap(ec_trace_replay.records, records);
+	ec_trace_replay.count = count;
+	ec_trace_replay.position = start + 1;
+	ec_trace_replay.dropped = 0;
+	msi_ec_unlock(&msi_ec_main.backend_mutex);
+
+	vfree(records);
+out:
+	vfree(upload);
+	return 0;
+}
+
+static const struct file_operations ec_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = ec_replay_open,
+	.read = ec_replay_read,
+	.write = ec_replay_write,
+	.release = ec_replay_release,
+	.llseek = default_llseek,
+};
+
+static int init_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%-14s %12s %12s\n", "stage", "start_us", "duration_us");
+
+	for (int i = 0; i < INIT_STAGES_COUNT; i++) {
+		const struct msi_ec_init_timing *timing = &init_timings[i];
+
+		if (!READ_ONCE(timing->done)) {
+			seq_printf(m, "%-14s %12s %12s\n", init_stage_names[i],
+				   "-", "-");
+			continue;
+		}
+
+		seq_printf(m, "%-14s %12llu %12llu\n", init_stage_names[i],
+			   div_u64(timing->start_ns, NSEC_PER_USEC),
+			   div_u64(timing->duration_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(init);
+
+static int thermal_state_show(struct seq_file *m, void *v)
+{
+	msi_ec_lock(&msi_ec_main.backend_mutex);
+	seq_printf(m, "time_ms   %llu\n",
+		   div_u64(sim_state.clock_ns, NSEC_PER_MSEC));
+	seq_printf(m, "cpu_temp  %d\n", sim_state.cpu_temp);
+	seq_printf(m, "cpu_fan   %d\n", sim_state.cpu_fan);
+	seq_printf(m, "gpu_temp  %d\n", sim_state.gpu_temp);
+	seq_printf(m, "gpu_fan   %d\n", sim_state.gpu_fan);
+	msi_ec_unlock(&msi_ec_main.backend_mutex);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(thermal_state);
+
+static void __init thermal_debugfs_init(void)
+{
+	struct dentry *dir = debugfs_create_dir("thermal", msi_ec_debugfs);
+
+	debugfs_create_u32("ambient", 0600, dir, &sim_params.ambient);
+	debugfs_create_u32("cpu_load", 0600, dir, &sim_params.cpu_load);
+	debugfs_create_u32("gpu_load", 0600, dir, &sim_params.gpu_load);
+	debugfs_create_u32("tau_ms", 0600, dir, &sim_params.tau_ms);
+	debugfs_create_u32("fan_tau_ms", 0600, dir, &sim_params.fan_tau_ms);
+	debugfs_create_u32("step_us", 0600, dir, &sim_params.step_us);
+	debugfs_create_file("state", 0444, dir, NULL, &thermal_state_fops);
+}
+
+static void attr_stats_alloc_one(struct msi_ec_attribute *ma, void *data)
+{
+	// an attribute may be listed in more than one group
+	if (!ma->stats)
+		ma->stats = alloc_percpu(struct msi_ec_attr_stats);
+}
+
+static void attr_stats_free_one(struct msi_ec_attribute *ma, void *data)
+{
+	free_percpu(ma->stats);
+	ma->stats = NULL;
+}
+
+// must be called before the first EC access to account for all of them
+static void __init msi_ec_stats_init(void)
+{
+	ec_access_stats = alloc_percpu(struct msi_ec_access_stats);
+	if (!ec_access_stats) {
+		pr_warn("EC access statistics are unavailable\n");
+		return;
+	}
+
+	msi_ec_for_each_attr(attr_stats_alloc_one, NULL);
+
+	msi_ec_debugfs = debugfs_create_dir(MSI_EC_DRIVER_NAME, NULL);
+	debugfs_create_file("ec_access", 0444, msi_ec_debugfs, NULL,
+			    &ec_access_fops);
+	debugfs_create_file("ec_latency", 0444, msi_ec_debugfs, NULL,
+			    &ec_latency_fops);
+	debugfs_create_file("attributes", 0444, msi_ec_debugfs, NULL,
+			    &attributes_fops);
+	debugfs_create_file("locks", 0444, msi_ec_debugfs, NULL, &locks_fops);
+	debugfs_create_file("reset", 0200, msi_ec_debugfs, NULL, &reset_fops);
+	debugfs_create_file("init", 0444, msi_ec_debugfs, NULL, &init_fops);
+
+	debugfs_create_file("ec_trace", 0400, msi_ec_debugfs, NULL,
+			    &ec_trace_fops);
+	debugfs_create_file("ec_trace_enable", 0600, msi_ec_debugfs, NULL,
+			    &ec_trace_enable_fops);
+
+	if (msi_ec_main.backend != &acpi_ec_backend)
+		debugfs_create_file_size("ec_image", 0600, msi_ec_debugfs,
+					 &msi_ec_main, &ec_image_fops,
+					 sizeof(msi_ec_main.image));
+
+	if (msi_ec_main.backend == &replay_ec_backend)
+		debugfs_create_file("ec_replay", 0600, msi_ec_debugfs, NULL,
+				    &ec_replay_fops);
+
+	if (msi_ec_main.backend == &sim_ec_backend)
+		thermal_debugfs_init();
+}
+
+// must be called after the attributes are removed
+static void msi_ec_stats_exit(void)
+{
+	debugfs_remove_recursive(msi_ec_debugfs);
+	msi_ec_debugfs = NULL;
+
+	if (!ec_access_stats)
+		return;
+
+	msi_ec_for_each_attr(attr_stats_free_one, NULL);
+	free_percpu(ec_access_stats);
+	ec_access_stats = NULL;
+}
+
+// ============================================================ //
+// Perf PMU
+// ============================================================ //
+
+/*
+ * The "msi_ec" PMU exposes the realtime sensors as perf events, so they can
+ * be counted on the same timeline as other events:
+ *
+ *   perf stat -a -I 1000 -e msi_ec/cpu_temp/,cycles,instructions
+ *
+ * EC reads may sleep, so the sensors are sampled by a worker every
+ * PMU_SAMPLE_INTERVAL_MS while events are active. Like energy counters,
+ * events count the sensor value integrated over time (value * ns, scaled to
+ * value * s), so the count of an interval divided by its length is the
+ * average sensor value over that interval.
+ */
+
+#define PMU_SAMPLE_INTERVAL_MS 100
+
+enum msi_ec_pmu_event {
+	PMU_CPU_TEMP,
+	PMU_CPU_FAN_SPEED,
+	PMU_GPU_TEMP,
+	PMU_GPU_FAN_SPEED,
+	PMU_EVENTS_COUNT
+};
+
+static DEFINE_RAW_SPINLOCK(pmu_lock);
+static u64 pmu_integrals[PMU_EVENTS_COUNT]; // value * ns until pmu_sampled_at
+static u8 pmu_values[PMU_EVENTS_COUNT];
+static u64 pmu_sampled_at;
+static atomic_t pmu_active = ATOMIC_INIT(0);
+static unsigned int pmu_cpu; // the events are counted on this cpu
+static bool pmu_registered;
+static enum cpuhp_state pmu_cpuhp_state = CPUHP_INVALID;
+
+static int pmu_event_address(int id)
+{
+	const struct msi_ec_conf *conf;
+	int address;
+	int idx;
+
+	conf = conf_read_lock(&msi_ec_main, &idx);
+	switch (id) {
+	case PMU_CPU_TEMP:
+		address = msi_ec_sensor_address(conf, "cpu", MSI_EC_SENSOR_TEMP);
+		break;
+	case PMU_CPU_FAN_SPEED:
+		address = msi_ec_sensor_address(conf, "cpu", MSI_EC_SENSOR_FAN);
+		break;
+	case PMU_GPU_TEMP:
+		address = msi_ec_sensor_address(conf, "gpu", MSI_EC_SENSOR_TEMP);
+		break;
+	case PMU_GPU_FAN_SPEED:
+		address = msi_ec_sensor_address(conf, "gpu", MSI_EC_SENSOR_FAN);
+		break;
+	default:
+		address = MSI_EC_ADDR_UNSUPP;
+		break;
+	}
+	conf_read_unlock(idx);
+
+	return address;
+}
+
+// must be called with pmu_lock held
+static u64 pmu_integral(int id)
+{
+	return pmu_integrals[id] +
+	       (u64)pmu_values[id] * (ktime_get_ns() - pmu_sampled_at);
+}
+
+static void pmu_sample_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(pmu_sample_work, pmu_sample_fn);
+
+static void pmu_sample_fn(struct work_struct *work)
+{
+	u8 values[PMU_EVENTS_COUNT];
+	unsigned long flags;
+	u64 now;
+
+	// the previous value is kept if a sensor can't be read
+	for (int id = 0; id < PMU_EVENTS_COUNT; id++) {
+		int address = pmu_event_address(id);
+		u8 value;
+
+		values[id] = pmu_values[id];
+		if (address != MSI_EC_ADDR_UNSUPP &&
+		    msi_ec_read(&msi_ec_main, address, &value) >= 0)
+			values[id] = value;
+	}
+
+	raw_spin_lock_irqsave(&pmu_lock, flags);
+	now = ktime_get_ns();
+	for (int id = 0; id < PMU_EVENTS_COUNT; id++) {
+		pmu_integrals[id] +=
+			(u64)pmu_values[id] * (now - pmu_sampled_at);
+		pmu_values[id] = values[id];
+	}
+	pmu_sampled_at = now;
+	raw_spin_unlock_irqrestore(&pmu_lock, flags);
+
+	if (atomic_read(&pmu_active))
+		schedule_delayed_work(&pmu_sample_work,
+				      msecs_to_jiffies(PMU_SAMPLE_INTERVAL_MS));
+}
+
+static u64 msi_ec_pmu_read_integral(struct perf_event *event)
+{
+	unsigned long flags;
+	u64 integral;
+
+	raw_spin_lock_irqsave(&pmu_lock, flags);
+	integral = pmu_integral(event->attr.config);
+	raw_spin_unlock_irqrestore(&pmu_lock, flags);
+
+	return integral;
+}
+
+static void msi_ec_pmu_read(struct perf_event *event)
+{
+	u64 integral = msi_ec_pmu_read_integral(event);
+	u64 prev = local64_xchg(&event->hw.prev_count, integral);
+
+	local64_add(integral - prev, &event->count);
+}
+
+static int msi_ec_pmu_event_init(struct perf_event *event)
+{
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	// the sensors are system-wide and are only counted
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EINVAL;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (event->attr.config >= PMU_EVENTS_COUNT ||
+	    pmu_event_address(event->attr.config) == MSI_EC_ADDR_UNSUPP)
+		return -EINVAL;
+
+	// the sampling worker would not follow the replayed trace
+	if (msi_ec_replaying(&msi_ec_main))
+		return -EBUSY;
+
+	event->cpu = READ_ONCE(pmu_cpu);
+
+	return 0;
+}
+
+static void msi_ec_pmu_start(struct perf_event *event, int flags)
+{
+	local64_set(&event->hw.prev_count, msi_ec_pmu_read_integral(event));
+	event->hw.state = 0;
+
+	if (atomic_inc_return(&pmu_active) == 1)
+		mod_delayed_work(system_wq, &pmu_sample_work, 0);
+}
+
+static void msi_ec_pmu_stop(struct perf_event *event, int flags)
+{
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+
+	msi_ec_pmu_read(event);
+	atomic_dec(&pmu_active);
+	event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+static int msi_ec_pmu_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+
+	if (flags & PERF_EF_START)
+		msi_ec_pmu_start(event, PERF_EF_RELOAD);
+
+	return 0;
+}
+
+static void msi_ec_pmu_del(struct perf_event *event, int flags)
+{
+	msi_ec_pmu_stop(event, PERF_EF_UPDATE);
+}
+
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf,
+				       cpumask_of(READ_ONCE(pmu_cpu)));
+}
+
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *msi_ec_pmu_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL
+};
+
+static struct attribute_group msi_ec_pmu_attr_group = {
+	.attrs = msi_ec_pmu_attrs,
+};
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *msi_ec_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL
+};
+
+static struct attribute_group msi_ec_pmu_format_group = {
+	.name = "format",
+	.attrs = msi_ec_pmu_format_attrs,
+};
+
+#define MSI_EC_PMU_EVENT_ATTR(_var, _name, _id, _str)			\
+static struct perf_pmu_events_attr pmu_event_attr_##_var = {		\
+	.attr = __ATTR(_name, 0444, perf_event_sysfs_show, NULL),	\
+	.id = _id,							\
+	.event_str = _str,						\
+}
+
+MSI_EC_PMU_EVENT_ATTR(cpu_temp, cpu_temp, PMU_CPU_TEMP, "event=0x00");
+MSI_EC_PMU_EVENT_ATTR(cpu_temp_unit, cpu_temp.unit, PMU_CPU_TEMP, "C*s");
+MSI_EC_PMU_EVENT_ATTR(cpu_temp_scale, cpu_temp.scale, PMU_CPU_TEMP, "1e-9");
+MSI_EC_PMU_EVENT_ATTR(cpu_fan_speed, cpu_fan_speed, PMU_CPU_FAN_SPEED,
+		      "event=0x01");
+MSI_EC_PMU_EVENT_ATTR(cpu_fan_speed_unit, cpu_fan_speed.unit,
+		      PMU_CPU_FAN_SPEED, "%*s");
+MSI_EC_PMU_EVENT_ATTR(cpu_fan_speed_scale, cpu_fan_speed.scale,
+		      PMU_CPU_FAN_SPEED, "1e-9");
+MSI_EC_PMU_EVENT_ATTR(gpu_temp, gpu_temp, PMU_GPU_TEMP, "event=0x02");
+MSI_EC_PMU_EVENT_ATTR(gpu_temp_unit, gpu_temp.unit, PMU_GPU_TEMP, "C*s");
+MSI_EC_PMU_EVENT_ATTR(gpu_temp_scale, gpu_temp.scale, PMU_GPU_TEMP, "1e-9");
+MSI_EC_PMU_EVENT_ATTR(gpu_fan_speed, gpu_fan_speed, PMU_GPU_FAN_SPEED,
+		      "event=0x03");
+MSI_EC_PMU_EVENT_ATTR(gpu_fan_speed_unit, gpu_fan_speed.unit,
+		      PMU_GPU_FAN_SPEED, "%*s");
+MSI_EC_PMU_EVENT_ATTR(gpu_fan_speed_scale, gpu_fan_speed.scale,
+		      PMU_GPU_FAN_SPEED, "1e-9");
+
+static struct attribute *msi_ec_pmu_event_attrs[] = {
+	&pmu_event_attr_cpu_temp.attr.attr,
+	&pmu_event_attr_cpu_temp_unit.attr.attr,
+	&pmu_event_attr_cpu_temp_scale.attr.attr,
+	&pmu_event_attr_cpu_fan_speed.attr.attr,
+	&pmu_event_attr_cpu_fan_speed_unit.attr.attr,
+	&pmu_event_attr_cpu_fan_speed_scale.attr.attr,
+	&pmu_event_attr_gpu_temp.attr.attr,
+	&pmu_event_attr_gpu_temp_unit.attr.attr,
+	&pmu_event_attr_gpu_temp_scale.attr.attr,
+	&pmu_event_attr_gpu_fan_speed.attr.attr,
+	&pmu_event_attr_gpu_fan_speed_unit.attr.attr,
+	&pmu_event_attr_gpu_fan_speed_scale.attr.attr,
+	NULL
+};
+
+static umode_t msi_ec_pmu_event_is_visible(struct kobject *kobj,
+					   struct attribute *attr, int idx)
+{
+	struct perf_pmu_events_attr *pmu_attr =
+		container_of(attr, struct perf_pmu_events_attr, attr.attr);
+
+	if (pmu_event_address(pmu_attr->id) == MSI_EC_ADDR_UNSUPP)
+		return 0;
+
+	return attr->mode;
+}
+
+static struct attribute_group msi_ec_pmu_event_group = {
+	.name = "events",
+	.is_visible = msi_ec_pmu_event_is_visible,
+	.attrs = msi_ec_pmu_event_attrs,
+};
+
+static const struct attribute_group *msi_ec_pmu_attr_groups[] = {
+	&msi_ec_pmu_attr_group,
+	&msi_ec_pmu_format_group,
+	&msi_ec_pmu_event_group,
+	NULL
+};
+
+static struct pmu msi_ec_pmu = {
+	.module = THIS_MODULE,
+	.task_ctx_nr = perf_invalid_context,
+	.attr_groups = msi_ec_pmu_attr_groups,
+	.capabilities = PERF_PMU_CAP_NO_INTERRUPT | PERF_PMU_CAP_NO_EXCLUDE,
+	.event_init = msi_ec_pmu_event_init,
+	.add = msi_ec_pmu_add,
+	.del = msi_ec_pmu_del,
+	.start = msi_ec_pmu_start,
+	.stop = msi_ec_pmu_stop,
+	.read = msi_ec_pmu_read,
+};
+
+// moves the events to another cpu when theirs goes offline
+static int msi_ec_pmu_offline_cpu(unsigned int cpu)
+{
+	unsigned int target;
+
+	if (cpu != pmu_cpu)
+		return 0;
+
+	target = cpumask_any_but(cpu_online_mask, cpu);
+	if (target >= nr_cpu_ids)
+		return 0;
+
+	// no events exist before the PMU is registered
+	if (READ_ONCE(pmu_registered))
+		perf_pmu_migrate_context(&msi_ec_pmu, cpu, target);
+	WRITE_ONCE(pmu_cpu, target);
+
+	return 0;
+}
+
+static int msi_ec_pmu_register(void)
+{
+	int result;
+
+	result = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN,
+					   "perf/msi_ec:online", NULL,
+					   msi_ec_pmu_offline_cpu);
+	if (result < 0)
+		return result;
+	pmu_cpuhp_state = result;
+
+	// the EC is not per-CPU, so all events are counted on a single CPU
+	cpus_read_lock();
+	WRITE_ONCE(pmu_cpu, cpumask_first(cpu_online_mask));
+	cpus_read_unlock();
+
+	result = perf_pmu_register(&msi_ec_pmu, "msi_ec", -1);
+	if (result < 0) {
+		cpuhp_remove_state_nocalls(pmu_cpuhp_state);
+		pmu_cpuhp_state = CPUHP_INVALID;
+		return result;
+	}
+
+	WRITE_ONCE(pmu_registered, true);
+	return 0;
+}
+
+static void msi_ec_pmu_unregister(void)
+{
+	if (!pmu_registered)
+		return;
+
+	cpuhp_remove_state_nocalls(pmu_cpuhp_state);
+	pmu_cpuhp_state = CPUHP_INVALID;
+	perf_pmu_unregister(&msi_ec_pmu);
+	cancel_delayed_work_sync(&pmu_sample_work);
+	WRITE_ONCE(pmu_registered, false);
+}
+
+// ============================================================ //
+// Configuration blobs
+// ============================================================ //
+
+/*
+ * Configurations can also be loaded at runtime from a blob in the format of
+ * msi-ec-conf-blob.h, found through request_firmware(), so that a firmware
+ * version can be enabled or a configuration adjusted without rebuilding the
+ * module. The whole blob is validated; a configuration of a valid blob
+ * matching the firmware version takes precedence over the built-in ones,
+ * which remain the fallback.
+ */
+
+static char *conf_blob = "msi-ec/conf.bin";
+module_param(conf_blob, charp, 0);
+MODULE_PARM_DESC(conf_blob, "Configuration blob loaded from the firmware directory, empty to disable (default: msi-ec/conf.bin)");
+
+static const char *const conf_blob_mode_names[MSI_EC_CONF_BLOB_MODE_COUNT] = {
+	[MSI_EC_CONF_BLOB_SM_ECO] = SM_ECO_NAME,
+	[MSI_EC_CONF_BLOB_SM_COMFORT] = SM_COMFORT_NAME,
+	[MSI_EC_CONF_BLOB_SM_SPORT] = SM_SPORT_NAME,
+	[MSI_EC_CONF_BLOB_SM_TURBO] = SM_TURBO_NAME,
+	[MSI_EC_CONF_BLOB_FM_AUTO] = FM_AUTO_NAME,
+	[MSI_EC_CONF_BLOB_FM_SILENT] = FM_SILENT_NAME,
+	[MSI_EC_CONF_BLOB_FM_BASIC] = FM_BASIC_NAME,
+	[MSI_EC_CONF_BLOB_FM_ADVANCED] = FM_ADVANCED_NAME,
+};
+
+static bool conf_blob_address(int *address, __le16 value)
+{
+	u16 addr = le16_to_cpu(value);
+
+	if (addr == MSI_EC_CONF_BLOB_UNSUPP) {
+		*address = MSI_EC_ADDR_UNSUPP;
+		return true;
+	}
+
+	*address = addr;
+	return addr <= 0xff;
+}
+
+static bool conf_blob_bit(int *bit, u8 value)
+{
+	*bit = value;
+	return value < 8;
+}
+
+static bool conf_blob_modes(struct msi_ec_mode *modes,
+			    const struct msi_ec_conf_blob_mode *blob,
+			    int first_id, int last_id)
+{
+	for (int i = 0; i < MSI_EC_CONF_BLOB_MODES; i++) {
+		if (blob[i].id == MSI_EC_CONF_BLOB_MODE_NONE)
+			break;
+
+		if (blob[i].id < first_id || blob[i].id > last_id)
+			return false;
+
+		modes[i].name = conf_blob_mode_names[blob[i].id];
+		modes[i].value = blob[i].value;
+	}
+
+	return true;
+}
+
+static const enum msi_ec_sensor_kind
+	conf_blob_sensor_kinds[MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT] = {
+	[MSI_EC_CONF_BLOB_SENSOR_TEMP] = MSI_EC_SENSOR_TEMP,
+	[MSI_EC_CONF_BLOB_SENSOR_FAN] = MSI_EC_SENSOR_FAN,
+	[MSI_EC_CONF_BLOB_SENSOR_RPM] = MSI_EC_SENSOR_RPM,
+	[MSI_EC_CONF_BLOB_SENSOR_TACH] = MSI_EC_SENSOR_TACH,
+};
+
+// appends a sensor, the table keeps its NULL entry
+static bool conf_blob_add_sensor(struct msi_ec_conf *c, int *count,
+				 const char *label,
+				 enum msi_ec_sensor_kind kind,
+				 int address, int width, int scale)
+{
+	struct msi_ec_sensor *sensor = &c->sensors[*count];
+
+	if (address == MSI_EC_ADDR_UNSUPP)
+		return true;
+
+	if (*count == MSI_EC_SENSORS_MAX - 1)
+		return false;
+
+	strscpy(sensor->label, label, sizeof(sensor->label));
+	sensor->kind = kind;
+	sensor->address = address;
+	sensor->width = width;
+	sensor->scale = scale;
+	(*count)++;
+
+	return true;
+}
+
+static bool conf_blob_sensor(struct msi_ec_conf *c, int *count,
+			     const struct msi_ec_conf_blob_sensor *s)
+{
+	size_t label_length = strnlen(s->label, sizeof(s->label));
+	int address;
+
+	if (!label_length || label_length == sizeof(s->label) ||
+	    s->kind >= MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT ||
+	    s->width > MSI_EC_CONF_BLOB_SENSOR_WIDTH_MAX ||
+	    le32_to_cpu(s->scale) > INT_MAX)
+		return false;
+
+	if (!conf_blob_address(&address, s->address) ||
+	    address == MSI_EC_ADDR_UNSUPP ||
+	    address + max_t(int, s->width, 1) > 0x100)
+		return false;
+
+	return conf_blob_add_sensor(c, count, s->label,
+				    conf_blob_sensor_kinds[s->kind], address,
+				    s->width, le32_to_cpu(s->scale));
+}
+
+static bool conf_blob_decode(struct msi_ec_conf *c,
+			     const struct msi_ec_conf_blob_entry *e,
+			     const struct msi_ec_conf_blob_sensor *sensors)
+{
+	int legacy_addresses[4];
+	int sensor_count = 0;
+	bool valid = true;
+
+	memset(c, 0, sizeof(*c));
+
+	valid &= conf_blob_address(&c->charge_control_address,
+				   e->charge_control_address);
+
+	valid &= conf_blob_address(&c->webcam.address, e->webcam_address);
+	valid &= conf_blob_address(&c->webcam.block_address,
+				   e->webcam_block_address);
+	valid &= conf_blob_bit(&c->webcam.bit, e->webcam_bit);
+
+	valid &= conf_blob_address(&c->fn_win_swap.address,
+				   e->fn_win_swap_address);
+	valid &= conf_blob_bit(&c->fn_win_swap.bit, e->fn_win_swap_bit);
+	c->fn_win_swap.invert = e->fn_win_swap_invert;
+
+	valid &= conf_blob_address(&c->cooler_boost.address,
+				   e->cooler_boost_address);
+	valid &= conf_blob_bit(&c->cooler_boost.bit, e->cooler_boost_bit);
+
+	valid &= conf_blob_address(&c->shift_mode.address,
+				   e->shift_mode_address);
+	valid &= conf_blob_modes(c->shift_mode.modes, e->shift_modes,
+				 MSI_EC_CONF_BLOB_SM_ECO,
+				 MSI_EC_CONF_BLOB_SM_TURBO);
+
+	valid &= conf_blob_address(&c->super_battery.address,
+				   e->super_battery_address);
+	c->super_battery.mask = e->super_battery_mask;
+
+	valid &= conf_blob_address(&c->fan_mode.address, e->fan_mode_address);
+	valid &= conf_blob_modes(c->fan_mode.modes, e->fan_modes,
+				 MSI_EC_CONF_BLOB_FM_AUTO,
+				 MSI_EC_CONF_BLOB_FM_ADVANCED);
+
+	valid &= conf_blob_address(&legacy_addresses[0],
+				   e->cpu_rt_temp_address);
+	valid &= conf_blob_address(&legacy_addresses[1],
+				   e->cpu_rt_fan_speed_address);
+	valid &= conf_blob_address(&legacy_addresses[2],
+				   e->gpu_rt_temp_address);
+	valid &= conf_blob_address(&legacy_addresses[3],
+				   e->gpu_rt_fan_speed_address);
+	if (!valid)
+		return false;
+
+	conf_blob_add_sensor(c, &sensor_count, "cpu", MSI_EC_SENSOR_TEMP,
+			     legacy_addresses[0], 0, 0);
+	conf_blob_add_sensor(c, &sensor_count, "cpu", MSI_EC_SENSOR_FAN,
+			     legacy_addresses[1], 0, 0);
+	conf_blob_add_sensor(c, &sensor_count, "gpu", MSI_EC_SENSOR_TEMP,
+			     legacy_addresses[2], 0, 0);
+	conf_blob_add_sensor(c, &sensor_count, "gpu", MSI_EC_SENSOR_FAN,
+			     legacy_addresses[3], 0, 0);
+	for (int i = 0; i < e->sensor_count; i++)
+		valid &= conf_blob_sensor(c, &sensor_count, &sensors[i]);
+
+	valid &= conf_blob_address(&c->leds.micmute_led_address,
+				   e->micmute_led_address);
+	valid &= conf_blob_address(&c->leds.mute_led_address,
+				   e->mute_led_address);
+	valid &= conf_blob_bit(&c->leds.bit, e->leds_bit);
+
+	valid &= conf_blob_address(&c->kbd_bl.bl_mode_address,
+				   e->kbd_bl_mode_address);
+	c->kbd_bl.bl_modes[0] = e->kbd_bl_modes[0];
+	c->kbd_bl.bl_modes[1] = e->kbd_bl_modes[1];
+	c->kbd_bl.max_mode = e->kbd_bl_max_mode;
+	valid &= conf_blob_address(&c->kbd_bl.bl_state_address,
+				   e->kbd_bl_state_address);
+	c->kbd_bl.state_base_value = e->kbd_bl_state_base_value;
+	c->kbd_bl.max_state = e->kbd_bl_max_state;
+
+	return valid;
+}
+
+// fw is one of the firmware versions of an entry, padded with NULs
+static bool conf_blob_fw_matches(const char *fw, const char *ver)
+{
+	return strlen(ver) <= MSI_EC_FW_VERSION_LENGTH &&
+	       !strncmp(fw, ver, MSI_EC_FW_VERSION_LENGTH);
+}
+
+/*
+ * Looks up the configuration of the firmware version ver. Returns -ENOENT
+ * if the blob has none, -EINVAL if the blob is invalid.
+ */
+static int conf_blob_find(struct msi_ec_conf *c, const u8 *data,
+			  size_t size, const char *ver)
+{
+	const struct msi_ec_conf_blob_header *header = (const void *)data;
+	size_t offset = sizeof(*header);
+	bool found = false;
+
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, MSI_EC_CONF_BLOB_MAGIC,
+		   sizeof(header->magic)) ||
+	    le16_to_cpu(header->version) < 1 ||
+	    le16_to_cpu(header->version) > MSI_EC_CONF_BLOB_VERSION)
+		return -EINVAL;
+
+	if ((crc32_le(~0, data + offset, size - offset) ^ ~0) !=
+	    le32_to_cpu(header->crc32))
+		return -EINVAL;
+
+	for (int i = 0; i < le16_to_cpu(header->count); i++) {
+		const struct msi_ec_conf_blob_entry *e;
+		const struct msi_ec_conf_blob_sensor *sensors;
+		struct msi_ec_conf decoded;
+		const char *fw;
+		size_t fw_size, sensors_size;
+
+		if (size - offset < sizeof(*e))
+			return -EINVAL;
+
+		e = (const void *)(data + offset);
+		fw = (const char *)e + sizeof(*e);
+		fw_size = e->fw_count * MSI_EC_FW_VERSION_LENGTH;
+		sensors = (const void *)(fw + fw_size);
+		sensors_size = e->sensor_count * sizeof(*sensors);
+		offset += sizeof(*e);
+
+		if (size - offset < fw_size + sensors_size)
+			return -EINVAL;
+		offset += fw_size + sensors_size;
+
+		if (!conf_blob_decode(&decoded, e, sensors))
+			return -EINVAL;
+
+		for (int j = 0; j < e->fw_count && !found; j++) {
+			if (conf_blob_fw_matches(fw + j * MSI_EC_FW_VERSION_LENGTH,
+						 ver)) {
+				memcpy(c, &decoded, sizeof(*c));
+				found = true;
+			}
+		}
+	}
+
+	if (offset != size)
+		return -EINVAL;
+
+	return found ? 0 : -ENOENT;
+}
+
+static int __init conf_blob_load(struct msi_ec_device *ec, const char *ver)
+{
+	const struct firmware *fw;
+	struct msi_ec_conf blob_conf;
+	int result;
+
+	if (!conf_blob || !*conf_blob)
+		return -ENOENT;
+
+	result = firmware_request_nowarn(&fw, conf_blob, NULL);
+	if (result < 0)
+		return result;
+
+	result = conf_blob_find(&blob_conf, fw->data, fw->size, ver);
+	release_firmware(fw);
+
+	if (result == -EINVAL)
+		pr_warn("Invalid configuration blob %s is ignored\n",
+			conf_blob);
+	if (result < 0)
+		return result;
+
+	result = conf_install(ec, &blob_conf, conf_blob);
+	if (result < 0)
+		return result;
+
+	pr_info("%s: loaded the configuration of %s from %s\n", ec->name, ver,
+		conf_blob);
+
+	return 0;
+}
+
+// ============================================================ //
+// Aggregated state
+// ============================================================ //
+
+/*
+ * The state attribute and /dev/msi-ec-state give every value of the root,
+ * cpu and gpu attributes at once, decoded from a single EC snapshot, so a
+ * dashboard refresh costs one read and one burst of EC transactions. The
+ * attribute is text, "path=value" lines in the order of msi_ec_features[];
+ * the character device returns its binary twin, struct msi_ec_state.
+ */
+
+// the features of the fields of struct msi_ec_state
+static const enum msi_ec_feature_id
+	msi_ec_state_features[MSI_EC_STATE_FIELD_COUNT] = {
+	[MSI_EC_STATE_WEBCAM] = MSI_EC_WEBCAM,
+	[MSI_EC_STATE_WEBCAM_BLOCK] = MSI_EC_WEBCAM_BLOCK,
+	[MSI_EC_STATE_FN_KEY] = MSI_EC_FN_KEY,
+	[MSI_EC_STATE_WIN_KEY] = MSI_EC_WIN_KEY,
+	[MSI_EC_STATE_COOLER_BOOST] = MSI_EC_COOLER_BOOST,
+	[MSI_EC_STATE_SHIFT_MODE] = MSI_EC_SHIFT_MODE,
+	[MSI_EC_STATE_SUPER_BATTERY] = MSI_EC_SUPER_BATTERY,
+	[MSI_EC_STATE_FAN_MODE] = MSI_EC_FAN_MODE,
+	[MSI_EC_STATE_CPU_REALTIME_TEMPERATURE] =
+		MSI_EC_CPU_REALTIME_TEMPERATURE,
+	[MSI_EC_STATE_CPU_REALTIME_FAN_SPEED] = MSI_EC_CPU_REALTIME_FAN_SPEED,
+	[MSI_EC_STATE_GPU_REALTIME_TEMPERATURE] =
+		MSI_EC_GPU_REALTIME_TEMPERATURE,
+	[MSI_EC_STATE_GPU_REALTIME_FAN_SPEED] = MSI_EC_GPU_REALTIME_FAN_SPEED,
+};
+
+// returns the address of a feature with a value in the snapshot, or -1
+static int msi_ec_state_address(const struct msi_ec_feature *f,
+				const struct msi_ec_conf *conf)
+{
+	int address;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_MODES:
+	case MSI_EC_KIND_CUSTOM:
+		return -1;
+	default:
+		address = msi_ec_feature_address(f, conf);
+		return address == MSI_EC_ADDR_UNSUPP ? -1 : address;
+	}
+}
+
+// the blob id of the mode with value, MSI_EC_CONF_BLOB_MODE_NONE if unknown
+static u8 msi_ec_state_mode(const struct msi_ec_mode *modes, u8 value)
+{
+	for (int i = 0; modes[i].name; i++) {
+		if (modes[i].value != value)
+			continue;
+
+		for (int id = 1; id < MSI_EC_CONF_BLOB_MODE_COUNT; id++)
+			if (!strcmp(modes[i].name, conf_blob_mode_names[id]))
+				return id;
+	}
+
+	return MSI_EC_CONF_BLOB_MODE_NONE;
+}
+
+// the value of a feature in struct msi_ec_state, data as for the format
+static long msi_ec_state_value(const struct msi_ec_feature *f,
+			       const struct msi_ec_conf *conf, const u8 *data)
+{
+	const struct msi_ec_sensor *sensor;
+	bool value;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_BIT:
+		value = *data & BIT(conf_int(conf, f->bit));
+		return msi_ec_feature_flip(f, conf, value);
+
+	case MSI_EC_KIND_MASK:
+		return (*data & conf_int(conf, f->bit)) == conf_int(conf, f->bit);
+
+	case MSI_EC_KIND_ENUM:
+		return msi_ec_state_mode(msi_ec_feature_modes(f, conf), *data);
+
+	case MSI_EC_KIND_SENSOR:
+		sensor = msi_ec_sensor_find(conf, f->sensor, f->sensor_kind);
+		return sensor ? msi_ec_sensor_value(sensor, data) : 0;
+
+	default:
+		return 0;
+	}
+}
+
+static ssize_t state_show(struct device *device,
+			  struct device_attribute *attr, char *buf)
+{
+	struct msi_ec_device *ec = dev_get_drvdata(device);
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	struct msi_ec_identity id;
+	u8 image[256];
+	int count;
+	int result;
+
+	result = identity_get(ec, &id);
+	if (result < 0)
+		return result;
+
+	result = ec_read_snapshot(ec, conf, image);
+	if (result < 0)
+		return result;
+
+	count = sysfs_emit(buf, "fw_version=%s\n", id.version);
+	if (!id.build_result)
+		count += sysfs_emit_at(buf, count, "fw_release_date=%ptR\n",
+				       &id.build);
+
+	for (int i = 0; i < MSI_EC_FEATURE_COUNT; i++) {
+		const struct msi_ec_feature *f = &msi_ec_features[i];
+		int address = msi_ec_state_address(f, conf);
+
+		if (address < 0)
+			continue;
+
+		count += sysfs_emit_at(buf, count, "%s=", f->attr.path);
+		result = msi_ec_feature_format(f, conf, image + address, buf,
+					       count);
+		if (result < 0)
+			return result;
+		count += result;
+	}
+
+	return count;
+}
+
+static int msi_ec_state_fill(struct msi_ec_device *ec,
+			     const struct msi_ec_conf *conf,
+			     struct msi_ec_state *state)
+{
+	struct msi_ec_identity id;
+	u32 supported = 0;
+	u8 image[256];
+	int result;
+
+	result = identity_get(ec, &id);
+	if (result < 0)
+		return result;
+
+	result = ec_read_snapshot(ec, conf, image);
+	if (result < 0)
+		return result;
+
+	memset(state, 0, sizeof(*state));
+	state->version = cpu_to_le16(MSI_EC_STATE_VERSION);
+	state->size = cpu_to_le16(sizeof(*state));
+	state->time_ns = cpu_to_le64(ktime_get_ns());
+	if (!id.build_result)
+		state->fw_build_time =
+			cpu_to_le64(rtc_tm_to_time64(&id.build));
+	memcpy(state->fw_version, id.version, sizeof(state->fw_version));
+
+	for (int i = 0; i < MSI_EC_STATE_FIELD_COUNT; i++) {
+		const struct msi_ec_feature *f =
+			&msi_ec_features[msi_ec_state_features[i]];
+		int address = msi_ec_state_address(f, conf);
+
+		if (address < 0)
+			continue;
+
+		supported |= BIT(i);
+		state->values[i] = cpu_to_le32(
+			msi_ec_state_value(f, conf, image + address));
+	}
+	state->supported = cpu_to_le32(supported);
+
+	return 0;
+}
+
+// a snapshot is taken for every read at offset 0, e.g. with pread()
+// the snapshot of an open file, taken by a read at offset 0
+struct msi_ec_state_file {
+	struct mutex mutex; // protects the snapshot
+	bool valid;
+	struct msi_ec_state state;
+};
+
+static int state_open(struct inode *inode, struct file *file)
+{
+	struct msi_ec_state_file *sf;
+
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+
+	mutex_init(&sf->mutex);
+	file->private_data = sf;
+
+	return 0;
+}
+
+static int state_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+
+	return 0;
+}
+
+// later offsets are served from the snapshot of the last read at offset 0
+static ssize_t state_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct msi_ec_state_file *sf = file->private_data;
+	const struct msi_ec_conf *conf;
+	ssize_t result = 0;
+	int idx;
+
+	if (*ppos >= sizeof(sf->state))
+		return 0;
+
+	mutex_lock(&sf->mutex);
+	if (*ppos == 0 || !sf->valid) {
+		conf = conf_read_lock(&msi_ec_main, &idx);
+		result = msi_ec_state_fill(&msi_ec_main, conf, &sf->state);
+		conf_read_unlock(idx);
+		sf->valid = result >= 0;
+	}
+
+	if (result >= 0)
+		result = simple_read_from_buffer(buf, count, ppos, &sf->state,
+						 sizeof(sf->state));
+	mutex_unlock(&sf->mutex);
+
+	return result;
+}
+
+static const struct file_operations state_fops = {
+	.owner = THIS_MODULE,
+	.open = state_open,
+	.release = state_release,
+	.read = state_read,
+	.llseek = default_llseek,
+};
+
+static struct miscdevice state_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "msi-ec-state",
+	.fops = &state_fops,
+	.mode = 0444,
+};
+
+static bool state_registered;
+
+static int state_register(void)
+{
+	int result;
+
+	result = misc_register(&state_miscdev);
+	if (result < 0)
+		return result;
+
+	state_registered = true;
+
+	return 0;
+}
+
+static void state_unregister(void)
+{
+	if (!state_registered)
+		return;
+
+	misc_deregister(&state_miscdev);
+	state_registered = false;
+}
+
+// ============================================================ //
+// Configuration switching
+// ============================================================ //
+
+/*
+ * With the debug mode, a configuration blob written to
+ * /sys/kernel/debug/msi-ec/conf_switch replaces the current configuration of
+ * the main instance, using its configuration of the firmware version the
+ * driver was loaded with. The attributes stay in place; what depends on the configuration
+ * (LEDs, battery hook, PM QoS hold, fan lease, power profiles, perf PMU) is
+ * brought up again and the visibility of the attributes is re-evaluated.
+ * /sys/kernel/debug/msi-ec/conf (and msi-ec.N/conf for the emulated
+ * instances) prints the current configuration in the text format of
+ * tools/msi-ec-conf.
+ */
+
+#define CONF_UPLOAD_MAX_SIZE SZ_64K
+
+static struct dentry *conf_debugfs_switch;
+
+static void msi_ec_bringup(struct msi_ec_device *ec);
+static void msi_ec_teardown(struct msi_ec_device *ec);
+
+/*
+ * Replaces the current configuration with new_conf, which is owned by the
+ * driver afterwards. The background features are stopped while the old one
+ * is still published, so their saved state is restored to the right
+ * registers. Predictive cooler boost is started again if it was enabled and
+ * the new configuration supports it, a delayed mode write is dropped.
+ */
+static void conf_switch(struct msi_ec_conf *new_conf, const char *source)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	struct msi_ec_conf *old_conf;
+	bool cb_auto;
+
+	mutex_lock(&conf_switch_mutex);
+
+	cb_auto = READ_ONCE(cb_auto_enabled);
+
+	msi_ec_teardown(ec);
+	cb_auto_stop();
+	arbiter_stop();
+	power_profile_reset_modes();
+
+	old_conf = rcu_dereference_protected(ec->conf,
+					     lockdep_is_held(&conf_switch_mutex));
+	rcu_assign_pointer(ec->conf, new_conf);
+	WRITE_ONCE(ec->conf_source, source);
+
+	// the readers still using the old configuration are done after this
+	synchronize_srcu(&conf_srcu);
+	kfree(old_conf);
+
+	if (sysfs_update_groups(&ec->pdev->dev.kobj, msi_platform_groups))
+		pr_warn("Failed to update the attributes\n");
+
+	msi_ec_bringup(ec);
+
+	if (cb_auto && msi_cb_auto_supported(new_conf)) {
+		msi_ec_lock(&cb_auto_mutex);
+		cb_auto_set_enabled(true);
+		msi_ec_unlock(&cb_auto_mutex);
+	}
+
+	mutex_unlock(&conf_switch_mutex);
+}
+
+static void conf_show_address(struct seq_file *m, const char *key,
+			      int address)
+{
+	if (address != MSI_EC_ADDR_UNSUPP)
+		seq_printf(m, "%s = 0x%02x\n", key, address);
+}
+
+static const char *const conf_sensor_kind_names[] = {
+	[MSI_EC_SENSOR_TEMP] = "temp",
+	[MSI_EC_SENSOR_FAN] = "fan",
+	[MSI_EC_SENSOR_RPM] = "rpm",
+	[MSI_EC_SENSOR_TACH] = "tach",
+};
+
+// the cpu and gpu sensors also have the blob entry fields of version 1
+static bool conf_sensor_is_legacy(const struct msi_ec_conf *conf,
+				  const struct msi_ec_sensor *sensor)
+{
+	return (!strcmp(sensor->label, "cpu") ||
+		!strcmp(sensor->label, "gpu")) &&
+	       (sensor->kind == MSI_EC_SENSOR_TEMP ||
+		sensor->kind == MSI_EC_SENSOR_FAN) && sensor->width <= 1 &&
+	       sensor->scale <= 1 &&
+	       msi_ec_sensor_find(conf, sensor->label, sensor->kind) == sensor;
+}
+
+static void conf_show_legacy_sensor(struct seq_file *m, const char *key,
+				    const struct msi_ec_conf *conf,
+				    const char *label,
+				    enum msi_ec_sensor_kind kind)
+{
+	const struct msi_ec_sensor *sensor =
+		msi_ec_sensor_find(conf, label, kind);
+
+	if (sensor && conf_sensor_is_legacy(conf, sensor))
+		conf_show_address(m, key, sensor->address);
+}
+
+static void conf_show_sensors(struct seq_file *m,
+			      const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_sensor *sensor;
+
+	conf_show_legacy_sensor(m, "cpu.rt_temp_address", conf, "cpu",
+				MSI_EC_SENSOR_TEMP);
+	conf_show_legacy_sensor(m, "cpu.rt_fan_speed_address", conf, "cpu",
+				MSI_EC_SENSOR_FAN);
+	conf_show_legacy_sensor(m, "gpu.rt_temp_address", conf, "gpu",
+				MSI_EC_SENSOR_TEMP);
+	conf_show_legacy_sensor(m, "gpu.rt_fan_speed_address", conf, "gpu",
+				MSI_EC_SENSOR_FAN);
+
+	msi_ec_for_each_sensor(sensor, conf) {
+		if (conf_sensor_is_legacy(conf, sensor))
+			continue;
+
+		seq_printf(m, "sensor = %s %s 0x%02x %d %d\n", sensor->label,
+			   conf_sensor_kind_names[sensor->kind],
+			   sensor->address, msi_ec_sensor_width(sensor),
+			   sensor->scale ? sensor->scale :
+			   sensor->kind == MSI_EC_SENSOR_TACH ?
+					   MSI_EC_TACH_SCALE : 1);
+	}
+}
+
+static void conf_show_modes(struct seq_file *m, const char *key,
+			    const struct msi_ec_mode *modes)
+{
+	if (!modes[0].name)
+		return;
+
+	seq_printf(m, "%s =", key);
+	for (int i = 0; modes[i].name; i++)
+		seq_printf(m, " %s:0x%02x", modes[i].name, modes[i].value);
+	seq_puts(m, "\n");
+}
+
+// the private data is the instance
+static int conf_show(struct seq_file *m, void *v)
+{
+	struct msi_ec_device *ec = m->private;
+	const struct msi_ec_conf *conf;
+	int idx;
+
+	conf = conf_read_lock(ec, &idx);
+	if (!conf)
+		goto unlock;
+
+	seq_printf(m, "# %s\n", READ_ONCE(ec->conf_source));
+	seq_printf(m, "allowed_fw = %s\n", ec->fw_version);
+	conf_show_address(m, "charge_control_address",
+			  conf->charge_control_address);
+
+	conf_show_address(m, "webcam.address", conf->webcam.address);
+	conf_show_address(m, "webcam.block_address",
+			  conf->webcam.block_address);
+	seq_printf(m, "webcam.bit = %d\n", conf->webcam.bit);
+
+	conf_show_address(m, "fn_win_swap.address", conf->fn_win_swap.address);
+	seq_printf(m, "fn_win_swap.bit = %d\n", conf->fn_win_swap.bit);
+	seq_printf(m, "fn_win_swap.invert = %s\n",
+		   conf->fn_win_swap.invert ? "true" : "false");
+
+	conf_show_address(m, "cooler_boost.address",
+			  conf->cooler_boost.address);
+	seq_printf(m, "cooler_boost.bit = %d\n", conf->cooler_boost.bit);
+
+	conf_show_address(m, "shift_mode.address", conf->shift_mode.address);
+	conf_show_modes(m, "shift_mode.modes", conf->shift_mode.modes);
+
+	conf_show_address(m, "super_battery.address",
+			  conf->super_battery.address);
+	seq_printf(m, "super_battery.mask = 0x%02x\n", conf->super_battery.mask);
+
+	conf_show_address(m, "fan_mode.address", conf->fan_mode.address);
+	conf_show_modes(m, "fan_mode.modes", conf->fan_mode.modes);
+
+	conf_show_sensors(m, conf);
+
+	conf_show_address(m, "leds.micmute_led_address",
+			  conf->leds.micmute_led_address);
+	conf_show_address(m, "leds.mute_led_address",
+			  conf->leds.mute_led_address);
+	seq_printf(m, "leds.bit = %d\n", conf->leds.bit);
+
+	conf_show_address(m, "kbd_bl.bl_mode_address",
+			  conf->kbd_bl.bl_mode_address);
+	seq_printf(m, "kbd_bl.bl_modes = 0x%02x 0x%02x\n",
+		   conf->kbd_bl.bl_modes[0], conf->kbd_bl.bl_modes[1]);
+	seq_printf(m, "kbd_bl.max_mode = 0x%02x\n", conf->kbd_bl.max_mode);
+	conf_show_address(m, "kbd_bl.bl_state_address",
+			  conf->kbd_bl.bl_state_address);
+	seq_printf(m, "kbd_bl.state_base_value = 0x%02x\n",
+		   conf->kbd_bl.state_base_value);
+	seq_printf(m, "kbd_bl.max_state = 0x%02x\n", conf->kbd_bl.max_state);
+
+unlock:
+	conf_read_unlock(idx);
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(conf);
+
+/*
+ * msi-ec/read_plan (and msi-ec.N/read_plan) prints a snapshot of the EC
+ * addresses behind the available features, taken with one read per address.
+ */
+static int read_plan_show(struct seq_file *m, void *v)
+{
+	struct msi_ec_device *ec = m->private;
+	const struct msi_ec_conf *conf;
+	struct msi_ec_read_plan plan;
+	unsigned int addr;
+	u8 image[256];
+	int result = 0;
+	int idx;
+
+	conf = conf_read_lock(ec, &idx);
+	if (!conf)
+		goto unlock;
+
+	msi_ec_read_plan_init(&plan, conf);
+	result = ec_read_plan(ec, &plan, image);
+	if (result < 0)
+		goto unlock;
+
+	for_each_set_bit(addr, plan.addrs, 256)
+		seq_printf(m, "0x%02x = 0x%02x\n", addr, image[addr]);
+
+unlock:
+	conf_read_unlock(idx);
+	return result;
+}
+
+DEFINE_SHOW_ATTRIBUTE(read_plan);
+
+// the private data is the instance
+static int match_show(struct seq_file *m, void *v)
+{
+	struct msi_ec_device *ec = m->private;
+
+	if (!ec->match_path)
+		return 0;
+
+	seq_printf(m, "path        %s\n", ec->match_path);
+	seq_printf(m, "confidence  %d\n", ec->match_confidence);
+	seq_printf(m, "fw_version  %s\n", ec->fw_version);
+	seq_printf(m, "matched_fw  %s\n", ec->match_fw);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(match);
+
+struct conf_upload {
+	struct mutex mutex; // serializes the writes to the file
+	size_t written;
+	size_t parsed; // end of the entries parsed so far, 0 before the header
+	unsigned int entries; // entries parsed so far
+	u8 data[CONF_UPLOAD_MAX_SIZE];
+};
+
+// returns the size of the blob if data holds all of it, 0 otherwise; the
+// entries already complete are not parsed again on the next writes
+static size_t conf_upload_size(struct conf_upload *upload)
+{
+	const struct msi_ec_conf_blob_header *header = (const void *)upload->data;
+
+	if (upload->written < sizeof(*header))
+		return 0;
+
+	if (!upload->parsed)
+		upload->parsed = sizeof(*header);
+
+	while (upload->entries < le16_to_cpu(header->count)) {
+		const struct msi_ec_conf_blob_entry *e =
+			(const void *)(upload->data + upload->parsed);
+		size_t size;
+
+		if (upload->written - upload->parsed < sizeof(*e))
+			return 0;
+
+		size = sizeof(*e) + e->fw_count * MSI_EC_FW_VERSION_LENGTH +
+		       e->sensor_count * sizeof(struct msi_ec_conf_blob_sensor);
+		if (size > upload->written - upload->parsed)
+			return 0;
+
+		upload->parsed += size;
+		upload->entries++;
+	}
+
+	return upload->parsed;
+}
+
+static int conf_switch_open(struct inode *inode, struct file *file)
+{
+	struct conf_upload *upload = vmalloc(sizeof(*upload));
+
+	if (!upload)
+		return -ENOMEM;
+
+	mutex_init(&upload->mutex);
+	upload->written = 0;
+	upload->parsed = 0;
+	upload->entries = 0;
+	file->private_data = upload;
+
+	return 0;
+}
+
+// the configuration is switched by the write completing the blob
+static ssize_t conf_switch_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct conf_upload *upload = file->private_data;
+	struct msi_ec_conf *new_conf;
+	ssize_t result;
+	size_t size;
+	int err;
+
+	if (*ppos < 0)
+		return -EINVAL;
+	if (count > sizeof(upload->data) ||
+	    *ppos > sizeof(upload->data) - count)
+		return -EFBIG;
+
+	mutex_lock(&upload->mutex);
+
+	// rewriting the parsed entries or the header parses them again
+	if (*ppos < upload->parsed) {
+		upload->parsed = 0;
+		upload->entries = 0;
+	}
+
+	result = simple_write_to_buffer(upload->data, sizeof(upload->data),
+					ppos, buf, count);
+	if (result < 0)
+		goto out;
+
+	upload->written = max_t(size_t, upload->written, *ppos);
+	size = conf_upload_size(upload);
+	if (!size)
+		goto out;
+
+	if (size != upload->written) {
+		result = -EINVAL;
+		goto out;
+	}
+
+	new_conf = kmalloc(sizeof(*new_conf), GFP_KERNEL);
+	if (!new_conf) {
+		result = -ENOMEM;
+		goto out;
+	}
+
+	err = conf_blob_find(new_conf, upload->data, size,
+			     msi_ec_main.fw_version);
+	if (err < 0) {
+		kfree(new_conf);
+		result = err;
+		goto out;
+	}
+
+	conf_switch(new_conf, "debugfs");
+	pr_info("Switched to the configuration of %s from debugfs\n",
+		msi_ec_main.fw_version);
+
+out:
+	mutex_unlock(&upload->mutex);
+	return result;
+}
+
+static int conf_switch_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations conf_switch_fops = {
+	.owner = THIS_MODULE,
+	.open = conf_switch_open,
+	.write = conf_switch_write,
+	.release = conf_switch_release,
+	.llseek = default_llseek,
+};
+
+static void conf_debugfs_init(void)
+{
+	debugfs_create_file("conf", 0444, msi_ec_debugfs, &msi_ec_main,
+			    &conf_fops);
+	debugfs_create_file("read_plan", 0444, msi_ec_debugfs, &msi_ec_main,
+			    &read_plan_fops);
+	debugfs_create_file("match", 0444, msi_ec_debugfs, &msi_ec_main,
+			    &match_fops);
+
+	// writing to the EC with untested addresses is only for the debug mode
+	if (debug)
+		conf_debugfs_switch =
+			debugfs_create_file("conf_switch", 0200,
+					    msi_ec_debugfs, NULL,
+					    &conf_switch_fops);
+}
+
+// no switch can start or be in progress afterwards
+static void conf_debugfs_exit(void)
+{
+	debugfs_remove(conf_debugfs_switch);
+	conf_debugfs_switch = NULL;
+}
+
+// ============================================================ //
+// Configuration matching
+// ============================================================ //
+
+/*
+ * A firmware version is matched to a built-in configuration through the
+ * following paths, from the most to the least reliable:
+ *
+ *   exact - the version is in the allowed_fw list of a configuration
+ *   model - another release of the same model, 14C1EMS1.013 takes the
+ *           configuration of the nearest known release of 14C1EMS1
+ *   board - another EC of the same board, the first 4 characters
+ *   dmi   - the board of the DMI board name, MS-14C1 for 14C1
+ *   probe - the configuration whose mode registers hold known values
+ *
+ * The conf_match parameter sets the last path tried. When the candidates
+ * of a path disagree, the probe picks among them and the confidence drops.
+ * The probe only reads the EC. The known versions are sorted into an index
+ * at init, so each path is a binary search.
+ */
+
+enum conf_match_path {
+	CONF_MATCH_EXACT,
+	CONF_MATCH_MODEL,
+	CONF_MATCH_BOARD,
+	CONF_MATCH_DMI,
+	CONF_MATCH_PROBE,
+	CONF_MATCH_PATHS
+};
+
+static const char *const conf_match_names[CONF_MATCH_PATHS] = {
+	[CONF_MATCH_EXACT] = "exact",
+	[CONF_MATCH_MODEL] = "model",
+	[CONF_MATCH_BOARD] = "board",
+	[CONF_MATCH_DMI] = "dmi",
+	[CONF_MATCH_PROBE] = "probe",
+};
+
+// in %, of an unambiguous match
+static const int conf_match_confidence[CONF_MATCH_PATHS] = {
+	[CONF_MATCH_EXACT] = 100,
+	[CONF_MATCH_MODEL] = 90,
+	[CONF_MATCH_BOARD] = 60,
+	[CONF_MATCH_DMI] = 50,
+	[CONF_MATCH_PROBE] = 40,
+};
+
+#define CONF_MATCH_BOARD_LENGTH 4
+
+static char *conf_match = "model";
+module_param(conf_match, charp, 0);
+MODULE_PARM_DESC(conf_match, "Last path tried to match the firmware version to a configuration: exact, model (default), board, dmi or probe");
+
+struct conf_index_entry {
+	const char *fw;
+	struct msi_ec_conf *conf;
+};
+
+static struct conf_index_entry *conf_index __initdata;
+static int conf_index_count __initdata;
+
+static int __init conf_index_cmp(const void *a, const void *b)
+{
+	const struct conf_index_entry *x = a, *y = b;
+
+	return strcmp(x->fw, y->fw);
+}
+
+static int __init conf_index_build(void)
+{
+	int n = 0;
+
+	for (int i = 0; CONFIGURATIONS[i]; i++)
+		for (int j = 0; CONFIGURATIONS[i]->allowed_fw[j]; j++)
+			n++;
+
+	conf_index = kmalloc_array(n, sizeof(*conf_index), GFP_KERNEL);
+	if (!conf_index)
+		return -ENOMEM;
+
+	for (int i = 0; CONFIGURATIONS[i]; i++) {
+		for (int j = 0; CONFIGURATIONS[i]->allowed_fw[j]; j++) {
+			conf_index[conf_index_count].fw =
+				CONFIGURATIONS[i]->allowed_fw[j];
+			conf_index[conf_index_count].conf = CONFIGURATIONS[i];
+			conf_index_count++;
+		}
+	}
+
+	sort(conf_index, conf_index_count, sizeof(*conf_index),
+	     conf_index_cmp, NULL);
+
+	return 0;
+}
+
+static void __init conf_index_free(void)
+{
+	kfree(conf_index);
+	conf_index = NULL;
+	conf_index_count = 0;
+}
+
+// returns the first entry not below key
+static int __init conf_index_lower_bound(const char *key)
+{
+	int first = 0, last = conf_index_count;
+
+	while (first < last) {
+		int mid = first + (last - first) / 2;
+
+		if (strcmp(conf_index[mid].fw, key) < 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return first;
+}
+
+struct conf_match_result {
+	enum conf_match_path path;
+	int confidence;
+	const char *fw; // of the configuration
+	struct msi_ec_conf *conf;
+};
+
+struct conf_probe {
+	bool done;
+	int result;
+	u8 image[256];
+};
+
+static void __init conf_probe_plan_add(struct msi_ec_read_plan *plan,
+				       const struct msi_ec_conf *conf)
+{
+	if (conf->shift_mode.address != MSI_EC_ADDR_UNSUPP)
+		msi_ec_read_plan_add(plan, conf->shift_mode.address, 1);
+	if (conf->fan_mode.address != MSI_EC_ADDR_UNSUPP)
+		msi_ec_read_plan_add(plan, conf->fan_mode.address, 1);
+	if (conf->kbd_bl.bl_state_address != MSI_EC_ADDR_UNSUPP)
+		msi_ec_read_plan_add(plan, conf->kbd_bl.bl_state_address, 1);
+}
+
+// reads the registers checked for all the configurations, once
+static int __init conf_probe_read(struct msi_ec_device *ec,
+				  struct conf_probe *probe)
+{
+	struct msi_ec_read_plan plan;
+
+	if (probe->done)
+		return probe->result;
+
+	bitmap_zero(plan.addrs, 256);
+	for (int i = 0; CONFIGURATIONS[i]; i++)
+		conf_probe_plan_add(&plan, CONFIGURATIONS[i]);
+
+	probe->result = ec_read_plan(ec, &plan, probe->image);
+	probe->done = true;
+
+	return probe->result;
+}
+
+static bool __init conf_probe_mode(const struct msi_ec_mode *modes, u8 value)
+{
+	for (int i = 0; modes[i].name; i++)
+		if (modes[i].value == value)
+			return true;
+
+	return false;
+}
+
+/*
+ * Returns the percentage of the known-value checks of conf that the EC
+ * passes, -1 if conf has too few of them to tell anything.
+ */
+static int __init conf_probe_score(const struct conf_probe *probe,
+				   const struct msi_ec_conf *conf)
 {
-	int result;
+	int checks = 0, passed = 0;
 
-	result = ec_set_bit(conf.leds.mute_led_address, conf.leds.bit, brightness);
+	if (conf->shift_mode.address != MSI_EC_ADDR_UNSUPP) {
+		checks++;
+		passed += conf_probe_mode(conf->shift_mode.modes,
+			probe->image[conf->shift_mode.address]);
+	}
 
-	if (result < 0)
-		return result;
+	if (conf->fan_mode.address != MSI_EC_ADDR_UNSUPP) {
+		checks++;
+		passed += conf_probe_mode(conf->fan_mode.modes,
+			probe->image[conf->fan_mode.address]);
+	}
 
-	return 0;
-}
+	if (conf->kbd_bl.bl_state_address != MSI_EC_ADDR_UNSUPP) {
+		u8 state = probe->image[conf->kbd_bl.bl_state_address];
 
-static enum led_brightness kbd_bl_sysfs_get(struct led_classdev *led_cdev)
-{
-	u8 rdata;
-	int result = ec_read(conf.kbd_bl.bl_state_address, &rdata);
-	if (result < 0)
-		return 0;
-	return rdata & MSI_EC_KBD_BL_STATE_MASK;
+		checks++;
+		passed += (state & ~MSI_EC_KBD_BL_STATE_MASK) ==
+				  conf->kbd_bl.state_base_value &&
+			  (state & MSI_EC_KBD_BL_STATE_MASK) <=
+				  conf->kbd_bl.max_state;
+	}
+
+	return checks < 2 ? -1 : passed * 100 / checks;
 }
 
-static int kbd_bl_sysfs_set(struct led_classdev *led_cdev,
-			    enum led_brightness brightness)
+/*
+ * Picks the configuration of the index entries [first, last), preferring
+ * nearest. If the entries disagree, the probe picks among them and the
+ * confidence of the path is lowered.
+ */
+static void __init conf_match_range(struct msi_ec_device *ec,
+				    struct conf_probe *probe, int first,
+				    int last, int nearest,
+				    struct conf_match_result *match)
 {
-	// By default, on an unregister event,
-	// kernel triggers the setter with 0 brightness.
-	if (led_cdev->flags & LED_UNREGISTERING)
-		return 0;
+	int best = nearest, best_score = -1;
+	bool ambiguous = false;
+
+	for (int i = first; i < last; i++)
+		ambiguous |= conf_index[i].conf != conf_index[nearest].conf;
+
+	if (ambiguous) {
+		match->confidence -= 15;
+
+		if (conf_probe_read(ec, probe) >= 0) {
+			best_score = conf_probe_score(probe,
+						      conf_index[nearest].conf);
+			for (int i = first; i < last; i++) {
+				int score = conf_probe_score(probe,
+							     conf_index[i].conf);
+
+				if (score > best_score) {
+					best = i;
+					best_score = score;
+				}
+			}
+		}
+	}
 
-	u8 wdata;
-	if (brightness < 0 || brightness > 3)
-		return -1;
-	wdata = conf.kbd_bl.state_base_value | brightness;
-	return ec_write(conf.kbd_bl.bl_state_address, wdata);
+	match->fw = conf_index[best].fw;
+	match->conf = conf_index[best].conf;
 }
 
-static struct led_classdev micmute_led_cdev = {
-	.name = "platform::micmute",
-	.max_brightness = 1,
-	.brightness_set_blocking = &micmute_led_sysfs_set,
-	.default_trigger = "audio-micmute",
-};
+// the entries of a prefix, their nearest to ver is the highest below it
+static bool __init conf_match_prefix(struct msi_ec_device *ec,
+				     struct conf_probe *probe,
+				     const char *ver, const char *prefix,
+				     struct conf_match_result *match)
+{
+	size_t length = strlen(prefix);
+	int first = conf_index_lower_bound(prefix);
+	int last = first;
+	int nearest;
 
-static struct led_classdev mute_led_cdev = {
-	.name = "platform::mute",
-	.max_brightness = 1,
-	.brightness_set_blocking = &mute_led_sysfs_set,
-	.default_trigger = "audio-mute",
-};
+	while (last < conf_index_count &&
+	       !strncmp(conf_index[last].fw, prefix, length))
+		last++;
 
-static struct led_classdev msiacpi_led_kbdlight = {
-	.name = "msiacpi::kbd_backlight",
-	.max_brightness = 3,
-	.flags = LED_BRIGHT_HW_CHANGED,
-	.brightness_set_blocking = &kbd_bl_sysfs_set,
-	.brightness_get = &kbd_bl_sysfs_get,
-};
+	if (first == last)
+		return false;
 
-// ============================================================ //
-// Sysfs platform driver
-// ============================================================ //
+	nearest = min(conf_index_lower_bound(ver), last) - 1;
+	if (nearest < first)
+		nearest = first;
 
-static umode_t msi_ec_is_visible(struct kobject *kobj,
-				 struct attribute *attr,
-				 int idx)
+	conf_match_range(ec, probe, first, last, nearest, match);
+	return true;
+}
+
+// returns the board of the DMI board name, MS-14C1 for 14C1
+static bool __init conf_match_dmi_board(char board[CONF_MATCH_BOARD_LENGTH + 1])
 {
-	int address;
+	const char *name = dmi_get_system_info(DMI_BOARD_NAME);
 
-	if (!conf_loaded)
-		return 0;
+	if (!name || strncmp(name, "MS-", 3) ||
+	    strlen(name + 3) < CONF_MATCH_BOARD_LENGTH)
+		return false;
 
-	/* root group */
-	if (attr == &dev_attr_webcam.attr)
-		address = conf.webcam.address;
+	for (int i = 0; i < CONF_MATCH_BOARD_LENGTH; i++)
+		board[i] = toupper(name[3 + i]);
+	board[CONF_MATCH_BOARD_LENGTH] = '\0';
 
-	else if (attr == &dev_attr_webcam_block.attr)
-		address = conf.webcam.block_address;
+	return true;
+}
+
+// the configuration whose registers fit the EC, the newest on a tie
+static bool __init conf_match_probe(struct msi_ec_device *ec,
+				    struct conf_probe *probe,
+				    struct conf_match_result *match)
+{
+	int best_score = -1, ties = 0;
 
-	else if (attr == &dev_attr_fn_key.attr ||
-		 attr == &dev_attr_win_key.attr)
-		address = conf.fn_win_swap.address;
+	if (conf_probe_read(ec, probe) < 0)
+		return false;
 
-	else if (attr == &dev_attr_cooler_boost.attr)
-		address = conf.cooler_boost.address;
+	for (int i = 0; CONFIGURATIONS[i]; i++) {
+		int score = conf_probe_score(probe, CONFIGURATIONS[i]);
+
+		if (score > best_score) {
+			best_score = score;
+			match->conf = CONFIGURATIONS[i];
+			ties = 1;
+		} else if (score == best_score) {
+			match->conf = CONFIGURATIONS[i];
+			ties++;
+		}
+	}
 
-	else if (attr == &dev_attr_available_shift_modes.attr ||
-		 attr == &dev_attr_shift_mode.attr)
-		address = conf.shift_mode.address;
+	// the registers of every supported feature must hold known values
+	if (best_score < 100)
+		return false;
 
-	else if (attr == &dev_attr_super_battery.attr)
-		address = conf.super_battery.address;
+	match->fw = match->conf->allowed_fw[0];
+	match->confidence = match->confidence / ties;
+	return true;
+}
 
-	else if (attr == &dev_attr_available_fan_modes.attr ||
-		 attr == &dev_attr_fan_mode.attr)
-		address = conf.fan_mode.address;
+static bool __init conf_match_path(struct msi_ec_device *ec,
+				   struct conf_probe *probe, const char *ver,
+				   struct conf_match_result *match)
+{
+	char prefix[MSI_EC_FW_VERSION_LENGTH + 1];
+	const char *dot;
+	int i;
 
-	/* cpu group */
-	else if (attr == &dev_attr_cpu_realtime_temperature.attr)
-		address = conf.cpu.rt_temp_address;
+	switch (match->path) {
+	case CONF_MATCH_EXACT:
+		i = conf_index_lower_bound(ver);
+		if (i == conf_index_count || strcmp(conf_index[i].fw, ver))
+			return false;
 
-	else if (attr == &dev_attr_cpu_realtime_fan_speed.attr)
-		address = conf.cpu.rt_fan_speed_address;
+		match->fw = conf_index[i].fw;
+		match->conf = conf_index[i].conf;
+		return true;
 
-	/* gpu group */
-	else if (attr == &dev_attr_gpu_realtime_temperature.attr)
-		address = conf.gpu.rt_temp_address;
+	case CONF_MATCH_MODEL:
+		dot = strchr(ver, '.');
+		if (!dot)
+			return false;
 
-	else if (attr == &dev_attr_gpu_realtime_fan_speed.attr)
-		address = conf.gpu.rt_fan_speed_address;
+		strscpy(prefix, ver, min_t(size_t, dot - ver + 2,
+					   sizeof(prefix)));
+		return conf_match_prefix(ec, probe, ver, prefix, match);
 
-	/* default */
-	else
-		return attr->mode;
+	case CONF_MATCH_BOARD:
+		if (strlen(ver) < CONF_MATCH_BOARD_LENGTH)
+			return false;
 
-	return address == MSI_EC_ADDR_UNSUPP ? 0 : attr->mode;
-}
+		strscpy(prefix, ver, CONF_MATCH_BOARD_LENGTH + 1);
+		return conf_match_prefix(ec, probe, ver, prefix, match);
 
-static struct attribute_group msi_root_group = {
-	.is_visible = msi_ec_is_visible,
-	.attrs = msi_root_attrs,
-};
+	case CONF_MATCH_DMI:
+		// the DMI tables describe the real machine only
+		if (!msi_ec_is_main(ec) || !conf_match_dmi_board(prefix))
+			return false;
 
-static struct attribute_group msi_cpu_group = {
-	.name = "cpu",
-	.is_visible = msi_ec_is_visible,
-	.attrs = msi_cpu_attrs,
-};
-static struct attribute_group msi_gpu_group = {
-	.name = "gpu",
-	.is_visible = msi_ec_is_visible,
-	.attrs = msi_gpu_attrs,
-};
+		return conf_match_prefix(ec, probe, ver, prefix, match);
 
-static const struct attribute_group msi_debug_group = {
-	.name = "debug",
-	.attrs = msi_debug_attrs,
-};
+	case CONF_MATCH_PROBE:
+		return conf_match_probe(ec, probe, match);
 
-/* the debug group is created separately if needed */
-static const struct attribute_group *msi_platform_groups[] = {
-	&msi_root_group,
-	&msi_cpu_group,
-	&msi_gpu_group,
-	NULL
-};
+	default:
+		return false;
+	}
+}
 
-static int __init msi_platform_probe(struct platform_device *pdev)
+// returns -ENOENT if no path up to the conf_match parameter matches
+static int __init conf_match_find(struct msi_ec_device *ec, const char *ver,
+				  struct conf_match_result *match)
 {
-	if (debug) {
-		int result = sysfs_create_group(&pdev->dev.kobj,
-						&msi_debug_group);
-		if (result < 0)
-			return result;
+	struct conf_probe probe = { .done = false };
+	int last = match_string(conf_match_names, CONF_MATCH_PATHS, conf_match);
+
+	if (last < 0) {
+		pr_err("Unknown configuration matching path: %s\n", conf_match);
+		return -EINVAL;
 	}
 
-	return 0;
+	for (int path = CONF_MATCH_EXACT; path <= last; path++) {
+		match->path = path;
+		match->confidence = conf_match_confidence[path];
+		if (conf_match_path(ec, &probe, ver, match))
+			return 0;
+	}
+
+	return -ENOENT;
 }
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0))
-static void msi_platform_remove(struct platform_device *pdev)
-#else
-static int msi_platform_remove(struct platform_device *pdev)
-#endif
+static void __init conf_match_set(struct msi_ec_device *ec,
+				  const struct conf_match_result *match)
 {
-	if (debug)
-		sysfs_remove_group(&pdev->dev.kobj, &msi_debug_group);
-
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0))
-	return 0;
-#endif
+	ec->match_path = conf_match_names[match->path];
+	ec->match_confidence = match->confidence;
+	strscpy(ec->match_fw, match->fw ? match->fw : "-",
+		sizeof(ec->match_fw));
 }
 
-static struct platform_device *msi_platform_device;
-
-static struct platform_driver msi_platform_driver = {
-	.driver = {
-		.name = MSI_EC_DRIVER_NAME,
-		.dev_groups = msi_platform_groups,
-	},
-	.remove = msi_platform_remove,
-};
-
 // ============================================================ //
 // Module load/unload
 // ============================================================ //
 
-// must be called before msi_platform_probe()
-static int __init load_configuration(void)
+// must be called before the platform driver is registered
+static int __init load_configuration(struct msi_ec_device *ec)
 {
+	struct conf_match_result match;
 	int result;
 
 	char *ver;
-	char ver_by_ec[MSI_EC_FW_VERSION_LENGTH + 1]; // to store version read from EC
 
-	if (firmware) {
+	if (ec->fw_version[0]) {
 		// use fw version passed as a parameter
-		ver = firmware;
+		ver = ec->fw_version;
 	} else {
 		// get fw version from EC
-		result = ec_get_firmware_version(ver_by_ec);
+		result = ec_get_firmware_version(ec, ec->fw_version);
 		if (result < 0)
 			return result;
 
-		ver = ver_by_ec;
+		ver = ec->fw_version;
+	}
+
+	// a configuration from the blob takes precedence
+	if (!conf_blob_load(ec, ver)) {
+		match.path = CONF_MATCH_EXACT;
+		match.confidence = conf_match_confidence[CONF_MATCH_EXACT];
+		match.fw = ver;
+		conf_match_set(ec, &match);
+		return 0;
 	}
 
 	// load the suitable configuration, if exists
-	for (int i = 0; CONFIGURATIONS[i]; i++) {
-		if (match_string(CONFIGURATIONS[i]->allowed_fw, -1, ver) != -EINVAL) {
-			memcpy(&conf,
-			       CONFIGURATIONS[i],
-			       sizeof(struct msi_ec_conf));
-			conf.allowed_fw = NULL;
-			conf_loaded = true;
-			return 0;
-		}
+	result = conf_match_find(ec, ver, &match);
+	if (result == -EINVAL)
+		return result;
+
+	if (!result) {
+		conf_match_set(ec, &match);
+		// the attributes write to the EC without debug mode
+		if (match.path != CONF_MATCH_EXACT)
+			pr_warn("%s: firmware %s is not known, using the configuration of %s (%s match, %d%% confidence) with EC writes enabled, load with conf_match=exact to refuse it\n",
+				ec->name, ver, ec->match_fw, ec->match_path,
+				match.confidence);
+
+		return conf_install(ec, match.conf, "built-in");
 	}
 
 	// debug mode works regardless of whether the firmware is supported
 	if (debug)
 		return 0;
 
-	pr_err("Your firmware version is not supported!\n");
+	pr_err("%s: your firmware version is not supported!\n", ec->name);
 	return -EOPNOTSUPP;
 }
 
-static int __init msi_ec_init(void)
+// registers an LED of a supported address, a failure only loses the LED
+static void msi_ec_led_register(struct msi_ec_device *ec,
+				struct led_classdev *led, enum msi_ec_led id,
+				int address)
 {
 	int result;
 
-	result = load_configuration();
-	if (result < 0)
-		return result;
+	if (address == MSI_EC_ADDR_UNSUPP)
+		return;
+
+	result = led_classdev_register(&ec->pdev->dev, led);
+	if (result < 0) {
+		pr_warn("%s: LED %s is unavailable: %d\n", ec->name, led->name,
+			result);
+		return;
+	}
 
-	msi_platform_device = platform_create_bundle(&msi_platform_driver,
-						     msi_platform_probe,
-						     NULL, 0, NULL, 0);
-	if (IS_ERR(msi_platform_device))
-		return PTR_ERR(msi_platform_device);
+	ec->leds_registered |= BIT(id);
+}
 
-	pr_info("module_init\n");
-	if (!conf_loaded)
-		return 0;
+static void msi_ec_led_unregister(struct msi_ec_device *ec,
+				  struct led_classdev *led, enum msi_ec_led id)
+{
+	if (!(ec->leds_registered & BIT(id)))
+		return;
+
+	led_classdev_unregister(led);
+	ec->leds_registered &= ~BIT(id);
+}
+
+/*
+ * Brings up what is not needed to identify the EC and expose the attributes.
+ * Runs after the platform device is registered, and again for every
+ * configuration switch. Must be called with conf_switch_mutex held.
+ */
+static void msi_ec_bringup(struct msi_ec_device *ec)
+{
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	int result;
+
+	// a switch may have happened before the first bring-up
+	if (ec->bringup_done)
+		return;
+
+	// register LED classdevs
+	init_stage_begin(INIT_LEDS);
+	msi_ec_led_register(ec, &ec->micmute_led, MSI_EC_LED_MICMUTE,
+			    conf->leds.micmute_led_address);
+	msi_ec_led_register(ec, &ec->mute_led, MSI_EC_LED_MUTE,
+			    conf->leds.mute_led_address);
+	msi_ec_led_register(ec, &ec->kbd_led, MSI_EC_LED_KBD,
+			    conf->kbd_bl.bl_state_address);
+	init_stage_end(INIT_LEDS);
+
+	// the sensors as hwmon channels
+	init_stage_begin(INIT_HWMON);
+	result = msi_ec_hwmon_register(ec);
+	if (result < 0)
+		pr_warn("%s: hwmon is unavailable: %d\n", ec->name, result);
+	init_stage_end(INIT_HWMON);
+
+	// the system-wide features belong to the main instance
+	if (!msi_ec_is_main(ec))
+		goto done;
 
 	/*
 	 * Additional check: battery thresholds are supported only if
 	 * the 7th bit is set.
 	 */
-	if (conf.charge_control_address != MSI_EC_ADDR_UNSUPP) {
-		result = ec_check_bit(conf.charge_control_address, 7,
-				      &charge_control_supported);
+	init_stage_begin(INIT_BATTERY);
+	if (conf->charge_control_address != MSI_EC_ADDR_UNSUPP) {
+		result = ec_check_bit(ec, conf->charge_control_address, 7,
+				      &ec->charge_control_supported);
 		if (result < 0)
-			return result;
+			pr_warn("Battery charge control is unavailable: %d\n",
+				result);
 	}
 
-	if (charge_control_supported)
+	if (ec->charge_control_supported)
 		battery_hook_register(&battery_hook);
+	init_stage_end(INIT_BATTERY);
 
-	// register LED classdevs
-	if (conf.leds.micmute_led_address != MSI_EC_ADDR_UNSUPP)
-		led_classdev_register(&msi_platform_device->dev,
-				      &micmute_led_cdev);
+	// hold the highest shift mode under PM QoS latency constraints
+	if (conf->shift_mode.address != MSI_EC_ADDR_UNSUPP) {
+		init_stage_begin(INIT_PM_QOS);
+		result = qos_hold_register();
+		if (result < 0)
+			pr_warn("PM QoS performance hold is unavailable: %d\n",
+				result);
+		init_stage_end(INIT_PM_QOS);
+	}
+
+	// userspace fan control handle with the firmware fallback
+	if (conf->fan_mode.address != MSI_EC_ADDR_UNSUPP) {
+		init_stage_begin(INIT_FAN_LEASE);
+		result = fan_lease_register();
+		if (result < 0)
+			pr_warn("Fan control lease is unavailable: %d\n",
+				result);
+		init_stage_end(INIT_FAN_LEASE);
+	}
+
+	// the binary state snapshots
+	init_stage_begin(INIT_STATE);
+	result = state_register();
+	if (result < 0)
+		pr_warn("State snapshots are unavailable: %d\n", result);
+	init_stage_end(INIT_STATE);
+
+	// apply the ac/battery profiles on power source changes
+	init_stage_begin(INIT_POWER_PROFILE);
+	result = power_profile_register();
+	if (result < 0)
+		pr_warn("Power source profiles are unavailable: %d\n", result);
+	init_stage_end(INIT_POWER_PROFILE);
+
+	// the realtime sensors as perf events
+	init_stage_begin(INIT_PMU);
+	result = msi_ec_pmu_register();
+	if (result < 0)
+		pr_warn("Perf PMU is unavailable: %d\n", result);
+	init_stage_end(INIT_PMU);
+
+done:
+	ec->bringup_done = true;
+}
+
+static void msi_ec_bringup_fn(struct work_struct *work)
+{
+	struct msi_ec_device *ec =
+		container_of(work, struct msi_ec_device, bringup_work);
+
+	mutex_lock(&conf_switch_mutex);
+	msi_ec_bringup(ec);
+	mutex_unlock(&conf_switch_mutex);
+
+	// the load is over, a trace recorded from it is replayed from here
+	if (msi_ec_is_main(ec)) {
+		msi_ec_lock(&ec_trace_mutex);
+		ec_trace_mark();
+		msi_ec_unlock(&ec_trace_mutex);
+	}
+}
+
+/*
+ * Undoes msi_ec_bringup(), must be called with conf_switch_mutex held and
+ * the configuration of the bring-up still published, so that the state saved
+ * by the features is restored to the right registers.
+ */
+static void msi_ec_teardown(struct msi_ec_device *ec)
+{
+	lockdep_assert_held(&conf_switch_mutex);
+
+	if (!ec->bringup_done)
+		return;
+
+	// unregister LED classdevs
+	msi_ec_led_unregister(ec, &ec->micmute_led, MSI_EC_LED_MICMUTE);
+	msi_ec_led_unregister(ec, &ec->mute_led, MSI_EC_LED_MUTE);
+	msi_ec_led_unregister(ec, &ec->kbd_led, MSI_EC_LED_KBD);
+
+	msi_ec_hwmon_unregister(ec);
+
+	ec->bringup_done = false;
+
+	if (!msi_ec_is_main(ec))
+		return;
+
+	if (ec->charge_control_supported)
+		battery_hook_unregister(&battery_hook);
+	ec->charge_control_supported = false;
+
+	qos_hold_unregister();
+	power_profile_unregister();
+	fan_lease_unregister();
+	state_unregister();
+	msi_ec_pmu_unregister();
+}
+
+static int msi_ec_device_init(struct msi_ec_device *ec)
+{
+	msi_ec_lock_init(&ec->backend_mutex, "backend_mutex");
+	msi_ec_lock_init(&ec->ec_set_by_mask_mutex, "ec_set_by_mask_mutex");
+	msi_ec_lock_init(&ec->ec_unset_by_mask_mutex, "ec_unset_by_mask_mutex");
+	msi_ec_lock_init(&ec->ec_set_bit_mutex, "ec_set_bit_mutex");
+	msi_ec_lock_init(&ec->identity_mutex, "identity_mutex");
+
+	ec->micmute_led = micmute_led_cdev;
+	ec->mute_led = mute_led_cdev;
+	ec->kbd_led = msiacpi_led_kbdlight;
+	INIT_WORK(&ec->bringup_work, msi_ec_bringup_fn);
+
+	if (msi_ec_is_main(ec))
+		return 0;
+
+	// the LED names must be unique
+	ec->micmute_led.name = kasprintf(GFP_KERNEL, "%s::micmute", ec->name);
+	ec->mute_led.name = kasprintf(GFP_KERNEL, "%s::mute", ec->name);
+	ec->kbd_led.name = kasprintf(GFP_KERNEL, "%s::kbd_backlight", ec->name);
+	if (!ec->micmute_led.name || !ec->mute_led.name || !ec->kbd_led.name)
+		return -ENOMEM;
 
-	if (conf.leds.mute_led_address != MSI_EC_ADDR_UNSUPP)
-		led_classdev_register(&msi_platform_device->dev,
-				      &mute_led_cdev);
+	return 0;
+}
+
+static void msi_ec_emulated_free(struct msi_ec_device *ec)
+{
+	conf_free(ec);
+	kfree(ec->micmute_led.name);
+	kfree(ec->mute_led.name);
+	kfree(ec->kbd_led.name);
+	kfree(ec->name);
+	kfree(ec);
+}
+
+/*
+ * Every firmware version of the emulated_fw parameter gets its own emulated
+ * EC, exposed as the platform device msi-ec.N, with its own configuration,
+ * attributes and LEDs.
+ */
+static int __init msi_ec_emulated_add(int id)
+{
+	struct msi_ec_device *ec;
+	struct platform_device *pdev;
+	int result;
+
+	ec = kzalloc(sizeof(*ec), GFP_KERNEL);
+	if (!ec)
+		return -ENOMEM;
+
+	ec->name = kasprintf(GFP_KERNEL, "%s.%d", MSI_EC_DRIVER_NAME, id);
+	if (!ec->name) {
+		kfree(ec);
+		return -ENOMEM;
+	}
+
+	result = msi_ec_device_init(ec);
+	if (result < 0)
+		goto err_free;
+
+	strscpy(ec->fw_version, emulated_fw[id], sizeof(ec->fw_version));
+	ec->backend = &emulated_ec_backend;
+	result = ec->backend->init(ec);
+	if (result < 0)
+		goto err_free;
+
+	result = load_configuration(ec);
+	if (result < 0)
+		goto err_free;
+
+	// the probe looks the instance up by the device id
+	msi_ec_emulated[id] = ec;
+	pdev = platform_device_register_simple(MSI_EC_DRIVER_NAME, id, NULL, 0);
+	if (IS_ERR(pdev)) {
+		mutex_lock(&conf_switch_mutex);
+		msi_ec_emulated[id] = NULL;
+		mutex_unlock(&conf_switch_mutex);
+		result = PTR_ERR(pdev);
+		goto err_free;
+	}
+	ec->pdev = pdev;
+
+	ec->debugfs = debugfs_create_dir(ec->name, msi_ec_debugfs);
+	debugfs_create_file("conf", 0444, ec->debugfs, ec, &conf_fops);
+	debugfs_create_file("read_plan", 0444, ec->debugfs, ec,
+			    &read_plan_fops);
+	debugfs_create_file("match", 0444, ec->debugfs, ec, &match_fops);
+	debugfs_create_file("ec_image", 0600, ec->debugfs, ec, &ec_image_fops);
+
+	if (rcu_access_pointer(ec->conf))
+		queue_work(system_unbound_wq, &ec->bringup_work);
+
+	return 0;
+
+err_free:
+	msi_ec_emulated_free(ec);
+	return result;
+}
+
+static void msi_ec_emulated_remove(struct msi_ec_device *ec)
+{
+	debugfs_remove(ec->debugfs);
+	cancel_work_sync(&ec->bringup_work);
+
+	mutex_lock(&conf_switch_mutex);
+	msi_ec_teardown(ec);
+	mutex_unlock(&conf_switch_mutex);
+
+	platform_device_unregister(ec->pdev);
+	msi_ec_emulated_free(ec);
+}
 
-	if (conf.kbd_bl.bl_state_address != MSI_EC_ADDR_UNSUPP)
-		led_classdev_register(&msi_platform_device->dev,
-				      &msiacpi_led_kbdlight);
+static int __init msi_ec_init(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	struct platform_device *pdev;
+	int result;
+
+	init_start_ns = ktime_get_ns();
+
+	msi_ec_features_init();
+	msi_ec_device_init(ec);
+	if (firmware)
+		strscpy(ec->fw_version, firmware, sizeof(ec->fw_version));
+
+	result = ec_backend_select(ec);
+	if (result < 0)
+		return result;
+
+	if (ec_trace) {
+		msi_ec_lock(&ec_trace_mutex);
+		result = ec_trace_start();
+		msi_ec_unlock(&ec_trace_mutex);
+		if (result < 0)
+			pr_warn("EC transaction trace is unavailable: %d\n",
+				result);
+	}
+
+	msi_ec_stats_init();
+
+	init_stage_begin(INIT_IDENTIFY);
+	result = conf_index_build();
+	if (result < 0)
+		goto err_stats;
+
+	result = load_configuration(ec);
+	if (result < 0)
+		goto err_index;
+	init_stage_end(INIT_IDENTIFY);
 
+	// the attributes are created by the asynchronous probe
+	init_stage_begin(INIT_REGISTER);
+	result = platform_driver_register(&msi_platform_driver);
+	if (result < 0)
+		goto err_index;
+
+	pdev = platform_device_register_simple(MSI_EC_DRIVER_NAME,
+					       PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(pdev)) {
+		result = PTR_ERR(pdev);
+		goto err_driver;
+	}
+	ec->pdev = pdev;
+	init_stage_end(INIT_REGISTER);
+
+	conf_debugfs_init();
+
+	if (rcu_access_pointer(ec->conf))
+		queue_work(system_unbound_wq, &ec->bringup_work);
+
+	// a broken emulated instance does not affect the others
+	for (int i = 0; i < emulated_fw_count; i++) {
+		result = msi_ec_emulated_add(i);
+		if (result < 0)
+			pr_warn("Failed to add the emulated EC of %s: %d\n",
+				emulated_fw[i], result);
+	}
+
+	conf_index_free();
+	pr_info("module_init\n");
 	return 0;
+
+err_driver:
+	platform_driver_unregister(&msi_platform_driver);
+err_index:
+	conf_index_free();
+err_stats:
+	msi_ec_stats_exit();
+	ec_trace_free();
+	conf_free(ec);
+	return result;
 }
 
 static void __exit msi_ec_exit(void)
 {
-	if (conf_loaded) {
-		// unregister LED classdevs
-		if (conf.leds.micmute_led_address != MSI_EC_ADDR_UNSUPP)
-			led_classdev_unregister(&micmute_led_cdev);
+	struct msi_ec_device *ec = &msi_ec_main;
 
-		if (conf.leds.mute_led_address != MSI_EC_ADDR_UNSUPP)
-			led_classdev_unregister(&mute_led_cdev);
+	for (int i = 0; i < MSI_EC_MAX_EMULATED; i++) {
+		struct msi_ec_device *emulated;
 
-		if (conf.kbd_bl.bl_state_address != MSI_EC_ADDR_UNSUPP)
-			led_classdev_unregister(&msiacpi_led_kbdlight);
+		// the locks debugfs file no longer finds the instance
+		mutex_lock(&conf_switch_mutex);
+		emulated = msi_ec_emulated[i];
+		msi_ec_emulated[i] = NULL;
+		mutex_unlock(&conf_switch_mutex);
 
-		if (charge_control_supported)
-			battery_hook_unregister(&battery_hook);
+		if (emulated)
+			msi_ec_emulated_remove(emulated);
 	}
 
-	platform_device_unregister(msi_platform_device);
+	conf_debugfs_exit();
+	cancel_work_sync(&ec->bringup_work);
+
+	mutex_lock(&conf_switch_mutex);
+	msi_ec_teardown(ec);
+	mutex_unlock(&conf_switch_mutex);
+
+	platform_device_unregister(ec->pdev);
 	platform_driver_unregister(&msi_platform_driver);
 
+	// the attributes are gone, so no more background updates can be queued
+	cancel_work_sync(&qos_hold_work);
+	mutex_lock(&conf_switch_mutex);
+	cb_auto_stop();
+	mutex_unlock(&conf_switch_mutex);
+	arbiter_stop();
+	msi_ec_stats_exit();
+	ec_trace_free();
+	conf_free(ec);
+
 	pr_info("module_exit\n");
 }
 
@@ -0,0 +1,562 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * msi-ec-bench.c - Micro-benchmark of the msi-ec sysfs and LED paths.
+ *
+ * Every case is run for a fixed time at 1, 2, 4, ... up to the requested
+ * number of concurrent threads. Each thread keeps its own file descriptor
+ * and repeats the operation with pread()/pwrite() at offset 0, so every
+ * iteration reaches the driver's show/store handler.
+ *
+ * Results are printed one record per case and thread count, as JSON lines
+ * (default) or CSV, with the driver and firmware versions attached so that
+ * runs can be compared across firmwares and driver releases.
+ *
+ * Writes and LED changes store the value that was read beforehand, so they
+ * exercise the full path without changing the state of the laptop. The
+ * mode arbiter drops writes of the current value, so shift_mode and fan_mode
+ * writes alternate between the current value and another available one, and
+ * the writes the arbiter suppressed or delayed are reported separately. The
+ * current value is restored afterwards.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PLATFORM_PATH "/sys/devices/platform/msi-ec"
+#define LEDS_PATH "/sys/class/leds"
+
+#define MAX_SAMPLES (1 << 20) // per thread, further ops are only counted
+#define BUF_SIZE 8192 // large enough for ec_dump
+
+enum bench_op {
+	OP_READ,
+	OP_WRITE,
+};
+
+struct bench_case {
+	const char *name;
+	const char *path; // relative to the platform or LEDs directory
+	bool led;
+	enum bench_op op;
+	bool enabled_by_default;
+	const char *values_path; // arbitrated writes: the available values
+};
+
+static const struct bench_case cases[] = {
+	{ "shift_mode", "shift_mode", false, OP_READ, true, NULL },
+	{ "fan_mode", "fan_mode", false, OP_READ, true, NULL },
+	{ "cpu_temperature", "cpu/realtime_temperature", false, OP_READ, true,
+	  NULL },
+	{ "cpu_fan_speed", "cpu/realtime_fan_speed", false, OP_READ, true,
+	  NULL },
+	{ "gpu_temperature", "gpu/realtime_temperature", false, OP_READ, true,
+	  NULL },
+	{ "gpu_fan_speed", "gpu/realtime_fan_speed", false, OP_READ, true,
+	  NULL },
+	{ "fw_version", "fw_version", false, OP_READ, true, NULL },
+	{ "fw_release_date", "fw_release_date", false, OP_READ, true, NULL },
+	{ "ec_dump", "debug/ec_dump", false, OP_READ, true, NULL },
+	{ "shift_mode", "shift_mode", false, OP_WRITE, false,
+	  "available_shift_modes" },
+	{ "fan_mode", "fan_mode", false, OP_WRITE, false,
+	  "available_fan_modes" },
+	{ "webcam", "webcam", false, OP_WRITE, false, NULL },
+	{ "cooler_boost", "cooler_boost", false, OP_WRITE, false, NULL },
+	{ "mute_led", "platform::mute/brightness", true, OP_WRITE, false,
+	  NULL },
+	{ "micmute_led", "platform::micmute/brightness", true, OP_WRITE, false,
+	  NULL },
+	{ "kbd_backlight", "msiacpi::kbd_backlight/brightness", true, OP_WRITE,
+	  false, NULL },
+};
+
+#define CASES_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+struct bench_thread {
+	pthread_t thread;
+	const struct bench_case *bcase;
+	const char *file;
+	char values[2][64]; // written in turn by OP_WRITE
+	size_t values_len[2];
+	uint64_t *samples;
+	uint64_t ops;
+	uint64_t errors;
+};
+
+static const char *platform_path = PLATFORM_PATH;
+static const char *leds_path = LEDS_PATH;
+static unsigned int duration_ms = 1000;
+static unsigned int max_threads = 1;
+static bool csv;
+
+static pthread_barrier_t start_barrier;
+static volatile bool stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// reads a sysfs file into buf without the trailing newline
+static int read_value(const char *file, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+
+	while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+		len--;
+	buf[len] = '\0';
+
+	return 0;
+}
+
+static int write_value(const char *file, const char *value)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(file, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+
+	len = write(fd, value, strlen(value));
+	close(fd);
+
+	return len < 0 ? -errno : 0;
+}
+
+// the first value of a list that differs from value, or value itself
+static void other_value(const char *file, const char *value, char *buf,
+			size_t size)
+{
+	char list[1024];
+	char *saveptr;
+
+	snprintf(buf, size, "%s", value);
+	if (read_value(file, list, sizeof(list)))
+		return;
+
+	for (char *tok = strtok_r(list, " \n", &saveptr); tok;
+	     tok = strtok_r(NULL, " \n", &saveptr)) {
+		if (strcmp(tok, value)) {
+			snprintf(buf, size, "%s", tok);
+			return;
+		}
+	}
+}
+
+struct arbiter_counts {
+	unsigned long long suppressed;
+	unsigned long long deferred;
+};
+
+// the counters of register in mode_arbiter/stats, zero if not arbitrated
+static void read_arbiter_counts(const char *reg, struct arbiter_counts *c)
+{
+	char file[512];
+	char line[256];
+	char name[64];
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+	snprintf(file, sizeof(file), "%s/mode_arbiter/stats", platform_path);
+	f = fopen(file, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %*u %*u %llu %llu", name, &c->suppressed,
+			   &c->deferred) == 3 &&
+		    !strcmp(name, reg))
+			break;
+		memset(c, 0, sizeof(*c));
+	}
+	fclose(f);
+}
+
+static void *bench_thread_fn(void *arg)
+{
+	struct bench_thread *t = arg;
+	char buf[BUF_SIZE];
+	int fd;
+
+	fd = open(t->file, t->bcase->op == OP_READ ? O_RDONLY : O_WRONLY);
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		uint64_t start = now_ns();
+		ssize_t result;
+
+		if (fd < 0)
+			result = -1;
+		else if (t->bcase->op == OP_READ)
+			result = pread(fd, buf, sizeof(buf), 0);
+		else
+			result = pwrite(fd, t->values[t->ops & 1],
+					t->values_len[t->ops & 1], 0);
+
+		if (t->ops < MAX_SAMPLES)
+			t->samples[t->ops] = now_ns() - start;
+		t->ops++;
+
+		if (result < 0)
+			t->errors++;
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+	size_t i;
+
+	if (!n)
+		return 0;
+
+	i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+	return sorted[i];
+}
+
+struct bench_meta {
+	char driver_version[64];
+	char fw_version[64];
+	char kernel[128];
+};
+
+static void print_header(void)
+{
+	if (!csv)
+		return;
+
+	printf("case,op,threads,ops,errors,suppressed,deferred,duration_s,"
+	       "throughput_ops,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+	       "driver_version,fw_version,kernel\n");
+}
+
+static void print_result(const struct bench_case *bcase, unsigned int threads,
+			 uint64_t ops, uint64_t errors,
+			 const struct arbiter_counts *arbiter,
+			 double duration_s, const uint64_t *sorted, size_t n,
+			 const struct bench_meta *meta)
+{
+	const char *op = bcase->op == OP_READ ? "read" : "write";
+	double throughput = duration_s > 0 ? ops / duration_s : 0;
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < n; i++)
+		sum += sorted[i];
+
+	if (csv) {
+		printf("%s,%s,%u,%llu,%llu,%llu,%llu,%.3f,%.1f,%llu,%llu,"
+		       "%llu,%llu,%llu,%llu,%llu,%s,%s,%s\n",
+		       bcase->name, op, threads, (unsigned long long)ops,
+		       (unsigned long long)errors, arbiter->suppressed,
+		       arbiter->deferred, duration_s, throughput,
+		       (unsigned long long)(n ? sorted[0] : 0),
+		       (unsigned long long)(n ? sum / n : 0),
+		       (unsigned long long)percentile(sorted, n, 50),
+		       (unsigned long long)percentile(sorted, n, 90),
+		       (unsigned long long)percentile(sorted, n, 99),
+		       (unsigned long long)percentile(sorted, n, 99.9),
+		       (unsigned long long)(n ? sorted[n - 1] : 0),
+		       meta->driver_version, meta->fw_version, meta->kernel);
+		return;
+	}
+
+	printf("{\"case\":\"%s\",\"op\":\"%s\",\"threads\":%u,"
+	       "\"ops\":%llu,\"errors\":%llu,\"suppressed\":%llu,"
+	       "\"deferred\":%llu,\"duration_s\":%.3f,"
+	       "\"throughput_ops\":%.1f,\"latency_ns\":{\"min\":%llu,"
+	       "\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+	       "\"p999\":%llu,\"max\":%llu},\"driver_version\":\"%s\","
+	       "\"fw_version\":\"%s\",\"kernel\":\"%s\"}\n",
+	       bcase->name, op, threads, (unsigned long long)ops,
+	       (unsigned long long)errors, arbiter->suppressed,
+	       arbiter->deferred, duration_s, throughput,
+	       (unsigned long long)(n ? sorted[0] : 0),
+	       (unsigned long long)(n ? sum / n : 0),
+	       (unsigned long long)percentile(sorted, n, 50),
+	       (unsigned long long)percentile(sorted, n, 90),
+	       (unsigned long long)percentile(sorted, n, 99),
+	       (unsigned long long)percentile(sorted, n, 99.9),
+	       (unsigned long long)(n ? sorted[n - 1] : 0),
+	       meta->driver_version, meta->fw_version, meta->kernel);
+}
+
+static int run_case(const struct bench_case *bcase, unsigned int threads,
+		    const struct bench_meta *meta)
+{
+	struct arbiter_counts before, after;
+	struct bench_thread *t;
+	char file[512];
+	char values_file[512];
+	char value[64] = "";
+	char other[64] = "";
+	uint64_t *sorted;
+	uint64_t ops = 0, errors = 0, start, end;
+	size_t n = 0;
+	int result = 0;
+
+	snprintf(file, sizeof(file), "%s/%s",
+		 bcase->led ? leds_path : platform_path, bcase->path);
+
+	if (access(file, bcase->op == OP_READ ? R_OK : R_OK | W_OK))
+		return -errno;
+
+	// writes store the current value back, or alternate with another one
+	if (bcase->op == OP_WRITE) {
+		result = read_value(file, value, sizeof(value));
+		if (result < 0)
+			return result;
+
+		snprintf(other, sizeof(other), "%s", value);
+		if (bcase->values_path) {
+			snprintf(values_file, sizeof(values_file), "%s/%s",
+				 platform_path, bcase->values_path);
+			other_value(values_file, value, other, sizeof(other));
+		}
+	}
+
+	t = calloc(threads, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	pthread_barrier_init(&start_barrier, NULL, threads + 1);
+	stop = false;
+
+	for (unsigned int i = 0; i < threads; i++) {
+		t[i].bcase = bcase;
+		t[i].file = file;
+		strcpy(t[i].values[0], other);
+		t[i].values_len[0] = strlen(other);
+		strcpy(t[i].values[1], value);
+		t[i].values_len[1] = strlen(value);
+		t[i].samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+		if (!t[i].samples ||
+		    pthread_create(&t[i].thread, NULL, bench_thread_fn, &t[i])) {
+			fprintf(stderr, "failed to start thread %u\n", i);
+			exit(1);
+		}
+	}
+
+	read_arbiter_counts(bcase->path, &before);
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	usleep(duration_ms * 1000);
+	stop = true;
+
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_join(t[i].thread, NULL);
+		ops += t[i].ops;
+		errors += t[i].errors;
+		n += t[i].ops < MAX_SAMPLES ? t[i].ops : MAX_SAMPLES;
+	}
+	end = now_ns();
+
+	read_arbiter_counts(bcase->path, &after);
+	after.suppressed -= before.suppressed;
+	after.deferred -= before.deferred;
+	if (bcase->values_path)
+		write_value(file, value);
+
+	sorted = malloc((n ? n : 1) * sizeof(uint64_t));
+	if (!sorted) {
+		result = -ENOMEM;
+		goto free;
+	}
+
+	n = 0;
+	for (unsigned int i = 0; i < threads; i++) {
+		size_t count = t[i].ops < MAX_SAMPLES ? t[i].ops : MAX_SAMPLES;
+
+		memcpy(sorted + n, t[i].samples, count * sizeof(uint64_t));
+		n += count;
+	}
+	qsort(sorted, n, sizeof(uint64_t), compare_u64);
+
+	print_result(bcase, threads, ops, errors, &after, (end - start) / 1e9,
+		     sorted, n, meta);
+	fflush(stdout);
+
+	free(sorted);
+free:
+	for (unsigned int i = 0; i < threads; i++)
+		free(t[i].samples);
+	free(t);
+	pthread_barrier_destroy(&start_barrier);
+
+	return result;
+}
+
+static void read_meta(struct bench_meta *meta)
+{
+	struct utsname uts;
+	char file[512];
+
+	snprintf(file, sizeof(file), "%s/fw_version", platform_path);
+	if (read_value(file, meta->fw_version, sizeof(meta->fw_version)))
+		strcpy(meta->fw_version, "unknown");
+
+	if (read_value("/sys/module/msi_ec/version", meta->driver_version,
+		       sizeof(meta->driver_version)))
+		strcpy(meta->driver_version, "unknown");
+
+	if (uname(&uts))
+		strcpy(meta->kernel, "unknown");
+	else
+		snprintf(meta->kernel, sizeof(meta->kernel), "%s", uts.release);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [case[:read|:write]...]\n"
+		"\n"
+		"  -t THREADS   run with 1, 2, 4, ... up to THREADS threads (default 1)\n"
+		"  -d MS        duration of each run in milliseconds (default 1000)\n"
+		"  -w           also run the write and LED cases\n"
+		"  -c           print CSV instead of JSON lines\n"
+		"  -p PATH      platform device directory (default " PLATFORM_PATH ")\n"
+		"  -L PATH      LED class directory (default " LEDS_PATH ")\n"
+		"  -l           list the cases and exit\n"
+		"\n"
+		"Without case arguments all read cases are run. Writes store the\n"
+		"current value back, so they do not change the laptop state.\n"
+		"shift_mode and fan_mode writes alternate with another available\n"
+		"mode and restore the current one at the end.\n",
+		prog);
+}
+
+// 1, 2, 4, ... and max_threads last
+static unsigned int next_threads(unsigned int threads)
+{
+	if (threads == max_threads)
+		return max_threads + 1;
+
+	return threads * 2 < max_threads ? threads * 2 : max_threads;
+}
+
+static bool case_selected(const struct bench_case *bcase, int argc,
+			  char **argv, bool writes)
+{
+	const char *op = bcase->op == OP_READ ? "read" : "write";
+
+	if (!argc)
+		return bcase->enabled_by_default || writes;
+
+	for (int i = 0; i < argc; i++) {
+		size_t len = strlen(bcase->name);
+
+		if (strncmp(argv[i], bcase->name, len))
+			continue;
+
+		if (argv[i][len] == '\0' ||
+		    (argv[i][len] == ':' && !strcmp(argv[i] + len + 1, op)))
+			return true;
+	}
+
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_meta meta;
+	bool writes = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:wcp:L:lh")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			writes = true;
+			break;
+		case 'c':
+			csv = true;
+			break;
+		case 'p':
+			platform_path = optarg;
+			break;
+		case 'L':
+			leds_path = optarg;
+			break;
+		case 'l':
+			for (size_t i = 0; i < CASES_COUNT; i++)
+				printf("%s:%s\n", cases[i].name,
+				       cases[i].op == OP_READ ? "read" :
+								"write");
+			return 0;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!max_threads || !duration_ms) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	read_meta(&meta);
+	print_header();
+
+	for (size_t i = 0; i < CASES_COUNT; i++) {
+		if (!case_selected(&cases[i], argc - optind, argv + optind,
+				   writes))
+			continue;
+
+		for (unsigned int threads = 1; threads <= max_threads;
+		     threads = next_threads(threads)) {
+			int result = run_case(&cases[i], threads, &meta);
+
+			if (result < 0) {
+				fprintf(stderr, "%s: skipped: %s\n",
+					cases[i].name, strerror(-result));
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
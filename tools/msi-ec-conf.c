@@ -0,0 +1,614 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * msi-ec-conf.c - Encode and decode msi-ec configuration blobs.
+ *
+ * A configuration is written as "key = value" lines whose keys follow the
+ * designators of struct msi_ec_conf in msi-ec.c. Every allowed_fw line
+ * starts a new configuration:
+ *
+ *   allowed_fw = 14C1EMS1.012 14C1EMS1.101
+ *   charge_control_address = 0xef
+ *   webcam.address = 0x2e
+ *   shift_mode.modes = turbo:0xc4 eco:0xc2 comfort:0xc1 sport:0xc0
+ *   kbd_bl.bl_modes = 0x00 0x08
+ *   sensor = cpu_fan1 rpm 0xc8 2
+ *
+ * Every sensor line adds a sensor "label kind address [width [scale]]",
+ * kind being temp, fan, rpm or tach. Addresses that are not given are
+ * unsupported. Lines starting with "#" are comments. decode prints a blob
+ * back in the same format, as does the debugfs conf file of the driver.
+ *
+ * The blob is loaded by the driver from /lib/firmware/msi-ec/conf.bin (see
+ * the conf_blob module parameter).
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ec_memory_configuration.h"
+#include "../msi-ec-conf-blob.h"
+
+#define MAX_CONFIGURATIONS 256
+#define MAX_FW 64 // per configuration
+
+enum field_type {
+	FIELD_ADDRESS, // __le16, unsupported if not given
+	FIELD_U8,
+	FIELD_BIT,
+	FIELD_BOOL,
+	FIELD_SHIFT_MODES,
+	FIELD_FAN_MODES,
+	FIELD_BL_MODES,
+};
+
+struct field {
+	const char *key;
+	size_t offset;
+	enum field_type type;
+};
+
+#define FIELD(key, member, type) \
+	{ key, offsetof(struct msi_ec_conf_blob_entry, member), type }
+
+static const struct field fields[] = {
+	FIELD("charge_control_address", charge_control_address, FIELD_ADDRESS),
+	FIELD("webcam.address", webcam_address, FIELD_ADDRESS),
+	FIELD("webcam.block_address", webcam_block_address, FIELD_ADDRESS),
+	FIELD("webcam.bit", webcam_bit, FIELD_BIT),
+	FIELD("fn_win_swap.address", fn_win_swap_address, FIELD_ADDRESS),
+	FIELD("fn_win_swap.bit", fn_win_swap_bit, FIELD_BIT),
+	FIELD("fn_win_swap.invert", fn_win_swap_invert, FIELD_BOOL),
+	FIELD("cooler_boost.address", cooler_boost_address, FIELD_ADDRESS),
+	FIELD("cooler_boost.bit", cooler_boost_bit, FIELD_BIT),
+	FIELD("shift_mode.address", shift_mode_address, FIELD_ADDRESS),
+	FIELD("shift_mode.modes", shift_modes, FIELD_SHIFT_MODES),
+	FIELD("super_battery.address", super_battery_address, FIELD_ADDRESS),
+	FIELD("super_battery.mask", super_battery_mask, FIELD_U8),
+	FIELD("fan_mode.address", fan_mode_address, FIELD_ADDRESS),
+	FIELD("fan_mode.modes", fan_modes, FIELD_FAN_MODES),
+	FIELD("cpu.rt_temp_address", cpu_rt_temp_address, FIELD_ADDRESS),
+	FIELD("cpu.rt_fan_speed_address", cpu_rt_fan_speed_address,
+	      FIELD_ADDRESS),
+	FIELD("gpu.rt_temp_address", gpu_rt_temp_address, FIELD_ADDRESS),
+	FIELD("gpu.rt_fan_speed_address", gpu_rt_fan_speed_address,
+	      FIELD_ADDRESS),
+	FIELD("leds.micmute_led_address", micmute_led_address, FIELD_ADDRESS),
+	FIELD("leds.mute_led_address", mute_led_address, FIELD_ADDRESS),
+	FIELD("leds.bit", leds_bit, FIELD_BIT),
+	FIELD("kbd_bl.bl_mode_address", kbd_bl_mode_address, FIELD_ADDRESS),
+	FIELD("kbd_bl.bl_modes", kbd_bl_modes, FIELD_BL_MODES),
+	FIELD("kbd_bl.max_mode", kbd_bl_max_mode, FIELD_U8),
+	FIELD("kbd_bl.bl_state_address", kbd_bl_state_address, FIELD_ADDRESS),
+	FIELD("kbd_bl.state_base_value", kbd_bl_state_base_value, FIELD_U8),
+	FIELD("kbd_bl.max_state", kbd_bl_max_state, FIELD_U8),
+};
+
+#define FIELDS_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+// indexed by enum msi_ec_conf_blob_mode_id
+static const char *const mode_names[MSI_EC_CONF_BLOB_MODE_COUNT] = {
+	[MSI_EC_CONF_BLOB_SM_ECO] = "eco",
+	[MSI_EC_CONF_BLOB_SM_COMFORT] = "comfort",
+	[MSI_EC_CONF_BLOB_SM_SPORT] = "sport",
+	[MSI_EC_CONF_BLOB_SM_TURBO] = "turbo",
+	[MSI_EC_CONF_BLOB_FM_AUTO] = "auto",
+	[MSI_EC_CONF_BLOB_FM_SILENT] = "silent",
+	[MSI_EC_CONF_BLOB_FM_BASIC] = "basic",
+	[MSI_EC_CONF_BLOB_FM_ADVANCED] = "advanced",
+};
+
+// indexed by enum msi_ec_conf_blob_sensor_kind
+static const char *const sensor_kind_names[MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT] = {
+	[MSI_EC_CONF_BLOB_SENSOR_TEMP] = "temp",
+	[MSI_EC_CONF_BLOB_SENSOR_FAN] = "fan",
+	[MSI_EC_CONF_BLOB_SENSOR_RPM] = "rpm",
+	[MSI_EC_CONF_BLOB_SENSOR_TACH] = "tach",
+};
+
+struct configuration {
+	struct msi_ec_conf_blob_entry entry;
+	char fw[MAX_FW][MSI_EC_FW_VERSION_LENGTH];
+	struct msi_ec_conf_blob_sensor sensors[MSI_EC_SENSORS_MAX];
+};
+
+static struct configuration configurations[MAX_CONFIGURATIONS];
+static int configurations_count;
+
+// the standard CRC-32, as crc32_le(~0, ...) ^ ~0 in the kernel
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = ~0u;
+
+	while (len--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static void put_le16(void *p, uint16_t value)
+{
+	uint8_t *b = p;
+
+	b[0] = value & 0xff;
+	b[1] = value >> 8;
+}
+
+static uint16_t get_le16(const void *p)
+{
+	const uint8_t *b = p;
+
+	return b[0] | b[1] << 8;
+}
+
+static void put_le32(void *p, uint32_t value)
+{
+	put_le16(p, value & 0xffff);
+	put_le16((uint8_t *)p + 2, value >> 16);
+}
+
+static uint32_t get_le32(const void *p)
+{
+	return get_le16(p) | (uint32_t)get_le16((const uint8_t *)p + 2) << 16;
+}
+
+static char *trim(char *s)
+{
+	char *end;
+
+	while (*s == ' ' || *s == '\t')
+		s++;
+
+	end = s + strlen(s);
+	while (end > s && strchr(" \t\r\n", end[-1]))
+		end--;
+	*end = '\0';
+
+	return s;
+}
+
+static int parse_number(const char *s, long max, long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtol(s, &end, 0);
+
+	return !errno && end != s && !*end && *value >= 0 && *value <= max ?
+		       0 :
+		       -EINVAL;
+}
+
+static int parse_modes(struct msi_ec_conf_blob_mode *modes, char *value,
+		       int first_id, int last_id)
+{
+	int count = 0;
+
+	for (char *tok = strtok(value, " \t"); tok; tok = strtok(NULL, " \t")) {
+		char *sep = strchr(tok, ':');
+		long mode_value;
+		int id;
+
+		if (!sep || count == MSI_EC_CONF_BLOB_MODES)
+			return -EINVAL;
+		*sep++ = '\0';
+
+		for (id = first_id; id <= last_id; id++)
+			if (!strcmp(tok, mode_names[id]))
+				break;
+
+		if (id > last_id || parse_number(sep, 0xff, &mode_value))
+			return -EINVAL;
+
+		modes[count].id = id;
+		modes[count].value = mode_value;
+		count++;
+	}
+
+	return 0;
+}
+
+static int parse_field(struct configuration *c, const struct field *f,
+		       char *value)
+{
+	uint8_t *p = (uint8_t *)&c->entry + f->offset;
+	long n;
+
+	switch (f->type) {
+	case FIELD_ADDRESS:
+		if (parse_number(value, 0xff, &n))
+			return -EINVAL;
+		put_le16(p, n);
+		return 0;
+	case FIELD_U8:
+		if (parse_number(value, 0xff, &n))
+			return -EINVAL;
+		*p = n;
+		return 0;
+	case FIELD_BIT:
+		if (parse_number(value, 7, &n))
+			return -EINVAL;
+		*p = n;
+		return 0;
+	case FIELD_BOOL:
+		if (!strcmp(value, "true"))
+			n = 1;
+		else if (!strcmp(value, "false"))
+			n = 0;
+		else if (parse_number(value, 1, &n))
+			return -EINVAL;
+		*p = n;
+		return 0;
+	case FIELD_SHIFT_MODES:
+		return parse_modes((void *)p, value, MSI_EC_CONF_BLOB_SM_ECO,
+				   MSI_EC_CONF_BLOB_SM_TURBO);
+	case FIELD_FAN_MODES:
+		return parse_modes((void *)p, value, MSI_EC_CONF_BLOB_FM_AUTO,
+				   MSI_EC_CONF_BLOB_FM_ADVANCED);
+	case FIELD_BL_MODES:
+		for (int i = 0; i < 2; i++) {
+			char *tok = strtok(i ? NULL : value, " \t");
+
+			if (!tok || parse_number(tok, 0xff, &n))
+				return -EINVAL;
+			p[i] = n;
+		}
+		return strtok(NULL, " \t") ? -EINVAL : 0;
+	}
+
+	return -EINVAL;
+}
+
+static int parse_sensor(struct configuration *c, char *value)
+{
+	struct msi_ec_conf_blob_sensor *s;
+	char *label = strtok(value, " \t");
+	char *kind = strtok(NULL, " \t");
+	char *address = strtok(NULL, " \t");
+	char *width = strtok(NULL, " \t");
+	char *scale = strtok(NULL, " \t");
+	long n;
+
+	if (c->entry.sensor_count == MSI_EC_SENSORS_MAX - 1 || !address ||
+	    strtok(NULL, " \t") ||
+	    strlen(label) >= MSI_EC_CONF_BLOB_SENSOR_LABEL_LENGTH)
+		return -EINVAL;
+
+	s = &c->sensors[c->entry.sensor_count];
+	memset(s, 0, sizeof(*s));
+	strcpy(s->label, label);
+
+	s->kind = MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT;
+	for (int i = 0; i < MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT; i++)
+		if (!strcmp(kind, sensor_kind_names[i]))
+			s->kind = i;
+	if (s->kind == MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT)
+		return -EINVAL;
+
+	if (parse_number(address, 0xff, &n))
+		return -EINVAL;
+	put_le16(&s->address, n);
+
+	if (width) {
+		if (parse_number(width, MSI_EC_CONF_BLOB_SENSOR_WIDTH_MAX, &n))
+			return -EINVAL;
+		s->width = n;
+	}
+
+	if (scale) {
+		if (parse_number(scale, INT32_MAX, &n))
+			return -EINVAL;
+		put_le32(&s->scale, n);
+	}
+
+	c->entry.sensor_count++;
+	return 0;
+}
+
+static int begin_configuration(char *value)
+{
+	struct configuration *c;
+
+	if (configurations_count == MAX_CONFIGURATIONS)
+		return -ENOSPC;
+
+	c = &configurations[configurations_count++];
+	memset(c, 0, sizeof(*c));
+
+	for (size_t i = 0; i < FIELDS_COUNT; i++)
+		if (fields[i].type == FIELD_ADDRESS)
+			put_le16((uint8_t *)&c->entry + fields[i].offset,
+				 MSI_EC_CONF_BLOB_UNSUPP);
+
+	for (char *tok = strtok(value, " \t"); tok; tok = strtok(NULL, " \t")) {
+		if (c->entry.fw_count == MAX_FW ||
+		    strlen(tok) > MSI_EC_FW_VERSION_LENGTH)
+			return -EINVAL;
+		strncpy(c->fw[c->entry.fw_count++], tok,
+			MSI_EC_FW_VERSION_LENGTH);
+	}
+
+	return c->entry.fw_count ? 0 : -EINVAL;
+}
+
+static int read_text(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[512];
+	int lineno = 0;
+
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *key = trim(line);
+		const struct field *field = NULL;
+		char *value;
+		int result;
+
+		lineno++;
+		if (!*key || *key == '#')
+			continue;
+
+		value = strchr(key, '=');
+		if (!value)
+			goto invalid;
+		*value++ = '\0';
+		key = trim(key);
+		value = trim(value);
+
+		if (!strcmp(key, "allowed_fw")) {
+			result = begin_configuration(value);
+		} else if (!strcmp(key, "sensor")) {
+			if (!configurations_count)
+				goto invalid;
+
+			result = parse_sensor(
+				&configurations[configurations_count - 1],
+				value);
+		} else {
+			for (size_t i = 0; i < FIELDS_COUNT; i++)
+				if (!strcmp(key, fields[i].key))
+					field = &fields[i];
+
+			if (!field || !configurations_count)
+				goto invalid;
+
+			result = parse_field(
+				&configurations[configurations_count - 1],
+				field, value);
+		}
+
+		if (result < 0)
+			goto invalid;
+	}
+
+	fclose(f);
+	return 0;
+
+invalid:
+	fprintf(stderr, "%s:%d: invalid line\n", file, lineno);
+	fclose(f);
+	return -1;
+}
+
+static int encode(const char *in, const char *out)
+{
+	struct msi_ec_conf_blob_header header = { .magic = MSI_EC_CONF_BLOB_MAGIC };
+	uint8_t *blob, *p;
+	size_t size = sizeof(header);
+	FILE *f;
+
+	if (read_text(in) < 0)
+		return 1;
+
+	for (int i = 0; i < configurations_count; i++)
+		size += sizeof(configurations[i].entry) +
+			configurations[i].entry.fw_count *
+				MSI_EC_FW_VERSION_LENGTH +
+			configurations[i].entry.sensor_count *
+				sizeof(struct msi_ec_conf_blob_sensor);
+
+	blob = malloc(size);
+	if (!blob) {
+		perror("malloc");
+		return 1;
+	}
+
+	p = blob + sizeof(header);
+	for (int i = 0; i < configurations_count; i++) {
+		const struct configuration *c = &configurations[i];
+		size_t fw_size = c->entry.fw_count * MSI_EC_FW_VERSION_LENGTH;
+		size_t sensors_size =
+			c->entry.sensor_count * sizeof(c->sensors[0]);
+
+		memcpy(p, &c->entry, sizeof(c->entry));
+		p += sizeof(c->entry);
+		memcpy(p, c->fw, fw_size);
+		p += fw_size;
+		memcpy(p, c->sensors, sensors_size);
+		p += sensors_size;
+	}
+
+	put_le16(&header.version, MSI_EC_CONF_BLOB_VERSION);
+	put_le16(&header.count, configurations_count);
+	put_le32(&header.crc32,
+		 crc32(blob + sizeof(header), size - sizeof(header)));
+	memcpy(blob, &header, sizeof(header));
+
+	f = fopen(out, "wb");
+	if (!f || fwrite(blob, 1, size, f) != size || fclose(f)) {
+		perror(out);
+		free(blob);
+		return 1;
+	}
+
+	free(blob);
+	return 0;
+}
+
+static void print_modes(const struct msi_ec_conf_blob_mode *modes)
+{
+	for (int i = 0; i < MSI_EC_CONF_BLOB_MODES && modes[i].id; i++)
+		printf("%s%s:0x%02x", i ? " " : "",
+		       modes[i].id < MSI_EC_CONF_BLOB_MODE_COUNT ?
+			       mode_names[modes[i].id] :
+			       "?",
+		       modes[i].value);
+}
+
+static void print_entry(const struct msi_ec_conf_blob_entry *e,
+			const char *fw,
+			const struct msi_ec_conf_blob_sensor *sensors)
+{
+	printf("allowed_fw =");
+	for (int i = 0; i < e->fw_count; i++)
+		printf(" %.*s", MSI_EC_FW_VERSION_LENGTH,
+		       fw + i * MSI_EC_FW_VERSION_LENGTH);
+	printf("\n");
+
+	for (size_t i = 0; i < FIELDS_COUNT; i++) {
+		const uint8_t *p = (const uint8_t *)e + fields[i].offset;
+
+		switch (fields[i].type) {
+		case FIELD_ADDRESS:
+			if (get_le16(p) == MSI_EC_CONF_BLOB_UNSUPP)
+				continue;
+			printf("%s = 0x%02x\n", fields[i].key, get_le16(p));
+			break;
+		case FIELD_U8:
+			printf("%s = 0x%02x\n", fields[i].key, *p);
+			break;
+		case FIELD_BIT:
+			printf("%s = %u\n", fields[i].key, *p);
+			break;
+		case FIELD_BOOL:
+			printf("%s = %s\n", fields[i].key, *p ? "true" : "false");
+			break;
+		case FIELD_SHIFT_MODES:
+		case FIELD_FAN_MODES:
+			if (!((const struct msi_ec_conf_blob_mode *)p)->id)
+				continue;
+			printf("%s = ", fields[i].key);
+			print_modes((const void *)p);
+			printf("\n");
+			break;
+		case FIELD_BL_MODES:
+			printf("%s = 0x%02x 0x%02x\n", fields[i].key, p[0], p[1]);
+			break;
+		}
+	}
+
+	for (int i = 0; i < e->sensor_count; i++) {
+		const struct msi_ec_conf_blob_sensor *s = &sensors[i];
+
+		printf("sensor = %.*s %s 0x%02x %u %u\n",
+		       MSI_EC_CONF_BLOB_SENSOR_LABEL_LENGTH, s->label,
+		       s->kind < MSI_EC_CONF_BLOB_SENSOR_KIND_COUNT ?
+			       sensor_kind_names[s->kind] :
+			       "?",
+		       get_le16(&s->address), s->width ? s->width : 1,
+		       get_le32(&s->scale) ? get_le32(&s->scale) :
+		       s->kind == MSI_EC_CONF_BLOB_SENSOR_TACH ?
+					     MSI_EC_TACH_SCALE : 1);
+	}
+}
+
+static int decode(const char *in)
+{
+	const struct msi_ec_conf_blob_header *header;
+	uint8_t *blob;
+	size_t size, offset;
+	long file_size;
+	FILE *f;
+
+	f = fopen(in, "rb");
+	if (!f || fseek(f, 0, SEEK_END) || (file_size = ftell(f)) < 0) {
+		perror(in);
+		return 1;
+	}
+	rewind(f);
+
+	size = file_size;
+	blob = malloc(size ? size : 1);
+	if (!blob || fread(blob, 1, size, f) != size) {
+		perror(in);
+		fclose(f);
+		free(blob);
+		return 1;
+	}
+	fclose(f);
+
+	header = (const void *)blob;
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, MSI_EC_CONF_BLOB_MAGIC,
+		   sizeof(header->magic)) ||
+	    get_le16(&header->version) < 1 ||
+	    get_le16(&header->version) > MSI_EC_CONF_BLOB_VERSION) {
+		fprintf(stderr, "%s: not a configuration blob\n", in);
+		free(blob);
+		return 1;
+	}
+
+	offset = sizeof(*header);
+	if (crc32(blob + offset, size - offset) != get_le32(&header->crc32))
+		fprintf(stderr, "%s: CRC mismatch\n", in);
+
+	for (int i = 0; i < get_le16(&header->count); i++) {
+		const struct msi_ec_conf_blob_entry *e = (void *)(blob + offset);
+		size_t fw_size, sensors_size;
+
+		if (size - offset < sizeof(*e)) {
+			fprintf(stderr, "%s: truncated\n", in);
+			free(blob);
+			return 1;
+		}
+
+		fw_size = (size_t)e->fw_count * MSI_EC_FW_VERSION_LENGTH;
+		sensors_size = (size_t)e->sensor_count *
+			       sizeof(struct msi_ec_conf_blob_sensor);
+		if (size - offset - sizeof(*e) < fw_size + sensors_size) {
+			fprintf(stderr, "%s: truncated\n", in);
+			free(blob);
+			return 1;
+		}
+
+		printf("%s", i ? "\n" : "");
+		print_entry(e, (const char *)e + sizeof(*e),
+			    (const void *)((const char *)e + sizeof(*e) +
+					   fw_size));
+		offset += sizeof(*e) + fw_size + sensors_size;
+	}
+
+	free(blob);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s encode TEXT BLOB\n"
+		"       %s decode BLOB\n",
+		prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 4 && !strcmp(argv[1], "encode"))
+		return encode(argv[2], argv[3]);
+	if (argc == 3 && !strcmp(argv[1], "decode"))
+		return decode(argv[2]);
+
+	usage(argv[0]);
+	return 2;
+}
@@ -0,0 +1,1027 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * msi-ec-shim.h - The kernel API used by msi-ec.c, implemented in userspace.
+ *
+ * msi-ec.c is compiled unmodified against this header: every <linux/...>
+ * header it includes forwards here. The implementations live in shim.c and
+ * are backed by an emulated EC, so the attribute handlers and the module
+ * init/exit paths can be run under valgrind, perf or the sanitizers.
+ *
+ * Only what the driver uses is provided, with the kernel semantics that
+ * matter to it: mutexes and spinlocks are pthread mutexes, work items run
+ * on a worker thread, per-CPU data has a single copy and tracepoints are
+ * never enabled.
+ */
+
+#ifndef MSI_EC_SHIM_H
+#define MSI_EC_SHIM_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned short umode_t;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef uint8_t __u8;
+typedef uint16_t __le16; // little-endian hosts only
+typedef uint32_t __le32;
+typedef uint64_t __le64;
+
+#define cpu_to_le16(x) ((__le16)(x))
+#define cpu_to_le32(x) ((__le32)(x))
+#define cpu_to_le64(x) ((__le64)(x))
+#define le16_to_cpu(x) ((u16)(x))
+#define le32_to_cpu(x) ((u32)(x))
+#define le64_to_cpu(x) ((u64)(x))
+
+// ============================================================ //
+// Build environment
+// ============================================================ //
+
+#define KBUILD_MODNAME "msi_ec"
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 12, 0)
+
+#define __init
+#define __exit
+#define __initdata
+#define __initconst
+#define __user
+#define __percpu
+#define noinline __attribute__((__noinline__))
+#define __maybe_unused __attribute__((__unused__))
+#define __packed __attribute__((__packed__))
+#define _RET_IP_ ((unsigned long)__builtin_return_address(0))
+
+#ifndef pr_fmt
+#define pr_fmt(fmt) fmt
+#endif
+
+extern int shim_verbose;
+
+#define pr_err(fmt, ...) fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_warn(fmt, ...) fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info(fmt, ...)						\
+	do {								\
+		if (shim_verbose)					\
+			fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__);	\
+	} while (0)
+
+#define BIT(n) (1UL << (n))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define ERR_PTR(e) ((void *)(long)(e))
+#define PTR_ERR(p) ((long)(p))
+#define IS_ERR(p) ((unsigned long)(p) >= (unsigned long)-4095)
+#define IS_ERR_OR_NULL(p) (!(p) || IS_ERR(p))
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+#define swap(a, b)							\
+	do {								\
+		__typeof__(a) __tmp = (a);				\
+		(a) = (b);						\
+		(b) = __tmp;						\
+	} while (0)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define DIV_ROUND_CLOSEST(x, d) \
+	(((x) < 0 ? (x) - (d) / 2 : (x) + (d) / 2) / (d))
+#define array_size(n, size) ((size_t)(n) * (size))
+#define struct_size(p, member, n) \
+	(sizeof(*(p)) + array_size(n, sizeof(*(p)->member)))
+#define ilog2(n) (63 - __builtin_clzll((unsigned long long)(n)))
+#define S32_MAX INT32_MAX
+#define U32_MAX UINT32_MAX
+#define PAGE_SIZE 4096
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define BITS_TO_LONGS(n) DIV_ROUND_UP(n, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+#define bitmap_zero(map, bits) \
+	memset(map, 0, BITS_TO_LONGS(bits) * sizeof(long))
+#define __set_bit(n, map) \
+	((map)[(n) / BITS_PER_LONG] |= 1UL << ((n) % BITS_PER_LONG))
+#define test_bit(n, map) \
+	(!!((map)[(n) / BITS_PER_LONG] & (1UL << ((n) % BITS_PER_LONG))))
+#define for_each_set_bit(bit, map, size)				\
+	for ((bit) = 0; (bit) < (size); (bit)++)			\
+		if (!test_bit(bit, map)) {} else
+
+// ============================================================ //
+// Modules
+// ============================================================ //
+
+struct module;
+#define THIS_MODULE ((struct module *)0)
+
+enum shim_param_type {
+	SHIM_PARAM_charp,
+	SHIM_PARAM_bool,
+	SHIM_PARAM_int,
+	SHIM_PARAM_uint,
+	SHIM_PARAM__Bool = SHIM_PARAM_bool, // bool is a macro for _Bool
+};
+
+void shim_param_register(const char *name, void *value,
+			 enum shim_param_type type);
+void shim_param_register_array(const char *name, void *value,
+			       enum shim_param_type type, unsigned int *count,
+			       unsigned int max);
+int shim_param_set(const char *name, const char *value);
+
+#define module_param_named(name, value, type, perm)			\
+	static void __attribute__((constructor))			\
+	__shim_param_##name(void)					\
+	{								\
+		shim_param_register(#name, &(value),			\
+				    SHIM_PARAM_##type);			\
+	}
+#define module_param(name, type, perm) module_param_named(name, name, type, perm)
+// the values are comma-separated
+#define module_param_array(name, type, nump, perm)			\
+	static void __attribute__((constructor))			\
+	__shim_param_##name(void)					\
+	{								\
+		shim_param_register_array(#name, name,			\
+					  SHIM_PARAM_##type, nump,	\
+					  ARRAY_SIZE(name));		\
+	}
+#define MODULE_PARM_DESC(name, desc)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+
+#define module_init(fn) \
+	int shim_module_init(void) { return fn(); }
+#define module_exit(fn) \
+	void shim_module_exit(void) { fn(); }
+
+int shim_module_init(void);
+void shim_module_exit(void);
+
+// ============================================================ //
+// Locking and atomics
+// ============================================================ //
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define __MUTEX_INITIALIZER(name) { PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_MUTEX(name) struct mutex name = __MUTEX_INITIALIZER(name)
+
+static inline void mutex_init(struct mutex *l)
+{
+	pthread_mutex_init(&l->m, NULL);
+}
+static inline void mutex_lock(struct mutex *l) { pthread_mutex_lock(&l->m); }
+static inline void mutex_unlock(struct mutex *l) { pthread_mutex_unlock(&l->m); }
+static inline int mutex_trylock(struct mutex *l)
+{
+	return !pthread_mutex_trylock(&l->m);
+}
+
+typedef struct {
+	pthread_mutex_t m;
+} spinlock_t, raw_spinlock_t;
+
+#define DEFINE_SPINLOCK(x) spinlock_t x = { PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_RAW_SPINLOCK(x) raw_spinlock_t x = { PTHREAD_MUTEX_INITIALIZER }
+
+static inline void spin_lock(spinlock_t *l) { pthread_mutex_lock(&l->m); }
+static inline void spin_unlock(spinlock_t *l) { pthread_mutex_unlock(&l->m); }
+#define raw_spin_lock_irqsave(l, flags) \
+	((flags) = 0, pthread_mutex_lock(&(l)->m))
+#define raw_spin_unlock_irqrestore(l, flags) \
+	((void)(flags), pthread_mutex_unlock(&(l)->m))
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline int atomic_inc_return(atomic_t *v)
+{
+	return __atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_dec(atomic_t *v)
+{
+	__atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+// returns the old value, which is old if the exchange took place
+#define cmpxchg(p, old, new) ({						\
+	__typeof__(*(p)) __old = (old);					\
+	__atomic_compare_exchange_n((p), &__old, (new), false,		\
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);\
+	__old;								\
+})
+
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * SRCU readers take a read lock, so synchronize_srcu() waits for every
+ * reader and not only for the earlier ones. Readers may nest.
+ */
+struct srcu_struct {
+	pthread_rwlock_t lock;
+};
+
+#define DEFINE_STATIC_SRCU(name) \
+	static struct srcu_struct name = { PTHREAD_RWLOCK_INITIALIZER }
+
+static inline int srcu_read_lock(struct srcu_struct *ss)
+{
+	pthread_rwlock_rdlock(&ss->lock);
+	return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *ss, int idx)
+{
+	pthread_rwlock_unlock(&ss->lock);
+}
+
+static inline void synchronize_srcu(struct srcu_struct *ss)
+{
+	pthread_rwlock_wrlock(&ss->lock);
+	pthread_rwlock_unlock(&ss->lock);
+}
+
+#define __rcu
+#define lockdep_is_held(l) ((void)(l), 1)
+// only checks that the mutex is held, not by whom
+#define lockdep_assert_held(l) do {					\
+	if (!pthread_mutex_trylock(&(l)->m)) {				\
+		fprintf(stderr, "shim: %s is not held\n", #l);		\
+		abort();						\
+	}								\
+} while (0)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+#define rcu_access_pointer(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rcu_dereference_protected(p, c) ((void)(c), (p))
+#define srcu_dereference_check(p, ss, c) \
+	((void)(ss), (void)(c), __atomic_load_n(&(p), __ATOMIC_ACQUIRE))
+
+typedef struct {
+	s64 v;
+} local64_t;
+
+static inline void local64_set(local64_t *l, s64 i) { l->v = i; }
+static inline void local64_add(s64 i, local64_t *l) { l->v += i; }
+static inline s64 local64_xchg(local64_t *l, s64 i)
+{
+	s64 old = l->v;
+
+	l->v = i;
+	return old;
+}
+
+// ============================================================ //
+// Memory, per-CPU data and lists
+// ============================================================ //
+
+#define GFP_KERNEL 0u
+
+static inline void *kzalloc(size_t n, gfp_t gfp) { return calloc(1, n); }
+static inline void *kmalloc(size_t n, gfp_t gfp) { return malloc(n); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp)
+{
+	return calloc(n, size);
+}
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t gfp)
+{
+	size_t bytes = n * size;
+
+	return malloc(bytes ? bytes : 1);
+}
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void *kmemdup(const void *src, size_t n, gfp_t gfp)
+{
+	void *p = malloc(n);
+
+	return p ? memcpy(p, src, n) : NULL;
+}
+
+#define SZ_64K 0x10000
+static inline void *vmalloc(size_t n) { return malloc(n); }
+static inline void vfree(const void *p) { free((void *)p); }
+
+// this_cpu_*() always use the copy of cpu 0
+#define alloc_percpu(type) ((type *)calloc(nr_cpu_ids, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((ptr) + (cpu))
+#define this_cpu_ptr(ptr) (ptr)
+#define this_cpu_inc(var) __atomic_fetch_add(&(var), 1, __ATOMIC_RELAXED)
+#define this_cpu_add(var, val) \
+	__atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void list_add(struct list_head *n, struct list_head *head)
+{
+	n->next = head->next;
+	n->prev = head;
+	head->next->prev = n;
+	head->next = n;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return READ_ONCE(head->next) == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, __typeof__(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+// ============================================================ //
+// Strings
+// ============================================================ //
+
+int kstrtobool(const char *s, bool *res);
+int kstrtobool_from_user(const char __user *s, size_t count, bool *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoul(const char *s, unsigned int base, unsigned long *res);
+int kstrtou8(const char *s, unsigned int base, u8 *res);
+int kstrtou16(const char *s, unsigned int base, u16 *res);
+#define kstrtos32 kstrtoint
+#define kstrtou32 kstrtouint
+char *kstrdup(const char *s, gfp_t gfp);
+char *kasprintf(gfp_t gfp, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+char *kstrndup(const char *s, size_t max, gfp_t gfp);
+char *strim(char *s);
+ssize_t strscpy(char *dest, const char *src, size_t count);
+bool sysfs_streq(const char *s1, const char *s2);
+int match_string(const char *const *array, size_t n, const char *string);
+int sysfs_emit(char *buf, const char *fmt, ...);
+int scnprintf(char *buf, size_t size, const char *fmt, ...);
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...);
+
+static inline const char *str_on_off(bool v) { return v ? "on" : "off"; }
+
+// the swap function is always the generic one here
+#define sort(base, num, size, cmp, swap) qsort(base, num, size, cmp)
+
+struct rtc_time {
+	int tm_sec, tm_min, tm_hour, tm_mday, tm_mon, tm_year;
+};
+
+typedef s64 time64_t;
+
+time64_t rtc_tm_to_time64(struct rtc_time *tm);
+
+// ============================================================ //
+// Time and work items
+// ============================================================ //
+
+typedef s64 ktime_t;
+
+#define HZ 1000 // jiffies are milliseconds
+#define NSEC_PER_USEC 1000ull
+#define NSEC_PER_MSEC 1000000ull
+
+ktime_t ktime_get(void);
+unsigned long shim_jiffies(void);
+#define jiffies shim_jiffies()
+
+static inline u64 ktime_get_ns(void) { return ktime_get(); }
+static inline s64 ktime_to_ns(ktime_t t) { return t; }
+static inline s64 ktime_to_ms(ktime_t t) { return t / 1000000; }
+static inline s64 ktime_ms_delta(ktime_t a, ktime_t b)
+{
+	return (a - b) / 1000000;
+}
+void fsleep(unsigned long usecs);
+
+static inline unsigned long msecs_to_jiffies(unsigned int m) { return m; }
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return j; }
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+#define time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+
+static inline s64 div_s64(s64 a, s32 b) { return a / b; }
+static inline s64 div64_s64(s64 a, s64 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	struct work_struct *next; // in the pending list
+	u64 expires_ns;
+	bool pending;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+struct workqueue_struct;
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_highpri_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
+#define DECLARE_WORK(n, f) struct work_struct n = { .func = (f) }
+#define INIT_WORK(w, f) (*(w) = (struct work_struct){ .func = (f) })
+#define __DELAYED_WORK_INITIALIZER(n, f, flags) { .work = { .func = (f) } }
+#define DECLARE_DELAYED_WORK(n, f) \
+	struct delayed_work n = __DELAYED_WORK_INITIALIZER(n, f, 0)
+#define INIT_DELAYED_WORK(w, f) INIT_WORK(&(w)->work, f)
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool schedule_work(struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+void flush_work(struct work_struct *work);
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork,
+		      unsigned long delay);
+bool cancel_delayed_work(struct delayed_work *dwork);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+// ============================================================ //
+// Tasks and CPUs
+// ============================================================ //
+
+#define TASK_COMM_LEN 16
+
+struct task_struct {
+	pid_t pid;
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+};
+
+struct task_struct *shim_current(void);
+#define current shim_current()
+
+static inline pid_t task_tgid_nr(struct task_struct *t) { return t->tgid; }
+static inline pid_t task_pid_nr(struct task_struct *t) { return t->pid; }
+#define get_task_comm(buf, tsk) strscpy(buf, (tsk)->comm, TASK_COMM_LEN)
+
+#define SHIM_CPUS 2 // online at start, nr_cpu_ids
+extern unsigned int nr_cpu_ids;
+#define for_each_possible_cpu(cpu) \
+	for ((cpu) = 0; (cpu) < nr_cpu_ids; (cpu)++)
+
+struct cpumask {
+	unsigned long bits[1];
+};
+
+extern const struct cpumask *cpu_online_mask;
+unsigned int cpumask_first(const struct cpumask *mask);
+unsigned int cpumask_any_but(const struct cpumask *mask, unsigned int cpu);
+const struct cpumask *cpumask_of(unsigned int cpu);
+
+enum cpuhp_state {
+	CPUHP_INVALID = -1,
+	CPUHP_AP_ONLINE_DYN = 1,
+};
+
+static inline void cpus_read_lock(void) { }
+static inline void cpus_read_unlock(void) { }
+
+int cpuhp_setup_state(enum cpuhp_state state, const char *name,
+		      int (*startup)(unsigned int cpu),
+		      int (*teardown)(unsigned int cpu));
+void cpuhp_remove_state(enum cpuhp_state state);
+int cpuhp_setup_state_nocalls(enum cpuhp_state state, const char *name,
+			      int (*startup)(unsigned int cpu),
+			      int (*teardown)(unsigned int cpu));
+void cpuhp_remove_state_nocalls(enum cpuhp_state state);
+
+// ============================================================ //
+// Devices and sysfs
+// ============================================================ //
+
+struct kobject {
+	const char *name;
+};
+
+struct device {
+	struct kobject kobj;
+	void *driver_data;
+};
+
+#define kobj_to_dev(k) container_of(k, struct device, kobj)
+
+static inline void *dev_get_drvdata(const struct device *dev)
+{
+	return dev->driver_data;
+}
+
+struct attribute {
+	const char *name;
+	umode_t mode;
+};
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr,
+			char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t count);
+};
+
+#define __ATTR(_name, _mode, _show, _store)				\
+	{								\
+		.attr = { .name = #_name, .mode = _mode },		\
+		.show = _show,						\
+		.store = _store,					\
+	}
+#define __ATTR_RW(_name) __ATTR(_name, 0644, _name##_show, _name##_store)
+#define __ATTR_RO(_name) __ATTR(_name, 0444, _name##_show, NULL)
+#define __ATTR_WO(_name) __ATTR(_name, 0200, NULL, _name##_store)
+#define DEVICE_ATTR_RW(_name) \
+	struct device_attribute dev_attr_##_name = __ATTR_RW(_name)
+#define DEVICE_ATTR_RO(_name) \
+	struct device_attribute dev_attr_##_name = __ATTR_RO(_name)
+#define DEVICE_ATTR_WO(_name) \
+	struct device_attribute dev_attr_##_name = __ATTR_WO(_name)
+
+struct attribute_group {
+	const char *name;
+	umode_t (*is_visible)(struct kobject *kobj, struct attribute *attr,
+			      int n);
+	struct attribute **attrs;
+};
+
+#define ATTRIBUTE_GROUPS(_name)						\
+	static const struct attribute_group _name##_group = {		\
+		.attrs = _name##_attrs,					\
+	};								\
+	static const struct attribute_group *_name##_groups[] = {	\
+		&_name##_group,						\
+		NULL,							\
+	}
+
+int sysfs_create_group(struct kobject *kobj, const struct attribute_group *grp);
+void sysfs_remove_group(struct kobject *kobj,
+			const struct attribute_group *grp);
+int device_add_groups(struct device *dev,
+		      const struct attribute_group **groups);
+void device_remove_groups(struct device *dev,
+			  const struct attribute_group **groups);
+int sysfs_update_groups(struct kobject *kobj,
+			const struct attribute_group **groups);
+
+struct platform_device {
+	int id;
+	struct device dev;
+};
+
+static inline void platform_set_drvdata(struct platform_device *pdev,
+					void *data)
+{
+	pdev->dev.driver_data = data;
+}
+
+enum probe_type {
+	PROBE_DEFAULT_STRATEGY,
+	PROBE_PREFER_ASYNCHRONOUS, // probes are always synchronous here
+	PROBE_FORCE_SYNCHRONOUS,
+};
+
+// there is no system sleep here, the callbacks are never called
+struct dev_pm_ops {
+	int (*suspend)(struct device *dev);
+	int (*resume)(struct device *dev);
+};
+
+#define SIMPLE_DEV_PM_OPS(_name, _suspend, _resume)			\
+	const struct dev_pm_ops _name = {				\
+		.suspend = _suspend,					\
+		.resume = _resume,					\
+	}
+
+struct device_driver {
+	const char *name;
+	const struct attribute_group **dev_groups;
+	enum probe_type probe_type;
+	const struct dev_pm_ops *pm;
+};
+
+struct platform_driver {
+	struct device_driver driver;
+	int (*probe)(struct platform_device *pdev);
+	void (*remove)(struct platform_device *pdev);
+};
+
+#define PLATFORM_DEVID_NONE (-1)
+
+int platform_driver_register(struct platform_driver *drv);
+struct platform_device *
+platform_device_register_simple(const char *name, int id, void *res,
+				unsigned int num);
+void platform_device_unregister(struct platform_device *pdev);
+void platform_driver_unregister(struct platform_driver *drv);
+
+struct device *get_cpu_device(unsigned int cpu);
+
+// ============================================================ //
+// Files, seq_file, debugfs and misc devices
+// ============================================================ //
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	fmode_t f_mode;
+	void *private_data;
+};
+
+#define FMODE_READ 0x1
+#define FMODE_WRITE 0x2
+
+struct file_operations {
+	struct module *owner;
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	ssize_t (*read)(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos);
+	ssize_t (*write)(struct file *file, const char __user *buf,
+			 size_t count, loff_t *ppos);
+	int (*open)(struct inode *inode, struct file *file);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+int simple_open(struct inode *inode, struct file *file);
+loff_t noop_llseek(struct file *file, loff_t offset, int whence);
+loff_t default_llseek(struct file *file, loff_t offset, int whence);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+				const void *from, size_t available);
+ssize_t simple_write_to_buffer(void *to, size_t available, loff_t *ppos,
+			       const void __user *from, size_t count);
+
+struct seq_file {
+	char *buf;
+	size_t size;
+	size_t count;
+	int (*show)(struct seq_file *m, void *v);
+	void *private;
+};
+
+void seq_puts(struct seq_file *m, const char *s);
+void seq_printf(struct seq_file *m, const char *fmt, ...);
+int single_open(struct file *file, int (*show)(struct seq_file *m, void *v),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+
+#define DEFINE_SHOW_ATTRIBUTE(__name)					\
+static int __name##_open(struct inode *inode, struct file *file)	\
+{									\
+	return single_open(file, __name##_show, inode->i_private);	\
+}									\
+static const struct file_operations __name##_fops = {			\
+	.owner = THIS_MODULE,						\
+	.open = __name##_open,						\
+	.read = seq_read,						\
+	.llseek = seq_lseek,						\
+	.release = single_release,					\
+}
+
+struct dentry;
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+struct dentry *debugfs_create_file_size(const char *name, umode_t mode,
+					struct dentry *parent, void *data,
+					const struct file_operations *fops,
+					loff_t file_size);
+void debugfs_create_u32(const char *name, umode_t mode, struct dentry *parent,
+			u32 *value);
+void debugfs_remove(struct dentry *dentry);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+#define MISC_DYNAMIC_MINOR 255
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	umode_t mode;
+};
+
+int misc_register(struct miscdevice *misc);
+void misc_deregister(struct miscdevice *misc);
+
+// ============================================================ //
+// Notifiers, PM QoS and power supplies
+// ============================================================ //
+
+struct notifier_block {
+	int (*notifier_call)(struct notifier_block *nb, unsigned long action,
+			     void *data);
+	struct notifier_block *next;
+	int priority;
+};
+
+#define NOTIFY_DONE 0
+#define NOTIFY_OK 1
+
+enum dev_pm_qos_req_type {
+	DEV_PM_QOS_RESUME_LATENCY = 1,
+};
+
+#define PM_QOS_RESUME_LATENCY_NO_CONSTRAINT S32_MAX
+
+int dev_pm_qos_add_notifier(struct device *dev, struct notifier_block *nb,
+			    enum dev_pm_qos_req_type type);
+int dev_pm_qos_remove_notifier(struct device *dev, struct notifier_block *nb,
+			       enum dev_pm_qos_req_type type);
+s32 dev_pm_qos_read_value(struct device *dev, enum dev_pm_qos_req_type type);
+
+enum power_supply_type {
+	POWER_SUPPLY_TYPE_UNKNOWN = 0,
+	POWER_SUPPLY_TYPE_BATTERY,
+	POWER_SUPPLY_TYPE_UPS,
+	POWER_SUPPLY_TYPE_MAINS,
+};
+
+enum power_supply_notifier_events {
+	PSY_EVENT_PROP_CHANGED,
+};
+
+struct power_supply_desc {
+	const char *name;
+	enum power_supply_type type;
+};
+
+struct power_supply {
+	const struct power_supply_desc *desc;
+	struct device dev;
+};
+
+int power_supply_is_system_supplied(void);
+int power_supply_reg_notifier(struct notifier_block *nb);
+void power_supply_unreg_notifier(struct notifier_block *nb);
+
+struct acpi_battery_hook {
+	const char *name;
+	int (*add_battery)(struct power_supply *battery,
+			   struct acpi_battery_hook *hook);
+	int (*remove_battery)(struct power_supply *battery,
+			      struct acpi_battery_hook *hook);
+};
+
+void battery_hook_register(struct acpi_battery_hook *hook);
+void battery_hook_unregister(struct acpi_battery_hook *hook);
+
+// ============================================================ //
+// LEDs
+// ============================================================ //
+
+enum led_brightness {
+	LED_OFF = 0,
+	LED_ON = 1,
+	LED_FULL = 255,
+};
+
+#define LED_UNREGISTERING BIT(1)
+#define LED_BRIGHT_HW_CHANGED BIT(21)
+
+struct led_classdev {
+	const char *name;
+	unsigned int max_brightness;
+	unsigned long flags;
+	const char *default_trigger;
+	int (*brightness_set_blocking)(struct led_classdev *led_cdev,
+				       enum led_brightness brightness);
+	enum led_brightness (*brightness_get)(struct led_classdev *led_cdev);
+};
+
+int led_classdev_register(struct device *parent,
+			  struct led_classdev *led_cdev);
+void led_classdev_unregister(struct led_classdev *led_cdev);
+
+// ============================================================ //
+// Hwmon
+// ============================================================ //
+
+enum hwmon_sensor_types {
+	hwmon_chip,
+	hwmon_temp,
+	hwmon_fan,
+	hwmon_pwm,
+};
+
+// temp and fan channels share the attribute numbering here
+enum hwmon_temp_attributes { hwmon_temp_input, hwmon_temp_label };
+enum hwmon_fan_attributes { hwmon_fan_input, hwmon_fan_label };
+enum hwmon_pwm_attributes { hwmon_pwm_input };
+
+#define HWMON_T_INPUT BIT(hwmon_temp_input)
+#define HWMON_T_LABEL BIT(hwmon_temp_label)
+#define HWMON_F_INPUT BIT(hwmon_fan_input)
+#define HWMON_F_LABEL BIT(hwmon_fan_label)
+#define HWMON_PWM_INPUT BIT(hwmon_pwm_input)
+
+struct hwmon_channel_info {
+	enum hwmon_sensor_types type;
+	const u32 *config; // one per channel, 0 ends the list
+};
+
+struct hwmon_ops {
+	umode_t (*is_visible)(const void *drvdata,
+			      enum hwmon_sensor_types type, u32 attr,
+			      int channel);
+	int (*read)(struct device *dev, enum hwmon_sensor_types type, u32 attr,
+		    int channel, long *val);
+	int (*read_string)(struct device *dev, enum hwmon_sensor_types type,
+			   u32 attr, int channel, const char **str);
+};
+
+struct hwmon_chip_info {
+	const struct hwmon_ops *ops;
+	const struct hwmon_channel_info *const *info;
+};
+
+// the attributes are named after the parent, as msi-ec.0/hwmon/temp1_input
+struct device *
+hwmon_device_register_with_info(struct device *dev, const char *name,
+				void *drvdata,
+				const struct hwmon_chip_info *chip,
+				const struct attribute_group **extra_groups);
+void hwmon_device_unregister(struct device *dev);
+
+// ============================================================ //
+// Perf
+// ============================================================ //
+
+enum perf_event_task_context {
+	perf_invalid_context = -1,
+};
+
+#define PERF_PMU_CAP_NO_INTERRUPT 0x01
+#define PERF_PMU_CAP_NO_EXCLUDE 0x80
+#define PERF_ATTACH_TASK 0x04
+#define PERF_EF_START 0x01
+#define PERF_EF_RELOAD 0x02
+#define PERF_EF_UPDATE 0x04
+#define PERF_HES_STOPPED 0x01
+#define PERF_HES_UPTODATE 0x02
+
+struct perf_event_attr {
+	u32 type;
+	u64 config;
+	u64 sample_period;
+};
+
+struct hw_perf_event {
+	int state;
+	local64_t prev_count;
+};
+
+struct perf_event {
+	struct perf_event_attr attr;
+	struct pmu *pmu;
+	int cpu;
+	unsigned int attach_state;
+	struct hw_perf_event hw;
+	local64_t count;
+};
+
+struct pmu {
+	struct module *module;
+	int type;
+	int task_ctx_nr;
+	const struct attribute_group **attr_groups;
+	int capabilities;
+	int (*event_init)(struct perf_event *event);
+	int (*add)(struct perf_event *event, int flags);
+	void (*del)(struct perf_event *event, int flags);
+	void (*start)(struct perf_event *event, int flags);
+	void (*stop)(struct perf_event *event, int flags);
+	void (*read)(struct perf_event *event);
+};
+
+struct perf_pmu_events_attr {
+	struct device_attribute attr;
+	u64 id;
+	const char *event_str;
+};
+
+static inline bool is_sampling_event(struct perf_event *event)
+{
+	return event->attr.sample_period != 0;
+}
+
+int perf_pmu_register(struct pmu *pmu, const char *name, int type);
+void perf_pmu_migrate_context(struct pmu *pmu, int src_cpu, int dst_cpu);
+void perf_pmu_unregister(struct pmu *pmu);
+ssize_t perf_event_sysfs_show(struct device *dev,
+			      struct device_attribute *attr, char *page);
+int cpumap_print_to_pagebuf(bool list, char *buf, const struct cpumask *mask);
+
+#define PMU_FORMAT_ATTR(_name, _format)					\
+static ssize_t _name##_show(struct device *dev,			\
+			    struct device_attribute *attr, char *page)	\
+{									\
+	return sprintf(page, _format "\n");				\
+}									\
+static struct device_attribute format_attr_##_name = __ATTR_RO(_name)
+
+// ============================================================ //
+// Tracepoints (never enabled)
+// ============================================================ //
+
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define PARAMS(args...) args
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)			\
+	static inline void trace_##name(proto) {}			\
+	static inline bool trace_##name##_enabled(void) { return false; }
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	DEFINE_EVENT(name, name, PARAMS(proto), PARAMS(args))
+
+// ============================================================ //
+// Firmware loading (files in shim_firmware_path)
+// ============================================================ //
+
+struct firmware {
+	size_t size;
+	const u8 *data;
+};
+
+extern const char *shim_firmware_path;
+
+int firmware_request_nowarn(const struct firmware **fw, const char *name,
+			    struct device *device);
+void release_firmware(const struct firmware *fw);
+
+u32 crc32_le(u32 crc, const void *p, size_t len);
+
+// ============================================================ //
+// DMI (shim_dmi_board_name)
+// ============================================================ //
+
+enum dmi_field {
+	DMI_BOARD_NAME,
+};
+
+extern const char *shim_dmi_board_name;
+
+const char *dmi_get_system_info(int field);
+
+// ============================================================ //
+// EC
+// ============================================================ //
+
+int ec_read(u8 addr, u8 *val);
+int ec_write(u8 addr, u8 val);
+
+#endif // MSI_EC_SHIM_H
@@ -0,0 +1,3 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* tracepoints are never enabled in userspace, nothing to define */
@@ -0,0 +1,1344 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * msi-ec-test - Tests msi-ec.c with every configuration on the emulated EC.
+ *
+ * msi-ec.c is included rather than linked, so that CONFIGURATIONS[], the
+ * feature table and the static helpers can be driven directly. Each
+ * configuration is loaded in its own child process with the first firmware
+ * version it allows, and
+ *
+ *  - the is_visible() callbacks of every group must agree with the
+ *    addresses of the configuration,
+ *  - every readable attribute is read, the feature attributes are written
+ *    with each of their values and must read them back, the other writable
+ *    attributes are written with the value they show,
+ *  - the LEDs are read and set, the state device is read, also in two
+ *    parts that must come from one snapshot.
+ *
+ * The read-modify-write helpers, the transaction counts of concurrent
+ * operations and the settling of multi-byte sensors are checked once, on a
+ * scratch address of the first configuration, as is a configuration switch
+ * with background work pending, and the visibility and the locks on an
+ * emulated instance and without a configuration. The EC transactions of every operation are
+ * compared with a golden file of
+ *
+ *   conf operation path reads writes result
+ *
+ * lines: an operation that is new or missing, changes its result or takes
+ * more transactions than recorded fails the test.
+ *
+ *   msi-ec-test GOLDEN            check against GOLDEN
+ *   UPDATE=1 msi-ec-test GOLDEN   rewrite GOLDEN
+ */
+
+#define _GNU_SOURCE
+
+// first, it sets pr_fmt before the shim does
+#include "msi-ec.c"
+
+#include "shim.h"
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_SCRATCH_ADDRESS 0xfe
+#define TEST_FW_BUILD "0102202312:34:56" // date and time, MMDDYYYYhh:mm:ss
+
+struct test_line {
+	char key[224]; // conf operation path
+	unsigned long long reads;
+	unsigned long long writes;
+	long result;
+};
+
+static FILE *out;
+static const char *test_conf;
+static u64 test_reads;
+static u64 test_writes;
+static int test_failed;
+
+#define test_fail(fmt, ...) do {					\
+	fprintf(stderr, "FAIL %s: " fmt "\n", test_conf, ##__VA_ARGS__);	\
+	test_failed = 1;						\
+} while (0)
+
+static void op_begin(void)
+{
+	test_reads = shim_ec_reads;
+	test_writes = shim_ec_writes;
+}
+
+static void op_end(const char *op, const char *path, long result)
+{
+	fprintf(out, "%s %s %s %llu %llu %ld\n", test_conf, op, path,
+		(unsigned long long)(shim_ec_reads - test_reads),
+		(unsigned long long)(shim_ec_writes - test_writes),
+		result < 0 ? result : 0);
+}
+
+// the value of a single line attribute, without the newline
+static ssize_t attr_value(struct shim_attr *a, char *buf)
+{
+	ssize_t len = shim_attr_show(a, buf);
+
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+
+	return len;
+}
+
+static const struct msi_ec_feature *feature_find(const char *path)
+{
+	for (int i = 0; i < MSI_EC_FEATURE_COUNT; i++)
+		if (!strcmp(msi_ec_features[i].attr.path, path))
+			return &msi_ec_features[i];
+
+	return NULL;
+}
+
+// loads the driver in debug mode on an EC with the firmware version fw
+static int module_load(const char *fw)
+{
+	int result;
+
+	memset(shim_ec, 0, sizeof(shim_ec));
+	memcpy(shim_ec + MSI_EC_FW_VERSION_ADDRESS, fw, strlen(fw));
+	memcpy(shim_ec + MSI_EC_FW_DATE_ADDRESS, TEST_FW_BUILD,
+	       strlen(TEST_FW_BUILD));
+	shim_param_set("debug", "1");
+
+	result = shim_module_init();
+	shim_work_drain(0);
+	if (result < 0)
+		test_fail("%s: module init failed: %d", fw, result);
+
+	return result;
+}
+
+// ============================================================ //
+// Checks of a configuration
+// ============================================================ //
+
+static bool feature_expected(const struct msi_ec_feature *f,
+			     const struct msi_ec_conf *conf)
+{
+	if (f->kind == MSI_EC_KIND_SENSOR)
+		return msi_ec_sensor_find(conf, f->sensor, f->sensor_kind);
+
+	// the custom features have no address and are always there
+	return !f->address || conf_int(conf, f->address) != MSI_EC_ADDR_UNSUPP;
+}
+
+static void check_visibility(const struct msi_ec_conf *conf)
+{
+	struct kobject *kobj = &msi_ec_main.pdev->dev.kobj;
+
+	for (int i = 0; i < MSI_EC_FEATURE_COUNT; i++) {
+		struct msi_ec_feature *f = &msi_ec_features[i];
+		bool expected = feature_expected(f, conf);
+		umode_t mode;
+
+		mode = msi_ec_is_visible(kobj, &f->attr.dev_attr.attr, i);
+		if (!!mode != expected)
+			test_fail("%s is %svisible", f->attr.path,
+				  mode ? "" : "not ");
+		else if (mode && mode != f->attr.dev_attr.attr.mode)
+			test_fail("%s has mode %04o", f->attr.path, mode);
+
+		if (!!shim_attr_find(f->attr.path) != expected)
+			test_fail("%s is %sregistered", f->attr.path,
+				  expected ? "not " : "");
+	}
+}
+
+// the attributes of the groups of the system-wide features
+static bool group_attr_expected(const struct attribute_group *group,
+				const struct attribute *attr,
+				const struct msi_ec_conf *conf)
+{
+	bool shift_mode = conf->shift_mode.address != MSI_EC_ADDR_UNSUPP;
+	bool fan_mode = conf->fan_mode.address != MSI_EC_ADDR_UNSUPP;
+
+	if (group == &msi_pm_qos_group)
+		return shift_mode;
+
+	if (group == &msi_ac_profile_group ||
+	    group == &msi_battery_profile_group) {
+		if (!strcmp(attr->name, "shift_mode"))
+			return shift_mode;
+		if (!strcmp(attr->name, "fan_mode"))
+			return fan_mode;
+		if (!strcmp(attr->name, "super_battery"))
+			return conf->super_battery.address !=
+			       MSI_EC_ADDR_UNSUPP;
+		if (!strcmp(attr->name, "kbd_backlight"))
+			return conf->kbd_bl.bl_state_address !=
+			       MSI_EC_ADDR_UNSUPP;
+		return true;
+	}
+
+	if (group == &msi_cb_auto_group)
+		return conf->cooler_boost.address != MSI_EC_ADDR_UNSUPP &&
+		       (msi_ec_sensor_find(conf, "cpu", MSI_EC_SENSOR_TEMP) ||
+			msi_ec_sensor_find(conf, "gpu", MSI_EC_SENSOR_TEMP));
+
+	if (group == &msi_fan_lease_group)
+		return fan_mode;
+
+	if (group == &msi_arbiter_group)
+		return shift_mode || fan_mode;
+
+	test_fail("%s: unknown group", group->name);
+	return false;
+}
+
+/*
+ * Every is_visible decision of the groups of ec: the features follow conf,
+ * the other groups are only visible on the main instance, and nothing is
+ * visible without a configuration.
+ */
+static void check_groups(struct msi_ec_device *ec,
+			 const struct msi_ec_conf *conf)
+{
+	struct kobject *kobj = &ec->pdev->dev.kobj;
+
+	for (int i = 0; msi_platform_groups[i]; i++) {
+		const struct attribute_group *group = msi_platform_groups[i];
+
+		for (int j = 0; group->attrs[j]; j++) {
+			struct attribute *attr = group->attrs[j];
+			bool expected = false;
+			umode_t mode;
+
+			if (conf && group->is_visible == msi_ec_is_visible)
+				expected = feature_expected(
+					to_msi_ec_feature(container_of(
+						attr, struct device_attribute,
+						attr)), conf);
+			else if (conf && msi_ec_is_main(ec))
+				expected = group_attr_expected(group, attr,
+							       conf);
+
+			mode = group->is_visible(kobj, attr, j);
+			if (!!mode != expected)
+				test_fail("%s: %s/%s is %svisible", ec->name,
+					  group->name ? group->name : ".",
+					  attr->name, mode ? "" : "not ");
+		}
+	}
+}
+
+static void check_shows(void)
+{
+	for (int i = 0; i < shim_attr_count(); i++) {
+		struct shim_attr *a = shim_attr_get(i);
+		char buf[PAGE_SIZE];
+		ssize_t len;
+
+		if (!(a->mode & 0444))
+			continue;
+
+		// the hwmon reads are counted from a cold sample
+		if (msi_ec_main.hwmon && a->dev == msi_ec_main.hwmon->dev)
+			msi_ec_main.hwmon->sampled = false;
+
+		op_begin();
+		len = shim_attr_show(a, buf);
+		op_end("show", a->path, len);
+
+		if (len > 0 && memchr(buf, '\0', len))
+			test_fail("%s: NUL in the value", a->path);
+	}
+}
+
+// stores value and, for a feature, expects to read it back
+static void store(struct shim_attr *a, const char *value, bool read_back)
+{
+	char op[96];
+	char buf[PAGE_SIZE];
+	ssize_t len;
+
+	op_begin();
+	len = shim_attr_store(a, value);
+	snprintf(op, sizeof(op), "store=%s", value);
+	op_end(op, a->path, len);
+
+	if (len >= 0 && len != (ssize_t)strlen(value))
+		test_fail("%s: store of %s returned %zd", a->path, value, len);
+
+	if (!read_back)
+		return;
+
+	if (len < 0) {
+		test_fail("%s: store of %s failed: %zd", a->path, value, len);
+		return;
+	}
+
+	len = attr_value(a, buf);
+	if (len < 0 || strcmp(buf, value))
+		test_fail("%s: reads %s after a store of %s", a->path,
+			  len < 0 ? "an error" : buf, value);
+}
+
+static void check_feature_stores(struct shim_attr *a,
+				 const struct msi_ec_feature *f,
+				 const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_mode *modes;
+
+	switch (f->kind) {
+	case MSI_EC_KIND_BIT:
+		store(a, f->direction ? "left" : "on", true);
+		store(a, f->direction ? "right" : "off", true);
+		break;
+	case MSI_EC_KIND_MASK:
+		store(a, "on", true);
+		store(a, "off", true);
+		break;
+	case MSI_EC_KIND_ENUM:
+		modes = msi_ec_feature_modes(f, conf);
+		for (int i = 0; modes[i].name; i++)
+			store(a, modes[i].name, true);
+		store(a, "msi-ec-test", false);
+		break;
+	default:
+		break;
+	}
+}
+
+// writable attributes that do not take the value they show
+static const struct {
+	const char *path;
+	const char *value;
+} test_store_values[] = {
+	{ "identity", "refresh" },
+	{ "debug/ec_get", "a0" },
+	{ "debug/ec_set", "fe=00" },
+	{ "mode_arbiter/priorities", "msi-ec-test=1" },
+	{ }
+};
+
+static void check_stores(const struct msi_ec_conf *conf)
+{
+	for (int i = 0; i < shim_attr_count(); i++) {
+		struct shim_attr *a = shim_attr_get(i);
+		const struct msi_ec_feature *f = feature_find(a->path);
+		const char *value = NULL;
+		char buf[PAGE_SIZE];
+
+		if (!(a->mode & 0222))
+			continue;
+
+		if (f && f->kind != MSI_EC_KIND_CUSTOM) {
+			check_feature_stores(a, f, conf);
+			continue;
+		}
+
+		for (int j = 0; test_store_values[j].path; j++)
+			if (!strcmp(test_store_values[j].path, a->path))
+				value = test_store_values[j].value;
+
+		if (!value) {
+			if (attr_value(a, buf) < 0 || strchr(buf, '\n')) {
+				test_fail("%s: no value to store", a->path);
+				continue;
+			}
+			value = buf;
+		}
+
+		store(a, value, false);
+	}
+}
+
+static void check_leds(void)
+{
+	char op[32];
+
+	for (int i = 0; i < shim_led_count(); i++) {
+		struct led_classdev *led = shim_led_get(i);
+		unsigned int values[] = { led->max_brightness, 0 };
+
+		if (led->brightness_get) {
+			op_begin();
+			led->brightness_get(led);
+			op_end("led", led->name, 0);
+		}
+
+		for (int j = 0; j < ARRAY_SIZE(values); j++) {
+			int result;
+
+			op_begin();
+			result = led->brightness_set_blocking(led, values[j]);
+			snprintf(op, sizeof(op), "led=%u", values[j]);
+			op_end(op, led->name, result);
+
+			if (result < 0)
+				test_fail("%s: set to %u failed: %d", led->name,
+					  values[j], result);
+			else if (led->brightness_get &&
+				 led->brightness_get(led) != values[j])
+				test_fail("%s: not set to %u", led->name,
+					  values[j]);
+		}
+	}
+}
+
+// reads of one open file after the first are served from its snapshot
+static void check_state_snapshot(const struct msi_ec_conf *conf)
+{
+	const struct msi_ec_sensor *sensor;
+	const size_t split = offsetof(struct msi_ec_state, values);
+	struct msi_ec_state state;
+	struct inode inode = { 0 };
+	struct file file = { 0 };
+	loff_t pos = 0;
+	u32 value;
+
+	sensor = msi_ec_sensor_find(conf, "cpu", MSI_EC_SENSOR_TEMP);
+	if (!sensor)
+		return;
+
+	shim_ec[sensor->address] = 50;
+	if (state_open(&inode, &file) < 0) {
+		test_fail("msi-ec-state: open failed");
+		return;
+	}
+
+	if (state_read(&file, (char *)&state, split, &pos) != split) {
+		test_fail("msi-ec-state: first read failed");
+		goto release;
+	}
+
+	shim_ec[sensor->address] = 60;
+	if (state_read(&file, (char *)&state + split, sizeof(state),
+		       &pos) != sizeof(state) - split) {
+		test_fail("msi-ec-state: second read failed");
+		goto release;
+	}
+
+	value = le32_to_cpu(state.values[MSI_EC_STATE_CPU_REALTIME_TEMPERATURE]);
+	if (value != 50)
+		test_fail("msi-ec-state: split read returned %u", value);
+
+	pos = 0;
+	if (state_read(&file, (char *)&state, sizeof(state), &pos) !=
+	    sizeof(state))
+		test_fail("msi-ec-state: read at offset 0 failed");
+	else if (le32_to_cpu(state.values[MSI_EC_STATE_CPU_REALTIME_TEMPERATURE]) != 60)
+		test_fail("msi-ec-state: no new snapshot at offset 0");
+
+release:
+	state_release(&inode, &file);
+}
+
+static void check_state(const struct msi_ec_conf *conf)
+{
+	struct msi_ec_state state;
+	ssize_t len;
+
+	op_begin();
+	len = shim_misc_read("msi-ec-state", (char *)&state, sizeof(state));
+	op_end("misc", "msi-ec-state", len);
+
+	if (len != sizeof(state))
+		test_fail("msi-ec-state: read %zd bytes", len);
+	else if (le16_to_cpu(state.version) != MSI_EC_STATE_VERSION)
+		test_fail("msi-ec-state: version %u", le16_to_cpu(state.version));
+
+	check_state_snapshot(conf);
+}
+
+static int test_conf_child(struct msi_ec_conf *expected)
+{
+	const char *fw = expected->allowed_fw[0];
+	const struct msi_ec_conf *conf;
+	int result;
+
+	op_begin();
+	result = module_load(fw);
+	op_end("load", fw, result);
+
+	if (result < 0)
+		return 1;
+
+	conf = msi_ec_conf(&msi_ec_main);
+	if (!conf || strcmp(conf->name, expected->name)) {
+		test_fail("%s: loaded %s", fw, conf ? conf->name : "nothing");
+	} else {
+		check_visibility(conf);
+		check_groups(&msi_ec_main, conf);
+		check_shows();
+		check_stores(conf);
+		check_leds();
+		check_state(conf);
+	}
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Read-modify-write helpers and sensors
+// ============================================================ //
+
+static void check_rmw_value(const char *op, int result, u8 expected)
+{
+	op_end(op, "-", result);
+
+	if (result < 0)
+		test_fail("%s failed: %d", op, result);
+	else if (shim_ec[TEST_SCRATCH_ADDRESS] != expected)
+		test_fail("%s left %02x instead of %02x", op,
+			  shim_ec[TEST_SCRATCH_ADDRESS], expected);
+}
+
+static void check_rmw_flag(const char *op, int result, bool value,
+			   bool expected)
+{
+	op_end(op, "-", result);
+
+	if (result < 0)
+		test_fail("%s failed: %d", op, result);
+	else if (value != expected)
+		test_fail("%s returned %d", op, value);
+}
+
+// a batch may touch the bytes of any read-modify-write helper
+static void check_batch_locks(struct msi_ec_device *ec)
+{
+	struct msi_ec_lock *locks[] = {
+		&ec->ec_set_by_mask_mutex,
+		&ec->ec_unset_by_mask_mutex,
+		&ec->ec_set_bit_mutex,
+	};
+	struct msi_ec_batch_op ops[2];
+	u64 acquisitions[ARRAY_SIZE(locks)];
+	int result;
+	int n = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(locks); i++)
+		acquisitions[i] = locks[i]->acquisitions;
+
+	n = ec_batch_add(ops, n, TEST_SCRATCH_ADDRESS, 0x80, 0x80);
+	n = ec_batch_add(ops, n, TEST_SCRATCH_ADDRESS, 0x01, 0x00);
+
+	op_begin();
+	result = ec_write_batch(ec, ops, n);
+	check_rmw_value("write_batch", result, 0x9a);
+
+	for (int i = 0; i < ARRAY_SIZE(locks); i++)
+		if (locks[i]->acquisitions != acquisitions[i] + 1)
+			test_fail("write_batch did not take %s",
+				  locks[i]->name);
+}
+
+struct op_thread {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	struct msi_ec_op op;
+	const char *attr;
+	const char *current_attr;
+	int reads;
+};
+
+static void *op_thread_fn(void *arg)
+{
+	struct op_thread *t = arg;
+	u8 value;
+
+	ec_op_begin(&t->op, t->attr);
+	pthread_barrier_wait(t->barrier);
+	for (int i = 0; i < t->reads; i++)
+		msi_ec_read(&msi_ec_main, TEST_SCRATCH_ADDRESS, &value);
+	// the attribute of the EC tracepoints
+	t->current_attr = ec_op_current() ? ec_op_current()->attr : NULL;
+	pthread_barrier_wait(t->barrier);
+	ec_op_end(&t->op);
+
+	return NULL;
+}
+
+// operations running at the same time only see their own transactions
+static void check_op_counts(void)
+{
+	struct op_thread threads[2] = {
+		{ .attr = "shift_mode", .reads = 3 },
+		{ .attr = "fan_mode", .reads = 5 },
+	};
+	pthread_barrier_t barrier;
+
+	pthread_barrier_init(&barrier, NULL, ARRAY_SIZE(threads));
+	for (int i = 0; i < ARRAY_SIZE(threads); i++) {
+		threads[i].barrier = &barrier;
+		pthread_create(&threads[i].thread, NULL, op_thread_fn,
+			       &threads[i]);
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(threads); i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].op.ec_reads != threads[i].reads ||
+		    threads[i].op.ec_writes)
+			test_fail("operation counted %u reads %u writes instead of %d reads",
+				  threads[i].op.ec_reads,
+				  threads[i].op.ec_writes, threads[i].reads);
+		if (threads[i].current_attr != threads[i].attr)
+			test_fail("operation of %s traced as %s",
+				  threads[i].attr, threads[i].current_attr);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	for (int i = 0; i < MSI_EC_OP_SLOTS; i++)
+		if (ec_op_slots[i].task)
+			test_fail("operation slot %d not released", i);
+}
+
+// the EC increments the low byte of the scratch sensor on every read
+static void sensor_tick(u8 addr)
+{
+	if (addr == TEST_SCRATCH_ADDRESS - 3)
+		shim_ec[TEST_SCRATCH_ADDRESS]++;
+}
+
+static void check_sensor_settle(struct msi_ec_device *ec)
+{
+	const struct msi_ec_sensor sensor = {
+		.label = "test",
+		.kind = MSI_EC_SENSOR_TACH,
+		.address = TEST_SCRATCH_ADDRESS - 3,
+		.width = 4,
+	};
+	const u8 settled[] = { 0x00, 0x01, 0x00, 0x00 };
+	u8 data[4];
+	int result;
+
+	memcpy(shim_ec + sensor.address, settled, sizeof(settled));
+
+	// a carry into a middle byte between the reads of the first sweep
+	memcpy(data, settled, sizeof(data));
+	data[1] = 0x00;
+	data[3] = 0xff;
+
+	op_begin();
+	result = ec_sensor_settle(ec, &sensor, data);
+	op_end("sensor_settle", "-", result);
+
+	if (result < 0)
+		test_fail("sensor_settle failed: %d", result);
+	else if (memcmp(data, settled, sizeof(data)))
+		test_fail("sensor_settle kept a torn value");
+
+	shim_ec_read_hook = sensor_tick;
+	memcpy(data, shim_ec + sensor.address, sizeof(data));
+
+	op_begin();
+	result = ec_sensor_settle(ec, &sensor, data);
+	op_end("sensor_settle_unstable", "-", result);
+
+	shim_ec_read_hook = NULL;
+
+	if (result != -EAGAIN)
+		test_fail("sensor_settle of an unstable sensor returned %d",
+			  result);
+}
+
+static int test_rmw_child(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const u8 addr = TEST_SCRATCH_ADDRESS;
+	const char *fw = CONFIGURATIONS[0]->allowed_fw[0];
+	bool value = false;
+	int result;
+
+	if (module_load(fw) < 0)
+		return 1;
+
+	shim_ec[addr] = 0x5a;
+
+	op_begin();
+	result = ec_set_by_mask(ec, addr, 0x81);
+	check_rmw_value("set_by_mask", result, 0xdb);
+
+	op_begin();
+	result = ec_check_by_mask(ec, addr, 0x81, &value);
+	check_rmw_flag("check_by_mask", result, value, true);
+
+	op_begin();
+	result = ec_unset_by_mask(ec, addr, 0x81);
+	check_rmw_value("unset_by_mask", result, 0x5a);
+
+	op_begin();
+	result = ec_check_by_mask(ec, addr, 0x81, &value);
+	check_rmw_flag("check_by_mask", result, value, false);
+
+	op_begin();
+	result = ec_set_bit(ec, addr, 0, true);
+	check_rmw_value("set_bit", result, 0x5b);
+
+	op_begin();
+	result = ec_check_bit(ec, addr, 0, &value);
+	check_rmw_flag("check_bit", result, value, true);
+
+	op_begin();
+	result = ec_set_bit(ec, addr, 6, false);
+	check_rmw_value("unset_bit", result, 0x1b);
+
+	op_begin();
+	result = ec_check_bit(ec, addr, 6, &value);
+	check_rmw_flag("check_bit", result, value, false);
+
+	check_batch_locks(ec);
+	check_op_counts();
+
+	check_sensor_settle(ec);
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Configuration switching
+// ============================================================ //
+
+static void store_quiet(const char *path, const char *value)
+{
+	struct shim_attr *a = shim_attr_find(path);
+	ssize_t len = a ? shim_attr_store(a, value) : -ENOENT;
+
+	if (len < 0)
+		test_fail("%s: store of %s failed: %zd", path, value, len);
+}
+
+/*
+ * A switch with a delayed mode write and predictive cooler boost enabled.
+ * The background worker runs, so no transactions are counted.
+ */
+static int test_switch_child(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf;
+	const struct msi_ec_mode *modes;
+
+	if (module_load(CONFIGURATIONS[0]->allowed_fw[0]) < 0)
+		return 1;
+
+	conf = msi_ec_conf(ec);
+	modes = conf->shift_mode.modes;
+
+	store_quiet("cooler_boost_auto/enable", "on");
+	store_quiet("mode_arbiter/min_interval_ms", "60000");
+	store_quiet("shift_mode", modes[0].name);
+	store_quiet("shift_mode", modes[1].name); // delayed
+
+	conf_switch(kmemdup(conf, sizeof(*conf), GFP_KERNEL), "msi-ec-test");
+	conf = msi_ec_conf(ec);
+	modes = conf->shift_mode.modes;
+
+	if (!READ_ONCE(cb_auto_enabled))
+		test_fail("cooler_boost_auto is disabled after the switch");
+
+	store_quiet("mode_arbiter/min_interval_ms", "0");
+	store_quiet("shift_mode", modes[2].name);
+	if (shim_ec[conf->shift_mode.address] != modes[2].value)
+		test_fail("shift_mode write after the switch not applied");
+
+	store_quiet("cooler_boost_auto/enable", "off");
+
+	// only the LEDs registered by the bring-up are unregistered
+	shim_led_register_error = -ENOMEM;
+	conf_switch(kmemdup(conf, sizeof(*conf), GFP_KERNEL), "msi-ec-test");
+	if (ec->leds_registered || shim_led_count())
+		test_fail("LEDs registered after a failure");
+	shim_led_register_error = 0;
+	conf_switch(kmemdup(msi_ec_conf(ec), sizeof(*conf), GFP_KERNEL),
+		    "msi-ec-test");
+	if (shim_led_count() != 3)
+		test_fail("%d LEDs registered after the switch",
+			  shim_led_count());
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Emulated instances
+// ============================================================ //
+
+// the locks of every instance are listed and reset
+static void check_locks(void)
+{
+	static const char *const names[] = {
+		"msi-ec/backend_mutex", "msi-ec/sample_mutex",
+		"msi-ec.0/backend_mutex", "msi-ec.0/sample_mutex",
+	};
+	char buf[8192];
+	char *line;
+	ssize_t len;
+
+	len = shim_debugfs_read("locks", buf, sizeof(buf) - 1);
+	if (len < 0) {
+		test_fail("locks: read failed: %zd", len);
+		return;
+	}
+	buf[len] = '\0';
+
+	for (int i = 0; i < ARRAY_SIZE(names); i++) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "\n%s ", names[i]);
+		if (!strstr(buf, name))
+			test_fail("locks: no %s", names[i]);
+	}
+
+	shim_debugfs_write("reset", "1", 1);
+	len = shim_debugfs_read("locks", buf, sizeof(buf) - 1);
+	buf[len > 0 ? len : 0] = '\0';
+
+	// every line but the header
+	for (line = strchr(buf, '\n'); line && line[1];
+	     line = strchr(line + 1, '\n')) {
+		char name[64];
+		unsigned long long values[6];
+
+		if (sscanf(line + 1, "%63s %llu %llu %llu %llu %llu %llu", name,
+			   &values[0], &values[1], &values[2], &values[3],
+			   &values[4], &values[5]) != 7)
+			test_fail("locks: bad line %.40s", line + 1);
+		else if (values[0] || values[1] || values[2] || values[3] ||
+			 values[4] || values[5])
+			test_fail("locks: %s not reset", name);
+	}
+}
+
+// an emulated instance and the main instance without a configuration
+static int test_instances_child(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	struct msi_ec_conf *conf;
+
+	shim_param_set("emulated_fw", CONFIGURATIONS[1]->allowed_fw[0]);
+	if (module_load(CONFIGURATIONS[0]->allowed_fw[0]) < 0)
+		return 1;
+
+	if (!msi_ec_emulated[0] || !msi_ec_emulated[0]->pdev)
+		test_fail("the emulated instance is not registered");
+	else
+		check_groups(msi_ec_emulated[0],
+			     msi_ec_conf(msi_ec_emulated[0]));
+
+	check_locks();
+
+	conf = rcu_access_pointer(ec->conf);
+	rcu_assign_pointer(ec->conf, NULL);
+	check_groups(ec, NULL);
+	rcu_assign_pointer(ec->conf, conf);
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// PM QoS performance hold
+// ============================================================ //
+
+// a resume latency constraint set before the driver was loaded
+static int test_qos_child(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	int address;
+	u8 highest;
+
+	shim_resume_latency = 10;
+	shim_param_set("qos_latency_bound_us", "100");
+	if (module_load(CONFIGURATIONS[0]->allowed_fw[0]) < 0)
+		return 1;
+
+	address = msi_ec_conf(ec)->shift_mode.address;
+	if (!qos_hold_active)
+		test_fail("no hold for a constraint set before the load");
+	else if (qos_highest_shift_mode(ec, &highest) < 0 ||
+		 shim_ec[address] != highest)
+		test_fail("shift_mode is not held at the highest mode");
+
+	shim_module_exit();
+	if (qos_hold_active || shim_ec[address])
+		test_fail("shift_mode is not restored after the unload");
+
+	return test_failed;
+}
+
+// a failed hold leaves super battery as it was
+static int test_qos_error_child(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf;
+	int result;
+	int idx;
+	int i;
+
+	for (i = 0; CONFIGURATIONS[i]; i++)
+		if (CONFIGURATIONS[i]->super_battery.address !=
+		    MSI_EC_ADDR_UNSUPP &&
+		    CONFIGURATIONS[i]->shift_mode.address !=
+		    MSI_EC_ADDR_UNSUPP)
+			break;
+	if (!CONFIGURATIONS[i]) {
+		test_fail("no configuration with super battery");
+		return 1;
+	}
+
+	shim_param_set("qos_block_super_battery", "1");
+	if (module_load(CONFIGURATIONS[i]->allowed_fw[0]) < 0)
+		return 1;
+
+	conf = msi_ec_conf(ec);
+	shim_ec[conf->super_battery.address] |= conf->super_battery.mask;
+	shim_ec_write_error_addr = conf->shift_mode.address;
+
+	idx = srcu_read_lock(&conf_srcu);
+	msi_ec_lock(&qos_hold_mutex);
+	result = qos_hold_engage(ec);
+	msi_ec_unlock(&qos_hold_mutex);
+	srcu_read_unlock(&conf_srcu, idx);
+
+	if (result != -EIO || qos_hold_active)
+		test_fail("hold engaged with a failed shift_mode write: %d",
+			  result);
+	if ((shim_ec[conf->super_battery.address] & conf->super_battery.mask) !=
+	    conf->super_battery.mask)
+		test_fail("super battery not restored after a failed hold");
+
+	shim_ec_write_error_addr = -1;
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// CPU hotplug
+// ============================================================ //
+
+// the perf events and the PM QoS notifiers follow the CPUs going offline
+static int test_hotplug_child(void)
+{
+	if (module_load(CONFIGURATIONS[0]->allowed_fw[0]) < 0)
+		return 1;
+
+	if (!pmu_registered || pmu_cpu != 0)
+		test_fail("perf PMU not registered on cpu 0");
+
+	shim_cpu_offline(0);
+	if (pmu_cpu != 1 || shim_pmu_migrations != 1)
+		test_fail("perf events not migrated to cpu 1");
+	if (qos_nbs[0].cpu_dev || !qos_nbs[1].cpu_dev)
+		test_fail("PM QoS notifier of the offline cpu kept");
+
+	shim_cpu_offline(1);
+	if (pmu_cpu != 1 || shim_pmu_migrations != 1)
+		test_fail("perf events migrated without an online cpu");
+
+	shim_cpu_online(0);
+	shim_cpu_online(1);
+	if (!qos_nbs[0].cpu_dev || !qos_nbs[1].cpu_dev)
+		test_fail("PM QoS notifier not added for an online cpu");
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Fan control lease
+// ============================================================ //
+
+// cooler boost engaged before the lease is only turned off when it ends
+static void check_fan_lease_cb_auto(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	u8 bit = BIT(conf->cooler_boost.bit);
+	struct inode inode = { 0 };
+	struct file file = { .f_mode = FMODE_WRITE };
+
+	msi_ec_lock(&cb_auto_mutex);
+	if (cb_auto_engage(ec, 0) < 0 || !cb_auto_engaged)
+		test_fail("cooler_boost_auto not engaged");
+	fan_lease_open(&inode, &file);
+	if (cb_auto_disengage(ec, 0) < 0 || cb_auto_engaged)
+		test_fail("cooler_boost_auto not disengaged");
+	msi_ec_unlock(&cb_auto_mutex);
+
+	if (!(shim_ec[conf->cooler_boost.address] & bit))
+		test_fail("cooler_boost_auto changed cooler_boost under a lease");
+	fan_lease_release(&inode, &file);
+	if (shim_ec[conf->cooler_boost.address] & bit)
+		test_fail("cooler_boost not turned off after the lease");
+}
+
+// cooler boost turned on by the user while engaged is not turned off
+static void check_cb_auto_user_boost(void)
+{
+	struct msi_ec_device *ec = &msi_ec_main;
+	const struct msi_ec_conf *conf = msi_ec_conf(ec);
+	u8 bit = BIT(conf->cooler_boost.bit);
+
+	msi_ec_lock(&cb_auto_mutex);
+	if (cb_auto_engage(ec, 0) < 0 || !cb_auto_engaged)
+		test_fail("cooler_boost_auto not engaged");
+	msi_ec_unlock(&cb_auto_mutex);
+
+	store_quiet("cooler_boost", "on");
+	if (cb_auto_engaged)
+		test_fail("cooler_boost_auto still engaged after a user write");
+
+	msi_ec_lock(&cb_auto_mutex);
+	cb_auto_enabled = true;
+	cb_auto_set_enabled(false);
+	msi_ec_unlock(&cb_auto_mutex);
+
+	if (!(shim_ec[conf->cooler_boost.address] & bit))
+		test_fail("cooler_boost_auto turned off the boost of the user");
+}
+
+// an expired handle neither blocks nor renews the lease of a new one
+static int test_fan_lease_child(void)
+{
+	struct inode inode = { 0 };
+	struct file stale = { .f_mode = FMODE_WRITE };
+	struct file file = { .f_mode = FMODE_WRITE };
+	pid_t owner;
+
+	if (module_load(CONFIGURATIONS[0]->allowed_fw[0]) < 0)
+		return 1;
+
+	store_quiet("fan_lease/timeout_ms", "10");
+	if (fan_lease_open(&inode, &stale) < 0)
+		test_fail("fan lease not taken");
+	shim_work_drain(1000);
+	if (fan_lease_expirations != 1)
+		test_fail("fan lease not expired");
+
+	store_quiet("fan_lease/timeout_ms", "60000");
+	if (fan_lease_open(&inode, &file) < 0)
+		test_fail("fan lease not taken after an expiration");
+	if (fan_lease_write(&stale, "", 1, NULL) != -ETIMEDOUT)
+		test_fail("expired handle renewed the fan lease");
+	if (fan_lease_write(&file, "", 1, NULL) != 1)
+		test_fail("fan lease not renewed");
+
+	owner = fan_lease_owner;
+	fan_lease_release(&inode, &stale);
+	if (fan_lease_owner != owner)
+		test_fail("expired handle released the fan lease");
+	fan_lease_release(&inode, &file);
+	if (fan_lease_owner)
+		test_fail("fan lease not released");
+
+	check_fan_lease_cb_auto();
+	check_cb_auto_user_boost();
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Trace replay
+// ============================================================ //
+
+#define TEST_TRACE_SIZE (1 << 20)
+
+static void replay_workload(void)
+{
+	char buf[PAGE_SIZE];
+
+	attr_value(shim_attr_find("shift_mode"), buf);
+	attr_value(shim_attr_find("fan_mode"), buf);
+	store_quiet("cooler_boost", "on");
+	store_quiet("cooler_boost", "off");
+}
+
+// a trace recorded from the load is replayed from its end
+static int test_replay_child(void)
+{
+	const char *fw = CONFIGURATIONS[0]->allowed_fw[0];
+	unsigned int position, count, diverged;
+	char status[64];
+	ssize_t len;
+	char *trace;
+
+	shim_param_set("ec_trace", "1");
+	if (module_load(fw) < 0)
+		return 1;
+
+	replay_workload();
+	trace = malloc(TEST_TRACE_SIZE);
+	len = shim_debugfs_read("ec_trace", trace, TEST_TRACE_SIZE);
+	shim_module_exit();
+
+	shim_param_set("ec_trace", "0");
+	shim_param_set("ec_backend", "replay");
+	shim_param_set("firmware", fw);
+	if (shim_module_init() < 0) {
+		test_fail("replay: module init failed");
+		return 1;
+	}
+	shim_work_drain(0);
+
+	if (len <= 0 || shim_debugfs_write("ec_replay", trace, len) != len)
+		test_fail("trace not replayed: %zd", len);
+	replay_workload();
+	if (shim_attr_store(shim_attr_find("cooler_boost_auto/enable"), "on") !=
+	    -EBUSY)
+		test_fail("cooler_boost_auto enabled during a replay");
+
+	len = shim_debugfs_read("ec_replay", status, sizeof(status) - 1);
+	status[max_t(ssize_t, len, 0)] = '\0';
+	if (sscanf(status, "%u/%u %u", &position, &count, &diverged) != 3 ||
+	    position != count || diverged)
+		test_fail("replay not aligned with the recording: %s", status);
+
+	free(trace);
+	shim_module_exit();
+
+	return test_failed;
+}
+
+// ============================================================ //
+// Golden file
+// ============================================================ //
+
+static int lines_read(FILE *f, struct test_line **lines)
+{
+	char conf[64], op[96], path[64];
+	struct test_line line;
+	int count = 0;
+
+	*lines = NULL;
+	while (fscanf(f, "%63s %95s %63s %llu %llu %ld", conf, op, path,
+		      &line.reads, &line.writes, &line.result) == 6) {
+		snprintf(line.key, sizeof(line.key), "%s %s %s", conf, op,
+			 path);
+		*lines = realloc(*lines, (count + 1) * sizeof(**lines));
+		(*lines)[count++] = line;
+	}
+
+	return count;
+}
+
+static struct test_line *lines_find(struct test_line *lines, int count,
+				    const char *key)
+{
+	for (int i = 0; i < count; i++)
+		if (!strcmp(lines[i].key, key))
+			return &lines[i];
+
+	return NULL;
+}
+
+static int golden_compare(FILE *f, const char *golden)
+{
+	struct test_line *now, *then;
+	int now_count, then_count;
+	int improved = 0;
+	int failed = 0;
+	FILE *g;
+
+	g = fopen(golden, "r");
+	if (!g) {
+		fprintf(stderr, "FAIL %s: %s, run with UPDATE=1\n", golden,
+			strerror(errno));
+		return 1;
+	}
+
+	rewind(f);
+	now_count = lines_read(f, &now);
+	then_count = lines_read(g, &then);
+	fclose(g);
+
+	for (int i = 0; i < now_count; i++) {
+		struct test_line *n = &now[i];
+		struct test_line *t = lines_find(then, then_count, n->key);
+
+		if (!t) {
+			fprintf(stderr, "FAIL %s: new operation\n", n->key);
+			failed = 1;
+		} else if (n->result != t->result) {
+			fprintf(stderr, "FAIL %s: result %ld instead of %ld\n",
+				n->key, n->result, t->result);
+			failed = 1;
+		} else if (n->reads > t->reads || n->writes > t->writes) {
+			fprintf(stderr,
+				"FAIL %s: %llu reads %llu writes instead of %llu %llu\n",
+				n->key, n->reads, n->writes, t->reads,
+				t->writes);
+			failed = 1;
+		} else if (n->reads < t->reads || n->writes < t->writes) {
+			improved++;
+		}
+	}
+
+	for (int i = 0; i < then_count; i++) {
+		if (!lines_find(now, now_count, then[i].key)) {
+			fprintf(stderr, "FAIL %s: missing operation\n",
+				then[i].key);
+			failed = 1;
+		}
+	}
+
+	if (improved)
+		printf("%d operations take fewer transactions, run with UPDATE=1\n",
+		       improved);
+
+	printf("%d operations checked\n", now_count);
+
+	free(now);
+	free(then);
+
+	return failed;
+}
+
+static int golden_update(FILE *f, const char *golden)
+{
+	char buf[4096];
+	size_t len;
+	FILE *g;
+
+	g = fopen(golden, "w");
+	if (!g) {
+		fprintf(stderr, "%s: %s\n", golden, strerror(errno));
+		return 1;
+	}
+
+	rewind(f);
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, len, g);
+	fclose(g);
+
+	printf("%s updated\n", golden);
+
+	return 0;
+}
+
+// ============================================================ //
+// Main
+// ============================================================ //
+
+// runs fn in a child, so that every test starts from a fresh module
+static int run_child(const char *name, int (*fn)(void *), void *arg)
+{
+	int status;
+	pid_t pid;
+
+	fflush(out);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+
+	if (!pid) {
+		test_conf = name;
+		status = fn(arg);
+		fflush(out);
+		_exit(status);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+		fprintf(stderr, "FAIL %s: crashed\n", name);
+		return 1;
+	}
+
+	return WEXITSTATUS(status);
+}
+
+static int run_conf(void *conf)
+{
+	return test_conf_child(conf);
+}
+
+static int run_rmw(void *unused)
+{
+	return test_rmw_child();
+}
+
+static int run_switch(void *unused)
+{
+	return test_switch_child();
+}
+
+static int run_instances(void *unused)
+{
+	return test_instances_child();
+}
+
+static int run_qos(void *unused)
+{
+	return test_qos_child();
+}
+
+static int run_qos_error(void *unused)
+{
+	return test_qos_error_child();
+}
+
+static int run_hotplug(void *unused)
+{
+	return test_hotplug_child();
+}
+
+static int run_fan_lease(void *unused)
+{
+	return test_fan_lease_child();
+}
+
+static int run_replay(void *unused)
+{
+	return test_replay_child();
+}
+
+int main(int argc, char **argv)
+{
+	const char *update = getenv("UPDATE");
+	int failed = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: [UPDATE=1] %s GOLDEN\n", argv[0]);
+		return 2;
+	}
+
+	out = tmpfile();
+	if (!out) {
+		perror("tmpfile");
+		return 1;
+	}
+
+	failed |= run_child("rmw", run_rmw, NULL);
+	failed |= run_child("switch", run_switch, NULL);
+	failed |= run_child("instances", run_instances, NULL);
+	failed |= run_child("qos", run_qos, NULL);
+	failed |= run_child("qos_error", run_qos_error, NULL);
+	failed |= run_child("hotplug", run_hotplug, NULL);
+	failed |= run_child("fan_lease", run_fan_lease, NULL);
+	failed |= run_child("replay", run_replay, NULL);
+	for (int i = 0; CONFIGURATIONS[i]; i++)
+		failed |= run_child(CONFIGURATIONS[i]->name, run_conf,
+				    CONFIGURATIONS[i]);
+
+	if (failed)
+		return 1;
+
+	if (update && !strcmp(update, "1"))
+		return golden_update(out, argv[1]);
+
+	return golden_compare(out, argv[1]);
+}
@@ -0,0 +1,491 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * msi-ec-user - Runs msi-ec.c in userspace against an emulated EC.
+ *
+ * The driver is loaded, the given command is run against what it
+ * registered and the driver is unloaded again, so the whole module
+ * lifetime can be profiled or checked with the sanitizers.
+ *
+ *   msi-ec-user [options] list
+ *   msi-ec-user [options] show PATH
+ *   msi-ec-user [options] store PATH VALUE
+ *   msi-ec-user [options] dump
+ *   msi-ec-user [options] led NAME [VALUE]
+ *   msi-ec-user [options] debugfs FILE
+ *   msi-ec-user [options] validate
+ */
+
+#define _GNU_SOURCE
+
+#include "shim.h"
+
+#include <getopt.h>
+
+#define FW_VERSION_ADDRESS 0xa0
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] command [args]\n"
+		"\n"
+		"options:\n"
+		"  -f FIRMWARE     firmware version string stored in the EC\n"
+		"  -i FILE         load a 256 byte EC image\n"
+		"  -e FILE         load an EC dump (debug/ec_dump or hexdump -C)\n"
+		"  -F DIR          firmware directory for request_firmware\n"
+		"  -d BOARD        DMI board name, e.g. MS-14C1\n"
+		"  -l US           EC transaction latency in microseconds\n"
+		"  -p NAME=VALUE   set a module parameter\n"
+		"  -w NAME=FILE    write FILE to a debugfs file after loading\n"
+		"  -c BYTES        write the debugfs files BYTES at a time\n"
+		"  -n COUNT        repeat the command COUNT times\n"
+		"  -v              print the driver log messages\n"
+		"\n"
+		"commands:\n"
+		"  list                 list the attributes, LEDs and debugfs files\n"
+		"  show PATH            read an attribute\n"
+		"  store PATH VALUE     write an attribute\n"
+		"  dump                 read every readable attribute\n"
+		"  led NAME [VALUE]     read or set an LED brightness\n"
+		"  debugfs FILE         read a debugfs file\n"
+		"  misc NAME            read a misc device, e.g. msi-ec-state\n"
+		"  validate             check that every attribute decodes to a sane\n"
+		"                       value, with its EC transactions and latency\n",
+		prog);
+}
+
+static int cmd_list(void)
+{
+	for (int i = 0; i < shim_attr_count(); i++) {
+		struct shim_attr *a = shim_attr_get(i);
+
+		printf("attr    %04o %s\n", a->mode, a->path);
+	}
+
+	for (int i = 0; i < shim_led_count(); i++)
+		printf("led          %s\n", shim_led_get(i)->name);
+
+	for (int i = 0; i < shim_debugfs_count(); i++)
+		printf("debugfs      %s\n", shim_debugfs_name(i));
+
+	for (int i = 0; i < shim_misc_count(); i++)
+		if (shim_misc_name(i))
+			printf("misc         %s\n", shim_misc_name(i));
+
+	return 0;
+}
+
+static int cmd_show(const char *path, bool quiet)
+{
+	struct shim_attr *a = shim_attr_find(path);
+	char buf[PAGE_SIZE];
+	ssize_t len;
+
+	if (!a) {
+		fprintf(stderr, "%s: no such attribute\n", path);
+		return -ENOENT;
+	}
+
+	len = shim_attr_show(a, buf);
+	if (len < 0) {
+		if (!quiet)
+			fprintf(stderr, "%s: %s\n", path, strerror(-len));
+		return len;
+	}
+
+	if (!quiet)
+		fwrite(buf, 1, len, stdout);
+
+	return 0;
+}
+
+static int cmd_store(const char *path, const char *value)
+{
+	struct shim_attr *a = shim_attr_find(path);
+	ssize_t len;
+
+	if (!a) {
+		fprintf(stderr, "%s: no such attribute\n", path);
+		return -ENOENT;
+	}
+
+	len = shim_attr_store(a, value);
+	if (len < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-len));
+		return len;
+	}
+
+	return 0;
+}
+
+// attributes that fail to read are reported, as cat would, but do not fail
+static int cmd_dump(bool quiet)
+{
+	for (int i = 0; i < shim_attr_count(); i++) {
+		struct shim_attr *a = shim_attr_get(i);
+		char buf[PAGE_SIZE];
+		ssize_t len;
+
+		if (!(a->mode & 0444))
+			continue;
+
+		len = shim_attr_show(a, buf);
+		if (quiet)
+			continue;
+
+		if (len < 0) {
+			printf("%s: %s\n", a->path, strerror(-len));
+			continue;
+		}
+
+		// multi-line values (ec_dump) are printed below the path
+		if (memchr(buf, '\n', len) != buf + len - 1)
+			printf("%s:\n%.*s", a->path, (int)len, buf);
+		else
+			printf("%s: %.*s", a->path, (int)len, buf);
+	}
+
+	return 0;
+}
+
+static int cmd_led(const char *name, const char *value, bool quiet)
+{
+	struct led_classdev *led = shim_led_find(name);
+	unsigned int brightness;
+
+	if (!led) {
+		fprintf(stderr, "%s: no such LED\n", name);
+		return -ENOENT;
+	}
+
+	if (value) {
+		if (kstrtouint(value, 0, &brightness) < 0 ||
+		    brightness > led->max_brightness) {
+			fprintf(stderr, "%s: invalid brightness\n", value);
+			return -EINVAL;
+		}
+
+		return led->brightness_set_blocking(led, brightness);
+	}
+
+	if (!quiet)
+		printf("%u\n", led->brightness_get ?
+				       led->brightness_get(led) : 0);
+
+	return 0;
+}
+
+// the raw bytes of a read of the device
+static int cmd_misc(const char *name, bool quiet)
+{
+	static char buf[1 << 16];
+	ssize_t len;
+
+	len = shim_misc_read(name, buf, sizeof(buf));
+	if (len < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(-len));
+		return len;
+	}
+
+	if (!quiet)
+		fwrite(buf, 1, len, stdout);
+
+	return 0;
+}
+
+static int cmd_debugfs(const char *name, bool quiet)
+{
+	static char buf[1 << 20];
+	ssize_t len;
+
+	len = shim_debugfs_read(name, buf, sizeof(buf));
+	if (len < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(-len));
+		return len;
+	}
+
+	if (!quiet)
+		fwrite(buf, 1, len, stdout);
+
+	return 0;
+}
+
+/*
+ * Sanity checks of the decoded values, by attribute name. Attributes that
+ * are not listed only need to be readable.
+ */
+static const char *validate_value(const char *path, const char *value)
+{
+	const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	char *end;
+	long n;
+
+	if (!strcmp(name, "shift_mode") || !strcmp(name, "fan_mode"))
+		return strncmp(value, "unknown", 7) ? NULL : "unknown mode";
+
+	if (!strcmp(name, "fw_version"))
+		return strlen(value) == 12 ? NULL : "malformed version";
+
+	if (strcmp(name, "realtime_temperature") &&
+	    strcmp(name, "realtime_fan_speed") &&
+	    strncmp(name, "charge_control_", 15) &&
+	    !(!strncmp(name, "temp", 4) && strstr(name, "_input")) &&
+	    !(!strncmp(name, "fan", 3) && strstr(name, "_input")) &&
+	    !(!strncmp(name, "pwm", 3) && !strchr(name, '_')))
+		return NULL;
+
+	n = strtol(value, &end, 10);
+	if (end == value || *end)
+		return "not a number";
+
+	// hwmon channels, in millidegrees and 0-255
+	if (!strncmp(name, "temp", 4))
+		return n >= 10000 && n <= 110000 ? NULL :
+						   "temperature out of range";
+	if (!strncmp(name, "pwm", 3))
+		return n >= 0 && n <= 255 ? NULL : "pwm out of range";
+	if (!strncmp(name, "fan", 3))
+		return n >= 0 && n <= 20000 ? NULL : "rpm out of range";
+
+	if (!strcmp(name, "realtime_temperature"))
+		return n >= 10 && n <= 110 ? NULL : "temperature out of range";
+	if (!strcmp(name, "realtime_fan_speed"))
+		return n >= 0 && n <= 150 ? NULL : "fan speed out of range";
+
+	return n >= 0 && n <= 100 ? NULL : "threshold out of range";
+}
+
+/*
+ * One line per readable attribute:
+ *
+ *   path status ec_reads ec_writes latency_ns value
+ *
+ * Multi-line values are reduced to their line count.
+ */
+static int cmd_validate(bool quiet)
+{
+	int failed = 0;
+
+	for (int i = 0; i < shim_attr_count(); i++) {
+		struct shim_attr *a = shim_attr_get(i);
+		u64 reads = shim_ec_reads, writes = shim_ec_writes;
+		const char *error = NULL;
+		char buf[PAGE_SIZE];
+		char value[64];
+		ktime_t start;
+		ssize_t len;
+
+		if (!(a->mode & 0444))
+			continue;
+
+		start = ktime_get();
+		len = shim_attr_show(a, buf);
+		start = ktime_get() - start;
+
+		if (len < 0) {
+			snprintf(value, sizeof(value), "%s", strerror(-len));
+			error = "read failed";
+		} else if (len && memchr(buf, '\n', len) != buf + len - 1) {
+			int lines = 0;
+
+			for (ssize_t j = 0; j < len; j++)
+				lines += buf[j] == '\n';
+			snprintf(value, sizeof(value), "(%d lines)", lines);
+		} else {
+			snprintf(value, sizeof(value), "%.*s",
+				 (int)max(len - 1, 0), buf);
+			error = validate_value(a->path, value);
+		}
+
+		failed += error != NULL;
+		if (quiet)
+			continue;
+
+		printf("%-40s %-4s %3llu %3llu %10lld  %s%s%s\n", a->path,
+		       error ? "FAIL" : "ok",
+		       (unsigned long long)(shim_ec_reads - reads),
+		       (unsigned long long)(shim_ec_writes - writes),
+		       (long long)start, value, error ? ": " : "",
+		       error ? error : "");
+	}
+
+	return failed ? -EINVAL : 0;
+}
+
+static int debugfs_write_file(char *arg)
+{
+	char *file = strchr(arg, '=');
+	static char buf[16 << 20];
+	ssize_t result;
+	size_t len;
+	FILE *f;
+
+	if (!file)
+		return -EINVAL;
+	*file++ = '\0';
+
+	f = fopen(file, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return -errno;
+	}
+
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	result = shim_debugfs_write(arg, buf, len);
+	if (result < 0) {
+		fprintf(stderr, "%s: %s\n", arg, strerror(-result));
+		return result;
+	}
+
+	return 0;
+}
+
+static int run(int argc, char **argv, bool quiet)
+{
+	const char *cmd = argv[0];
+
+	if (!strcmp(cmd, "list") && argc == 1)
+		return quiet ? 0 : cmd_list();
+	if (!strcmp(cmd, "show") && argc == 2)
+		return cmd_show(argv[1], quiet);
+	if (!strcmp(cmd, "store") && argc == 3)
+		return cmd_store(argv[1], argv[2]);
+	if (!strcmp(cmd, "dump") && argc == 1)
+		return cmd_dump(quiet);
+	if (!strcmp(cmd, "led") && (argc == 2 || argc == 3))
+		return cmd_led(argv[1], argc == 3 ? argv[2] : NULL, quiet);
+	if (!strcmp(cmd, "debugfs") && argc == 2)
+		return cmd_debugfs(argv[1], quiet);
+	if (!strcmp(cmd, "misc") && argc == 2)
+		return cmd_misc(argv[1], quiet);
+	if (!strcmp(cmd, "validate") && argc == 1)
+		return cmd_validate(quiet);
+
+	usage("msi-ec-user");
+	return -EINVAL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *firmware = NULL;
+	const char *image = NULL;
+	const char *dump = NULL;
+	char *debugfs_writes[8];
+	int debugfs_writes_count = 0;
+	unsigned long latency_us = 0;
+	unsigned long repeat = 1;
+	int result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:i:e:F:d:l:p:w:c:n:vh")) != -1) {
+		char *value;
+
+		switch (opt) {
+		case 'f':
+			firmware = optarg;
+			break;
+		case 'i':
+			image = optarg;
+			break;
+		case 'e':
+			dump = optarg;
+			break;
+		case 'F':
+			shim_firmware_path = optarg;
+			break;
+		case 'd':
+			shim_dmi_board_name = optarg;
+			break;
+		case 'l':
+			latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			value = strchr(optarg, '=');
+			if (!value) {
+				usage(argv[0]);
+				return 2;
+			}
+			*value++ = '\0';
+			if (shim_param_set(optarg, value) < 0) {
+				fprintf(stderr, "%s: invalid parameter\n",
+					optarg);
+				return 2;
+			}
+			break;
+		case 'w':
+			if (debugfs_writes_count == ARRAY_SIZE(debugfs_writes)) {
+				usage(argv[0]);
+				return 2;
+			}
+			debugfs_writes[debugfs_writes_count++] = optarg;
+			break;
+		case 'c':
+			shim_debugfs_chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			repeat = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			shim_verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (image) {
+		result = shim_ec_load_image(image);
+		if (result < 0) {
+			fprintf(stderr, "%s: %s\n", image, strerror(-result));
+			return 1;
+		}
+	}
+
+	if (dump) {
+		result = shim_ec_load_dump(dump);
+		if (result < 0) {
+			fprintf(stderr, "%s: %s\n", dump, strerror(-result));
+			return 1;
+		}
+	}
+
+	if (firmware)
+		strncpy((char *)shim_ec + FW_VERSION_ADDRESS, firmware, 16);
+
+	shim_ec_set_latency(latency_us * 1000, latency_us * 1000);
+
+	result = shim_module_init();
+	if (result < 0) {
+		fprintf(stderr, "module init failed: %s\n", strerror(-result));
+		return 1;
+	}
+
+	// wait for the deferred bring-up
+	shim_work_drain(0);
+
+	for (int i = 0; i < debugfs_writes_count && result >= 0; i++)
+		result = debugfs_write_file(debugfs_writes[i]);
+
+	// only the last iteration prints, the others are for profiling
+	for (unsigned long i = 0; i < repeat && result >= 0; i++)
+		result = run(argc - optind, argv + optind, i + 1 < repeat);
+
+	shim_work_drain(0);
+	shim_module_exit();
+
+	if (shim_verbose)
+		fprintf(stderr, "ec transactions: %llu reads, %llu writes\n",
+			(unsigned long long)shim_ec_reads,
+			(unsigned long long)shim_ec_writes);
+
+	return result < 0 ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Boots the emulated EC from every dump of the corpus, checks that all the
+# attributes of the matching configuration decode to sane values and compares
+# their EC transaction counts with the golden files.
+#
+# The configuration of every dump is also written as text, encoded into a
+# blob with msi-ec-conf and loaded back, which must give the same
+# configuration and attributes, also when written to debugfs conf_switch.
+# Malformed blobs must be ignored.
+#
+#   regress.sh            check every dump, a dump without golden file fails
+#   UPDATE=1 regress.sh   write the golden files
+
+set -u
+
+dir=$(dirname "$0")
+bin=$dir/msi-ec-user
+conf=$dir/../msi-ec-conf
+corpus=$dir/corpus
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+failed=0
+count=0
+
+# run ARGS... boots the dump with the blob of $tmp/fw, if any
+run() {
+	"$bin" -e "$dump" -F "$tmp/fw" "$@"
+}
+
+# patch FILE OFFSET OCTAL writes one byte
+patch() {
+	printf "\\$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+# the blob is loaded as msi-ec/conf.bin from the firmware directory
+blob=$tmp/fw/msi-ec/conf.bin
+mkdir -p "$tmp/fw/msi-ec"
+
+# round_trip FW checks that the blob of the built-in configuration loads back
+round_trip() {
+	rm -f "$blob"
+	run debugfs conf > "$out.conf" &&
+		"$conf" encode "$out.conf" "$blob" || return 1
+
+	# the first line is the source of the configuration
+	tail -n +2 "$out.conf" > "$out.builtin"
+	run debugfs conf > "$out.conf" &&
+		[ "$(head -n 1 "$out.conf")" = "# msi-ec/conf.bin" ] &&
+		tail -n +2 "$out.conf" | diff -u "$out.builtin" - &&
+		run -p debug=1 validate | awk '{ $5 = ""; print }' |
+			diff -u "$out.golden" -
+}
+
+# malformed NAME checks that the blob is rejected and the built-in
+# configuration is used instead
+malformed() {
+	if ! run -v debugfs conf 2> "$out.log" > "$out.conf" ||
+	   ! grep -q 'Invalid configuration blob' "$out.log" ||
+	   [ "$(head -n 1 "$out.conf")" != "# built-in" ]; then
+		echo "FAIL blob with $1 is not ignored"
+		failed=1
+	fi
+	cp "$tmp/good.bin" "$blob"
+}
+
+for dump in "$corpus"/*.txt; do
+	[ -e "$dump" ] || continue
+
+	fw=$(basename "$dump" .txt)
+	golden=$corpus/$fw.golden
+	out=$tmp/$fw
+	count=$((count + 1))
+
+	if ! "$bin" -e "$dump" -p debug=1 validate > "$out"; then
+		echo "FAIL $fw: attributes do not decode"
+		grep ' FAIL ' "$out"
+		failed=1
+		continue
+	fi
+
+	if ! awk -v fw="$fw" '$1 == "fw_version" && $6 != fw { exit 1 }' "$out"; then
+		echo "FAIL $fw: the dump is of another firmware"
+		failed=1
+		continue
+	fi
+
+	# latencies vary between runs, only the other columns are compared
+	awk '{ $5 = ""; print }' "$out" > "$out.golden"
+
+	if [ "${UPDATE:-0}" = 1 ]; then
+		cp "$out.golden" "$golden"
+		echo "NEW  $fw"
+	elif [ ! -e "$golden" ]; then
+		echo "FAIL $fw: no golden file, write it with UPDATE=1 and review it"
+		failed=1
+		continue
+	elif ! diff -u "$golden" "$out.golden"; then
+		echo "FAIL $fw: differs from $golden"
+		failed=1
+		continue
+	fi
+
+	if ! round_trip; then
+		echo "FAIL $fw: the configuration does not survive a blob round trip"
+		failed=1
+		continue
+	fi
+
+	awk -v fw="$fw" '{ reads += $3; writes += $4; ns += $5 }
+		END { printf "ok   %-16s %5d reads %5d writes %10d ns\n",
+			     fw, reads, writes, ns }' "$out"
+done
+
+echo "$count dumps checked"
+if [ $count = 0 ]; then
+	echo "FAIL the corpus is empty"
+	failed=1
+	exit $failed
+fi
+
+# the blob of the last dump has a single entry, the header is the magic,
+# version, count and CRC of the entries
+[ -e "$blob" ] || exit $failed
+cp "$blob" "$tmp/good.bin"
+patch "$blob" 0 130
+malformed "a bad magic"
+patch "$blob" 8 377
+malformed "an unknown version"
+patch "$blob" 16 377
+malformed "a CRC mismatch"
+patch "$blob" 10 2
+malformed "a truncated entry"
+patch "$blob" 10 0
+malformed "trailing data"
+head -c 10 "$tmp/good.bin" > "$blob"
+malformed "a truncated header"
+echo "6 malformed blobs checked"
+
+# the debugfs conf_switch file switches to the blob once it is complete,
+# whether written at once or a few bytes at a time
+for chunk in 65536 3; do
+	if ! "$bin" -e "$dump" -p debug=1 -c $chunk -w conf_switch="$tmp/good.bin" \
+		debugfs conf > "$out.conf" ||
+	   [ "$(head -n 1 "$out.conf")" != "# debugfs" ] ||
+	   ! tail -n +2 "$out.conf" | diff -u "$out.builtin" -; then
+		echo "FAIL conf_switch does not load the blob written $chunk bytes at a time"
+		failed=1
+	fi
+done
+echo "conf_switch checked"
+
+exit $failed
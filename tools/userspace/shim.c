@@ -0,0 +1,1991 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * shim.c - Userspace implementation of the kernel API used by msi-ec.c.
+ *
+ * See include/msi-ec-shim.h for the scope. Registrations (sysfs groups,
+ * LEDs, debugfs files) are kept in tables the harness reaches through
+ * shim.h. The EC is a memory image with configurable access latencies.
+ */
+
+#define _GNU_SOURCE
+
+#include "shim.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int shim_verbose;
+
+// ============================================================ //
+// Module parameters
+// ============================================================ //
+
+#define SHIM_MAX_PARAMS 64
+
+static struct {
+	const char *name;
+	void *value;
+	enum shim_param_type type;
+	unsigned int *count; // of the arrays
+	unsigned int max;
+} params[SHIM_MAX_PARAMS];
+static int params_count;
+
+void shim_param_register(const char *name, void *value,
+			 enum shim_param_type type)
+{
+	if (params_count == SHIM_MAX_PARAMS) {
+		fprintf(stderr, "shim: too many module parameters\n");
+		abort();
+	}
+
+	params[params_count].name = name;
+	params[params_count].value = value;
+	params[params_count].type = type;
+	params_count++;
+}
+
+void shim_param_register_array(const char *name, void *value,
+			       enum shim_param_type type, unsigned int *count,
+			       unsigned int max)
+{
+	if (type != SHIM_PARAM_charp) {
+		fprintf(stderr, "shim: only charp arrays are supported\n");
+		abort();
+	}
+
+	shim_param_register(name, value, type);
+	params[params_count - 1].count = count;
+	params[params_count - 1].max = max;
+}
+
+static int param_set_array(int i, const char *value)
+{
+	char *values = strdup(value);
+	char *cur = values;
+	unsigned int n = 0;
+
+	for (char *v; (v = strsep(&cur, ","));) {
+		if (n == params[i].max) {
+			free(values);
+			return -EINVAL;
+		}
+		((char **)params[i].value)[n++] = strdup(v);
+	}
+
+	*params[i].count = n;
+	free(values);
+	return 0;
+}
+
+int shim_param_set(const char *name, const char *value)
+{
+	for (int i = 0; i < params_count; i++) {
+		if (strcmp(params[i].name, name))
+			continue;
+
+		if (params[i].count)
+			return param_set_array(i, value);
+
+		switch (params[i].type) {
+		case SHIM_PARAM_charp:
+			*(char **)params[i].value = strdup(value);
+			return 0;
+		case SHIM_PARAM_bool:
+			return kstrtobool(value, params[i].value);
+		case SHIM_PARAM_int:
+			return kstrtoint(value, 0, params[i].value);
+		case SHIM_PARAM_uint:
+			return kstrtouint(value, 0, params[i].value);
+		}
+	}
+
+	return -ENOENT;
+}
+
+// ============================================================ //
+// Strings
+// ============================================================ //
+
+// the value may be followed by a single newline, as written by echo
+static int parse_end(const char *end)
+{
+	if (*end == '\n')
+		end++;
+
+	return *end ? -EINVAL : 0;
+}
+
+int kstrtoul(const char *s, unsigned int base, unsigned long *res)
+{
+	unsigned long long value;
+	char *end;
+
+	if (!isalnum((unsigned char)*s) && *s != '+')
+		return -EINVAL;
+
+	errno = 0;
+	value = strtoull(s, &end, base);
+	if (errno || end == s || parse_end(end))
+		return errno == ERANGE ? -ERANGE : -EINVAL;
+
+	if (value > ULONG_MAX)
+		return -ERANGE;
+
+	*res = value;
+	return 0;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	long long value;
+	char *end;
+
+	errno = 0;
+	value = strtoll(s, &end, base);
+	if (errno || end == s || parse_end(end))
+		return errno == ERANGE ? -ERANGE : -EINVAL;
+
+	if (value < INT32_MIN || value > INT32_MAX)
+		return -ERANGE;
+
+	*res = value;
+	return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	unsigned long value;
+	int result = kstrtoul(s, base, &value);
+
+	if (result < 0)
+		return result;
+
+	if (value > UINT32_MAX)
+		return -ERANGE;
+
+	*res = value;
+	return 0;
+}
+
+int kstrtou16(const char *s, unsigned int base, u16 *res)
+{
+	unsigned long value;
+	int result = kstrtoul(s, base, &value);
+
+	if (result < 0)
+		return result;
+
+	if (value > UINT16_MAX)
+		return -ERANGE;
+
+	*res = value;
+	return 0;
+}
+
+int kstrtou8(const char *s, unsigned int base, u8 *res)
+{
+	unsigned long value;
+	int result = kstrtoul(s, base, &value);
+
+	if (result < 0)
+		return result;
+
+	if (value > UINT8_MAX)
+		return -ERANGE;
+
+	*res = value;
+	return 0;
+}
+
+int kstrtobool(const char *s, bool *res)
+{
+	if (!s)
+		return -EINVAL;
+
+	switch (s[0]) {
+	case 'y':
+	case 'Y':
+	case 't':
+	case 'T':
+	case '1':
+		*res = true;
+		return 0;
+	case 'n':
+	case 'N':
+	case 'f':
+	case 'F':
+	case '0':
+		*res = false;
+		return 0;
+	case 'o':
+	case 'O':
+		if (s[1] == 'n' || s[1] == 'N') {
+			*res = true;
+			return 0;
+		}
+		if (s[1] == 'f' || s[1] == 'F') {
+			*res = false;
+			return 0;
+		}
+		break;
+	}
+
+	return -EINVAL;
+}
+
+int kstrtobool_from_user(const char __user *s, size_t count, bool *res)
+{
+	char buf[4] = { 0 };
+
+	memcpy(buf, s, min(count, sizeof(buf) - 1));
+	return kstrtobool(buf, res);
+}
+
+char *kasprintf(gfp_t gfp, const char *fmt, ...)
+{
+	va_list args;
+	char *s;
+
+	va_start(args, fmt);
+	if (vasprintf(&s, fmt, args) < 0)
+		s = NULL;
+	va_end(args);
+
+	return s;
+}
+
+char *kstrdup(const char *s, gfp_t gfp)
+{
+	return s ? strdup(s) : NULL;
+}
+
+char *kstrndup(const char *s, size_t max, gfp_t gfp)
+{
+	return s ? strndup(s, max) : NULL;
+}
+
+char *strim(char *s)
+{
+	size_t len = strlen(s);
+
+	while (len && isspace((unsigned char)s[len - 1]))
+		s[--len] = '\0';
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	return s;
+}
+
+ssize_t strscpy(char *dest, const char *src, size_t count)
+{
+	size_t len;
+
+	if (!count)
+		return -E2BIG;
+
+	len = strnlen(src, count);
+	if (len == count) {
+		memcpy(dest, src, count - 1);
+		dest[count - 1] = '\0';
+		return -E2BIG;
+	}
+
+	memcpy(dest, src, len + 1);
+	return len;
+}
+
+bool sysfs_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+
+	if (*s1 == *s2)
+		return true;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return true;
+	if (*s1 == '\n' && !s1[1] && !*s2)
+		return true;
+
+	return false;
+}
+
+int match_string(const char *const *array, size_t n, const char *string)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (!array[i])
+			break;
+		if (!strcmp(array[i], string))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * vsnprintf() with the kernel %ptR extension (struct rtc_time as
+ * YYYY-mm-ddTHH:MM:SS). Conversions are formatted one at a time so that the
+ * arguments can be consumed by type.
+ */
+static int shim_vsnprintf(char *buf, size_t size, const char *fmt,
+			  va_list args)
+{
+	size_t len = 0;
+
+	while (*fmt) {
+		char spec[32];
+		size_t n = 0;
+		int longs = 0;
+		int out;
+
+		if (*fmt != '%' || fmt[1] == '%') {
+			if (len + 1 < size)
+				buf[len] = *fmt;
+			len++;
+			fmt += *fmt == '%' ? 2 : 1;
+			continue;
+		}
+
+		spec[n++] = *fmt++;
+		while (*fmt && strchr("-+ #0123456789.*hlzt", *fmt) &&
+		       n < sizeof(spec) - 2) {
+			longs += *fmt == 'l' || *fmt == 'z' || *fmt == 't';
+			spec[n++] = *fmt++;
+		}
+		spec[n++] = *fmt;
+		spec[n] = '\0';
+
+		if (*fmt == 'p' && fmt[1] == 't' && fmt[2] == 'R') {
+			const struct rtc_time *tm = va_arg(args, void *);
+
+			out = snprintf(buf + min(len, size), size - min(len, size),
+				       "%04d-%02d-%02dT%02d:%02d:%02d",
+				       tm->tm_year + 1900, tm->tm_mon + 1,
+				       tm->tm_mday, tm->tm_hour, tm->tm_min,
+				       tm->tm_sec);
+			fmt += 3;
+			len += out;
+			continue;
+		}
+
+		// a single * is supported for strings, as in %.*s
+		if (strchr(spec, '*') &&
+		    (*fmt != 's' || strchr(spec, '*') != strrchr(spec, '*'))) {
+			fprintf(stderr, "shim: unsupported format %s\n", spec);
+			abort();
+		}
+
+		if (strchr(spec, '*')) {
+			int star = va_arg(args, int);
+
+			out = snprintf(buf + min(len, size),
+				       size - min(len, size), spec, star,
+				       va_arg(args, char *));
+			fmt++;
+			len += out;
+			continue;
+		}
+
+		switch (*fmt) {
+		case 's':
+		case 'p':
+			out = snprintf(buf + min(len, size),
+				       size - min(len, size), spec,
+				       va_arg(args, void *));
+			break;
+		case 'c':
+			out = snprintf(buf + min(len, size),
+				       size - min(len, size), spec,
+				       va_arg(args, int));
+			break;
+		default:
+			if (longs >= 2)
+				out = snprintf(buf + min(len, size),
+					       size - min(len, size), spec,
+					       va_arg(args, long long));
+			else if (longs)
+				out = snprintf(buf + min(len, size),
+					       size - min(len, size), spec,
+					       va_arg(args, long));
+			else
+				out = snprintf(buf + min(len, size),
+					       size - min(len, size), spec,
+					       va_arg(args, int));
+		}
+
+		if (*fmt)
+			fmt++;
+		len += out;
+	}
+
+	if (size)
+		buf[min(len, size - 1)] = '\0';
+
+	return len;
+}
+
+int sysfs_emit(char *buf, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = shim_vsnprintf(buf, PAGE_SIZE, fmt, args);
+	va_end(args);
+
+	return min(len, PAGE_SIZE - 1);
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (!size)
+		return 0;
+
+	va_start(args, fmt);
+	len = shim_vsnprintf(buf, size, fmt, args);
+	va_end(args);
+
+	return min_t(size_t, len, size - 1);
+}
+
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (at < 0 || at >= PAGE_SIZE)
+		return 0;
+
+	va_start(args, fmt);
+	len = shim_vsnprintf(buf + at, PAGE_SIZE - at, fmt, args);
+	va_end(args);
+
+	return min(len, PAGE_SIZE - at - 1);
+}
+
+// ============================================================ //
+// Time and tasks
+// ============================================================ //
+
+static u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+ktime_t ktime_get(void)
+{
+	return monotonic_ns();
+}
+
+void fsleep(unsigned long usecs)
+{
+	usleep(usecs);
+}
+
+time64_t rtc_tm_to_time64(struct rtc_time *tm)
+{
+	struct tm t = {
+		.tm_sec = tm->tm_sec,
+		.tm_min = tm->tm_min,
+		.tm_hour = tm->tm_hour,
+		.tm_mday = tm->tm_mday,
+		.tm_mon = tm->tm_mon,
+		.tm_year = tm->tm_year,
+	};
+
+	return timegm(&t);
+}
+
+unsigned long shim_jiffies(void)
+{
+	return monotonic_ns() / 1000000;
+}
+
+static __thread struct task_struct task;
+
+struct task_struct *shim_current(void)
+{
+	if (!task.pid) {
+		task.pid = syscall(SYS_gettid);
+		task.tgid = getpid();
+		pthread_getname_np(pthread_self(), task.comm, sizeof(task.comm));
+	}
+
+	return &task;
+}
+
+unsigned int nr_cpu_ids = SHIM_CPUS;
+
+static struct cpumask cpu_online = { { BIT(SHIM_CPUS) - 1 } };
+const struct cpumask *cpu_online_mask = &cpu_online;
+
+static const struct cpumask cpu_masks[SHIM_CPUS] = { { { 1 } }, { { 2 } } };
+
+unsigned int cpumask_first(const struct cpumask *mask)
+{
+	return mask->bits[0] ? __builtin_ctzl(mask->bits[0]) : nr_cpu_ids;
+}
+
+unsigned int cpumask_any_but(const struct cpumask *mask, unsigned int cpu)
+{
+	unsigned long bits = mask->bits[0] & ~BIT(cpu);
+
+	return bits ? __builtin_ctzl(bits) : nr_cpu_ids;
+}
+
+const struct cpumask *cpumask_of(unsigned int cpu)
+{
+	return &cpu_masks[cpu];
+}
+
+int cpumap_print_to_pagebuf(bool list, char *buf, const struct cpumask *mask)
+{
+	return sysfs_emit(buf, "%u\n", cpumask_first(mask));
+}
+
+static struct device cpu_devices[SHIM_CPUS] = {
+	{ .kobj = { .name = "cpu0" } },
+	{ .kobj = { .name = "cpu1" } },
+};
+
+struct device *get_cpu_device(unsigned int cpu)
+{
+	return cpu < SHIM_CPUS ? &cpu_devices[cpu] : NULL;
+}
+
+/*
+ * Dynamic hotplug states. The CPUs stay online unless the harness takes
+ * them down with shim_cpu_offline().
+ */
+#define SHIM_CPUHP_STATES 8
+
+static struct {
+	bool used;
+	int (*startup)(unsigned int cpu);
+	int (*teardown)(unsigned int cpu);
+} cpuhp_states[SHIM_CPUHP_STATES];
+
+static int cpuhp_setup(enum cpuhp_state state, bool invoke,
+		       int (*startup)(unsigned int cpu),
+		       int (*teardown)(unsigned int cpu))
+{
+	unsigned int cpu;
+	int i, result;
+
+	for (i = 0; i < SHIM_CPUHP_STATES && cpuhp_states[i].used; i++)
+		;
+	if (i == SHIM_CPUHP_STATES)
+		return -ENOSPC;
+
+	for (cpu = 0; invoke && startup && cpu < nr_cpu_ids; cpu++) {
+		if (!(cpu_online.bits[0] & BIT(cpu)))
+			continue;
+
+		result = startup(cpu);
+		if (result < 0) {
+			while (cpu--)
+				if (teardown && (cpu_online.bits[0] & BIT(cpu)))
+					teardown(cpu);
+			return result;
+		}
+	}
+
+	cpuhp_states[i].used = true;
+	cpuhp_states[i].startup = startup;
+	cpuhp_states[i].teardown = teardown;
+
+	return CPUHP_AP_ONLINE_DYN + i;
+}
+
+static void cpuhp_remove(enum cpuhp_state state, bool invoke)
+{
+	int i = state - CPUHP_AP_ONLINE_DYN;
+	unsigned int cpu;
+
+	if (i < 0 || i >= SHIM_CPUHP_STATES || !cpuhp_states[i].used)
+		return;
+
+	for (cpu = 0; invoke && cpu < nr_cpu_ids; cpu++)
+		if (cpuhp_states[i].teardown &&
+		    (cpu_online.bits[0] & BIT(cpu)))
+			cpuhp_states[i].teardown(cpu);
+
+	cpuhp_states[i].used = false;
+}
+
+int cpuhp_setup_state(enum cpuhp_state state, const char *name,
+		      int (*startup)(unsigned int cpu),
+		      int (*teardown)(unsigned int cpu))
+{
+	return cpuhp_setup(state, true, startup, teardown);
+}
+
+int cpuhp_setup_state_nocalls(enum cpuhp_state state, const char *name,
+			      int (*startup)(unsigned int cpu),
+			      int (*teardown)(unsigned int cpu))
+{
+	return cpuhp_setup(state, false, startup, teardown);
+}
+
+void cpuhp_remove_state(enum cpuhp_state state)
+{
+	cpuhp_remove(state, true);
+}
+
+void cpuhp_remove_state_nocalls(enum cpuhp_state state)
+{
+	cpuhp_remove(state, false);
+}
+
+// the teardown callbacks run in the reverse order of the states
+void shim_cpu_offline(unsigned int cpu)
+{
+	for (int i = SHIM_CPUHP_STATES - 1; i >= 0; i--)
+		if (cpuhp_states[i].used && cpuhp_states[i].teardown)
+			cpuhp_states[i].teardown(cpu);
+
+	cpu_online.bits[0] &= ~BIT(cpu);
+}
+
+void shim_cpu_online(unsigned int cpu)
+{
+	cpu_online.bits[0] |= BIT(cpu);
+
+	for (int i = 0; i < SHIM_CPUHP_STATES; i++)
+		if (cpuhp_states[i].used && cpuhp_states[i].startup)
+			cpuhp_states[i].startup(cpu);
+}
+
+// ============================================================ //
+// Work items
+// ============================================================ //
+
+/*
+ * A single worker thread runs the work items in expiry order. Pending
+ * items are kept in a list linked through work_struct.next.
+ */
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static struct work_struct *work_pending;
+static struct work_struct *work_running;
+static pthread_t work_thread;
+static bool work_thread_started;
+
+struct workqueue_struct *system_wq;
+struct workqueue_struct *system_highpri_wq;
+struct workqueue_struct *system_unbound_wq;
+
+static void *work_thread_fn(void *arg)
+{
+	pthread_setname_np(pthread_self(), "kworker");
+
+	pthread_mutex_lock(&work_lock);
+	for (;;) {
+		struct work_struct **next = NULL;
+		u64 now = monotonic_ns();
+
+		for (struct work_struct **w = &work_pending; *w;
+		     w = &(*w)->next)
+			if (!next || (*w)->expires_ns < (*next)->expires_ns)
+				next = w;
+
+		if (!next) {
+			pthread_cond_wait(&work_cond, &work_lock);
+			continue;
+		}
+
+		if ((*next)->expires_ns > now) {
+			u64 expires = (*next)->expires_ns;
+			struct timespec ts;
+
+			// the condition uses CLOCK_REALTIME
+			clock_gettime(CLOCK_REALTIME, &ts);
+			expires = (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec +
+				  (expires - now);
+			ts.tv_sec = expires / 1000000000ull;
+			ts.tv_nsec = expires % 1000000000ull;
+			pthread_cond_timedwait(&work_cond, &work_lock, &ts);
+			continue;
+		}
+
+		work_running = *next;
+		*next = work_running->next;
+		work_running->pending = false;
+		pthread_mutex_unlock(&work_lock);
+
+		work_running->func(work_running);
+
+		pthread_mutex_lock(&work_lock);
+		work_running = NULL;
+		pthread_cond_broadcast(&work_cond);
+	}
+
+	return NULL;
+}
+
+// must be called with work_lock held
+static bool work_dequeue(struct work_struct *work)
+{
+	for (struct work_struct **w = &work_pending; *w; w = &(*w)->next) {
+		if (*w == work) {
+			*w = work->next;
+			work->pending = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool work_queue(struct work_struct *work, unsigned long delay,
+		       bool modify)
+{
+	bool pending;
+
+	pthread_mutex_lock(&work_lock);
+	if (!work_thread_started) {
+		pthread_create(&work_thread, NULL, work_thread_fn, NULL);
+		pthread_detach(work_thread);
+		work_thread_started = true;
+	}
+
+	pending = work->pending;
+	if (pending && !modify) {
+		pthread_mutex_unlock(&work_lock);
+		return false;
+	}
+
+	if (pending)
+		work_dequeue(work);
+
+	work->expires_ns = monotonic_ns() + (u64)delay * 1000000;
+	work->pending = true;
+	work->next = work_pending;
+	work_pending = work;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&work_lock);
+
+	return modify ? pending : true;
+}
+
+static bool work_cancel(struct work_struct *work, bool sync)
+{
+	bool pending;
+
+	pthread_mutex_lock(&work_lock);
+	pending = work_dequeue(work);
+	while (sync && work_running == work)
+		pthread_cond_wait(&work_cond, &work_lock);
+	pthread_mutex_unlock(&work_lock);
+
+	return pending;
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	return work_queue(work, 0, false);
+}
+
+bool schedule_work(struct work_struct *work)
+{
+	return work_queue(work, 0, false);
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	return work_queue(&dwork->work, delay, false);
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork,
+		      unsigned long delay)
+{
+	return work_queue(&dwork->work, delay, true);
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	return work_cancel(work, true);
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+	return work_cancel(&dwork->work, false);
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	return work_cancel(&dwork->work, true);
+}
+
+void flush_work(struct work_struct *work)
+{
+	pthread_mutex_lock(&work_lock);
+	while (work->pending || work_running == work)
+		pthread_cond_wait(&work_cond, &work_lock);
+	pthread_mutex_unlock(&work_lock);
+}
+
+void shim_work_drain(unsigned int timeout_ms)
+{
+	for (;;) {
+		u64 horizon = monotonic_ns() + (u64)timeout_ms * 1000000;
+		bool busy = false;
+
+		pthread_mutex_lock(&work_lock);
+		busy = work_running != NULL;
+		for (struct work_struct *w = work_pending; w; w = w->next)
+			if (w->expires_ns <= horizon)
+				busy = true;
+		pthread_mutex_unlock(&work_lock);
+
+		if (!busy)
+			return;
+
+		usleep(1000);
+	}
+}
+
+// ============================================================ //
+// Sysfs and devices
+// ============================================================ //
+
+#define SHIM_MAX_ATTRS 512
+
+static struct shim_attr attrs[SHIM_MAX_ATTRS];
+static int attrs_count;
+
+static void attr_add(struct device *dev, const struct attribute_group *grp)
+{
+	for (int i = 0; grp->attrs[i]; i++) {
+		struct attribute *attr = grp->attrs[i];
+		umode_t mode = attr->mode;
+		struct shim_attr *a;
+
+		if (grp->is_visible)
+			mode = grp->is_visible(&dev->kobj, attr, i);
+		if (!mode)
+			continue;
+
+		if (attrs_count == SHIM_MAX_ATTRS) {
+			fprintf(stderr, "shim: too many attributes\n");
+			abort();
+		}
+
+		a = &attrs[attrs_count++];
+		snprintf(a->path, sizeof(a->path), "%s%s%s%s%s",
+			 dev->kobj.name ? dev->kobj.name : "",
+			 dev->kobj.name ? "/" : "", grp->name ? grp->name : "",
+			 grp->name ? "/" : "", attr->name);
+		a->dev = dev;
+		a->group = grp;
+		a->attr = container_of(attr, struct device_attribute, attr);
+		a->mode = mode;
+	}
+}
+
+static void attr_remove(struct device *dev, const struct attribute_group *grp)
+{
+	int n = 0;
+
+	for (int i = 0; i < attrs_count; i++)
+		if (attrs[i].dev != dev || (grp && attrs[i].group != grp))
+			attrs[n++] = attrs[i];
+
+	attrs_count = n;
+}
+
+int shim_attr_count(void)
+{
+	return attrs_count;
+}
+
+struct shim_attr *shim_attr_get(int i)
+{
+	return i < attrs_count ? &attrs[i] : NULL;
+}
+
+struct shim_attr *shim_attr_find(const char *path)
+{
+	for (int i = 0; i < attrs_count; i++)
+		if (!strcmp(attrs[i].path, path))
+			return &attrs[i];
+
+	return NULL;
+}
+
+ssize_t shim_attr_show(struct shim_attr *a, char *buf)
+{
+	if (!(a->mode & 0444) || !a->attr->show)
+		return -EACCES;
+
+	memset(buf, 0, PAGE_SIZE);
+	return a->attr->show(a->dev, a->attr, buf);
+}
+
+ssize_t shim_attr_store(struct shim_attr *a, const char *buf)
+{
+	if (!(a->mode & 0222) || !a->attr->store)
+		return -EACCES;
+
+	return a->attr->store(a->dev, a->attr, buf, strlen(buf));
+}
+
+int sysfs_create_group(struct kobject *kobj, const struct attribute_group *grp)
+{
+	attr_add(container_of(kobj, struct device, kobj), grp);
+	return 0;
+}
+
+void sysfs_remove_group(struct kobject *kobj, const struct attribute_group *grp)
+{
+	attr_remove(container_of(kobj, struct device, kobj), grp);
+}
+
+int device_add_groups(struct device *dev, const struct attribute_group **groups)
+{
+	for (int i = 0; groups[i]; i++)
+		attr_add(dev, groups[i]);
+
+	return 0;
+}
+
+void device_remove_groups(struct device *dev,
+			  const struct attribute_group **groups)
+{
+	for (int i = 0; groups[i]; i++)
+		attr_remove(dev, groups[i]);
+}
+
+// the attributes of the groups are added again in their new visibility
+int sysfs_update_groups(struct kobject *kobj,
+			const struct attribute_group **groups)
+{
+	struct device *dev = container_of(kobj, struct device, kobj);
+
+	for (int i = 0; groups[i]; i++) {
+		attr_remove(dev, groups[i]);
+		attr_add(dev, groups[i]);
+	}
+
+	return 0;
+}
+
+#define SHIM_MAX_PLATFORM_DEVICES 16
+
+static struct platform_device *platform_devices[SHIM_MAX_PLATFORM_DEVICES];
+static struct platform_driver *platform_driver;
+
+// the attributes are added after the probe, as the driver core does
+static int platform_probe(struct platform_driver *driver,
+			  struct platform_device *pdev)
+{
+	int result;
+
+	result = driver->probe ? driver->probe(pdev) : 0;
+	if (result < 0)
+		return result;
+
+	if (driver->driver.dev_groups)
+		device_add_groups(&pdev->dev, driver->driver.dev_groups);
+
+	return 0;
+}
+
+int platform_driver_register(struct platform_driver *drv)
+{
+	platform_driver = drv;
+	return 0;
+}
+
+/*
+ * Devices are bound to the registered driver right away. The attributes of
+ * a device with an id are prefixed with its name, as msi-ec.0/shift_mode.
+ */
+struct platform_device *
+platform_device_register_simple(const char *name, int id, void *res,
+				unsigned int num)
+{
+	struct platform_device *pdev;
+	int slot;
+
+	for (slot = 0; slot < SHIM_MAX_PLATFORM_DEVICES; slot++)
+		if (!platform_devices[slot])
+			break;
+	if (slot == SHIM_MAX_PLATFORM_DEVICES)
+		return ERR_PTR(-ENOSPC);
+
+	pdev = calloc(1, sizeof(*pdev));
+	if (!pdev)
+		return ERR_PTR(-ENOMEM);
+
+	pdev->id = id;
+	if (id != PLATFORM_DEVID_NONE)
+		pdev->dev.kobj.name = kasprintf(GFP_KERNEL, "%s.%d", name, id);
+	platform_devices[slot] = pdev;
+
+	if (platform_driver)
+		platform_probe(platform_driver, pdev);
+
+	return pdev;
+}
+
+void platform_device_unregister(struct platform_device *pdev)
+{
+	if (!pdev || IS_ERR(pdev))
+		return;
+
+	if (platform_driver && platform_driver->remove)
+		platform_driver->remove(pdev);
+
+	attr_remove(&pdev->dev, NULL);
+
+	for (int i = 0; i < SHIM_MAX_PLATFORM_DEVICES; i++)
+		if (platform_devices[i] == pdev)
+			platform_devices[i] = NULL;
+	free((void *)pdev->dev.kobj.name);
+	free(pdev);
+}
+
+void platform_driver_unregister(struct platform_driver *drv)
+{
+	platform_driver = NULL;
+}
+
+// ============================================================ //
+// Power supplies, notifiers and PM QoS
+// ============================================================ //
+
+static const struct power_supply_desc battery_desc = {
+	.name = "BAT0",
+	.type = POWER_SUPPLY_TYPE_BATTERY,
+};
+
+static struct power_supply battery = {
+	.desc = &battery_desc,
+	.dev = { .kobj = { .name = "BAT0" } },
+};
+
+void battery_hook_register(struct acpi_battery_hook *hook)
+{
+	hook->add_battery(&battery, hook);
+}
+
+void battery_hook_unregister(struct acpi_battery_hook *hook)
+{
+	hook->remove_battery(&battery, hook);
+}
+
+int power_supply_is_system_supplied(void)
+{
+	return 1;
+}
+
+int power_supply_reg_notifier(struct notifier_block *nb)
+{
+	return 0;
+}
+
+void power_supply_unreg_notifier(struct notifier_block *nb)
+{
+}
+
+int dev_pm_qos_add_notifier(struct device *dev, struct notifier_block *nb,
+			    enum dev_pm_qos_req_type type)
+{
+	return 0;
+}
+
+int dev_pm_qos_remove_notifier(struct device *dev, struct notifier_block *nb,
+			       enum dev_pm_qos_req_type type)
+{
+	return 0;
+}
+
+s32 shim_resume_latency = PM_QOS_RESUME_LATENCY_NO_CONSTRAINT;
+
+s32 dev_pm_qos_read_value(struct device *dev, enum dev_pm_qos_req_type type)
+{
+	return shim_resume_latency;
+}
+
+// ============================================================ //
+// LEDs, hwmon, misc devices and perf
+// ============================================================ //
+
+#define SHIM_MAX_LEDS 8
+
+static struct led_classdev *leds[SHIM_MAX_LEDS];
+static int leds_count;
+
+int shim_led_register_error;
+
+int led_classdev_register(struct device *parent, struct led_classdev *led_cdev)
+{
+	if (shim_led_register_error)
+		return shim_led_register_error;
+
+	if (leds_count == SHIM_MAX_LEDS)
+		return -ENOSPC;
+
+	leds[leds_count++] = led_cdev;
+	return 0;
+}
+
+void led_classdev_unregister(struct led_classdev *led_cdev)
+{
+	int n = 0;
+
+	for (int i = 0; i < leds_count; i++)
+		if (leds[i] != led_cdev)
+			leds[n++] = leds[i];
+
+	if (n == leds_count) {
+		fprintf(stderr, "shim: LED %s is not registered\n",
+			led_cdev->name);
+		abort();
+	}
+
+	leds_count = n;
+}
+
+int shim_led_count(void)
+{
+	return leds_count;
+}
+
+struct led_classdev *shim_led_get(int i)
+{
+	return i < leds_count ? leds[i] : NULL;
+}
+
+struct led_classdev *shim_led_find(const char *name)
+{
+	for (int i = 0; i < leds_count; i++)
+		if (!strcmp(leds[i]->name, name))
+			return leds[i];
+
+	return NULL;
+}
+
+#define SHIM_MAX_HWMON_ATTRS 32
+
+struct shim_hwmon_attr {
+	struct device_attribute dev_attr;
+	enum hwmon_sensor_types type;
+	u32 attr;
+	int channel;
+	char name[24];
+};
+
+struct shim_hwmon {
+	struct device dev;
+	const char *name;
+	const struct hwmon_chip_info *chip;
+	struct device_attribute name_attr;
+	struct shim_hwmon_attr attrs[SHIM_MAX_HWMON_ATTRS];
+	struct attribute *group_attrs[SHIM_MAX_HWMON_ATTRS + 2];
+	struct attribute_group group;
+};
+
+static ssize_t hwmon_name_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%s\n",
+			  container_of(dev, struct shim_hwmon, dev)->name);
+}
+
+static ssize_t hwmon_attr_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct shim_hwmon *hw = container_of(dev, struct shim_hwmon, dev);
+	struct shim_hwmon_attr *a =
+		container_of(attr, struct shim_hwmon_attr, dev_attr);
+	const char *str;
+	long val;
+	int result;
+
+	// label is attribute 1 of the temp and fan channels
+	if (a->type != hwmon_pwm && a->attr == hwmon_temp_label) {
+		result = hw->chip->ops->read_string(dev, a->type, a->attr,
+						    a->channel, &str);
+		return result < 0 ? result : sysfs_emit(buf, "%s\n", str);
+	}
+
+	result = hw->chip->ops->read(dev, a->type, a->attr, a->channel, &val);
+	return result < 0 ? result : sysfs_emit(buf, "%ld\n", val);
+}
+
+static void hwmon_attr_name(char *name, size_t size,
+			    enum hwmon_sensor_types type, u32 attr, int channel)
+{
+	static const char *const prefixes[] = {
+		[hwmon_temp] = "temp",
+		[hwmon_fan] = "fan",
+		[hwmon_pwm] = "pwm",
+	};
+
+	if (type == hwmon_pwm)
+		snprintf(name, size, "pwm%d", channel + 1);
+	else
+		snprintf(name, size, "%s%d_%s", prefixes[type], channel + 1,
+			 attr == hwmon_temp_label ? "label" : "input");
+}
+
+struct device *
+hwmon_device_register_with_info(struct device *dev, const char *name,
+				void *drvdata,
+				const struct hwmon_chip_info *chip,
+				const struct attribute_group **extra_groups)
+{
+	struct shim_hwmon *hw = calloc(1, sizeof(*hw));
+	int n = 0;
+
+	if (!hw)
+		return ERR_PTR(-ENOMEM);
+
+	hw->name = name;
+	hw->chip = chip;
+	hw->dev.driver_data = drvdata;
+	hw->dev.kobj.name = kasprintf(GFP_KERNEL, "%s%shwmon",
+				      dev->kobj.name ? dev->kobj.name : "",
+				      dev->kobj.name ? "/" : "");
+
+	hw->name_attr = (struct device_attribute)__ATTR(name, 0444,
+							hwmon_name_show, NULL);
+	hw->group_attrs[n] = &hw->name_attr.attr;
+
+	for (int i = 0; chip->info[i]; i++) {
+		const struct hwmon_channel_info *info = chip->info[i];
+
+		for (int channel = 0; info->config[channel]; channel++) {
+			for (u32 attr = 0; attr < 32; attr++) {
+				struct shim_hwmon_attr *a;
+				umode_t mode;
+
+				if (!(info->config[channel] & BIT(attr)))
+					continue;
+
+				mode = chip->ops->is_visible(drvdata, info->type,
+							     attr, channel);
+				if (!mode)
+					continue;
+
+				if (n == SHIM_MAX_HWMON_ATTRS) {
+					fprintf(stderr,
+						"shim: too many hwmon attributes\n");
+					abort();
+				}
+
+				a = &hw->attrs[n++];
+				hwmon_attr_name(a->name, sizeof(a->name),
+						info->type, attr, channel);
+				a->type = info->type;
+				a->attr = attr;
+				a->channel = channel;
+				a->dev_attr = (struct device_attribute)__ATTR(
+					name, mode, hwmon_attr_show, NULL);
+				a->dev_attr.attr.name = a->name;
+				hw->group_attrs[n] = &a->dev_attr.attr;
+			}
+		}
+	}
+
+	hw->group.attrs = hw->group_attrs;
+	attr_add(&hw->dev, &hw->group);
+
+	return &hw->dev;
+}
+
+void hwmon_device_unregister(struct device *dev)
+{
+	struct shim_hwmon *hw = container_of(dev, struct shim_hwmon, dev);
+
+	attr_remove(dev, NULL);
+	free((void *)dev->kobj.name);
+	free(hw);
+}
+
+#define SHIM_MAX_MISC 4
+
+static struct miscdevice *miscs[SHIM_MAX_MISC];
+
+int misc_register(struct miscdevice *misc)
+{
+	for (int i = 0; i < SHIM_MAX_MISC; i++) {
+		if (!miscs[i]) {
+			miscs[i] = misc;
+			return 0;
+		}
+	}
+
+	return -EBUSY;
+}
+
+void misc_deregister(struct miscdevice *misc)
+{
+	for (int i = 0; i < SHIM_MAX_MISC; i++)
+		if (miscs[i] == misc)
+			miscs[i] = NULL;
+}
+
+int shim_misc_count(void)
+{
+	return SHIM_MAX_MISC;
+}
+
+// NULL for the free slots
+const char *shim_misc_name(int i)
+{
+	return miscs[i] ? miscs[i]->name : NULL;
+}
+
+// one read at offset 0 of an open device, as misc_open() leaves it
+ssize_t shim_misc_read(const char *name, char *buf, size_t size)
+{
+	struct miscdevice *misc = NULL;
+	struct inode inode = { 0 };
+	struct file file = { .f_mode = FMODE_READ };
+	loff_t pos = 0;
+	ssize_t result;
+
+	for (int i = 0; i < SHIM_MAX_MISC; i++)
+		if (miscs[i] && !strcmp(miscs[i]->name, name))
+			misc = miscs[i];
+
+	if (!misc)
+		return -ENOENT;
+	if (!misc->fops->read)
+		return -EACCES;
+
+	file.private_data = misc;
+	if (misc->fops->open) {
+		result = misc->fops->open(&inode, &file);
+		if (result < 0)
+			return result;
+	}
+
+	result = misc->fops->read(&file, buf, size, &pos);
+
+	if (misc->fops->release)
+		misc->fops->release(&inode, &file);
+
+	return result;
+}
+
+int perf_pmu_register(struct pmu *pmu, const char *name, int type)
+{
+	return 0;
+}
+
+unsigned int shim_pmu_migrations;
+
+void perf_pmu_migrate_context(struct pmu *pmu, int src_cpu, int dst_cpu)
+{
+	shim_pmu_migrations++;
+}
+
+void perf_pmu_unregister(struct pmu *pmu)
+{
+}
+
+ssize_t perf_event_sysfs_show(struct device *dev,
+			      struct device_attribute *attr, char *page)
+{
+	struct perf_pmu_events_attr *pmu_attr =
+		container_of(attr, struct perf_pmu_events_attr, attr);
+
+	return sysfs_emit(page, "%s\n", pmu_attr->event_str);
+}
+
+// ============================================================ //
+// Files, seq_file and debugfs
+// ============================================================ //
+
+int simple_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+loff_t noop_llseek(struct file *file, loff_t offset, int whence)
+{
+	return 0;
+}
+
+loff_t default_llseek(struct file *file, loff_t offset, int whence)
+{
+	return offset;
+}
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+				const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= available || !count)
+		return 0;
+
+	count = min(count, available - pos);
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+
+	return count;
+}
+
+ssize_t simple_write_to_buffer(void *to, size_t available, loff_t *ppos,
+			       const void __user *from, size_t count)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= available || !count)
+		return 0;
+
+	count = min(count, available - pos);
+	memcpy((char *)to + pos, from, count);
+	*ppos = pos + count;
+
+	return count;
+}
+
+#define SEQ_BUF_SIZE (64 * 1024)
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+	seq_printf(m, "%s", s);
+}
+
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (m->count >= m->size)
+		return;
+
+	va_start(args, fmt);
+	len = shim_vsnprintf(m->buf + m->count, m->size - m->count, fmt, args);
+	va_end(args);
+
+	m->count = min(m->count + len, m->size);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *m, void *v),
+		void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+
+	m->show = show;
+	m->private = data;
+	file->private_data = m;
+
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	free(m->buf);
+	free(m);
+
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+
+	if (!m->buf) {
+		int result;
+
+		m->buf = malloc(SEQ_BUF_SIZE);
+		if (!m->buf)
+			return -ENOMEM;
+
+		m->size = SEQ_BUF_SIZE;
+		result = m->show(m, NULL);
+		if (result < 0)
+			return result;
+	}
+
+	return simple_read_from_buffer(buf, size, ppos, m->buf, m->count);
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return offset;
+}
+
+#define SHIM_MAX_DEBUGFS 32
+
+struct dentry {
+	char name[64];
+	void *data;
+	const struct file_operations *fops;
+};
+
+static struct dentry debugfs[SHIM_MAX_DEBUGFS];
+static int debugfs_count;
+
+// the driver directory is the root, subdirectories prefix their file names
+static struct dentry debugfs_dirs[16];
+static int debugfs_dirs_count;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	struct dentry *d;
+
+	if (!parent)
+		return &debugfs_dirs[0];
+
+	if (debugfs_dirs_count == ARRAY_SIZE(debugfs_dirs) - 1)
+		return ERR_PTR(-ENOSPC);
+
+	d = &debugfs_dirs[++debugfs_dirs_count];
+	if (snprintf(d->name, sizeof(d->name), "%.31s%.31s/", parent->name,
+		     name) >= (int)sizeof(d->name))
+		return ERR_PTR(-ENAMETOOLONG);
+
+	return d;
+}
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	struct dentry *d;
+
+	if (debugfs_count == SHIM_MAX_DEBUGFS)
+		return ERR_PTR(-ENOSPC);
+
+	d = &debugfs[debugfs_count++];
+	snprintf(d->name, sizeof(d->name), "%s%s", parent ? parent->name : "",
+		 name);
+	d->data = data;
+	d->fops = fops;
+
+	return d;
+}
+
+struct dentry *debugfs_create_file_size(const char *name, umode_t mode,
+					struct dentry *parent, void *data,
+					const struct file_operations *fops,
+					loff_t file_size)
+{
+	return debugfs_create_file(name, mode, parent, data, fops);
+}
+
+static ssize_t debugfs_u32_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	char value[16];
+	int len;
+
+	len = snprintf(value, sizeof(value), "%u\n",
+		       READ_ONCE(*(u32 *)file->private_data));
+	return simple_read_from_buffer(buf, count, ppos, value, len);
+}
+
+static ssize_t debugfs_u32_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	char value[16] = { 0 };
+	u32 result;
+
+	memcpy(value, buf, min(count, sizeof(value) - 1));
+	if (kstrtouint(strim(value), 0, &result) < 0)
+		return -EINVAL;
+
+	WRITE_ONCE(*(u32 *)file->private_data, result);
+	return count;
+}
+
+static int debugfs_u32_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations debugfs_u32_fops = {
+	.open = debugfs_u32_open,
+	.read = debugfs_u32_read,
+	.write = debugfs_u32_write,
+};
+
+void debugfs_create_u32(const char *name, umode_t mode, struct dentry *parent,
+			u32 *value)
+{
+	debugfs_create_file(name, mode, parent, value, &debugfs_u32_fops);
+}
+
+// a subdirectory is removed with its files
+void debugfs_remove(struct dentry *dentry)
+{
+	bool dir = dentry >= &debugfs_dirs[1] &&
+		   dentry < &debugfs_dirs[ARRAY_SIZE(debugfs_dirs)];
+	int n = 0;
+
+	if (IS_ERR_OR_NULL(dentry))
+		return;
+
+	for (int i = 0; i < debugfs_count; i++)
+		if (dir ? strncmp(debugfs[i].name, dentry->name,
+				  strlen(dentry->name)) :
+			  &debugfs[i] != dentry)
+			debugfs[n++] = debugfs[i];
+
+	debugfs_count = n;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	if (dentry == &debugfs_dirs[0]) {
+		debugfs_count = 0;
+		debugfs_dirs_count = 0;
+	}
+}
+
+int shim_debugfs_count(void)
+{
+	return debugfs_count;
+}
+
+const char *shim_debugfs_name(int i)
+{
+	return i < debugfs_count ? debugfs[i].name : NULL;
+}
+
+static struct dentry *debugfs_find(const char *name)
+{
+	for (int i = 0; i < debugfs_count; i++)
+		if (!strcmp(debugfs[i].name, name))
+			return &debugfs[i];
+
+	return NULL;
+}
+
+ssize_t shim_debugfs_read(const char *name, char *buf, size_t size)
+{
+	struct dentry *d = debugfs_find(name);
+	struct inode inode = { 0 };
+	struct file file = { .f_mode = FMODE_READ };
+	loff_t pos = 0;
+	ssize_t result;
+
+	if (!d)
+		return -ENOENT;
+	if (!d->fops->read)
+		return -EACCES;
+
+	inode.i_private = d->data;
+	if (d->fops->open) {
+		result = d->fops->open(&inode, &file);
+		if (result < 0)
+			return result;
+	}
+
+	result = d->fops->read(&file, buf, size, &pos);
+
+	if (d->fops->release)
+		d->fops->release(&inode, &file);
+
+	return result;
+}
+
+size_t shim_debugfs_chunk;
+
+ssize_t shim_debugfs_write(const char *name, const char *buf, size_t count)
+{
+	struct dentry *d = debugfs_find(name);
+	struct inode inode = { 0 };
+	struct file file = { .f_mode = FMODE_WRITE };
+	loff_t pos = 0;
+	ssize_t result = 0;
+	size_t done = 0;
+
+	if (!d)
+		return -ENOENT;
+	if (!d->fops->write)
+		return -EACCES;
+
+	inode.i_private = d->data;
+	if (d->fops->open) {
+		result = d->fops->open(&inode, &file);
+		if (result < 0)
+			return result;
+	}
+
+	// like a userspace write loop, not every write() moves pos
+	while (done < count && result >= 0) {
+		size_t chunk = count - done;
+
+		if (shim_debugfs_chunk && chunk > shim_debugfs_chunk)
+			chunk = shim_debugfs_chunk;
+		result = d->fops->write(&file, buf + done, chunk, &pos);
+		if (!result)
+			result = -EIO;
+		if (result > 0)
+			done += result;
+	}
+	if (result >= 0)
+		result = done;
+
+	if (d->fops->release)
+		d->fops->release(&inode, &file);
+
+	return result;
+}
+
+// ============================================================ //
+// Firmware loading
+// ============================================================ //
+
+const char *shim_firmware_path;
+
+int firmware_request_nowarn(const struct firmware **fw, const char *name,
+			    struct device *device)
+{
+	struct firmware *f;
+	char path[PATH_MAX];
+	FILE *file;
+	long size;
+	u8 *data;
+
+	if (!shim_firmware_path)
+		return -ENOENT;
+
+	snprintf(path, sizeof(path), "%s/%s", shim_firmware_path, name);
+	file = fopen(path, "rb");
+	if (!file)
+		return -ENOENT;
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+
+	f = malloc(sizeof(*f));
+	data = malloc(size > 0 ? size : 1);
+	if (!f || !data || size < 0 || fread(data, 1, size, file) != (size_t)size) {
+		fclose(file);
+		free(data);
+		free(f);
+		return -EIO;
+	}
+	fclose(file);
+
+	f->size = size;
+	f->data = data;
+	*fw = f;
+
+	return 0;
+}
+
+void release_firmware(const struct firmware *fw)
+{
+	if (!fw)
+		return;
+
+	free((void *)fw->data);
+	free((void *)fw);
+}
+
+u32 crc32_le(u32 crc, const void *p, size_t len)
+{
+	const u8 *b = p;
+
+	while (len--) {
+		crc ^= *b++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return crc;
+}
+
+// ============================================================ //
+// DMI
+// ============================================================ //
+
+const char *shim_dmi_board_name;
+
+const char *dmi_get_system_info(int field)
+{
+	return field == DMI_BOARD_NAME ? shim_dmi_board_name : NULL;
+}
+
+// ============================================================ //
+// Emulated EC
+// ============================================================ //
+
+u8 shim_ec[SHIM_EC_SIZE];
+u64 shim_ec_reads;
+u64 shim_ec_writes;
+
+static pthread_mutex_t ec_lock = PTHREAD_MUTEX_INITIALIZER;
+static u64 ec_read_latency_ns;
+static u64 ec_write_latency_ns;
+
+void shim_ec_set_latency(u64 read_ns, u64 write_ns)
+{
+	ec_read_latency_ns = read_ns;
+	ec_write_latency_ns = write_ns;
+}
+
+int shim_ec_load_image(const char *file)
+{
+	FILE *f = fopen(file, "rb");
+	size_t len;
+
+	if (!f)
+		return -errno;
+
+	len = fread(shim_ec, 1, sizeof(shim_ec), f);
+	fclose(f);
+
+	return len == sizeof(shim_ec) ? 0 : -EINVAL;
+}
+
+/*
+ * Reads a dump as printed by debug/ec_dump:
+ *
+ *   | 0x1_ | 00 01 02 ...  |................|
+ *
+ * or by hexdump -C, including the "*" lines that stand for repeated rows:
+ *
+ *   00000010  00 01 02 ...  |................|
+ */
+int shim_ec_load_dump(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	u8 row[16] = { 0 };
+	long last = -16;
+	bool repeat = false;
+	int rows = 0;
+	char line[256];
+
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+		long offset;
+		char *end;
+		int n = 0;
+
+		while (*p == '|' || *p == ' ')
+			p++;
+
+		if (*p == '*') {
+			repeat = true;
+			continue;
+		}
+
+		offset = strtol(p, &end, 16);
+		if (end == p)
+			continue; // header or separator
+
+		if (*end == '_') { // ec_dump rows are numbered
+			offset *= 16;
+			end = strchr(end, '|');
+			if (!end)
+				continue;
+			end++;
+		}
+
+		if (offset % 16 || offset >= SHIM_EC_SIZE)
+			continue;
+
+		if (repeat)
+			for (long o = last + 16; o < offset; o += 16)
+				memcpy(shim_ec + o, row, sizeof(row));
+		repeat = false;
+
+		for (p = end; n < 16; n++) {
+			unsigned long value = strtoul(p, &end, 16);
+
+			if (end == p || *end == '|' || value > 0xff)
+				break;
+			row[n] = value;
+			p = end;
+		}
+
+		if (n != 16)
+			continue;
+
+		memcpy(shim_ec + offset, row, sizeof(row));
+		last = offset;
+		rows++;
+	}
+
+	fclose(f);
+
+	if (repeat)
+		for (long o = last + 16; o < SHIM_EC_SIZE; o += 16)
+			memcpy(shim_ec + o, row, sizeof(row));
+
+	return rows ? 0 : -EINVAL;
+}
+
+// an EC transaction keeps the EC busy, like the ACPI EC mutex
+static void ec_delay(u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ull,
+		.tv_nsec = ns % 1000000000ull,
+	};
+
+	if (ns)
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+void (*shim_ec_read_hook)(u8 addr);
+
+int ec_read(u8 addr, u8 *val)
+{
+	pthread_mutex_lock(&ec_lock);
+	ec_delay(ec_read_latency_ns);
+	*val = shim_ec[addr];
+	shim_ec_reads++;
+	if (shim_ec_read_hook)
+		shim_ec_read_hook(addr);
+	pthread_mutex_unlock(&ec_lock);
+
+	return 0;
+}
+
+int shim_ec_write_error_addr = -1;
+
+int ec_write(u8 addr, u8 val)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&ec_lock);
+	ec_delay(ec_write_latency_ns);
+	if (addr == shim_ec_write_error_addr)
+		result = -EIO;
+	else
+		shim_ec[addr] = val;
+	shim_ec_writes++;
+	pthread_mutex_unlock(&ec_lock);
+
+	return result;
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * shim.h - Harness side of the userspace kernel shim.
+ *
+ * Gives the harness access to what the driver registered (sysfs attributes,
+ * LEDs, debugfs files) and control over the emulated EC.
+ */
+
+#ifndef MSI_EC_USERSPACE_SHIM_H
+#define MSI_EC_USERSPACE_SHIM_H
+
+#include "msi-ec-shim.h"
+
+#define SHIM_EC_SIZE 256
+
+struct shim_attr {
+	char path[160]; // relative to /sys/devices/platform/msi-ec
+	struct device *dev;
+	const struct attribute_group *group;
+	struct device_attribute *attr;
+	umode_t mode;
+};
+
+int shim_attr_count(void);
+struct shim_attr *shim_attr_get(int i);
+struct shim_attr *shim_attr_find(const char *path);
+ssize_t shim_attr_show(struct shim_attr *a, char *buf); // PAGE_SIZE buffer
+ssize_t shim_attr_store(struct shim_attr *a, const char *buf);
+
+int shim_led_count(void);
+struct led_classdev *shim_led_get(int i);
+struct led_classdev *shim_led_find(const char *name);
+// returned by led_classdev_register() if not 0
+extern int shim_led_register_error;
+
+int shim_debugfs_count(void);
+const char *shim_debugfs_name(int i);
+ssize_t shim_debugfs_read(const char *name, char *buf, size_t size);
+ssize_t shim_debugfs_write(const char *name, const char *buf, size_t count);
+// shim_debugfs_write() calls write() with at most this many bytes if not 0
+extern size_t shim_debugfs_chunk;
+
+int shim_misc_count(void);
+const char *shim_misc_name(int i);
+ssize_t shim_misc_read(const char *name, char *buf, size_t size);
+
+// the emulated EC behind ec_read()/ec_write()
+extern u8 shim_ec[SHIM_EC_SIZE];
+extern u64 shim_ec_reads;
+extern u64 shim_ec_writes;
+void shim_ec_set_latency(u64 read_ns, u64 write_ns);
+// called after every EC read, with the EC lock held, e.g. to move a sensor
+extern void (*shim_ec_read_hook)(u8 addr);
+// the writes to this address fail with -EIO, -1 for none
+extern int shim_ec_write_error_addr;
+int shim_ec_load_image(const char *file);
+int shim_ec_load_dump(const char *file); // ec_dump or hexdump -C text
+
+// the resume latency constraint of every CPU
+extern s32 shim_resume_latency;
+
+// runs the hotplug callbacks of the driver, all SHIM_CPUS start online
+void shim_cpu_offline(unsigned int cpu);
+void shim_cpu_online(unsigned int cpu);
+
+// perf_pmu_migrate_context() calls
+extern unsigned int shim_pmu_migrations;
+
+// waits until no work item is pending within timeout_ms or running
+void shim_work_drain(unsigned int timeout_ms);
+
+#endif // MSI_EC_USERSPACE_SHIM_H